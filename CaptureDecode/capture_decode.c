@@ -0,0 +1,226 @@
+#include "frame_capture.h"
+#include "message_protocol.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Offline decoder for the binary frame capture written by RAWHID_Service.
+ *
+ * Usage: CaptureDecode <capture file> [--csv]
+ *
+ * Prints every complete record, oldest first, as text (default) or CSV.
+ * Reads version 1 (32-byte frames) and version 2 captures.
+ */
+
+/**
+ * Short name of a capture direction.
+ *
+ * @param direction The direction stored in a record.
+ * @return A printable name.
+ */
+static const char* direction_name(uint8_t direction) {
+    switch (direction) {
+    case CAPTURE_HID_TO_TCP:
+        return "HID->TCP";
+    case CAPTURE_TCP_TO_HID:
+        return "TCP->HID";
+    case CAPTURE_CONFIRM_TO_HID:
+        return "CONFIRM->HID";
+    case CAPTURE_CONFIRM_FROM_TCP:
+        return "CONFIRM<-TCP";
+    case CAPTURE_CACHE_TO_HID:
+        return "CACHE->HID";
+    case CAPTURE_CONTROL_FROM_TCP:
+        return "CONTROL<-TCP";
+    case CAPTURE_PUSH_TO_HID:
+        return "PUSH->HID";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+/**
+ * Short name of a message type.
+ *
+ * @param type The type reported by interpret_message.
+ * @return A printable name.
+ */
+static const char* message_type_name(MessageType type) {
+    switch (type) {
+    case REQUEST_MESSAGE:
+        return "REQUEST";
+    case CONFIRM_MESSAGE:
+        return "CONFIRM";
+    case RESPONSE_MESSAGE:
+        return "RESPONSE";
+    case INVALIDATE_MESSAGE:
+        return "INVALIDATE";
+    case PUSH_MESSAGE:
+        return "PUSH";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+/**
+ * Reads the next record of either layout into a version 2 record.
+ *
+ * @param file The capture, positioned at a record.
+ * @param version The capture's version.
+ * @param record Receives the record.
+ * @return 1 on success, 0 if the file ended.
+ */
+static int read_record(FILE* file, uint32_t version, capture_record* record) {
+    if (version >= 2) {
+        return fread(record, sizeof(*record), 1, file) == 1;
+    }
+
+    capture_record_v1 old;
+    if (fread(&old, sizeof(old), 1, file) != 1) {
+        return 0;
+    }
+    memset(record, 0, sizeof(*record));
+    record->timestamp_us = old.timestamp_us;
+    record->sequence = old.sequence;
+    record->direction = old.direction;
+    record->device_index = old.device_index;
+    record->request_id = old.request_id;
+    record->frame_length = MESSAGE_SIZE_BYTES;
+    memcpy(record->frame, old.frame, MESSAGE_SIZE_BYTES);
+    return 1;
+}
+
+/**
+ * Prints one record.
+ *
+ * @param record The record to print.
+ * @param start_time_us Capture start time, so timestamps print relative to it.
+ * @param csv Whether to print a CSV row instead of a text line.
+ */
+static void print_record(const capture_record* record, uint64_t start_time_us, int csv) {
+    MessageType type;
+    uint16_t wire_request_id;
+    uint64_t value;
+    uint16_t status = ((uint16_t)record->frame[3] << 8) | record->frame[4];
+    char frame_hex[MESSAGE_MAX_SIZE_BYTES * 2 + 1] = "";
+    int frame_length = record->frame_length <= MESSAGE_MAX_SIZE_BYTES ? record->frame_length : MESSAGE_MAX_SIZE_BYTES;
+
+    interpret_message(record->frame, &type);
+    extract_request_id_and_data(record->frame, &wire_request_id, &value);
+    if (type == REQUEST_MESSAGE) {
+        extract_request_uri(record->frame, &value);
+    }
+
+    for (int i = 0; i < frame_length; i++) {
+        sprintf(frame_hex + i * 2, "%02x", record->frame[i]);
+    }
+
+    unsigned long long elapsed_us = (unsigned long long)(record->timestamp_us - start_time_us);
+    if (csv) {
+        printf("%llu,%s,%u,%u,%s,%u,%u,0x%016llx,%s\n",
+            elapsed_us, direction_name(record->direction), record->device_index, record->request_id,
+            message_type_name(type), wire_request_id, status, (unsigned long long)value, frame_hex);
+        return;
+    }
+
+    printf("%6llu.%06llu  %-12s  dev %3u  req %5u  %-8s  wire id %5u  ",
+        elapsed_us / 1000000, elapsed_us % 1000000, direction_name(record->direction),
+        record->device_index, record->request_id, message_type_name(type), wire_request_id);
+    switch (type) {
+    case REQUEST_MESSAGE:
+        printf("uri 0x%016llx\n", (unsigned long long)value);
+        break;
+    case CONFIRM_MESSAGE:
+        printf("status 0x%04x\n", status);
+        break;
+    case RESPONSE_MESSAGE:
+        printf("data 0x%016llx\n", (unsigned long long)value);
+        break;
+    case INVALIDATE_MESSAGE: {
+        uint64_t first_uri, last_uri;
+        extract_invalidation_range(record->frame, &first_uri, &last_uri);
+        printf("uris 0x%016llx-0x%016llx\n", (unsigned long long)first_uri, (unsigned long long)last_uri);
+        break;
+    }
+    case PUSH_MESSAGE:
+        printf("data 0x%016llx\n", (unsigned long long)value);
+        break;
+    default:
+        printf("frame %s\n", frame_hex);
+        break;
+    }
+}
+
+int main(int argc, char** argv) {
+    int ret = 1;
+    int csv = 0;
+    FILE* file = NULL;
+    capture_file_header header;
+    capture_record record;
+
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "--csv") != 0)) {
+        fprintf(stderr, "Usage: %s <capture file> [--csv]\n", argv[0]);
+        return 1;
+    }
+    csv = (argc == 3);
+
+    // interpret_message logs at DEBUG; keep the decoder's output clean
+    set_log_level(LOGLEVEL_ERROR);
+
+    file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        goto cleanup;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        strncmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a frame capture\n", argv[1]);
+        goto cleanup;
+    }
+    int v1 = header.version == 1 && header.record_size == sizeof(capture_record_v1) && header.frame_size == MESSAGE_SIZE_BYTES;
+    int v2 = header.version == CAPTURE_VERSION && header.record_size == sizeof(capture_record) && header.frame_size == MESSAGE_MAX_SIZE_BYTES;
+    if ((!v1 && !v2) || header.capacity == 0) {
+        fprintf(stderr, "Unsupported capture: version %u, %u-byte records, %u-byte frames\n",
+            header.version, header.record_size, header.frame_size);
+        goto cleanup;
+    }
+
+    // Only the newest capacity records survive once the capture has wrapped
+    uint64_t count = (uint64_t)header.record_count;
+    uint64_t first = count > header.capacity ? count - header.capacity : 0;
+    uint64_t skipped = 0;
+
+    if (csv) {
+        printf("time_us,direction,device_index,request_id,message_type,wire_request_id,status,value,frame\n");
+    }
+
+    for (uint64_t number = first; number < count; number++) {
+        uint64_t slot = number % header.capacity;
+        if (number == first || slot == 0) {
+            _fseeki64(file, (long long)(header.header_size + slot * header.record_size), SEEK_SET);
+        }
+        if (!read_record(file, header.version, &record)) {
+            fprintf(stderr, "Capture truncated at record %llu\n", (unsigned long long)number);
+            goto cleanup;
+        }
+
+        // A record that never got its sequence was still being written
+        if (record.sequence != (uint32_t)(number + 1)) {
+            skipped++;
+            continue;
+        }
+        print_record(&record, header.start_time_us, csv);
+    }
+
+    fprintf(stderr, "%llu records decoded, %llu incomplete records skipped, %llu older records overwritten\n",
+        (unsigned long long)(count - first - skipped), (unsigned long long)skipped, (unsigned long long)first);
+    ret = 0;
+
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    return ret;
+}
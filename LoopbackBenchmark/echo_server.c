@@ -0,0 +1,307 @@
+#include "echo_server.h"
+#include "message_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How often an idle server checks whether it should stop.
+#define ECHO_STOP_CHECK_MS 100
+#define ECHO_BUFFER_SIZE (64 * 1024)
+
+// A response waiting out its service time.
+typedef struct {
+    uint64_t due_ns;
+    unsigned char frame[MESSAGE_MAX_SIZE_BYTES];
+} pending_response;
+
+// Server thread state. Responses are due in the order their requests came, so they wait in a FIFO.
+typedef struct {
+    echo_server* server;
+    SOCKET listener;
+    SOCKET client;
+    unsigned char in[ECHO_BUFFER_SIZE];
+    size_t in_length;
+    unsigned char out[ECHO_BUFFER_SIZE];
+    size_t out_length;
+    pending_response* pending;
+    size_t pending_head;
+    size_t pending_count;
+    size_t pending_capacity;
+} echo_state;
+
+/**
+ * Drops the current connection and everything queued for it.
+ *
+ * @param state The server state.
+ */
+static void drop_client(echo_state* state) {
+    if (state->client != INVALID_SOCKET) {
+        closesocket(state->client);
+        state->client = INVALID_SOCKET;
+    }
+    state->in_length = 0;
+    state->out_length = 0;
+    state->pending_head = 0;
+    state->pending_count = 0;
+}
+
+/**
+ * Sends everything queued for the client.
+ *
+ * @param state The server state.
+ */
+static void flush_out(echo_state* state) {
+    size_t sent = 0;
+    while (sent < state->out_length && state->client != INVALID_SOCKET) {
+        platform_buffer buffer = { state->out + sent, state->out_length - sent };
+        size_t result;
+        if (platform_send_buffers(state->client, &buffer, 1, &result) != 0) {
+            drop_client(state);
+            return;
+        }
+        InterlockedIncrement64(&state->server->send_calls);
+        sent += result;
+    }
+    state->out_length = 0;
+}
+
+/**
+ * Queues one frame for the client, sending first if the buffer is full.
+ *
+ * @param state The server state.
+ * @param frame The frame.
+ */
+static void queue_out(echo_state* state, const unsigned char* frame) {
+    size_t frame_size = state->server->frame_size;
+    if (state->out_length + frame_size > sizeof(state->out)) {
+        flush_out(state);
+    }
+    memcpy(state->out + state->out_length, frame, frame_size);
+    state->out_length += frame_size;
+}
+
+/**
+ * Holds a response until its service time has passed.
+ *
+ * @param state The server state.
+ * @param frame The response.
+ * @param due_ns When to send it.
+ * @return 1 on success, 0 if out of memory.
+ */
+static int hold_response(echo_state* state, const unsigned char* frame, uint64_t due_ns) {
+    if (state->pending_count == state->pending_capacity) {
+        size_t capacity = state->pending_capacity ? state->pending_capacity * 2 : 1024;
+        pending_response* grown = (pending_response*)malloc(capacity * sizeof(pending_response));
+        if (!grown) {
+            return 0;
+        }
+        for (size_t i = 0; i < state->pending_count; i++) {
+            grown[i] = state->pending[(state->pending_head + i) % state->pending_capacity];
+        }
+        free(state->pending);
+        state->pending = grown;
+        state->pending_head = 0;
+        state->pending_capacity = capacity;
+    }
+
+    pending_response* slot = &state->pending[(state->pending_head + state->pending_count) % state->pending_capacity];
+    slot->due_ns = due_ns;
+    memcpy(slot->frame, frame, state->server->frame_size);
+    state->pending_count++;
+    return 1;
+}
+
+/**
+ * Confirms every complete request received and answers it now or holds the
+ * answer for its service time.
+ *
+ * @param state The server state.
+ */
+static void serve_requests(echo_state* state) {
+    echo_server* server = state->server;
+    size_t offset = 0;
+    size_t frame_size = server->frame_size;
+    uint64_t now = monotonic_time_ns();
+
+    for (; offset + frame_size <= state->in_length; offset += frame_size) {
+        const unsigned char* frame = state->in + offset;
+        MessageType type;
+        interpret_message(frame, &type);
+        if (type != REQUEST_MESSAGE) {
+            continue;
+        }
+        if (message_is_fragment(frame)) {
+            uint8_t index, count, length;
+            extract_fragment_info(frame, &index, &count, &length);
+            if (index + 1 != count) {
+                continue;  // A fragmented request is answered once, at its last fragment
+            }
+        }
+
+        uint16_t request_id;
+        uint64_t unused, uri;
+        unsigned char reply[MESSAGE_MAX_SIZE_BYTES] = { 0 };
+        extract_request_id_and_data(frame, &request_id, &unused);
+        extract_request_uri(frame, &uri);
+        InterlockedIncrement64(&server->requests);
+
+        encode_confirmation(reply, request_id, 0);
+        queue_out(state, reply);
+
+        memset(reply, 0, sizeof(reply));
+        encode_response(reply, request_id, uri);
+        if (server->service_us == 0 || !hold_response(state, reply, now + (uint64_t)server->service_us * 1000)) {
+            queue_out(state, reply);
+            InterlockedIncrement64(&server->responses);
+        }
+    }
+
+    memmove(state->in, state->in + offset, state->in_length - offset);
+    state->in_length -= offset;
+}
+
+/**
+ * Queues every held response whose service time has passed.
+ *
+ * @param state The server state.
+ * @param now_ns The current monotonic_time_ns().
+ */
+static void release_due_responses(echo_state* state, uint64_t now_ns) {
+    while (state->pending_count > 0 && state->pending[state->pending_head].due_ns <= now_ns) {
+        queue_out(state, state->pending[state->pending_head].frame);
+        state->pending_head = (state->pending_head + 1) % state->pending_capacity;
+        state->pending_count--;
+        InterlockedIncrement64(&state->server->responses);
+    }
+}
+
+/**
+ * Server thread: accepts the bridge's connection and answers its requests
+ * until asked to stop.
+ *
+ * @param context Pointer to the echo_state.
+ */
+static void echo_server_thread(void* context) {
+    echo_state* state = (echo_state*)context;
+    echo_server* server = state->server;
+
+    while (!ReadNoFence(&server->stop_requested)) {
+        uint64_t now = monotonic_time_ns();
+        uint64_t wait_us = ECHO_STOP_CHECK_MS * 1000;
+        if (state->pending_count > 0) {
+            uint64_t due = state->pending[state->pending_head].due_ns;
+            uint64_t until_due_us = due > now ? (due - now) / 1000 : 0;
+            wait_us = until_due_us < wait_us ? until_due_us : wait_us;
+        }
+
+        // WinSock ignores the descriptor count; BSD sockets need the highest descriptor plus one
+        fd_set readable;
+        SOCKET highest = state->listener;
+        FD_ZERO(&readable);
+        FD_SET(state->listener, &readable);
+        if (state->client != INVALID_SOCKET) {
+            FD_SET(state->client, &readable);
+            highest = state->client > highest ? state->client : highest;
+        }
+        struct timeval timeout = { (long)(wait_us / 1000000), (long)(wait_us % 1000000) };
+        if (select((int)highest + 1, &readable, NULL, NULL, &timeout) == SOCKET_ERROR) {
+            break;
+        }
+
+        if (FD_ISSET(state->listener, &readable)) {
+            SOCKET accepted = accept(state->listener, NULL, NULL);
+            if (accepted != INVALID_SOCKET) {
+                drop_client(state);
+                int no_delay = 1;
+                setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+                state->client = accepted;
+            }
+        }
+
+        if (state->client != INVALID_SOCKET && FD_ISSET(state->client, &readable)) {
+            int received = recv(state->client, (char*)state->in + state->in_length, (int)(sizeof(state->in) - state->in_length), 0);
+            if (received <= 0) {
+                drop_client(state);
+                continue;
+            }
+            InterlockedIncrement64(&server->recv_calls);
+            state->in_length += (size_t)received;
+            serve_requests(state);
+        }
+
+        release_due_responses(state, monotonic_time_ns());
+        flush_out(state);
+    }
+
+    drop_client(state);
+    closesocket(state->listener);
+    free(state->pending);
+    free(state);
+    platform_socket_cleanup();
+}
+
+/**
+ * Binds the server to a loopback port and starts its thread.
+ *
+ * @param server Port and service time to use; receives the bound port.
+ * @param thread Receives the server thread.
+ * @return 1 on success, 0 on failure.
+ */
+int echo_server_start(echo_server* server, platform_thread* thread) {
+    echo_state* state = NULL;
+    SOCKET listener = INVALID_SOCKET;
+
+    if (platform_socket_startup() != 0) {
+        fprintf(stderr, "Echo server - Socket startup failed\n");
+        return 0;
+    }
+
+    struct sockaddr_in address = { 0 };
+    socklen_t address_length = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(server->port);
+
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET ||
+        bind(listener, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(listener, 4) == SOCKET_ERROR ||
+        getsockname(listener, (struct sockaddr*)&address, &address_length) == SOCKET_ERROR) {
+        fprintf(stderr, "Echo server - Failed to listen on port %u, error %d\n", server->port, platform_socket_error());
+        goto fail;
+    }
+    server->port = ntohs(address.sin_port);
+
+    state = (echo_state*)calloc(1, sizeof(echo_state));
+    if (!state) {
+        goto fail;
+    }
+    state->server = server;
+    state->listener = listener;
+    state->client = INVALID_SOCKET;
+
+    *thread = platform_thread_start(echo_server_thread, state);
+    if (!*thread) {
+        goto fail;
+    }
+    return 1;
+
+fail:
+    free(state);
+    if (listener != INVALID_SOCKET) {
+        closesocket(listener);
+    }
+    platform_socket_cleanup();
+    return 0;
+}
+
+/**
+ * Stops the server and waits for its thread.
+ *
+ * @param server The server.
+ * @param thread Its thread, as returned by echo_server_start.
+ */
+void echo_server_stop(echo_server* server, platform_thread thread) {
+    InterlockedExchange(&server->stop_requested, 1);
+    platform_thread_join(thread);
+}
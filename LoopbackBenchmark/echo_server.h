@@ -0,0 +1,32 @@
+#ifndef ECHO_SERVER_H
+#define ECHO_SERVER_H
+
+#include <stdint.h>
+#include "platform.h"
+
+/**
+ * Stand-in upstream server on the loopback interface.
+ *
+ * Speaks the bridge's side of the protocol: every request is confirmed as
+ * soon as it is read and answered service_us later with its URI as the
+ * response data, echoing the request ID in both. Requests are served
+ * concurrently, so the service time adds latency but does not cap
+ * throughput, like a pipelined backend. One connection is served at a time;
+ * a new one replaces the old, as when the bridge reconnects.
+ */
+
+typedef struct {
+    uint16_t port;            // Bound port; 0 in the request picks a free one and is updated
+    uint32_t service_us;      // Delay between confirming a request and answering it
+    uint32_t frame_size;      // Bytes per frame on the connection
+    volatile LONG stop_requested;
+    volatile LONG64 requests;
+    volatile LONG64 responses;
+    volatile LONG64 recv_calls;
+    volatile LONG64 send_calls;
+} echo_server;
+
+int echo_server_start(echo_server* server, platform_thread* thread);
+void echo_server_stop(echo_server* server, platform_thread thread);
+
+#endif // ECHO_SERVER_H
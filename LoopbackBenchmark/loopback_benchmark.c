@@ -0,0 +1,219 @@
+#include "config.h"
+#include "sim_hid.h"
+#include "echo_server.h"
+#include "loopback_bridge.h"
+#include "latency_stats.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Loopback benchmark for RAWHID_Service.
+ *
+ * Runs the real bridge (the HID and TCP threads on Windows, the event loop on
+ * Linux) against simulated devices (sim_hid.c, standing in for hidapi or
+ * hidraw) and a stand-in server on 127.0.0.1 (echo_server.c), so throughput
+ * and latency can be measured with no USB device and no network.
+ *
+ * Usage: LoopbackBenchmark [options]
+ *   --seconds N       How long to run (default 10)
+ *   --devices N       Simulated devices (default 1)
+ *   --rate N          Requests per second per device, 0 for unpaced (default 0)
+ *   --outstanding N   Unanswered requests a device allows, 0 for open loop (default 32)
+ *   --pattern P       uniform, hot or sequential URIs (default uniform)
+ *   --uris N          Distinct URIs (default 1024)
+ *   --service-us N    Server time between confirming and answering (default 0)
+ *   --window N        Requests in flight per upstream (default TCP_PIPELINE_WINDOW)
+ *   --lockstep        One request at a time instead of pipelining
+ *   --cache N         Response cache entries (default 0)
+ *   --spin-us N       Bridge spin budget before blocking, Windows only (default BRIDGE_SPIN_BUDGET_US)
+ *   --engine E        epoll or uring I/O, Linux only (default epoll)
+ *   --frame-size N    Report size of the devices and frame size on the server
+ *                     connection, 32 to 64 bytes (default 32)
+ *
+ * Prints frames/sec, CPU usage and latency percentiles, and exits with 2 if
+ * no request was answered. Bridge logging goes to loopback_benchmark.log at
+ * WARN so it does not skew the numbers.
+ */
+
+#define BENCHMARK_LOG_FILE "loopback_benchmark.log"
+
+static const char* usage_text =
+    "Usage: %s [--seconds N] [--devices N] [--rate N] [--outstanding N] [--pattern uniform|hot|sequential]\n"
+    "          [--uris N] [--service-us N] [--window N] [--lockstep] [--cache N] [--spin-us N] [--engine epoll|uring]\n"
+    "          [--frame-size N]\n";
+
+/**
+ * Parses a non-negative decimal option value.
+ *
+ * @param text The value.
+ * @param value Receives the number.
+ * @return 1 if it parsed, 0 otherwise.
+ */
+static int parse_uint(const char* text, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (!*text || *end || parsed > UINT32_MAX) {
+        return 0;
+    }
+    *value = (uint32_t)parsed;
+    return 1;
+}
+
+/**
+ * Prints one row of the latency table.
+ *
+ * @param name Row label.
+ * @param summary The percentiles.
+ */
+static void print_latency(const char* name, const latency_summary* summary) {
+    printf("  %-22s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, (unsigned long long)summary->count,
+        summary->p50_ns / 1000.0, summary->p90_ns / 1000.0, summary->p99_ns / 1000.0,
+        summary->p999_ns / 1000.0, summary->max_ns / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    uint32_t run_seconds = 10;
+    loopback_bridge_options options = { TCP_PIPELINE_WINDOW, 0, true, BRIDGE_SPIN_BUDGET_US, false };
+    sim_hid_config sim = { { VENDOR_ID, PRODUCT_ID, TARGET_USAGE_PAGE, TARGET_USAGE }, 1, 0, 32, SIM_PATTERN_UNIFORM, 1024, MESSAGE_SIZE_BYTES };
+    echo_server server = { 0 };
+    uint32_t service_us = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        int ok = 1;
+        if (strcmp(argv[i], "--lockstep") == 0) {
+            options.pipelined = false;
+            continue;
+        }
+        else if (strcmp(argv[i], "--seconds") == 0) {
+            ok = parse_uint(value, &run_seconds) && run_seconds > 0;
+        }
+        else if (strcmp(argv[i], "--devices") == 0) {
+            ok = parse_uint(value, &sim.device_count) && sim.device_count > 0 && sim.device_count <= HID_MAX_DEVICES;
+        }
+        else if (strcmp(argv[i], "--rate") == 0) {
+            ok = parse_uint(value, &sim.rate);
+        }
+        else if (strcmp(argv[i], "--outstanding") == 0) {
+            ok = parse_uint(value, &sim.outstanding);
+        }
+        else if (strcmp(argv[i], "--pattern") == 0) {
+            if (strcmp(value, "uniform") == 0) {
+                sim.pattern = SIM_PATTERN_UNIFORM;
+            }
+            else if (strcmp(value, "hot") == 0) {
+                sim.pattern = SIM_PATTERN_HOT;
+            }
+            else if (strcmp(value, "sequential") == 0) {
+                sim.pattern = SIM_PATTERN_SEQUENTIAL;
+            }
+            else {
+                ok = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--uris") == 0) {
+            ok = parse_uint(value, &sim.uri_count) && sim.uri_count > 0;
+        }
+        else if (strcmp(argv[i], "--service-us") == 0) {
+            ok = parse_uint(value, &service_us);
+        }
+        else if (strcmp(argv[i], "--window") == 0) {
+            ok = parse_uint(value, &options.window) && options.window > 0;
+        }
+        else if (strcmp(argv[i], "--cache") == 0) {
+            ok = parse_uint(value, &options.cache_entries);
+        }
+        else if (strcmp(argv[i], "--spin-us") == 0) {
+            ok = parse_uint(value, &options.spin_budget_us);
+        }
+        else if (strcmp(argv[i], "--engine") == 0) {
+            options.io_uring = strcmp(value, "uring") == 0;
+            ok = options.io_uring || strcmp(value, "epoll") == 0;
+        }
+        else if (strcmp(argv[i], "--frame-size") == 0) {
+            ok = parse_uint(value, &sim.frame_size) && sim.frame_size >= MESSAGE_SIZE_BYTES && sim.frame_size <= MESSAGE_MAX_SIZE_BYTES;
+        }
+        else {
+            ok = 0;
+        }
+        if (!ok) {
+            fprintf(stderr, usage_text, argv[0]);
+            return 1;
+        }
+        i++;
+    }
+    if (sim.rate == 0 && sim.outstanding == 0) {
+        fprintf(stderr, "Unpaced devices need an --outstanding limit\n");
+        return 1;
+    }
+
+    init_logger(BENCHMARK_LOG_FILE);
+    set_log_level(LOGLEVEL_WARN);
+    latency_stats_enable(true);
+
+    // The server comes up first so the bridge connects on its first attempt
+    platform_thread server_thread;
+    server.service_us = service_us;
+    server.frame_size = sim.frame_size;
+    if (!echo_server_start(&server, &server_thread)) {
+        return 1;
+    }
+
+    tcp_socket_info endpoint = { "127.0.0.1", server.port, TCP_CONNECT_TIMEOUT_MS, (uint8_t)sim.frame_size };
+    upstream_shard shard = { 0, { 0 }, 1 };
+    upstream_routing routing = { &shard, 1, UPSTREAM_SHARD_BY_HASH };
+    priority_rule priority_rules[] = PRIORITY_RULES;
+    priority_config priorities = { priority_rules, sizeof(priority_rules) / sizeof(priority_rules[0]), PRIORITY_POLICY, PRIORITY_WEIGHTS };
+    if (!sim_hid_configure(&sim) || !loopback_bridge_start(&options, &sim.usage, &endpoint, &routing, &priorities)) {
+        fprintf(stderr, "Failed to start the bridge\n");
+        return 1;
+    }
+
+    uint64_t start_us = monotonic_time_us();
+    uint64_t start_cpu_us = platform_process_cpu_us();
+    uint64_t start_server_cpu_us = platform_thread_cpu_us(server_thread);
+    platform_sleep_ms(run_seconds * 1000);
+    uint64_t elapsed_us = monotonic_time_us() - start_us;
+    uint64_t cpu_us = platform_process_cpu_us() - start_cpu_us;
+    uint64_t server_cpu_us = platform_thread_cpu_us(server_thread) - start_server_cpu_us;
+    sim_hid_stop();
+
+    sim_hid_stats stats;
+    latency_summary device_latency, bridge_latency, upstream_latency;
+    sim_hid_totals(&stats);
+    latency_histogram_summarize(sim_hid_latency(), &device_latency);
+    latency_summarize(LATENCY_TOTAL, &bridge_latency);
+    latency_summarize(LATENCY_SEND_TO_RESPONSE, &upstream_latency);
+
+    static const char* pattern_names[] = { "uniform", "hot", "sequential" };
+    double seconds = elapsed_us / 1e6;
+    printf("%u device(s), %s, %u outstanding, %s over %u URIs, %u us service time, %s window %u, %u-byte frames, %.1f s\n",
+        sim.device_count, sim.rate ? "paced" : "unpaced", sim.outstanding, pattern_names[sim.pattern], sim.uri_count,
+        service_us, options.pipelined ? "pipelined" : "lockstep", options.pipelined ? options.window : 1, sim.frame_size, seconds);
+    if (sim.rate) {
+        printf("Offered        %10u req/s per device\n", sim.rate);
+    }
+    printf("Requests       %10llu  %12.1f /s\n", (unsigned long long)stats.requests, stats.requests / seconds);
+    printf("Responses      %10llu  %12.1f /s\n", (unsigned long long)stats.responses, stats.responses / seconds);
+    printf("Confirmations  %10llu\n", (unsigned long long)stats.confirmations);
+    printf("Lost           %10llu\n", (unsigned long long)stats.lost);
+    printf("Unexpected     %10llu\n", (unsigned long long)stats.unexpected);
+    printf("CPU            %9.1f%% of one core (server %.1f%%), %.2f us per response\n",
+        100.0 * cpu_us / elapsed_us, 100.0 * server_cpu_us / elapsed_us,
+        stats.responses ? (double)cpu_us / stats.responses : 0.0);
+    printf("Latency (us)                count       p50       p90       p99     p99.9       max\n");
+    print_latency("device round trip", &device_latency);
+    print_latency("bridge total", &bridge_latency);
+    print_latency("upstream round trip", &upstream_latency);
+
+    loopback_bridge_stop();
+    echo_server_stop(&server, server_thread);
+    close_logger();
+    if (stats.responses == 0) {
+        fprintf(stderr, "No request was answered; see %s\n", BENCHMARK_LOG_FILE);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef LOOPBACK_BRIDGE_H
+#define LOOPBACK_BRIDGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "platform.h"
+#include "hid_descriptor.h"
+#include "upstream_pipeline.h"
+#include "priority_lanes.h"
+
+/**
+ * Starts and stops the bridge under test, configured as the service's main
+ * does apart from the options below: the HID and TCP threads on Windows
+ * (loopback_bridge_win32.c), the single-threaded event loop on Linux
+ * (loopback_bridge_linux.c).
+ */
+
+typedef struct {
+    uint32_t window;          // Requests in flight per upstream
+    uint32_t cache_entries;
+    bool pipelined;
+    uint32_t spin_budget_us;  // Spin before blocking; Windows only
+    bool io_uring;            // io_uring instead of epoll; Linux only
+} loopback_bridge_options;
+
+int loopback_bridge_start(const loopback_bridge_options* options, hid_usage_info* device_filter,
+    tcp_socket_info* endpoint, const upstream_routing* routing, const priority_config* priorities);
+void loopback_bridge_stop(void);
+
+#endif // LOOPBACK_BRIDGE_H
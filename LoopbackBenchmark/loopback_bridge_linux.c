@@ -0,0 +1,100 @@
+#include "config.h"
+#include "loopback_bridge.h"
+#include "bridge_linux.h"
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static linux_bridge_config bridgeConfig;
+static platform_thread bridgeThread = NULL;
+static int bridgeStopFd = -1;
+
+/**
+ * Runs the bridge until loopback_bridge_stop signals its stop descriptor.
+ *
+ * @param context Unused.
+ */
+static void bridge_thread(void* context) {
+    (void)context;
+    if (run_linux_bridge(&bridgeConfig, bridgeStopFd) < 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Loopback Benchmark - Bridge failed");
+    }
+}
+
+/**
+ * Starts the Linux bridge in its own thread, configured as main_linux.c does
+ * apart from the options under test. Every device uses the report size its
+ * descriptor declares.
+ *
+ * @param options The options under test.
+ * @param device_filter What the simulated devices enumerate as.
+ * @param endpoint The echo server.
+ * @param routing Shard table sending everything to the echo server.
+ * @param priorities How requests are classed.
+ * @return 1 on success, 0 on failure.
+ */
+int loopback_bridge_start(const loopback_bridge_options* options, hid_usage_info* device_filter,
+    tcp_socket_info* endpoint, const upstream_routing* routing, const priority_config* priorities) {
+    static cache_ttl_rule cache_ttls[] = RESPONSE_CACHE_TTLS;
+
+    signal(SIGPIPE, SIG_IGN);  // A dropped connection shows up as EPIPE instead
+    bridgeStopFd = eventfd(0, EFD_CLOEXEC);
+    if (bridgeStopFd < 0) {
+        return 0;
+    }
+
+    bridgeConfig.device_filters = device_filter;
+    bridgeConfig.device_filter_count = 1;
+    bridgeConfig.open_all_devices = true;
+    bridgeConfig.max_devices = HID_MAX_DEVICES;
+    bridgeConfig.reacquire_interval_ms = HID_REACQUIRE_INTERVAL_MS;
+    bridgeConfig.enumerate_interval_ms = HID_ENUMERATE_INTERVAL_MS;
+    bridgeConfig.held_responses = HID_HELD_RESPONSES;
+    bridgeConfig.frame_size = 0;
+    bridgeConfig.upstream.endpoints = endpoint;
+    bridgeConfig.upstream.endpoint_count = 1;
+    bridgeConfig.upstream.routing = routing;
+    bridgeConfig.upstream.pipelined = options->pipelined;
+    bridgeConfig.upstream.pipeline_window = options->window;
+    bridgeConfig.upstream.request_timeout_ms = TCP_REQUEST_TIMEOUT_MS;
+    bridgeConfig.upstream.send_batch_delay_us = TCP_SEND_BATCH_DELAY_US;
+    bridgeConfig.upstream.reconnect_min_ms = TCP_RECONNECT_MIN_MS;
+    bridgeConfig.upstream.reconnect_max_ms = TCP_RECONNECT_MAX_MS;
+    bridgeConfig.upstream.retain_frames = TCP_RETAIN_FRAMES;
+    bridgeConfig.upstream.unhealthy_timeouts = UPSTREAM_UNHEALTHY_TIMEOUTS;
+    bridgeConfig.upstream.coalesce_waiters = TCP_COALESCE_WAITERS;
+    bridgeConfig.upstream.cache_entries = options->cache_entries;
+    bridgeConfig.upstream.server_push = TCP_SERVER_PUSH_ENABLED;
+    bridgeConfig.upstream.cache_ttl_rules = cache_ttls;
+    bridgeConfig.upstream.cache_ttl_rule_count = sizeof(cache_ttls) / sizeof(cache_ttls[0]);
+    bridgeConfig.priorities = priorities;
+    bridgeConfig.latency_report_interval_ms = 0;
+    bridgeConfig.io_engine = options->io_uring ? LINUX_IO_URING : LINUX_IO_EPOLL;
+    bridgeConfig.uring_reads_per_device = LINUX_URING_READS_PER_DEVICE;
+    bridgeConfig.uring_writes_per_device = LINUX_URING_WRITES_PER_DEVICE;
+
+    bridgeThread = platform_thread_start(bridge_thread, NULL);
+    if (!bridgeThread) {
+        close(bridgeStopFd);
+        bridgeStopFd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Stops the bridge and waits for its thread.
+ */
+void loopback_bridge_stop(void) {
+    if (!bridgeThread) {
+        return;
+    }
+    uint64_t stop = 1;
+    if (write(bridgeStopFd, &stop, sizeof(stop)) == sizeof(stop)) {
+        platform_thread_join(bridgeThread);
+    }
+    bridgeThread = NULL;
+    close(bridgeStopFd);
+    bridgeStopFd = -1;
+}
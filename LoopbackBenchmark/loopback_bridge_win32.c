@@ -0,0 +1,88 @@
+#include "config.h"
+#include "loopback_bridge.h"
+#include "rawhid_thread.h"
+#include "tcp_client_thread.h"
+#include "shared_thread_data.h"
+#include <stdlib.h>
+
+static shared_thread_data sharedData;
+
+/**
+ * Starts the bridge's HID and TCP threads, configured as main.c does apart
+ * from the options under test.
+ *
+ * @param options The options under test.
+ * @param device_filter What the simulated devices enumerate as.
+ * @param endpoint The echo server.
+ * @param routing Shard table sending everything to the echo server.
+ * @param priorities How requests are classed.
+ * @return 1 on success, 0 on failure.
+ */
+int loopback_bridge_start(const loopback_bridge_options* options, hid_usage_info* device_filter,
+    tcp_socket_info* endpoint, const upstream_routing* routing, const priority_config* priorities) {
+    static cache_ttl_rule cache_ttls[] = RESPONSE_CACHE_TTLS;
+
+    if (!initialize_shared_data(&sharedData, SHARED_RING_DEPTH, SHARED_RING_POLICY, priorities)) {
+        return 0;
+    }
+
+    hid_thread_config* hid_config = (hid_thread_config*)calloc(1, sizeof(hid_thread_config));
+    client_thread_config* client_config = (client_thread_config*)calloc(1, sizeof(client_thread_config));
+    if (!hid_config || !client_config) {
+        free(hid_config);
+        free(client_config);
+        return 0;
+    }
+
+    hid_config->device_filters = device_filter;
+    hid_config->device_filter_count = 1;
+    hid_config->open_all_devices = true;
+    hid_config->max_devices = HID_MAX_DEVICES;
+    hid_config->reacquire_interval_ms = HID_REACQUIRE_INTERVAL_MS;
+    hid_config->enumerate_interval_ms = HID_ENUMERATE_INTERVAL_MS;
+    hid_config->held_responses = HID_HELD_RESPONSES;
+    hid_config->shared_data = &sharedData;
+    hid_config->spin_budget_us = options->spin_budget_us;
+
+    client_config->upstream.endpoints = endpoint;
+    client_config->upstream.endpoint_count = 1;
+    client_config->upstream.routing = routing;
+    client_config->shared_data = &sharedData;
+    client_config->spin_budget_us = options->spin_budget_us;
+    client_config->upstream.pipelined = options->pipelined;
+    client_config->upstream.pipeline_window = options->window;
+    client_config->upstream.request_timeout_ms = TCP_REQUEST_TIMEOUT_MS;
+    client_config->upstream.send_batch_delay_us = TCP_SEND_BATCH_DELAY_US;
+    client_config->upstream.reconnect_min_ms = TCP_RECONNECT_MIN_MS;
+    client_config->upstream.reconnect_max_ms = TCP_RECONNECT_MAX_MS;
+    client_config->upstream.retain_frames = TCP_RETAIN_FRAMES;
+    client_config->upstream.unhealthy_timeouts = UPSTREAM_UNHEALTHY_TIMEOUTS;
+    client_config->upstream.coalesce_waiters = TCP_COALESCE_WAITERS;
+    client_config->upstream.cache_entries = options->cache_entries;
+    client_config->upstream.server_push = TCP_SERVER_PUSH_ENABLED;
+    client_config->upstream.cache_ttl_rules = cache_ttls;
+    client_config->upstream.cache_ttl_rule_count = sizeof(cache_ttls) / sizeof(cache_ttls[0]);
+
+    // The threads own their configs from here on and run until the process exits
+    HANDLE client_thread = CreateThread(NULL, 0, tcp_client_thread, client_config, 0, NULL);
+    if (!client_thread) {
+        free(hid_config);
+        free(client_config);
+        return 0;
+    }
+    CloseHandle(client_thread);
+
+    HANDLE rawhid_thread = CreateThread(NULL, 0, rawhid_device_thread, hid_config, 0, NULL);
+    if (!rawhid_thread) {
+        free(hid_config);
+        return 0;
+    }
+    CloseHandle(rawhid_thread);
+    return 1;
+}
+
+/**
+ * The HID and TCP threads have no stop request; they end with the process.
+ */
+void loopback_bridge_stop(void) {
+}
@@ -0,0 +1,279 @@
+#include "sim_hid.h"
+#include "message_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A device blocked on its outstanding limit this long with no response gives its requests up as lost.
+#define SIM_LOST_AFTER_MS 2000
+// Waits longer than this sleep; shorter ones spin, as a sleep cannot wake up that precisely.
+#define SIM_SPIN_BELOW_NS 2000000ULL
+
+typedef struct {
+    uint64_t interval_ns;     // Between two requests, 0 when not paced
+    uint64_t next_due_ns;     // When the next paced request is due
+    uint16_t last_id;         // HID-side request ID the bridge gave the last request
+    uint64_t* due_ns;         // When each request was due, by HID-side request ID
+    uint32_t rng;
+    uint64_t sequence;
+    uint64_t last_answer_ns;  // Last response, or the last request given up on
+    platform_event answered_event;  // Auto-reset; a response freed an outstanding slot
+    volatile LONG outstanding;
+    volatile LONG64 requests;
+    volatile LONG64 confirmations;
+    volatile LONG64 responses;
+    volatile LONG64 unexpected;
+    volatile LONG64 lost;
+} sim_device;
+
+static sim_hid_config simConfig;
+static sim_device* simDevices = NULL;
+static volatile LONG simRunning = 0;
+static latency_histogram deviceLatency;
+
+/**
+ * Sets up the simulated devices. Call once, before the bridge enumerates.
+ *
+ * @param config How many devices there are and how they behave.
+ * @return 1 on success, 0 on failure.
+ */
+int sim_hid_configure(const sim_hid_config* config) {
+    if (!config || config->device_count == 0 || config->uri_count == 0) {
+        return 0;
+    }
+
+    simConfig = *config;
+    simDevices = (sim_device*)calloc(config->device_count, sizeof(sim_device));
+    if (!simDevices) {
+        return 0;
+    }
+
+    uint64_t now = monotonic_time_ns();
+    for (uint32_t i = 0; i < config->device_count; i++) {
+        sim_device* dev = &simDevices[i];
+        dev->interval_ns = config->rate ? 1000000000ULL / config->rate : 0;
+        dev->next_due_ns = now;
+        dev->due_ns = (uint64_t*)calloc(UINT16_MAX + 1, sizeof(uint64_t));
+        dev->rng = 0x9E3779B9u * (i + 1);
+        dev->last_answer_ns = now;
+        dev->answered_event = platform_event_create();
+        if (!dev->due_ns || !dev->answered_event) {
+            return 0;
+        }
+    }
+
+    WriteRelease(&simRunning, 1);
+    return 1;
+}
+
+/**
+ * Stops the devices from emitting further requests; responses are still
+ * counted.
+ */
+void sim_hid_stop(void) {
+    WriteRelease(&simRunning, 0);
+}
+
+/**
+ * Adds up the counters of every device.
+ *
+ * @param stats Receives the totals.
+ */
+void sim_hid_totals(sim_hid_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < simConfig.device_count && simDevices; i++) {
+        sim_device* dev = &simDevices[i];
+        stats->requests += ReadNoFence64(&dev->requests);
+        stats->confirmations += ReadNoFence64(&dev->confirmations);
+        stats->responses += ReadNoFence64(&dev->responses);
+        stats->unexpected += ReadNoFence64(&dev->unexpected);
+        stats->lost += ReadNoFence64(&dev->lost);
+    }
+}
+
+/**
+ * Latency seen by the devices, from when each request was due until its
+ * response was written back.
+ *
+ * @return The histogram.
+ */
+const latency_histogram* sim_hid_latency(void) {
+    return &deviceLatency;
+}
+
+/**
+ * How the devices were configured, for the platform's device calls.
+ *
+ * @return The configuration passed to sim_hid_configure.
+ */
+const sim_hid_config* sim_hid_get_config(void) {
+    return &simConfig;
+}
+
+/**
+ * Next URI a device asks for.
+ *
+ * @param dev The device.
+ * @return The URI.
+ */
+static uint64_t next_uri(sim_device* dev) {
+    // xorshift32
+    dev->rng ^= dev->rng << 13;
+    dev->rng ^= dev->rng >> 17;
+    dev->rng ^= dev->rng << 5;
+
+    uint32_t count = simConfig.uri_count;
+    switch (simConfig.pattern) {
+    case SIM_PATTERN_SEQUENTIAL:
+        return dev->sequence++ % count;
+    case SIM_PATTERN_HOT: {
+        uint32_t hot = count / 10 ? count / 10 : 1;
+        if (dev->rng % 10 != 0 || hot == count) {
+            return (dev->rng >> 4) % hot;
+        }
+        return hot + (dev->rng >> 4) % (count - hot);
+    }
+    default:
+        return dev->rng % count;
+    }
+}
+
+/**
+ * Waits until a point in time, sleeping for the bulk of long waits and
+ * spinning through short ones.
+ *
+ * @param when_ns The monotonic_time_ns() to wait for.
+ */
+static void wait_until(uint64_t when_ns) {
+    uint64_t now = monotonic_time_ns();
+    if (when_ns > now + SIM_SPIN_BELOW_NS) {
+        platform_sleep_ms((uint32_t)((when_ns - now - SIM_SPIN_BELOW_NS / 2) / 1000000));
+    }
+    while (monotonic_time_ns() < when_ns) {
+        YieldProcessor();
+    }
+}
+
+/**
+ * Frees an outstanding slot, never taking the count below zero when a
+ * response arrives for a request already given up on.
+ *
+ * @param dev The device.
+ */
+static void release_outstanding(sim_device* dev) {
+    LONG current = ReadNoFence(&dev->outstanding);
+    while (current > 0) {
+        LONG previous = InterlockedCompareExchange(&dev->outstanding, current - 1, current);
+        if (previous == current) {
+            platform_event_signal(dev->answered_event);
+            return;
+        }
+        current = previous;
+    }
+}
+
+
+/**
+ * Produces a device's next request once it is due, or returns 0 if the
+ * timeout passes first. A device at its outstanding limit waits for a
+ * response before it emits again.
+ *
+ * @param device Index of the device.
+ * @param data Receives the request frame.
+ * @param length Size of data, at least the configured frame size.
+ * @param milliseconds How long to wait, negative for no limit.
+ * @return The frame size, 0 on timeout, -1 on a bad argument.
+ */
+int sim_hid_next_request(uint32_t device, unsigned char* data, size_t length, int milliseconds) {
+    if (!simDevices || device >= simConfig.device_count || length < simConfig.frame_size) {
+        return -1;
+    }
+    sim_device* dev = &simDevices[device];
+
+    uint64_t now = monotonic_time_ns();
+    uint64_t deadline = milliseconds < 0 ? UINT64_MAX : now + (uint64_t)milliseconds * 1000000;
+    while (true) {
+        if (!ReadNoFence(&simRunning)) {
+            platform_sleep_ms(milliseconds < 0 ? 100 : (uint32_t)milliseconds);
+            return 0;
+        }
+
+        if (simConfig.outstanding && (uint32_t)ReadNoFence(&dev->outstanding) >= simConfig.outstanding) {
+            if (now - dev->last_answer_ns >= (uint64_t)SIM_LOST_AFTER_MS * 1000000) {
+                InterlockedExchangeAdd64(&dev->lost, InterlockedExchange(&dev->outstanding, 0));
+                dev->last_answer_ns = now;
+                continue;
+            }
+            if (now >= deadline) {
+                return 0;
+            }
+            uint64_t wait_ms = (deadline - now) / 1000000;
+            platform_event_wait(dev->answered_event, (uint32_t)(wait_ms < SIM_LOST_AFTER_MS ? wait_ms : SIM_LOST_AFTER_MS));
+            now = monotonic_time_ns();
+            continue;
+        }
+
+        if (dev->interval_ns && now < dev->next_due_ns) {
+            if (now >= deadline) {
+                return 0;
+            }
+            wait_until(dev->next_due_ns < deadline ? dev->next_due_ns : deadline);
+            now = monotonic_time_ns();
+            continue;
+        }
+        break;
+    }
+
+    // A paced request is due on its schedule, however late it is read
+    uint64_t due = now;
+    if (dev->interval_ns) {
+        due = dev->next_due_ns;
+        dev->next_due_ns += dev->interval_ns;
+    }
+
+    // The bridge numbers each device's requests 1, 2, 3, ... in the order it reads them
+    dev->due_ns[++dev->last_id] = due;
+    memset(data, 0, simConfig.frame_size);
+    encode_request(data, next_uri(dev));
+    InterlockedIncrement(&dev->outstanding);
+    InterlockedIncrement64(&dev->requests);
+    return (int)simConfig.frame_size;
+}
+
+/**
+ * Takes a confirmation or response the bridge wrote to a device.
+ *
+ * @param device Index of the device.
+ * @param data The report.
+ * @param length Its size in bytes.
+ */
+void sim_hid_take_report(uint32_t device, const unsigned char* data, size_t length) {
+    MessageType type;
+
+    if (!simDevices || device >= simConfig.device_count || length < MESSAGE_SIZE_BYTES) {
+        return;
+    }
+    sim_device* dev = &simDevices[device];
+
+    interpret_message(data, &type);
+    if (type == CONFIRM_MESSAGE) {
+        InterlockedIncrement64(&dev->confirmations);
+    }
+    else if (type == RESPONSE_MESSAGE) {
+        uint16_t request_id;
+        uint64_t value;
+        extract_request_id_and_data(data, &request_id, &value);
+
+        uint64_t now = monotonic_time_ns();
+        uint64_t due = dev->due_ns[request_id];
+        if (due && due <= now) {
+            latency_histogram_record(&deviceLatency, now - due);
+        }
+        dev->last_answer_ns = now;
+        InterlockedIncrement64(&dev->responses);
+        release_outstanding(dev);
+    }
+    else {
+        InterlockedIncrement64(&dev->unexpected);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SIM_HID_H
+#define SIM_HID_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "platform.h"
+#include "hid_descriptor.h"
+#include "latency_stats.h"
+
+/**
+ * Simulated HID devices.
+ *
+ * Implements the device calls the bridge makes, so it runs unchanged against
+ * in-process devices instead of USB: hidapi for rawhid.c and rawhid_thread.c
+ * on Windows (sim_hid_win32.c), hidraw descriptors for bridge_linux.c on
+ * Linux (sim_hid_linux.c). Each device emits request frames on its own
+ * schedule and counts the confirmations and responses the bridge writes back.
+ * A device's latency is measured from when a request was due, not from when
+ * the bridge got round to reading it, so a reader falling behind shows up as
+ * latency rather than silently lowering the offered rate.
+ */
+
+// Which URIs the devices ask for.
+typedef enum {
+    SIM_PATTERN_UNIFORM,      // Any of uri_count URIs with equal probability
+    SIM_PATTERN_HOT,          // 90% of requests go to the first 10% of the URIs
+    SIM_PATTERN_SEQUENTIAL    // 0, 1, 2, ... wrapping at uri_count
+} sim_uri_pattern;
+
+typedef struct {
+    hid_usage_info usage;     // What the devices enumerate as
+    uint32_t device_count;
+    uint32_t rate;            // Requests per second per device, 0 for as fast as outstanding allows
+    uint32_t outstanding;     // Unanswered requests a device allows, 0 for no limit (open loop)
+    sim_uri_pattern pattern;
+    uint32_t uri_count;
+    uint32_t frame_size;      // Report size the devices declare, MESSAGE_SIZE_BYTES to MESSAGE_MAX_SIZE_BYTES
+} sim_hid_config;
+
+typedef struct {
+    uint64_t requests;        // Request frames read by the bridge
+    uint64_t confirmations;   // Confirmations written back
+    uint64_t responses;       // Responses written back
+    uint64_t unexpected;      // Anything else written back
+    uint64_t lost;            // Requests given up on because no response came
+} sim_hid_stats;
+
+int sim_hid_configure(const sim_hid_config* config);
+void sim_hid_stop(void);
+void sim_hid_totals(sim_hid_stats* stats);
+const latency_histogram* sim_hid_latency(void);
+
+// Device side, for the platform's device calls.
+const sim_hid_config* sim_hid_get_config(void);
+int sim_hid_next_request(uint32_t device, unsigned char* data, size_t length, int milliseconds);
+void sim_hid_take_report(uint32_t device, const unsigned char* data, size_t length);
+
+#endif // SIM_HID_H
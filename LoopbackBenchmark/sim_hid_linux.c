@@ -0,0 +1,195 @@
+#include "config.h"
+#include "sim_hid.h"
+#include "hidraw_linux.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/**
+ * hidraw side of the simulated devices, for the Linux bridge: bridge_linux.c
+ * calls these in place of hidraw_linux.c. Each device is a SOCK_SEQPACKET
+ * socket pair, which keeps report boundaries as a hidraw node does. The
+ * bridge polls and reads its end like a hidraw descriptor, with either I/O
+ * engine; two threads play the device on the other end, one writing requests
+ * as sim_hid.c makes them due and one taking the bridge's confirmations and
+ * responses.
+ */
+
+// How long a device thread waits for its next request before checking again.
+#define SIM_POLL_INTERVAL_MS 100
+// Socket buffer on either end, a few thousand reports.
+#define SIM_SOCKET_BUFFER_BYTES (256 * 1024)
+
+typedef struct {
+    uint32_t index;
+    int fd;                   // Device end of the socket pair
+} sim_hidraw_device;
+
+static sim_hidraw_device simHidraw[HID_MAX_DEVICES];
+static uint32_t simOpened = 0;
+
+/**
+ * Device thread writing requests to the bridge as they fall due.
+ *
+ * @param context The device's sim_hidraw_device.
+ */
+static void request_writer(void* context) {
+    sim_hidraw_device* device = (sim_hidraw_device*)context;
+    unsigned char frame[MESSAGE_MAX_SIZE_BYTES];
+
+    while (true) {
+        int length = sim_hid_next_request(device->index, frame, sizeof(frame), SIM_POLL_INTERVAL_MS);
+        if (length < 0) {
+            return;
+        }
+        if (length > 0 && send(device->fd, frame, (size_t)length, MSG_NOSIGNAL) < 0) {
+            return;  // The bridge closed its end
+        }
+    }
+}
+
+/**
+ * Device thread taking what the bridge writes back.
+ *
+ * @param context The device's sim_hidraw_device.
+ */
+static void report_reader(void* context) {
+    sim_hidraw_device* device = (sim_hidraw_device*)context;
+    unsigned char report[MESSAGE_MAX_SIZE_BYTES];
+
+    while (true) {
+        ssize_t length = recv(device->fd, report, sizeof(report), 0);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return;  // The bridge closed its end
+        }
+        sim_hid_take_report(device->index, report, (size_t)length);
+    }
+}
+
+/**
+ * Creates a device's socket pair and starts the threads playing the device.
+ * Devices live until the process exits.
+ *
+ * @param index Index of the device.
+ * @return The bridge's end, non-blocking, or -1 on failure.
+ */
+static int open_device(uint32_t index) {
+    int ends[2];
+    int buffer = SIM_SOCKET_BUFFER_BYTES;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, ends) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        setsockopt(ends[i], SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        setsockopt(ends[i], SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    }
+
+    sim_hidraw_device* device = &simHidraw[index];
+    device->index = index;
+    device->fd = ends[1];
+    if (platform_set_socket_blocking(ends[0], false) != 0 ||
+        !platform_thread_start(request_writer, device) ||
+        !platform_thread_start(report_reader, device)) {
+        close(ends[0]);
+        close(ends[1]);
+        return -1;
+    }
+    return ends[0];
+}
+
+/**
+ * Opens the simulated devices if a filter tuple matches what they enumerate
+ * as. Each device is handed out once.
+ */
+size_t hidraw_open_matching(const hid_usage_info* filters, size_t filter_count, bool open_all, hidraw_device* devices, size_t max_devices) {
+    const sim_hid_config* config = sim_hid_get_config();
+    size_t opened = 0;
+
+    if (!filters || !devices) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < filter_count; i++) {
+        const hid_usage_info* filter = &filters[i];
+        if (filter->vendor_id != config->usage.vendor_id || filter->product_id != config->usage.product_id ||
+            filter->usage_page != config->usage.usage_page || filter->usage != config->usage.usage) {
+            continue;
+        }
+
+        while (simOpened < config->device_count && simOpened < HID_MAX_DEVICES && opened < max_devices) {
+            char path[32];
+            snprintf(path, sizeof(path), "sim:%u", simOpened);
+            devices[opened].path = strdup(path);
+            devices[opened].fd = devices[opened].path ? open_device(simOpened) : -1;
+            if (devices[opened].fd < 0) {
+                free(devices[opened].path);
+                return opened;
+            }
+            devices[opened].filter_index = i;
+            devices[opened].report_size = config->frame_size;
+            simOpened++;
+            opened++;
+            if (!open_all) {
+                break;
+            }
+        }
+        break;
+    }
+    return opened;
+}
+
+/**
+ * Simulated devices are never lost, so there is nothing to find again.
+ */
+int hidraw_open_first_matching(const hid_usage_info* filter, hidraw_path_filter skip, void* skip_context, char** opened_path, size_t* report_size) {
+    (void)filter;
+    (void)skip;
+    (void)skip_context;
+    (void)opened_path;
+    (void)report_size;
+    errno = ENODEV;
+    return -1;
+}
+
+int hidraw_open_path(const char* path, size_t* report_size) {
+    (void)path;
+    (void)report_size;
+    errno = ENODEV;
+    return -1;
+}
+
+int hidraw_read(int fd, unsigned char* buffer, size_t size) {
+    ssize_t bytes_read = read(fd, buffer, size);
+    if (bytes_read < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return (int)bytes_read;
+}
+
+/**
+ * Writes a report to a device. A hidraw write returns once the report is
+ * sent, so a full socket buffer is waited out rather than reported.
+ */
+int hidraw_write(int fd, const unsigned char* message, size_t size) {
+    while (true) {
+        ssize_t written = send(fd, message, size, MSG_NOSIGNAL);
+        if (written >= 0) {
+            return (int)written;
+        }
+        if (errno == EAGAIN) {
+            struct pollfd target = { fd, POLLOUT, 0 };
+            poll(&target, 1, -1);
+        }
+        else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#include "config.h"
+#include "sim_hid.h"
+#include "rawhid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * hidapi side of the simulated devices, for the Windows bridge: rawhid.c and
+ * rawhid_thread.c call these in place of the real hidapi, and each call is
+ * answered by the device it names in sim_hid.c.
+ */
+
+struct hid_device_ {
+    uint32_t index;
+};
+
+static hid_device simHandles[HID_MAX_DEVICES];
+
+/**
+ * The handle of a simulated device.
+ *
+ * @param index Index of the device.
+ * @return The handle, or NULL if there is no such device.
+ */
+static hid_device* device_handle(uint32_t index) {
+    if (index >= sim_hid_get_config()->device_count || index >= HID_MAX_DEVICES) {
+        return NULL;
+    }
+    simHandles[index].index = index;
+    return &simHandles[index];
+}
+
+int HID_API_EXPORT HID_API_CALL hid_init(void) {
+    return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_exit(void) {
+    return 0;
+}
+
+struct hid_device_info HID_API_EXPORT* HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    const sim_hid_config* config = sim_hid_get_config();
+    struct hid_device_info* head = NULL;
+
+    if ((vendor_id && vendor_id != config->usage.vendor_id) || (product_id && product_id != config->usage.product_id)) {
+        return NULL;
+    }
+
+    // Built back to front so the list comes out in device order
+    for (uint32_t i = config->device_count; i > 0; i--) {
+        struct hid_device_info* info = (struct hid_device_info*)calloc(1, sizeof(struct hid_device_info));
+        char* path = (char*)malloc(32);
+        if (!info || !path) {
+            free(info);
+            free(path);
+            break;
+        }
+        snprintf(path, 32, "sim:%u", i - 1);
+        info->path = path;
+        info->vendor_id = config->usage.vendor_id;
+        info->product_id = config->usage.product_id;
+        info->usage_page = config->usage.usage_page;
+        info->usage = config->usage.usage;
+        info->interface_number = -1;
+        info->next = head;
+        head = info;
+    }
+    return head;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info* devs) {
+    while (devs) {
+        struct hid_device_info* next = devs->next;
+        free(devs->path);
+        free(devs);
+        devs = next;
+    }
+}
+
+HID_API_EXPORT hid_device* HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t* serial_number) {
+    const sim_hid_config* config = sim_hid_get_config();
+    (void)serial_number;
+    if (vendor_id != config->usage.vendor_id || product_id != config->usage.product_id) {
+        return NULL;
+    }
+    return device_handle(0);
+}
+
+HID_API_EXPORT hid_device* HID_API_CALL hid_open_path(const char* path) {
+    unsigned int index;
+    if (sscanf(path, "sim:%u", &index) != 1) {
+        return NULL;
+    }
+    return device_handle(index);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_close(hid_device* dev) {
+    (void)dev;  // Devices live until the process exits
+}
+
+HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device* dev) {
+    (void)dev;
+    return L"Simulated device error";
+}
+
+/**
+ * Hands the bridge the device's next request once it is due, or returns 0
+ * if the timeout passes first. A device at its outstanding limit waits for a
+ * response before it emits again.
+ */
+int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device* dev, unsigned char* data, size_t length, int milliseconds) {
+    if (!dev) {
+        return -1;
+    }
+    return sim_hid_next_request(dev->index, data, length, milliseconds);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read(hid_device* dev, unsigned char* data, size_t length) {
+    return hid_read_timeout(dev, data, length, -1);
+}
+
+/**
+ * Describes one vendor-defined input and one output report of frame_size
+ * bytes each, without report IDs.
+ */
+int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device* dev, unsigned char* buf, size_t buf_size) {
+    const sim_hid_config* config = sim_hid_get_config();
+    const unsigned char descriptor[] = {
+        0x06, (unsigned char)config->usage.usage_page, (unsigned char)(config->usage.usage_page >> 8),  // Usage Page
+        0x09, config->usage.usage,            // Usage
+        0xA1, 0x01,                           // Collection (Application)
+        0x15, 0x00, 0x26, 0xFF, 0x00,         //   Logical Minimum 0, Maximum 255
+        0x75, 0x08,                           //   Report Size 8
+        0x95, (unsigned char)config->frame_size,  //   Report Count
+        0x09, 0x01, 0x81, 0x02,               //   Usage, Input (Data, Variable, Absolute)
+        0x95, (unsigned char)config->frame_size,  //   Report Count
+        0x09, 0x01, 0x91, 0x02,               //   Usage, Output (Data, Variable, Absolute)
+        0xC0                                  // End Collection
+    };
+    if (!dev || buf_size < sizeof(descriptor)) {
+        return -1;
+    }
+    memcpy(buf, descriptor, sizeof(descriptor));
+    return (int)sizeof(descriptor);
+}
+
+/**
+ * Takes a confirmation or response from the bridge.
+ */
+int HID_API_EXPORT HID_API_CALL hid_write(hid_device* dev, const unsigned char* data, size_t length) {
+    if (!dev || length < MESSAGE_SIZE_BYTES) {
+        return -1;
+    }
+    sim_hid_take_report(dev->index, data, length);
+    return (int)length;
+}
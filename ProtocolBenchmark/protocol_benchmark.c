@@ -0,0 +1,429 @@
+#include "message_protocol.h"
+#include "message_batch.h"
+#include "logger.h"
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Microbenchmarks for the frame codec and the logger.
+ *
+ * Usage: ProtocolBenchmark [--filter TEXT] [--max-batch N] [--json FILE]
+ *                          [--baseline FILE] [--threshold PERCENT]
+ *
+ * Every case runs over batches of 1, 16, 256, 4K, 64K and 1M frames (logger
+ * cases stop at 64K, as each frame is a log line). A batch is repeated until
+ * a trial covers enough frames to time reliably, and the fastest of
+ * BENCH_TRIALS trials is reported in ns/frame and TSC cycles/frame (0 on
+ * CPUs without a TSC).
+ *
+ * The batch decoder cases run once per SIMD level the CPU has, so the
+ * vector paths can be compared with the scalar one.
+ *
+ * --json writes the results one per line, so a run can be kept as a
+ * baseline. --baseline compares against such a file and exits with 2 if any
+ * case got slower than the threshold (default 10%) allows.
+ */
+
+#define BENCH_TRIALS 5
+#define BENCH_MAX_BATCH (1024 * 1024)
+#define BENCH_CODEC_TRIAL_FRAMES (4 * 1024 * 1024)
+#define BENCH_LOGGER_TRIAL_FRAMES (64 * 1024)
+#define BENCH_LOGGER_MAX_BATCH (64 * 1024)
+#define BENCH_LOG_FILE "protocol_benchmark.log"
+#define BENCH_MAX_RESULTS 256
+
+typedef void (*bench_function)(uint8_t* frames, size_t count, uint64_t* sink);
+
+typedef struct {
+    const char* name;
+    bench_function run;
+    size_t max_batch;
+    size_t trial_frames;      // Frames a trial covers at least, over repeated batches
+    LogLevel log_level;       // Runtime log level while the case runs
+    codec_simd_level simd_level;  // Level the batch decoder runs at; scalar for the other cases
+} bench_case;
+
+typedef struct {
+    char name[64];
+    uint32_t batch;
+    double ns_per_frame;
+    double cycles_per_frame;
+} bench_result;
+
+static void bench_interpret_message(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        MessageType type;
+        interpret_message(frames + i * MESSAGE_SIZE_BYTES, &type);
+        *sink += type;
+    }
+}
+
+static void bench_encode_request(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        encode_request(frames + i * MESSAGE_SIZE_BYTES, *sink + i);
+    }
+    *sink += frames[8];
+}
+
+static void bench_encode_response(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        encode_response(frames + i * MESSAGE_SIZE_BYTES, (uint16_t)i, *sink + i);
+    }
+    *sink += frames[8];
+}
+
+static void bench_encode_confirmation(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        encode_confirmation(frames + i * MESSAGE_SIZE_BYTES, (uint16_t)i, (uint16_t)*sink);
+    }
+    *sink += frames[2];
+}
+
+static void bench_extract_request_uri(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t uri;
+        extract_request_uri(frames + i * MESSAGE_SIZE_BYTES, &uri);
+        *sink += uri;
+    }
+}
+
+static void bench_extract_request_id_and_data(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        uint16_t request_id;
+        uint64_t data;
+        extract_request_id_and_data(frames + i * MESSAGE_SIZE_BYTES, &request_id, &data);
+        *sink += request_id + data;
+    }
+}
+
+static void bench_classify_messages(uint8_t* frames, size_t count, uint64_t* sink) {
+    static MessageType types[BENCH_MAX_BATCH];
+    classify_messages(frames, count, MESSAGE_SIZE_BYTES, types);
+    *sink += types[count - 1];
+}
+
+static void bench_decode_messages(uint8_t* frames, size_t count, uint64_t* sink) {
+    static MessageType types[BENCH_MAX_BATCH];
+    static uint16_t request_ids[BENCH_MAX_BATCH];
+    static uint64_t values[BENCH_MAX_BATCH];
+    message_batch out = { types, request_ids, NULL, values };
+    decode_messages(frames, count, MESSAGE_SIZE_BYTES, &out);
+    *sink += types[count - 1] + request_ids[count - 1] + values[count - 1];
+}
+
+static void bench_bytes_to_hex_string(uint8_t* frames, size_t count, uint64_t* sink) {
+    char hex[MESSAGE_SIZE_BYTES * 2 + 1];
+    for (size_t i = 0; i < count; i++) {
+        bytes_to_hex_string(frames + i * MESSAGE_SIZE_BYTES, MESSAGE_SIZE_BYTES, hex, sizeof(hex));
+        *sink += (uint8_t)hex[i % (MESSAGE_SIZE_BYTES * 2)];
+    }
+}
+
+static void bench_write_log(uint8_t* frames, size_t count, uint64_t* sink) {
+    (void)frames;
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG(LOGLEVEL_INFO, "TCP Client Thread - Benchmark message");
+    }
+    *sink += count;
+}
+
+static void bench_write_log_format(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Number of bytes read from device %u: %d", frames[i * MESSAGE_SIZE_BYTES + 8], MESSAGE_SIZE_BYTES);
+    }
+    *sink += count;
+}
+
+static void bench_write_log_byte_array(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG_BYTE_ARRAY(LOGLEVEL_INFO, frames + i * MESSAGE_SIZE_BYTES, MESSAGE_SIZE_BYTES);
+    }
+    *sink += count;
+}
+
+static void bench_write_log_uint64_dec(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG_UINT64_DEC(LOGLEVEL_INFO, "URI", frames[i * MESSAGE_SIZE_BYTES + 8] + i);
+    }
+    *sink += count;
+}
+
+static void bench_write_log_uint64_hex(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG_UINT64_HEX(LOGLEVEL_INFO, "URI", frames[i * MESSAGE_SIZE_BYTES + 8] + i);
+    }
+    *sink += count;
+}
+
+static void bench_write_log_uint64_bin(uint8_t* frames, size_t count, uint64_t* sink) {
+    for (size_t i = 0; i < count; i++) {
+        WRITE_LOG_UINT64_BIN(LOGLEVEL_INFO, "URI", frames[i * MESSAGE_SIZE_BYTES + 8] + i);
+    }
+    *sink += count;
+}
+
+// The filtered case runs at WARN, so its INFO calls stop at the level check.
+static const bench_case benchCases[] = {
+    { "interpret_message", bench_interpret_message, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "encode_request", bench_encode_request, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "encode_response", bench_encode_response, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "encode_confirmation", bench_encode_confirmation, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "extract_request_uri", bench_extract_request_uri, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "extract_request_id_and_data", bench_extract_request_id_and_data, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "classify_messages_scalar", bench_classify_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "classify_messages_sse2", bench_classify_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SSE2 },
+    { "classify_messages_avx2", bench_classify_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_AVX2 },
+    { "decode_messages_scalar", bench_decode_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "decode_messages_sse2", bench_decode_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SSE2 },
+    { "decode_messages_avx2", bench_decode_messages, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_AVX2 },
+    { "bytes_to_hex_string", bench_bytes_to_hex_string, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_ERROR, CODEC_SIMD_SCALAR },
+    { "write_log", bench_write_log, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+    { "write_log_format", bench_write_log_format, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+    { "write_log_format_filtered", bench_write_log_format, BENCH_MAX_BATCH, BENCH_CODEC_TRIAL_FRAMES, LOGLEVEL_WARN, CODEC_SIMD_SCALAR },
+    { "write_log_byte_array", bench_write_log_byte_array, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+    { "write_log_uint64_dec", bench_write_log_uint64_dec, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+    { "write_log_uint64_hex", bench_write_log_uint64_hex, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+    { "write_log_uint64_bin", bench_write_log_uint64_bin, BENCH_LOGGER_MAX_BATCH, BENCH_LOGGER_TRIAL_FRAMES, LOGLEVEL_INFO, CODEC_SIMD_SCALAR },
+};
+
+static const uint32_t benchBatches[] = { 1, 16, 256, 4096, 65536, BENCH_MAX_BATCH };
+
+/**
+ * Fills the input frames with a mix of the traffic the bridge sees: mostly
+ * requests and responses, some confirmations, in no predictable order.
+ *
+ * @param frames The frame buffer.
+ * @param count Frames in the buffer.
+ */
+static void fill_frames(uint8_t* frames, size_t count) {
+    uint32_t rng = 0x2545F491;
+    memset(frames, 0, count * MESSAGE_SIZE_BYTES);
+    for (size_t i = 0; i < count; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        uint8_t* frame = frames + i * MESSAGE_SIZE_BYTES;
+        uint64_t value = ((uint64_t)rng << 32) | (rng * 2654435761u);
+        switch (rng % 5) {
+        case 0:
+        case 1:
+            encode_request(frame, value);
+            break;
+        case 2:
+        case 3:
+            encode_response(frame, (uint16_t)i, value);
+            break;
+        default:
+            encode_confirmation(frame, (uint16_t)i, 0);
+            break;
+        }
+    }
+}
+
+/**
+ * Reads the time-stamp counter.
+ *
+ * @return TSC cycles, or 0 where there is no TSC.
+ */
+static uint64_t read_cycles(void) {
+#ifdef PLATFORM_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Times one case at one batch size.
+ *
+ * @param test The case.
+ * @param frames Input frames, at least batch of them.
+ * @param batch Frames per call.
+ * @param result Receives the fastest trial's cost per frame.
+ */
+static void run_case(const bench_case* test, uint8_t* frames, uint32_t batch, bench_result* result) {
+    static volatile uint64_t keep;
+    size_t repetitions = test->trial_frames > batch ? test->trial_frames / batch : 1;
+    double best_ns = 0, best_cycles = 0;
+    uint64_t sink = 0;
+
+    set_log_level(test->log_level);
+    test->run(frames, batch, &sink);  // Warm up caches and the branch predictor
+
+    for (int trial = 0; trial < BENCH_TRIALS; trial++) {
+        uint64_t start_ns = monotonic_time_ns();
+        uint64_t start_cycles = read_cycles();
+        for (size_t r = 0; r < repetitions; r++) {
+            test->run(frames, batch, &sink);
+        }
+        uint64_t cycles = read_cycles() - start_cycles;
+        uint64_t elapsed_ns = monotonic_time_ns() - start_ns;
+
+        double frame_count = (double)repetitions * batch;
+        double ns = (double)elapsed_ns / frame_count;
+        if (trial == 0 || ns < best_ns) {
+            best_ns = ns;
+            best_cycles = (double)cycles / frame_count;
+        }
+    }
+    keep += sink;
+
+    snprintf(result->name, sizeof(result->name), "%s", test->name);
+    result->batch = batch;
+    result->ns_per_frame = best_ns;
+    result->cycles_per_frame = best_cycles;
+}
+
+/**
+ * Writes results one JSON object per line inside a results array, which
+ * load_baseline reads back.
+ *
+ * @param path File to write.
+ * @param results The results.
+ * @param count Number of results.
+ * @return 1 on success, 0 on failure.
+ */
+static int write_json(const char* path, const bench_result* results, size_t count) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "{\n  \"frame_size\": %d,\n  \"trials\": %d,\n  \"results\": [\n", MESSAGE_SIZE_BYTES, BENCH_TRIALS);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, "    {\"name\": \"%s\", \"batch\": %u, \"ns_per_frame\": %.4f, \"cycles_per_frame\": %.4f}%s\n",
+            results[i].name, results[i].batch, results[i].ns_per_frame, results[i].cycles_per_frame, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 1;
+}
+
+/**
+ * Reads the results of a file written by write_json.
+ *
+ * @param path File to read.
+ * @param results Receives the results.
+ * @param capacity Capacity of results.
+ * @return Number of results read, or -1 if the file can't be opened.
+ */
+static int load_baseline(const char* path, bench_result* results, size_t capacity) {
+    char line[256];
+    int count = 0;
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open baseline %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) && (size_t)count < capacity) {
+        bench_result* result = &results[count];
+        if (sscanf(line, " {\"name\": \"%63[^\"]\", \"batch\": %u, \"ns_per_frame\": %lf, \"cycles_per_frame\": %lf}",
+            result->name, &result->batch, &result->ns_per_frame, &result->cycles_per_frame) == 4) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+int main(int argc, char** argv) {
+    const char* filter = NULL;
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    double threshold = 10.0;
+    uint32_t max_batch = BENCH_MAX_BATCH;
+    static bench_result results[BENCH_MAX_RESULTS];
+    static bench_result baseline[BENCH_MAX_RESULTS];
+    size_t result_count = 0;
+    int baseline_count = 0;
+    int regressions = 0;
+
+    for (int i = 1; i < argc; i += 2) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--filter") == 0) {
+            filter = value;
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            json_path = value;
+        }
+        else if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = value;
+        }
+        else if (strcmp(argv[i], "--threshold") == 0) {
+            threshold = atof(value);
+        }
+        else if (strcmp(argv[i], "--max-batch") == 0) {
+            max_batch = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--filter TEXT] [--max-batch N] [--json FILE] [--baseline FILE] [--threshold PERCENT]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (baseline_path && (baseline_count = load_baseline(baseline_path, baseline, BENCH_MAX_RESULTS)) < 0) {
+        return 1;
+    }
+
+    uint8_t* frames = (uint8_t*)malloc((size_t)BENCH_MAX_BATCH * MESSAGE_SIZE_BYTES);
+    if (!frames) {
+        fprintf(stderr, "Failed to allocate frames\n");
+        return 1;
+    }
+    fill_frames(frames, BENCH_MAX_BATCH);
+    init_logger(BENCH_LOG_FILE);
+
+    printf("%-30s %9s %12s %12s %10s\n", "case", "batch", "ns/frame", "cycles/frame", "vs base");
+    for (size_t c = 0; c < sizeof(benchCases) / sizeof(benchCases[0]); c++) {
+        const bench_case* test = &benchCases[c];
+        if (filter && !strstr(test->name, filter)) {
+            continue;
+        }
+        if (set_codec_simd_level(test->simd_level) != test->simd_level) {
+            continue;  // The CPU lacks this level
+        }
+
+        for (size_t b = 0; b < sizeof(benchBatches) / sizeof(benchBatches[0]); b++) {
+            uint32_t batch = benchBatches[b];
+            if (batch > test->max_batch || batch > max_batch || result_count == BENCH_MAX_RESULTS) {
+                continue;
+            }
+
+            // Encoders overwrite their batch; restore the mixed input for the cases after them
+            bench_result* result = &results[result_count++];
+            run_case(test, frames, batch, result);
+            fill_frames(frames, batch);
+
+            printf("%-30s %9u %12.3f %12.2f", result->name, batch, result->ns_per_frame, result->cycles_per_frame);
+            for (int i = 0; i < baseline_count; i++) {
+                if (baseline[i].batch == batch && strcmp(baseline[i].name, result->name) == 0) {
+                    double change = (result->ns_per_frame / baseline[i].ns_per_frame - 1.0) * 100.0;
+                    bool regressed = change > threshold;
+                    regressions += regressed;
+                    printf(" %+9.1f%%%s", change, regressed ? "  REGRESSION" : "");
+                    break;
+                }
+            }
+            printf("\n");
+        }
+    }
+
+    close_logger();
+    free(frames);
+
+    if (json_path && !write_json(json_path, results, result_count)) {
+        return 1;
+    }
+    if (baseline_path) {
+        printf("%d case(s) more than %.1f%% slower than %s\n", regressions, threshold, baseline_path);
+    }
+    return regressions ? 2 : 0;
+}
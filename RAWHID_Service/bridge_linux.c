@@ -0,0 +1,1574 @@
+#include "bridge_linux.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+
+#define BRIDGE_MAX_EVENTS 64
+#define URING_SUBMIT_ENTRIES 256
+
+// What an epoll registration or io_uring submission belongs to: the kind in
+// the top byte, a generation in the next three (so completions for a closed
+// descriptor are recognised) and an index in the low half.
+#define EVENT_STOP 0U
+#define EVENT_DEVICE 1U       // epoll: device readable
+#define EVENT_UPSTREAM 2U     // Upstream socket ready
+#define EVENT_READ 3U         // io_uring: report read into a pool slot
+#define EVENT_WRITE 4U        // io_uring: pool slot written to a device
+#define EVENT_CANCEL 5U       // io_uring: cancellation or poll removal, nothing to do
+#define EVENT_TAG(kind, generation, index) (((uint64_t)(kind) << 56) | ((uint64_t)((generation) & 0xFFFFFF) << 32) | (uint32_t)(index))
+#define EVENT_KIND(tag) ((uint32_t)((tag) >> 56))
+#define EVENT_GENERATION(tag) ((uint32_t)((tag) >> 32) & 0xFFFFFF)
+#define EVENT_INDEX(tag) ((uint32_t)(tag))
+
+#define NO_PENDING_RESPONSE UINT32_MAX  // Write slot of a report that is not a response, e.g. a confirmation
+
+typedef struct linux_bridge linux_bridge;
+
+// A response the io_uring engine is writing, kept until its last write completes.
+typedef struct {
+    bridge_frame frame;
+    uint64_t sequence;        // Order the device's responses were written in
+    uint32_t writes;          // Its writes queued or in flight
+    bool queued;              // Every fragment has been queued
+    bool failed;              // A write failed or was cancelled; it is held again when the device is lost
+    bool in_use;
+} pending_response;
+
+// One bridged hidraw device.
+typedef struct {
+    linux_bridge* bridge;
+    uint8_t index;        // Device index carried in the frames of this device
+    int fd;               // -1 while the device is lost
+    char* path;           // Last path the device was opened from
+    const hid_usage_info* filter;  // Tuple the device matched, used to find it again
+    uint8_t frame_size;   // Bytes per report
+    uint16_t next_request_id;  // Last ID a request from the device was confirmed with
+    bool reading;         // Registered for input; off while a request is held back
+    bridge_frame* held;   // Responses waiting for the device to come back
+    uint32_t held_start;
+    uint32_t held_count;
+    uint64_t held_dropped;
+    uint32_t reacquisitions;
+    uint64_t lost_us;         // When the device was lost
+    uint64_t next_reacquire_us;  // When to retry its cached path
+    uint64_t next_enumerate_us;  // When to search for it by enumeration
+    uint64_t frames_read;
+    uint64_t frames_written;
+    fragment_assembler fragments;  // Fragmented request being read
+    uint64_t message_read_ns; // When its first fragment was read
+
+    // io_uring engine
+    uint32_t generation;      // Bumped when the device is lost, so late completions on its old descriptor are ignored
+    bool failed;              // A read or write completed with an error; the device is lost at the next pass
+    uint32_t reads_in_flight;
+    uint32_t* ready;          // Pool slots holding completed reads, oldest first
+    uint32_t ready_start;
+    uint32_t ready_count;
+    uring_write_queue writes; // Pool slots queued for writing
+    uint32_t writes_in_flight;
+    pending_response* pending;  // Responses being written, write_slots + 1 of them
+    uint32_t writing;         // Pending response the writes being queued belong to
+    uint64_t next_sequence;
+} linux_hid_device;
+
+// Connection attempt in progress to one upstream.
+typedef struct {
+    SOCKET socket;            // INVALID_SOCKET when not connecting
+    uint64_t deadline_us;     // Give up once monotonic_time_us() passes this, UINT64_MAX for never
+
+    // io_uring engine
+    SOCKET polled;            // Socket the multishot poll is armed on, INVALID_SOCKET for none
+    bool poll_armed;
+    uint32_t poll_generation;
+    uint32_t events;          // Readiness reported since the upstream was last serviced
+} upstream_attempt;
+
+// Everything the event loop owns.
+struct linux_bridge {
+    int epoll_fd;
+    linux_hid_device* devices;
+    size_t device_count;
+    tcp_router router;
+    upstream_attempt* attempts;
+    bool reading;             // Devices are read; off while a request is held back
+    uint32_t reacquire_interval_ms;
+    uint32_t enumerate_interval_ms;
+    uint32_t held_capacity;
+    uint8_t configured_frame_size;  // Frame size for every device, 0 to use each one's report size
+    const priority_config* priorities;  // How requests are classed, NULL for all normal
+    bool stop_requested;
+
+    // I/O engine
+    linux_io_engine engine;   // Engine in use, after any fallback
+    uint64_t io_syscalls;     // Waits, reads and writes made by the loop; socket calls are counted by the pipelines
+    uint64_t io_frames;       // Reports read from and written to the devices
+    uring ring;
+    uring_frame_pool pool;
+    uint8_t* slot_device;     // Device each pool slot is being read or written for
+    uint8_t* slot_length;     // Bytes read into or to be written from each pool slot
+    uint32_t* slot_response;  // Pending response each write slot belongs to
+    uint32_t read_slots;      // Reads kept in flight per device
+    uint32_t write_slots;     // Writes queued or in flight per device
+};
+
+/**
+ * Handles a completed read: queues the report for the loop, or releases the
+ * slot if the read failed or belongs to a descriptor since closed.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param slot The pool slot read into.
+ * @param generation Generation of the device the read was submitted for.
+ * @param result Bytes read, or a negative errno.
+ */
+static void complete_read(linux_bridge* bridge, uint32_t slot, uint32_t generation, int result) {
+    linux_hid_device* device = &bridge->devices[bridge->slot_device[slot]];
+    device->reads_in_flight--;
+    bool current = device->fd >= 0 && generation == (device->generation & 0xFFFFFF);
+
+    if (!current || result <= 0) {
+        uring_pool_put(&bridge->pool, slot);
+        // A blocking hidraw read never returns zero bytes unless the node went away
+        if (current && result == 0) {
+            device->failed = true;
+        }
+        else if (current && result != -EINTR && result != -EAGAIN && result != -ECANCELED) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Failed to read from device %u. Error: %d", device->index, -result);
+            device->failed = true;
+        }
+        return;
+    }
+    bridge->slot_length[slot] = (uint8_t)result;
+    device->ready[(device->ready_start + device->ready_count) % bridge->read_slots] = slot;
+    device->ready_count++;
+}
+
+static void record_delivery(linux_hid_device* device, bridge_frame* frame);
+
+/**
+ * Handles a completed write by releasing its slot, and records a response
+ * as delivered once its last write has completed. A failed write loses the
+ * device; the writes linked after it complete as cancelled, and their
+ * responses are held again.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param slot The pool slot written from.
+ * @param generation Generation of the device the write was submitted for.
+ * @param result Bytes written, or a negative errno.
+ */
+static void complete_write(linux_bridge* bridge, uint32_t slot, uint32_t generation, int result) {
+    linux_hid_device* device = &bridge->devices[bridge->slot_device[slot]];
+    uint32_t response = bridge->slot_response[slot];
+    device->writes_in_flight--;
+    uring_pool_put(&bridge->pool, slot);
+    if (device->fd < 0 || generation != (device->generation & 0xFFFFFF)) {
+        return;  // Its response was held when the device was lost
+    }
+    if (result < 0 && result != -ECANCELED) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "HIDRAW - Failed to write to device. Error: %d", -result);
+        device->failed = true;
+    }
+    if (response == NO_PENDING_RESPONSE) {
+        return;
+    }
+
+    pending_response* pending = &device->pending[response];
+    pending->writes--;
+    pending->failed |= result < 0;
+    if (pending->writes == 0 && pending->queued && !pending->failed) {
+        record_delivery(device, &pending->frame);
+        pending->in_use = false;
+    }
+}
+
+/**
+ * Consumes every completion the ring has. Only records what happened; the
+ * loop acts on it, so this is safe to call from anywhere.
+ *
+ * @param bridge Pointer to the bridge.
+ */
+static void reap_completions(linux_bridge* bridge) {
+    struct io_uring_cqe* cqe;
+    while ((cqe = uring_peek_cqe(&bridge->ring)) != NULL) {
+        uint64_t tag = cqe->user_data;
+        int result = cqe->res;
+        bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        uring_cqe_seen(&bridge->ring);
+
+        uint32_t index = EVENT_INDEX(tag);
+        switch (EVENT_KIND(tag)) {
+        case EVENT_READ:
+            complete_read(bridge, index, EVENT_GENERATION(tag), result);
+            break;
+        case EVENT_WRITE:
+            complete_write(bridge, index, EVENT_GENERATION(tag), result);
+            break;
+        case EVENT_UPSTREAM: {
+            upstream_attempt* attempt = &bridge->attempts[index];
+            if (EVENT_GENERATION(tag) != (attempt->poll_generation & 0xFFFFFF)) {
+                break;  // Poll on a socket since closed
+            }
+            attempt->events |= result < 0 ? (uint32_t)POLLERR : (uint32_t)result;
+            if (!more) {
+                attempt->poll_armed = false;  // The kernel ended the multishot poll; rearm it
+            }
+            break;
+        }
+        case EVENT_STOP:
+            bridge->stop_requested = true;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * Submits a device's queued writes as one linked chain, so they reach the
+ * device in order however the kernel runs them. Only one chain is in flight
+ * per device; the next starts once it has completed.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ */
+static void start_writes(linux_bridge* bridge, linux_hid_device* device) {
+    if (device->writes_in_flight > 0 || device->writes.count == 0 || device->fd < 0) {
+        return;
+    }
+    // A chain must not be split across submissions, or the link is lost
+    if (uring_sq_space(&bridge->ring) < device->writes.count) {
+        uring_submit_and_wait(&bridge->ring, 0, 0);
+    }
+    uint32_t chain = device->writes.count;
+    if (chain > uring_sq_space(&bridge->ring)) {
+        chain = uring_sq_space(&bridge->ring);
+    }
+
+    for (uint32_t i = 0; i < chain; i++) {
+        uint32_t slot = uring_write_queue_pop(&device->writes);
+        struct io_uring_sqe* sqe = uring_get_sqe(&bridge->ring);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = device->fd;
+        sqe->addr = (uint64_t)(uintptr_t)uring_pool_buffer(&bridge->pool, slot);
+        sqe->len = bridge->slot_length[slot];
+        sqe->buf_index = 0;
+        sqe->flags = i + 1 < chain ? IOSQE_IO_LINK : 0;
+        sqe->user_data = EVENT_TAG(EVENT_WRITE, device->generation, slot);
+        device->writes_in_flight++;
+    }
+}
+
+/**
+ * Queues a report for writing with the next submission, ahead of any queued
+ * reports of a lower class but behind those of its own or a higher one, or
+ * straight after the previous fragment of its message. If the device already
+ * has its limit of writes outstanding, waits for some to complete. A write
+ * that later fails loses the device.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param message The report.
+ * @param size Its size in bytes.
+ * @param priority Its message's class.
+ * @param continues Whether it is a later fragment of the report queued before it.
+ * @return size once queued, or -1 if the device is lost.
+ */
+static int queue_write(linux_bridge* bridge, linux_hid_device* device, const unsigned char* message, size_t size, priority_class priority, bool continues) {
+    while (device->writes.count + device->writes_in_flight >= bridge->write_slots && device->fd >= 0 && !device->failed) {
+        start_writes(bridge, device);
+        if (uring_submit_and_wait(&bridge->ring, 1, -1) < 0) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - io_uring wait failed. Error: %d", errno);
+            return -1;
+        }
+        reap_completions(bridge);
+    }
+    if (device->fd < 0 || device->failed) {
+        return -1;
+    }
+
+    uint32_t slot;
+    if (!uring_pool_get(&bridge->pool, &slot)) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Frame pool exhausted writing to device %u", device->index);
+        return -1;
+    }
+    memcpy(uring_pool_buffer(&bridge->pool, slot), message, size);
+    bridge->slot_device[slot] = device->index;
+    bridge->slot_length[slot] = (uint8_t)size;
+    bridge->slot_response[slot] = device->writing;
+    if (device->writing != NO_PENDING_RESPONSE) {
+        device->pending[device->writing].writes++;
+    }
+    uring_write_queue_push(&device->writes, slot, priority, continues);
+    return (int)size;
+}
+
+/**
+ * Keeps the io_uring engine's reads in flight on a device, up to its
+ * per-device limit less the reports still waiting to be handled. Nothing
+ * is armed while reading is paused.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ */
+static void arm_reads(linux_bridge* bridge, linux_hid_device* device) {
+    while (device->fd >= 0 && !device->failed && device->reading &&
+        device->reads_in_flight + device->ready_count < bridge->read_slots) {
+        uint32_t slot;
+        if (!uring_pool_get(&bridge->pool, &slot)) {
+            return;
+        }
+        struct io_uring_sqe* sqe = uring_get_sqe(&bridge->ring);
+        if (!sqe) {
+            uring_pool_put(&bridge->pool, slot);
+            return;
+        }
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = device->fd;
+        sqe->addr = (uint64_t)(uintptr_t)uring_pool_buffer(&bridge->pool, slot);
+        sqe->len = device->frame_size;
+        sqe->buf_index = 0;
+        sqe->user_data = EVENT_TAG(EVENT_READ, device->generation, slot);
+        bridge->slot_device[slot] = device->index;
+        device->reads_in_flight++;
+    }
+}
+
+/**
+ * Keeps one multishot poll armed on each upstream's current socket (the one
+ * connecting, or the connected one) and removes the poll of a socket that
+ * was closed. Runs before new connections are made, so a closed socket's
+ * poll is gone before its descriptor number can be reused.
+ *
+ * @param bridge Pointer to the bridge.
+ */
+static void sync_upstream_polls(linux_bridge* bridge) {
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        upstream_attempt* attempt = &bridge->attempts[i];
+        tcp_pipeline* upstream = &bridge->router.upstreams[i];
+        SOCKET current = attempt->socket != INVALID_SOCKET ? attempt->socket
+            : upstream->connected ? upstream->socket : INVALID_SOCKET;
+        if (current == attempt->polled && (current == INVALID_SOCKET || attempt->poll_armed)) {
+            continue;
+        }
+
+        struct io_uring_sqe* sqe;
+        if (attempt->polled != INVALID_SOCKET && attempt->poll_armed && (sqe = uring_get_sqe(&bridge->ring)) != NULL) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = EVENT_TAG(EVENT_UPSTREAM, attempt->poll_generation, i);
+            sqe->user_data = EVENT_TAG(EVENT_CANCEL, 0, 0);
+        }
+        attempt->poll_generation++;
+        attempt->polled = current;
+        attempt->poll_armed = false;
+        attempt->events = 0;
+        if (current != INVALID_SOCKET && (sqe = uring_get_sqe(&bridge->ring)) != NULL) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = current;
+            sqe->poll32_events = POLLIN | POLLOUT | POLLRDHUP;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = EVENT_TAG(EVENT_UPSTREAM, attempt->poll_generation, i);
+            attempt->poll_armed = true;
+        }
+    }
+}
+
+/**
+ * Writes a report to a device through the engine in use: directly with the
+ * epoll engine, queued for the next submission in its class with the
+ * io_uring engine.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param message The report.
+ * @param size Its size in bytes.
+ * @param priority Its message's class.
+ * @param continues Whether it is a later fragment of the report written before it.
+ * @return The number of bytes written, or -1 if an error occurs or the device is lost.
+ */
+static int device_write(linux_bridge* bridge, linux_hid_device* device, const unsigned char* message, size_t size, priority_class priority, bool continues) {
+    if (device->fd < 0) {
+        return -1;
+    }
+    bridge->io_frames++;
+    if (bridge->engine == LINUX_IO_URING) {
+        return queue_write(bridge, device, message, size, priority, continues);
+    }
+    bridge->io_syscalls++;
+    return hidraw_write(device->fd, message, size);
+}
+
+/**
+ * Writes a message to a device as one frame of the device's frame size,
+ * zero-padded if it came from a link with smaller frames.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param message Pointer to the message buffer, MESSAGE_MAX_SIZE_BYTES long.
+ * @param size The size of the message in bytes.
+ * @param priority Its class.
+ * @return The number of bytes written, or -1 if an error occurs or the device is lost.
+ */
+static int write_frame(linux_bridge* bridge, linux_hid_device* device, unsigned char* message, size_t size, priority_class priority) {
+    resize_message(message, size, device->frame_size);
+    return device_write(bridge, device, message, device->frame_size, priority, false);
+}
+
+/**
+ * Writes a response to a device in its class, a fragmented one as fragments
+ * of the device's frame size. The fragments are queued together and in
+ * order, so no other report can be written between them.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param frame The response.
+ * @return The number of bytes written, or -1 if an error occurs or the device is lost.
+ */
+static int write_response(linux_bridge* bridge, linux_hid_device* device, bridge_frame* frame) {
+    if (!frame->payload) {
+        return write_frame(bridge, device, frame->data, frame->size, (priority_class)frame->priority);
+    }
+
+    int written = 0;
+    size_t count = message_fragment_count(frame->payload->size, device->frame_size);
+    for (size_t i = 0; i < count && written >= 0; i++) {
+        unsigned char fragment[MESSAGE_MAX_SIZE_BYTES];
+        fragment_message(fragment, device->frame_size, frame->data, frame->payload, i);
+        int result = device_write(bridge, device, fragment, device->frame_size, (priority_class)frame->priority, i > 0);
+        written = result < 0 ? -1 : written + result;
+    }
+    return written;
+}
+
+/**
+ * Keeps a response for a lost device until it comes back, discarding the
+ * oldest held response if the device's buffer is full.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param frame The response to hold.
+ */
+static void hold_response(linux_bridge* bridge, linux_hid_device* device, const bridge_frame* frame) {
+    uint32_t capacity = bridge->held_capacity;
+    if (capacity == 0) {
+        message_payload_free(frame->payload);
+        device->held_dropped++;
+        return;
+    }
+    if (device->held_count == capacity) {
+        message_payload_free(device->held[device->held_start].payload);
+        device->held_start = (device->held_start + 1) % capacity;
+        device->held_count--;
+        device->held_dropped++;
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Device %u still lost, dropped its oldest held response", device->index);
+    }
+    device->held[(device->held_start + device->held_count) % capacity] = *frame;
+    device->held_count++;
+}
+
+/**
+ * Puts a response back in front of those held for a lost device, since it
+ * is older than all of them. If the buffer is full it is the oldest, and is
+ * the one discarded.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param frame The response to hold.
+ */
+static void hold_response_first(linux_bridge* bridge, linux_hid_device* device, const bridge_frame* frame) {
+    uint32_t capacity = bridge->held_capacity;
+    if (device->held_count == capacity) {
+        message_payload_free(frame->payload);
+        device->held_dropped++;
+        if (capacity > 0) {
+            WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Device %u still lost, dropped its oldest held response", device->index);
+        }
+        return;
+    }
+    device->held_start = (device->held_start + capacity - 1) % capacity;
+    device->held[device->held_start] = *frame;
+    device->held_count++;
+}
+
+/**
+ * Stamps a response as written to its device, records its latencies and
+ * releases its payload.
+ *
+ * @param device The device the response was written to.
+ * @param frame The response just written.
+ */
+static void record_delivery(linux_hid_device* device, bridge_frame* frame) {
+    device->frames_written++;
+    frame->timing.hid_written_ns = monotonic_time_ns();
+    latency_record_request(&frame->timing, frame->priority);
+    message_payload_free(frame->payload);
+    frame->payload = NULL;
+}
+
+/**
+ * Writes a response to a device and records its delivery: straight away with
+ * the epoll engine, and with the io_uring engine once its last write has
+ * completed. Until then the io_uring engine keeps the response, so it can
+ * be held again if the device is lost first.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param frame The response; its payload is taken over on success.
+ * @return 0 once the response is taken over, -1 if the device is lost and the caller keeps it.
+ */
+static int send_response(linux_bridge* bridge, linux_hid_device* device, bridge_frame* frame) {
+    if (bridge->engine != LINUX_IO_URING) {
+        if (write_response(bridge, device, frame) < 0) {
+            return -1;
+        }
+        record_delivery(device, frame);
+        return 0;
+    }
+
+    // Every pending response has a write outstanding, so one of write_slots + 1 is free
+    uint32_t index = 0;
+    while (index <= bridge->write_slots && device->pending[index].in_use) {
+        index++;
+    }
+    if (index > bridge->write_slots) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - No room to track a response to device %u", device->index);
+        return -1;
+    }
+    pending_response* pending = &device->pending[index];
+    pending->in_use = true;
+    pending->writes = 0;
+    pending->queued = false;
+    pending->failed = false;
+    pending->sequence = device->next_sequence++;
+
+    device->writing = index;
+    int written = write_response(bridge, device, frame);
+    device->writing = NO_PENDING_RESPONSE;
+    if (written < 0 && pending->writes == 0) {
+        pending->in_use = false;
+        return -1;
+    }
+
+    // Some of it is queued; if that is all, losing the device holds it again
+    pending->frame = *frame;
+    pending->queued = written >= 0;
+    pending->failed |= written < 0;
+    if (pending->writes == 0 && !pending->failed) {
+        record_delivery(device, &pending->frame);
+        pending->in_use = false;
+    }
+    return 0;
+}
+
+/**
+ * Holds again the responses not yet fully written to a lost device, in
+ * front of those already held and in the order they were written, so they
+ * go out first when the device comes back.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ */
+static void hold_pending_responses(linux_bridge* bridge, linux_hid_device* device) {
+    uint32_t count = 0;
+    while (true) {
+        // Newest first, each going in front of the last
+        pending_response* newest = NULL;
+        for (uint32_t i = 0; i <= bridge->write_slots; i++) {
+            pending_response* pending = &device->pending[i];
+            if (pending->in_use && (newest == NULL || pending->sequence > newest->sequence)) {
+                newest = pending;
+            }
+        }
+        if (newest == NULL) {
+            break;
+        }
+        newest->in_use = false;
+        hold_response_first(bridge, device, &newest->frame);
+        count++;
+    }
+    if (count > 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Holding %u response(s) not yet written to device %u", count, device->index);
+    }
+}
+
+/**
+ * Delivers the responses held for a device once it is back.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ */
+static void flush_held_responses(linux_bridge* bridge, linux_hid_device* device) {
+    uint32_t delivered = 0;
+    while (device->held_count > 0) {
+        bridge_frame* frame = &device->held[device->held_start];
+        if (send_response(bridge, device, frame) < 0) {
+            break;  // Lost again; keep the rest for the next reacquisition
+        }
+        device->held_start = (device->held_start + 1) % bridge->held_capacity;
+        device->held_count--;
+        delivered++;
+    }
+    if (delivered > 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - Delivered %u held response(s) to device %u", delivered, device->index);
+    }
+}
+
+/**
+ * Writes a frame to a device after whatever is held for it, or holds it
+ * while the device is lost.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param frame The frame; its payload is taken over.
+ */
+static void deliver_frame(linux_bridge* bridge, linux_hid_device* device, bridge_frame* frame) {
+    if (device->held_count > 0) {
+        flush_held_responses(bridge, device);  // Older responses go first
+    }
+    if (device->held_count > 0 || send_response(bridge, device, frame) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Device %u unavailable, holding response", device->index);
+        hold_response(bridge, device, frame);
+    }
+}
+
+/**
+ * Writes a response from the upstream side to the device it is addressed to,
+ * or holds it while that device is lost; a push for every device goes to
+ * each of them. Called by the upstream pipelines.
+ *
+ * @param response The response; its payload is taken over.
+ * @param context Pointer to the bridge.
+ */
+static void deliver_to_device(const bridge_frame* response, void* context) {
+    linux_bridge* bridge = (linux_bridge*)context;
+    bridge_frame frame = *response;
+
+    if (message_is_push_to_all(frame.data)) {
+        for (size_t i = 0; i < bridge->device_count; i++) {
+            bridge_frame copy = frame;  // Pushes carry no payload
+            copy.device_index = (uint8_t)i;
+            deliver_frame(bridge, &bridge->devices[i], &copy);
+        }
+        return;
+    }
+    if (frame.device_index >= bridge->device_count) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Dropping message for unknown device %u", frame.device_index);
+        message_payload_free(frame.payload);
+        return;
+    }
+    deliver_frame(bridge, &bridge->devices[frame.device_index], &frame);
+}
+
+/**
+ * Picks the frame size of a device: the configured one, or else the report
+ * size its descriptor declares, within what a frame can be.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param report_size Report size its descriptor declares.
+ * @return The frame size in bytes.
+ */
+static uint8_t device_frame_size(const linux_bridge* bridge, const linux_hid_device* device, size_t report_size) {
+    if (bridge->configured_frame_size) {
+        report_size = bridge->configured_frame_size;
+    }
+    uint8_t frame_size = (uint8_t)message_frame_size(report_size);
+    if (report_size != frame_size) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Device %u has %zu-byte reports, using %u-byte frames", device->index, report_size, frame_size);
+    }
+    return frame_size;
+}
+
+/**
+ * Registers a descriptor with the event loop. The io_uring engine only
+ * needs the stop descriptor polled here: it reads devices through
+ * arm_reads and polls sockets through sync_upstream_polls.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param fd The descriptor.
+ * @param events EPOLL* flags to watch for.
+ * @param tag EVENT_TAG naming what the descriptor belongs to.
+ * @return 0 on success, -1 on failure.
+ */
+static int watch(linux_bridge* bridge, int fd, uint32_t events, uint64_t tag) {
+    if (bridge->engine == LINUX_IO_URING) {
+        if (EVENT_KIND(tag) == EVENT_STOP) {
+            struct io_uring_sqe* sqe = uring_get_sqe(&bridge->ring);
+            if (!sqe) {
+                return -1;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = tag;
+        }
+        return 0;
+    }
+
+    struct epoll_event event = { 0 };
+    event.events = events;
+    event.data.u64 = tag;
+    if (epoll_ctl(bridge->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Failed to watch descriptor %d. Error: %d", fd, errno);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Turns reading of one device on or off, leaving reports queued in the
+ * driver meanwhile.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device, which must be open.
+ * @param reading Whether to read it.
+ */
+static void set_device_reading(linux_bridge* bridge, linux_hid_device* device, bool reading) {
+    struct epoll_event event = { 0 };
+    if (device->reading == reading) {
+        return;
+    }
+    if (bridge->engine == LINUX_IO_URING) {
+        device->reading = reading;  // arm_reads stops rearming; reads already in flight still complete
+        return;
+    }
+    event.events = reading ? EPOLLIN : 0;
+    event.data.u64 = EVENT_TAG(EVENT_DEVICE, 0, device->index);
+    bridge->io_syscalls++;
+    if (epoll_ctl(bridge->epoll_fd, EPOLL_CTL_MOD, device->fd, &event) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Failed to %s reading device %u. Error: %d", reading ? "resume" : "pause", device->index, errno);
+        return;
+    }
+    device->reading = reading;
+}
+
+/**
+ * Pauses or resumes reading every open device. While a request is held back
+ * because its upstream is full, nothing more is read, so a busy upstream
+ * pushes back on the devices.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param reading Whether to read the devices.
+ */
+static void set_reading(linux_bridge* bridge, bool reading) {
+    bridge->reading = reading;
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        if (bridge->devices[i].fd >= 0) {
+            set_device_reading(bridge, &bridge->devices[i], reading);
+        }
+    }
+}
+
+/**
+ * Starts using a freshly opened device: sizes its frames, adds it to the
+ * event loop and delivers what was held for it.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param fd The open descriptor.
+ * @param report_size Report size its descriptor declares.
+ * @return 0 on success, -1 if it could not be watched (the descriptor is closed).
+ */
+static int attach_device(linux_bridge* bridge, linux_hid_device* device, int fd, size_t report_size) {
+    device->frame_size = device_frame_size(bridge, device, report_size);
+    device->reading = bridge->reading;
+    device->failed = false;
+    if (watch(bridge, fd, bridge->reading ? EPOLLIN : 0, EVENT_TAG(EVENT_DEVICE, 0, device->index)) < 0) {
+        close(fd);
+        return -1;
+    }
+    // io_uring honours O_NONBLOCK by failing a read with nothing pending; blocking, it waits for the report
+    if (bridge->engine == LINUX_IO_URING) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    device->fd = fd;
+    flush_held_responses(bridge, device);
+    return 0;
+}
+
+/**
+ * Closes a device that stopped answering and schedules its reacquisition.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ */
+static void lose_device(linux_bridge* bridge, linux_hid_device* device) {
+    uint64_t now = monotonic_time_us();
+    WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Device %u lost, waiting for it at %s", device->index, device->path);
+
+    if (bridge->engine == LINUX_IO_URING) {
+        // Cancel its reads while the descriptor still names it; their late completions are ignored by generation
+        struct io_uring_sqe* sqe = uring_get_sqe(&bridge->ring);
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = device->fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = EVENT_TAG(EVENT_CANCEL, 0, 0);
+            uring_submit_and_wait(&bridge->ring, 0, 0);
+        }
+        device->generation++;
+        for (; device->ready_count > 0; device->ready_count--) {
+            uring_pool_put(&bridge->pool, device->ready[device->ready_start]);
+            device->ready_start = (device->ready_start + 1) % bridge->read_slots;
+        }
+        while (device->writes.count > 0) {
+            uring_pool_put(&bridge->pool, uring_write_queue_pop(&device->writes));
+        }
+        hold_pending_responses(bridge, device);
+    }
+    close(device->fd);  // Also removes it from the event loop
+    device->fd = -1;
+    fragment_assembler_reset(&device->fragments);
+    device->lost_us = now;
+    device->next_reacquire_us = now + (uint64_t)bridge->reacquire_interval_ms * 1000;
+    device->next_enumerate_us = now + (uint64_t)bridge->enumerate_interval_ms * 1000;
+}
+
+/**
+ * Whether another device already owns a path, so reacquisition never grabs
+ * a sibling keypad.
+ *
+ * @param path The path.
+ * @param context The linux_hid_device looking for its device.
+ * @return true if the path belongs to another device.
+ */
+static bool path_in_use(const char* path, void* context) {
+    linux_hid_device* self = (linux_hid_device*)context;
+    linux_bridge* bridge = self->bridge;
+    bool in_use = false;
+
+    for (size_t i = 0; i < bridge->device_count && !in_use; i++) {
+        linux_hid_device* device = &bridge->devices[i];
+        in_use = device != self && device->path && strcmp(device->path, path) == 0;
+    }
+    return in_use;
+}
+
+/**
+ * Tries to reopen the lost devices whose retry is due: the cached path every
+ * reacquire interval, and a full enumeration every enumerate interval in case
+ * a device came back under a different node.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param now_us Current monotonic time in microseconds.
+ */
+static void reacquire_devices(linux_bridge* bridge, uint64_t now_us) {
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        linux_hid_device* device = &bridge->devices[i];
+        if (device->fd >= 0 || now_us < device->next_reacquire_us) {
+            continue;
+        }
+
+        char* new_path = NULL;
+        size_t report_size = 0;
+        int fd = hidraw_open_path(device->path, &report_size);
+        if (fd < 0 && now_us >= device->next_enumerate_us) {
+            fd = hidraw_open_first_matching(device->filter, path_in_use, device, &new_path, &report_size);
+            device->next_enumerate_us = now_us + (uint64_t)bridge->enumerate_interval_ms * 1000;
+        }
+        device->next_reacquire_us = now_us + (uint64_t)bridge->reacquire_interval_ms * 1000;
+        if (fd < 0) {
+            continue;
+        }
+
+        if (new_path) {
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - Device %u moved to %s", device->index, new_path);
+            free(device->path);
+            device->path = new_path;
+        }
+        if (attach_device(bridge, device, fd, report_size) < 0) {
+            continue;
+        }
+        device->reacquisitions++;
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - Device %u reacquired after %llu ms",
+            device->index, (unsigned long long)((now_us - device->lost_us) / 1000));
+    }
+}
+
+/**
+ * Adds a fragment read from a device to the request it is reassembling.
+ *
+ * @param device Pointer to the device.
+ * @param frame The fragment just read; receives the whole request once its last fragment is in.
+ * @param read_ns When the fragment was read.
+ * @return true if the request is complete.
+ */
+static bool collect_fragment(linux_hid_device* device, bridge_frame* frame, uint64_t read_ns) {
+    uint8_t index, count, length;
+    extract_fragment_info(frame->data, &index, &count, &length);
+    if (index == 0) {
+        device->message_read_ns = read_ns;
+    }
+
+    fragment_status status = fragment_assembler_add(&device->fragments, frame->data, frame->size);
+    if (status == FRAGMENT_REJECTED) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Fragment %u of %u from device %u out of order, request discarded", index, count, device->index);
+    }
+    if (status != FRAGMENT_COMPLETE) {
+        return false;
+    }
+
+    frame->payload = fragment_assembler_take(&device->fragments, frame->data);
+    frame->timing.hid_read_ns = device->message_read_ns;
+    return true;
+}
+
+/**
+ * Confirms a request to its device and routes it upstream, or answers it
+ * from the cache. A request whose upstream has no room yet is held back and
+ * reading pauses until it is placed.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device it came from.
+ * @param request The request; its payload is taken over.
+ */
+static void handle_request(linux_bridge* bridge, linux_hid_device* device, bridge_frame* request) {
+    unsigned char confirm_message[MESSAGE_MAX_SIZE_BYTES] = { 0 };
+    uint16_t request_id = ++device->next_request_id;
+
+    encode_confirmation(confirm_message, request_id, 0x01);
+    capture_frame(CAPTURE_HID_TO_TCP, device->index, request_id, request->data, request->size);
+    // Critical, so no response queued later can overtake the confirmation of its own request
+    write_frame(bridge, device, confirm_message, MESSAGE_SIZE_BYTES, PRIORITY_CRITICAL);
+    capture_frame(CAPTURE_CONFIRM_TO_HID, device->index, request_id, confirm_message, device->frame_size);
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, request->data, request->size);
+
+    request->request_id = request_id;
+    request->priority = (uint8_t)priority_of_request(bridge->priorities, request->data);
+    request->timing.enqueued_ns = monotonic_time_ns();
+    if (upstream_answer_from_cache(&bridge->router, request)) {
+        return;
+    }
+
+    if (!upstream_place_request(&bridge->router, request)) {
+        bridge->router.pending = *request;
+        bridge->router.has_pending = true;
+        set_reading(bridge, false);
+    }
+}
+
+/**
+ * Takes the next report a device has pending: read directly with the epoll
+ * engine, taken from the completed reads with the io_uring engine.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @param buffer Buffer receiving the report, the device's frame size long.
+ * @return The number of bytes read, 0 if no report is pending, or -1 if the device failed.
+ */
+static int next_report(linux_bridge* bridge, linux_hid_device* device, unsigned char* buffer) {
+    if (bridge->engine == LINUX_IO_URING) {
+        if (device->failed) {
+            return -1;
+        }
+        if (device->ready_count == 0) {
+            return 0;
+        }
+        uint32_t slot = device->ready[device->ready_start];
+        int bytes_read = bridge->slot_length[slot];
+        memcpy(buffer, uring_pool_buffer(&bridge->pool, slot), (size_t)bytes_read);
+        uring_pool_put(&bridge->pool, slot);
+        device->ready_start = (device->ready_start + 1) % bridge->read_slots;
+        device->ready_count--;
+        return bytes_read;
+    }
+
+    bridge->io_syscalls++;
+    int bytes_read = hidraw_read(device->fd, buffer, device->frame_size);
+    if (bytes_read < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Failed to read from device %u. Error: %d", device->index, errno);
+    }
+    return bytes_read;
+}
+
+/**
+ * Handles every report a device has pending, until it has none left or a
+ * request is held back. A failed read loses the device.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param device Pointer to the device.
+ * @return 0 on success, -1 on failure.
+ */
+static int service_device(linux_bridge* bridge, linux_hid_device* device) {
+    bridge_frame request;
+    request.device_index = device->index;
+    request.payload = NULL;
+
+    while (device->fd >= 0 && !bridge->router.has_pending) {
+        int bytes_read = next_report(bridge, device, request.data);
+        if (bytes_read < 0) {
+            lose_device(bridge, device);
+            return 0;
+        }
+        if (bytes_read == 0) {
+            return 0;
+        }
+
+        device->frames_read++;
+        bridge->io_frames++;
+        memset(&request.timing, 0, sizeof(request.timing));
+        request.timing.hid_read_ns = monotonic_time_ns();
+        request.size = device->frame_size;
+        resize_message(request.data, (size_t)bytes_read, request.size);  // A short report reads as zero-padded
+        if (message_is_fragment(request.data) && !collect_fragment(device, &request, request.timing.hid_read_ns)) {
+            continue;
+        }
+        handle_request(bridge, device, &request);
+        request.payload = NULL;  // Handed over with the request
+    }
+    return 0;
+}
+
+/**
+ * Starts connecting to every upstream whose next attempt is due, and gives up
+ * on attempts that ran past their connect timeout. Sockets are watched
+ * edge-triggered: writability completes the connection and afterwards means
+ * a full socket buffer has drained.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param now_us Current monotonic time in microseconds.
+ */
+static void connect_upstreams(linux_bridge* bridge, uint64_t now_us) {
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        tcp_pipeline* upstream = &bridge->router.upstreams[i];
+        upstream_attempt* attempt = &bridge->attempts[i];
+
+        if (attempt->socket != INVALID_SOCKET && now_us >= attempt->deadline_us) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Connecting to upstream %zu (%s:%u) timed out.", i, upstream->server->ip, upstream->server->port);
+            cleanup_client(attempt->socket);
+            attempt->socket = INVALID_SOCKET;
+            upstream_connect_failed(upstream);
+        }
+        if (upstream->connected || attempt->socket != INVALID_SOCKET || now_us < upstream->next_attempt_us) {
+            continue;
+        }
+
+        bool connected = false;
+        SOCKET socket = begin_client_connect(upstream->server, &connected);
+        if (socket != INVALID_SOCKET &&
+            watch(bridge, socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, EVENT_TAG(EVENT_UPSTREAM, 0, i)) < 0) {
+            cleanup_client(socket);
+            socket = INVALID_SOCKET;
+        }
+        if (socket == INVALID_SOCKET) {
+            upstream_connect_failed(upstream);
+        }
+        else if (connected) {
+            upstream_connected(&bridge->router, upstream, socket);
+        }
+        else {
+            attempt->socket = socket;
+            attempt->deadline_us = upstream->server->connect_timeout_ms
+                ? now_us + (uint64_t)upstream->server->connect_timeout_ms * 1000 : UINT64_MAX;
+        }
+    }
+}
+
+/**
+ * Handles an event on an upstream socket: completes a pending connection,
+ * drains what the server sent, resumes a blocked flush and drops the
+ * connection if it failed.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param index Index of the upstream.
+ * @param events The EPOLL* flags reported.
+ */
+static void service_upstream(linux_bridge* bridge, size_t index, uint32_t events) {
+    tcp_pipeline* upstream = &bridge->router.upstreams[index];
+    upstream_attempt* attempt = &bridge->attempts[index];
+
+    if (attempt->socket != INVALID_SOCKET) {
+        if (finish_client_connect(attempt->socket, upstream->server) < 0) {
+            cleanup_client(attempt->socket);
+            attempt->socket = INVALID_SOCKET;
+            upstream_connect_failed(upstream);
+            return;
+        }
+        upstream_connected(&bridge->router, upstream, attempt->socket);
+        attempt->socket = INVALID_SOCKET;
+        events |= EPOLLIN;  // Data may have come with the connection; its edge is already spent
+    }
+    if (!upstream->connected) {
+        return;  // Dropped earlier in this batch of events
+    }
+
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && upstream_receive(upstream) < 0) {
+        upstream_drop_connection(&bridge->router, upstream);
+        return;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Upstream %zu closed the connection.", index);
+        upstream_drop_connection(&bridge->router, upstream);
+        return;
+    }
+
+    // Room in the socket buffer again; resume the pending flush
+    if (events & EPOLLOUT) {
+        upstream->write_blocked = false;
+    }
+}
+
+/**
+ * Milliseconds until the event loop has something to do without being
+ * woken: an upstream timeout, flush or reconnect, a connect timeout, a
+ * device reacquisition or reports already read by the io_uring engine.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param now_us Current monotonic time in microseconds.
+ * @param report_us When the next latency report is due, UINT64_MAX for never.
+ * @return The wait timeout, -1 if nothing is scheduled.
+ */
+static int next_timeout_ms(const linux_bridge* bridge, uint64_t now_us, uint64_t report_us) {
+    uint64_t deadline = report_us;
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        const linux_hid_device* device = &bridge->devices[i];
+        if (device->fd < 0 && device->next_reacquire_us < deadline) {
+            deadline = device->next_reacquire_us;
+        }
+        // Completed reads left over while reading was paused, or a failure to act on
+        if (device->fd >= 0 && (device->failed || (device->ready_count > 0 && !bridge->router.has_pending))) {
+            deadline = now_us;
+        }
+    }
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        if (bridge->attempts[i].socket != INVALID_SOCKET && bridge->attempts[i].deadline_us < deadline) {
+            deadline = bridge->attempts[i].deadline_us;
+        }
+    }
+
+    uint32_t timeout = deadline == UINT64_MAX ? INFINITE
+        : deadline <= now_us ? 0 : (uint32_t)((deadline - now_us + 999) / 1000);
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        const tcp_pipeline* upstream = &bridge->router.upstreams[i];
+        if (bridge->attempts[i].socket != INVALID_SOCKET) {
+            continue;  // Waiting for the connection, not for a retry
+        }
+        uint32_t upstream_timeout = upstream_next_timeout_ms(upstream);
+        if (upstream_timeout < timeout) {
+            timeout = upstream_timeout;
+        }
+    }
+    return timeout == INFINITE ? -1 : (int)timeout;
+}
+
+/**
+ * System calls made on the data path: the loop's waits, reads and writes (or
+ * io_uring calls) plus every upstream's receive and send calls.
+ *
+ * @param bridge Pointer to the bridge.
+ * @return The number of system calls.
+ */
+static uint64_t io_syscall_count(const linux_bridge* bridge) {
+    uint64_t calls = bridge->io_syscalls + bridge->ring.enter_calls;
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        calls += bridge->router.upstreams[i].reader.recv_calls + bridge->router.upstreams[i].send_queue.send_calls;
+    }
+    return calls;
+}
+
+/**
+ * Logs how many system calls the engine needed per frame so far.
+ *
+ * @param bridge Pointer to the bridge.
+ */
+static void report_io(const linux_bridge* bridge) {
+    uint64_t calls = io_syscall_count(bridge);
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - %s engine: %llu system call(s) for %llu frame(s), %.2f per frame",
+        bridge->engine == LINUX_IO_URING ? "io_uring" : "epoll", (unsigned long long)calls, (unsigned long long)bridge->io_frames,
+        bridge->io_frames ? (double)calls / (double)bridge->io_frames : 0.0);
+}
+
+/**
+ * Metrics source for the HID side: per-device counters, labelled by device
+ * index, and the I/O engine's system calls per frame.
+ *
+ * @param page The page to append to.
+ * @param context Pointer to the linux_bridge.
+ */
+static void write_device_metrics(metrics_page* page, void* context) {
+    static const metrics_field fields[] = {
+        METRICS_FIELD(linux_hid_device, frames_read, "rawhid_hid_frames_read_total", "counter", "Reports read from the device"),
+        METRICS_FIELD(linux_hid_device, frames_written, "rawhid_hid_frames_written_total", "counter", "Responses written to the device"),
+        METRICS_FIELD(linux_hid_device, held_count, "rawhid_hid_held_responses", "gauge", "Responses held while the device is lost"),
+        METRICS_FIELD(linux_hid_device, held_dropped, "rawhid_hid_held_dropped_total", "counter", "Held responses dropped because the hold queue was full"),
+        METRICS_FIELD(linux_hid_device, reacquisitions, "rawhid_hid_reacquisitions_total", "counter", "Times the device was found again after being lost"),
+        METRICS_FIELD(linux_hid_device, frame_size, "rawhid_hid_frame_size_bytes", "gauge", "Bytes per frame exchanged with the device"),
+        METRICS_FIELD(linux_hid_device, fragments.reassembled, "rawhid_hid_reassembled_requests_total", "counter", "Fragmented requests reassembled from the device"),
+        METRICS_FIELD(linux_hid_device, fragments.discarded, "rawhid_hid_fragments_discarded_total", "counter", "Fragmented requests from the device dropped incomplete or out of order"),
+    };
+    linux_bridge* bridge = (linux_bridge*)context;
+    metrics_write_fields(page, fields, sizeof(fields) / sizeof(fields[0]), "device",
+        bridge->devices, sizeof(linux_hid_device), bridge->device_count);
+
+    metrics_printf(page, "# HELP rawhid_hid_queued_writes Reports queued for writing to the device by the io_uring engine, by class\n# TYPE rawhid_hid_queued_writes gauge\n");
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        for (int c = 0; c < PRIORITY_CLASS_COUNT; c++) {
+            metrics_printf(page, "rawhid_hid_queued_writes{device=\"%zu\",class=\"%s\"} %u\n", i, priority_class_names[c], bridge->devices[i].writes.queued[c]);
+        }
+    }
+
+    uint64_t calls = io_syscall_count(bridge);
+    metrics_write_value(page, "rawhid_io_uring_engine", "gauge", "1 if the io_uring engine is in use, 0 for epoll", bridge->engine == LINUX_IO_URING);
+    metrics_write_value(page, "rawhid_io_syscalls_total", "counter", "System calls made to read, write and wait for devices and upstreams", calls);
+    metrics_write_value(page, "rawhid_io_frames_total", "counter", "Reports read from and written to the devices", bridge->io_frames);
+    metrics_printf(page, "# HELP rawhid_io_syscalls_per_frame System calls per device report since start\n# TYPE rawhid_io_syscalls_per_frame gauge\nrawhid_io_syscalls_per_frame %.4f\n",
+        bridge->io_frames ? (double)calls / (double)bridge->io_frames : 0.0);
+}
+
+/**
+ * Opens the devices, waiting for the first one to be plugged in, and sets
+ * up their state.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param config The bridge configuration.
+ * @param stop_fd Descriptor that becomes readable once the bridge should stop.
+ * @return 1 on success, 0 if asked to stop first, -1 on failure.
+ */
+static int open_devices(linux_bridge* bridge, const linux_bridge_config* config, int stop_fd) {
+    hidraw_device* opened = (hidraw_device*)calloc(config->max_devices, sizeof(hidraw_device));
+    bridge->devices = (linux_hid_device*)calloc(config->max_devices, sizeof(linux_hid_device));
+    if (!opened || !bridge->devices) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Linux Bridge - Failed to allocate device table.");
+        free(opened);
+        return -1;
+    }
+
+    size_t count;
+    while ((count = hidraw_open_matching(config->device_filters, config->device_filter_count,
+        config->open_all_devices, opened, config->max_devices)) == 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - No device found, retrying in %u ms.", config->enumerate_interval_ms);
+        if (platform_wait_socket(stop_fd, false, config->enumerate_interval_ms) != 0) {
+            free(opened);
+            return 0;
+        }
+    }
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - %zu device(s) opened successfully.", count);
+
+    int ok = 1;
+    for (size_t i = 0; i < count; i++) {
+        linux_hid_device* device = &bridge->devices[i];
+        device->bridge = bridge;
+        device->index = (uint8_t)i;
+        device->fd = -1;
+        device->path = opened[i].path;
+        device->filter = &config->device_filters[opened[i].filter_index];
+        bridge->device_count++;
+        if (!ok) {
+            close(opened[i].fd);
+            continue;
+        }
+
+        device->held = bridge->held_capacity ? (bridge_frame*)calloc(bridge->held_capacity, sizeof(bridge_frame)) : NULL;
+        device->writing = NO_PENDING_RESPONSE;
+        if (bridge->engine == LINUX_IO_URING) {
+            device->ready = (uint32_t*)calloc(bridge->read_slots, sizeof(uint32_t));
+            device->pending = (pending_response*)calloc(bridge->write_slots + 1, sizeof(pending_response));
+        }
+        if ((bridge->held_capacity && !device->held) || (bridge->engine == LINUX_IO_URING &&
+            (!device->ready || !device->pending || !uring_write_queue_init(&device->writes, bridge->write_slots)))) {
+            close(opened[i].fd);
+            ok = 0;
+        }
+        else if (attach_device(bridge, device, opened[i].fd, opened[i].report_size) < 0) {
+            ok = 0;
+        }
+        if (!ok) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Failed to set up device %zu.", i);
+            continue;
+        }
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - Device %zu uses %u-byte frames.", i, device->frame_size);
+    }
+    free(opened);
+    return ok ? 1 : -1;
+}
+
+/**
+ * Sets up the io_uring engine: the ring and a registered pool with room for
+ * every device's reads and writes.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param config The bridge configuration.
+ * @return true if the engine is ready, false to fall back to epoll.
+ */
+static bool start_uring(linux_bridge* bridge, const linux_bridge_config* config) {
+    bridge->read_slots = config->uring_reads_per_device ? config->uring_reads_per_device : 1;
+    bridge->write_slots = config->uring_writes_per_device ? config->uring_writes_per_device : 1;
+    uint32_t slot_count = config->max_devices * (bridge->read_slots + bridge->write_slots);
+    unsigned completion_entries = slot_count + (unsigned)config->upstream.endpoint_count * 2 + 16;
+    if (completion_entries < 2 * URING_SUBMIT_ENTRIES) {
+        completion_entries = 2 * URING_SUBMIT_ENTRIES;
+    }
+
+    if (uring_init(&bridge->ring, URING_SUBMIT_ENTRIES, completion_entries) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - io_uring unavailable (error %d), using epoll.", errno);
+        return false;
+    }
+    // Waiting with a timeout needs 5.11, multishot polls 5.13 (when resource tags came in)
+    if (!(bridge->ring.features & IORING_FEAT_EXT_ARG) || !(bridge->ring.features & IORING_FEAT_RSRC_TAGS)) {
+        WRITE_LOG(LOGLEVEL_WARN, "Linux Bridge - Kernel io_uring too old (5.13 or later needed), using epoll.");
+        uring_cleanup(&bridge->ring);
+        return false;
+    }
+    bridge->slot_device = (uint8_t*)calloc(slot_count, sizeof(uint8_t));
+    bridge->slot_length = (uint8_t*)calloc(slot_count, sizeof(uint8_t));
+    bridge->slot_response = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    if (!bridge->slot_device || !bridge->slot_length || !bridge->slot_response || !uring_pool_init(&bridge->pool, slot_count)) {
+        WRITE_LOG(LOGLEVEL_WARN, "Linux Bridge - Failed to allocate the io_uring frame pool, using epoll.");
+        uring_cleanup(&bridge->ring);
+        return false;
+    }
+    if (uring_register_pool(&bridge->ring, &bridge->pool) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Linux Bridge - Failed to register the io_uring frame pool (error %d), using epoll.", errno);
+        uring_cleanup(&bridge->ring);
+        return false;
+    }
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - io_uring engine with %u registered frame buffers, %u read(s) in flight per device.",
+        slot_count, bridge->read_slots);
+    return true;
+}
+
+/**
+ * One wait of the epoll engine: waits for readiness and services what is ready.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param timeout_ms Longest wait, -1 for no limit.
+ * @return 0 to keep running, 1 once a stop is requested, -1 on failure.
+ */
+static int epoll_pass(linux_bridge* bridge, int timeout_ms) {
+    struct epoll_event events[BRIDGE_MAX_EVENTS];
+    bridge->io_syscalls++;
+    int event_count = epoll_wait(bridge->epoll_fd, events, BRIDGE_MAX_EVENTS, timeout_ms);
+    if (event_count < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Wait failed. Error: %d", errno);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < event_count && ret == 0; i++) {
+        uint32_t kind = EVENT_KIND(events[i].data.u64);
+        size_t index = EVENT_INDEX(events[i].data.u64);
+        if (kind == EVENT_STOP) {
+            ret = 1;
+        }
+        else if (kind == EVENT_UPSTREAM) {
+            service_upstream(bridge, index, events[i].events);
+        }
+        else if (bridge->devices[index].fd >= 0) {
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                lose_device(bridge, &bridge->devices[index]);
+            }
+            else if (service_device(bridge, &bridge->devices[index]) < 0) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ * One wait of the io_uring engine: rearms reads and polls, submits them with
+ * every write queued since the last pass, waits, and services what completed.
+ * A burst of reports and responses costs one io_uring_enter instead of a
+ * read or write each.
+ *
+ * @param bridge Pointer to the bridge.
+ * @param timeout_ms Longest wait, -1 for no limit.
+ * @return 0 to keep running, 1 once a stop is requested, -1 on failure.
+ */
+static int uring_pass(linux_bridge* bridge, int timeout_ms) {
+    sync_upstream_polls(bridge);
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        arm_reads(bridge, &bridge->devices[i]);
+        start_writes(bridge, &bridge->devices[i]);
+    }
+    if (uring_submit_and_wait(&bridge->ring, 1, timeout_ms) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Wait failed. Error: %d", errno);
+        return -1;
+    }
+    reap_completions(bridge);
+    if (bridge->stop_requested) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < bridge->router.upstream_count; i++) {
+        uint32_t events = bridge->attempts[i].events;
+        if (events) {
+            bridge->attempts[i].events = 0;
+            service_upstream(bridge, i, events);
+        }
+    }
+    for (size_t i = 0; i < bridge->device_count; i++) {
+        linux_hid_device* device = &bridge->devices[i];
+        if (device->fd >= 0 && (device->failed || device->ready_count > 0) && service_device(bridge, device) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Runs the bridge on Linux in the calling thread: every hidraw device and
+ * every upstream socket is driven by one event loop, so a report is read,
+ * confirmed and sent upstream, and a response written back to its device,
+ * in the same wake-up it arrives, with no hand-off between threads. The loop
+ * waits with epoll or, if configured and available, io_uring.
+ * Upstream connections, routing, replay and failover behave as in the
+ * Windows TCP thread; a lost device is reacquired as by the Windows readers.
+ *
+ * @param config The bridge configuration.
+ * @param stop_fd Descriptor that becomes readable once the bridge should stop, e.g. a signalfd.
+ * @return 0 once stopped, -1 on failure.
+ */
+int run_linux_bridge(const linux_bridge_config* config, int stop_fd) {
+    WRITE_LOG(LOGLEVEL_INFO, "Linux Bridge - Starting.");
+    int ret = 0;
+    linux_bridge bridge = { 0 };
+    bridge.epoll_fd = -1;
+    bridge.ring.fd = -1;
+
+    if (!config || !config->device_filters) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Linux Bridge - Configuration or Device information is NULL.");
+        ret = -1;
+        goto cleanup;
+    }
+    if (config->max_devices == 0 || config->max_devices > 256) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Linux Bridge - Maximum device count must be 1 to 256.");
+        ret = -1;
+        goto cleanup;
+    }
+    if (!validate_priority_config(config->priorities)) {
+        ret = -1;
+        goto cleanup;
+    }
+    bridge.reacquire_interval_ms = config->reacquire_interval_ms;
+    bridge.enumerate_interval_ms = config->enumerate_interval_ms;
+    bridge.held_capacity = config->held_responses;
+    bridge.configured_frame_size = config->frame_size;
+    bridge.priorities = config->priorities;
+    bridge.reading = true;
+
+    bridge.engine = config->io_engine == LINUX_IO_URING && start_uring(&bridge, config) ? LINUX_IO_URING : LINUX_IO_EPOLL;
+    if (bridge.engine == LINUX_IO_EPOLL) {
+        bridge.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    if ((bridge.engine == LINUX_IO_EPOLL && bridge.epoll_fd < 0) || watch(&bridge, stop_fd, EPOLLIN, EVENT_TAG(EVENT_STOP, 0, 0)) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Linux Bridge - Failed to set up the event loop. Error: %d", errno);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (!upstream_router_init(&bridge.router, &config->upstream, deliver_to_device, &bridge)) {
+        ret = -1;
+        goto cleanup;
+    }
+    bridge.attempts = (upstream_attempt*)calloc(bridge.router.upstream_count, sizeof(upstream_attempt));
+    if (!bridge.attempts) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Linux Bridge - Failed to allocate upstream state.");
+        ret = -1;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < bridge.router.upstream_count; i++) {
+        bridge.attempts[i].socket = INVALID_SOCKET;
+        bridge.attempts[i].polled = INVALID_SOCKET;
+    }
+
+    int opened = open_devices(&bridge, config, stop_fd);
+    if (opened <= 0) {
+        ret = opened;
+        goto cleanup;
+    }
+    metrics_register(write_device_metrics, &bridge);
+    srand((unsigned)monotonic_time_us() ^ (unsigned)getpid());
+
+    uint64_t report_interval_us = (uint64_t)config->latency_report_interval_ms * 1000;
+    uint64_t next_report_us = report_interval_us ? monotonic_time_us() + report_interval_us : UINT64_MAX;
+
+    WRITE_LOG(LOGLEVEL_INFO, "Linux Bridge - Entering event loop.");
+    while (true) {
+        uint64_t now = monotonic_time_us();
+        if (bridge.engine == LINUX_IO_URING) {
+            sync_upstream_polls(&bridge);  // Remove the polls of sockets closed since the last pass before any descriptor is reused
+        }
+        connect_upstreams(&bridge, now);
+        reacquire_devices(&bridge, now);
+
+        // Replayed and failed-over requests go first, then the one held back from the devices
+        upstream_send_retained(&bridge.router);
+        if (bridge.router.has_pending) {
+            if (upstream_place_request(&bridge.router, &bridge.router.pending)) {
+                bridge.router.has_pending = false;
+                set_reading(&bridge, true);
+            }
+        }
+
+        // Coalesce everything queued at this wake-up into one send per upstream, subject to the batching delay
+        now = monotonic_time_us();
+        upstream_flush(&bridge.router, now);
+        if (now >= next_report_us) {
+            latency_report(true);
+            report_io(&bridge);
+            next_report_us = now + report_interval_us;
+        }
+
+        int timeout = next_timeout_ms(&bridge, now, next_report_us);
+        int result = bridge.engine == LINUX_IO_URING ? uring_pass(&bridge, timeout) : epoll_pass(&bridge, timeout);
+        if (result != 0) {
+            ret = result < 0 ? -1 : 0;
+            break;
+        }
+    }
+    WRITE_LOG(LOGLEVEL_INFO, "Linux Bridge - Stop requested.");
+
+cleanup:
+    metrics_unregister(write_device_metrics, &bridge);
+    WRITE_LOG(LOGLEVEL_INFO, "Linux Bridge - Starting cleanup process.");
+    for (size_t i = 0; bridge.attempts && i < bridge.router.upstream_count; i++) {
+        if (bridge.attempts[i].socket != INVALID_SOCKET) {
+            cleanup_client(bridge.attempts[i].socket);
+        }
+    }
+    if (bridge.device_count > 0) {
+        report_io(&bridge);
+    }
+    free(bridge.attempts);
+    upstream_router_cleanup(&bridge.router);
+    for (size_t i = 0; i < bridge.device_count; i++) {
+        linux_hid_device* device = &bridge.devices[i];
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Linux Bridge - Device %zu: %u reacquisition(s), %llu held response(s) dropped",
+            i, device->reacquisitions, (unsigned long long)device->held_dropped);
+        if (device->fd >= 0) {
+            close(device->fd);
+        }
+        for (uint32_t h = 0; h < device->held_count; h++) {
+            message_payload_free(device->held[(device->held_start + h) % bridge.held_capacity].payload);
+        }
+        for (uint32_t w = 0; device->pending && w <= bridge.write_slots; w++) {
+            if (device->pending[w].in_use) {
+                message_payload_free(device->pending[w].frame.payload);
+            }
+        }
+        fragment_assembler_reset(&device->fragments);
+        free(device->path);
+        free(device->held);
+        free(device->ready);
+        free(device->pending);
+        uring_write_queue_cleanup(&device->writes);
+    }
+    free(bridge.devices);
+    if (bridge.epoll_fd >= 0) {
+        close(bridge.epoll_fd);
+    }
+    uring_cleanup(&bridge.ring);  // Cancels what is still in flight before the pool goes
+    uring_pool_cleanup(&bridge.pool);
+    free(bridge.slot_device);
+    free(bridge.slot_length);
+    free(bridge.slot_response);
+    WRITE_LOG(LOGLEVEL_INFO, "Linux Bridge - Stopped.");
+    return ret;
+}
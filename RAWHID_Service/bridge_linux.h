@@ -0,0 +1,42 @@
+#ifndef BRIDGE_LINUX_H
+#define BRIDGE_LINUX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "platform.h"
+#include "hidraw_linux.h"
+#include "uring_linux.h"
+#include "upstream_pipeline.h"
+#include "priority_lanes.h"
+#include "frame_capture.h"
+#include "latency_stats.h"
+#include "metrics.h"
+#include "logger.h"
+
+// How the Linux bridge does its device and socket I/O.
+typedef enum {
+    LINUX_IO_EPOLL,           // Readiness through epoll, one read()/write() per report
+    LINUX_IO_URING            // Batched io_uring reads and writes on registered frame buffers; falls back to epoll if unavailable
+} linux_io_engine;
+
+// Settings of the Linux bridge: the HID side as in hid_thread_config, plus the upstream side.
+typedef struct {
+    const hid_usage_info* device_filters;  // VID/PID/usage tuples to bridge
+    size_t device_filter_count;
+    bool open_all_devices;    // Bridge every matching interface, not just the first
+    uint32_t max_devices;     // At most 256, as frames carry an 8-bit device index
+    uint32_t reacquire_interval_ms;  // How often a lost device's cached path is retried
+    uint32_t enumerate_interval_ms;  // How often a lost device is searched for by enumeration
+    uint32_t held_responses;  // Responses kept per device while it is disconnected
+    uint8_t frame_size;       // Bytes per frame for every device, 0 to use each device's report size
+    upstream_config upstream; // Endpoints, routing and pipeline settings
+    const priority_config* priorities;  // How requests are classed, NULL for all normal
+    uint32_t latency_report_interval_ms;  // Log latency percentiles this often, 0 to leave it to the caller
+    linux_io_engine io_engine;
+    uint32_t uring_reads_per_device;   // Reads kept in flight per device by the io_uring engine
+    uint32_t uring_writes_per_device;  // Writes queued or in flight per device before the engine waits for them
+} linux_bridge_config;
+
+int run_linux_bridge(const linux_bridge_config* config, int stop_fd);
+
+#endif // BRIDGE_LINUX_H
@@ -6,9 +6,177 @@
 #define TARGET_USAGE_PAGE 0xfacc
 #define TARGET_USAGE 0x41
 
+// HID interfaces to bridge, as { vendor, product, usage page, usage } tuples.
+// With HID_OPEN_ALL_DEVICES every matching interface is opened (up to
+// HID_MAX_DEVICES, at most 64) and gets its own device index; all of them share
+// the one server connection. Otherwise only the first match is bridged.
+#define HID_DEVICE_FILTERS { { VENDOR_ID, PRODUCT_ID, TARGET_USAGE_PAGE, TARGET_USAGE } }
+#define HID_OPEN_ALL_DEVICES 1
+#define HID_MAX_DEVICES 32
+
+// Frame size on the HID side. 0 gives each device frames of the report size
+// its descriptor declares (32 up to 64 bytes, so a full-speed device can use
+// all 64 bytes of a report); otherwise every device uses this size.
+#define HID_FRAME_SIZE_BYTES 0
+
+// Device reacquisition after an unplug or hub reset. A lost device's cached
+// path is retried every HID_REACQUIRE_INTERVAL_MS, and every
+// HID_ENUMERATE_INTERVAL_MS it is also searched for by enumeration in case it
+// came back under another path. Up to HID_HELD_RESPONSES responses per device
+// are kept meanwhile and delivered once it is back.
+#define HID_REACQUIRE_INTERVAL_MS 100
+#define HID_ENUMERATE_INTERVAL_MS 1000
+#define HID_HELD_RESPONSES 64
+
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 4000
 
+// Frame size on the server connections (32 up to 64 bytes). Frames from a
+// device with bigger frames are cut to this size, which only drops reserved
+// bytes; smaller ones are zero-padded.
+#define TCP_FRAME_SIZE_BYTES 32
+
+// Connection recovery. A lost connection is retried at once and then with
+// jittered exponential backoff from TCP_RECONNECT_MIN_MS up to
+// TCP_RECONNECT_MAX_MS; each attempt gives up after TCP_CONNECT_TIMEOUT_MS.
+// Meanwhile up to TCP_RETAIN_FRAMES requests (including those that were in
+// flight) are kept and replayed in order once connected; beyond that the
+// oldest are dropped. Replayed requests may reach the server twice.
+#define TCP_CONNECT_TIMEOUT_MS 1000
+#define TCP_RECONNECT_MIN_MS 50
+#define TCP_RECONNECT_MAX_MS 2000
+#define TCP_RETAIN_FRAMES 4096
+
+// Several settings below are URI range tables: arrays of rules whose first
+// member is the first URI the rule covers, sorted by it and the first starting
+// at 0; each rule covers the URIs up to the next rule's start.
+
+// Upstream servers and how requests are spread across them. An endpoint is
+// { IP, port, connect timeout, frame size }. Each request goes to a shard
+// picked by its 64-bit URI: UPSTREAM_SHARD_BY_HASH hashes the URI over the
+// shards, UPSTREAM_SHARD_BY_RANGE picks the last shard whose start URI is <=
+// the request's (the shards form a URI range table). A shard is
+// { range start, { endpoint indices, preferred first }, endpoint count }; its
+// requests go to the first endpoint that is connected, so later endpoints act
+// as replicas. An endpoint is treated as down while disconnected or after
+// UPSTREAM_UNHEALTHY_TIMEOUTS consecutive request timeouts (0 = only on
+// disconnect). TCP_RETAIN_FRAMES applies per endpoint.
+#define UPSTREAM_ENDPOINTS { { SERVER_IP, SERVER_PORT, TCP_CONNECT_TIMEOUT_MS, TCP_FRAME_SIZE_BYTES } }
+#define UPSTREAM_SHARDS { { 0, { 0 }, 1 } }
+#define UPSTREAM_SHARD_MODE UPSTREAM_SHARD_BY_HASH
+#define UPSTREAM_UNHEALTHY_TIMEOUTS 3
+
+// Request coalescing. A request for a URI that is already in flight is not
+// sent again; it waits on the outstanding request and gets a copy of its
+// response under its own request ID. Up to TCP_COALESCE_WAITERS duplicates can
+// wait per upstream (0 sends every request). Off by default: a duplicate never
+// reaches the server, which is only safe when no URI has side effects (a key
+// press sent twice must be sent twice).
+#define TCP_COALESCE_WAITERS 0
+
+// Response cache. With RESPONSE_CACHE_ENTRIES > 0 the bridge answers a request
+// itself while the last response for its URI is fresh, without a round trip.
+// RESPONSE_CACHE_TTLS is a URI range table of { first URI, TTL in ms } rules;
+// a TTL of 0 leaves a range uncached. When full the least recently used entry
+// is evicted (about 44 bytes each). The server can drop entries at any time
+// with an invalidation message.
+#define RESPONSE_CACHE_ENTRIES 0
+#define RESPONSE_CACHE_TTLS { { 0, 1000 } }
+
+// Server push. The bridge reads every upstream whenever data arrives, so the
+// server can send a push message (flags 0x11) at any time; with this enabled it
+// is written to the device it names, or to every device, without the device
+// asking or polling. Disabled, pushes are discarded and counted, for devices
+// that don't understand them.
+#define TCP_SERVER_PUSH_ENABLED 0
+
+// Event loop tuning: how long (in microseconds) a thread keeps polling for work
+// before it blocks on its events. 0 blocks immediately (lowest idle CPU), a few
+// tens of microseconds trades one busy core for lower wake-up latency under load.
+#define BRIDGE_SPIN_BUDGET_US 0
+
+// Frames each direction can queue between the HID and TCP threads (rounded up
+// to a power of two) and what happens when a ring is full: FRAME_RING_DROP_NEWEST,
+// FRAME_RING_OVERWRITE_OLDEST or FRAME_RING_BACKPRESSURE.
+#define SHARED_RING_DEPTH 256
+#define SHARED_RING_POLICY FRAME_RING_BACKPRESSURE
+
+// Priority lanes. PRIORITY_RULES is a URI range table of { first URI, class }
+// rules. Each class (PRIORITY_CRITICAL, PRIORITY_NORMAL, PRIORITY_BULK) has its
+// own rings between the threads, and on Linux with io_uring its own place in a
+// device's write queue, so a burst of bulk traffic doesn't delay a critical key. The
+// fragments of a response keep its class there and are never split up. Critical
+// requests are also sent upstream without waiting out TCP_SEND_BATCH_DELAY_US.
+// PRIORITY_STRICT always serves the highest class waiting; PRIORITY_WEIGHTED
+// serves each class in turn for up to PRIORITY_WEIGHTS frames (critical,
+// normal, bulk), so bulk is never starved.
+#define PRIORITY_RULES { { 0, PRIORITY_NORMAL } }
+#define PRIORITY_POLICY PRIORITY_STRICT
+#define PRIORITY_WEIGHTS { 8, 4, 1 }
+
+// I/O engine of the Linux build: LINUX_IO_EPOLL makes one read()/write() per
+// report, LINUX_IO_URING keeps LINUX_URING_READS_PER_DEVICE reads in flight per
+// device on registered frame buffers and submits writes in batches, so a burst
+// costs a few io_uring_enter calls. Falls back to epoll on kernels without
+// io_uring (5.13 or later) or where it is disabled.
+#define LINUX_IO_ENGINE LINUX_IO_EPOLL
+#define LINUX_URING_READS_PER_DEVICE 8
+#define LINUX_URING_WRITES_PER_DEVICE 64
+
+// Request pipelining. When enabled the bridge stamps its own request ID into
+// bytes 1-2 of every request (the server must echo it in the confirmation and
+// response) and keeps up to TCP_PIPELINE_WINDOW requests in flight. When
+// disabled one request is outstanding at a time per upstream, across all devices.
+// Either way a response reaches the device under the request ID the bridge
+// confirmed the request with. Requests without a
+// response after TCP_REQUEST_TIMEOUT_MS are dropped from the window (0 = never).
+// The timeout applies to pipelined mode only: lockstep answers are matched by
+// position, so a late answer to an expired request would be delivered as the
+// next one's. A lockstep request waits until it is answered or the connection drops.
+#define TCP_PIPELINE_ENABLED 0
+#define TCP_PIPELINE_WINDOW 32
+#define TCP_REQUEST_TIMEOUT_MS 2000
+
+// Outbound batching: frames queued for the server are written together with one
+// vectored send. 0 flushes as soon as the thread has drained the HID ring;
+// a few hundred microseconds yields far fewer packets when many devices are busy.
+#define TCP_SEND_BATCH_DELAY_US 0
+
+// Per-request latency. Each request is timestamped as it is read, handed to
+// the TCP thread, sent, confirmed, answered and written back to the device,
+// and every stage goes into a lock-free log-linear histogram. Percentiles are
+// logged every LATENCY_REPORT_INTERVAL_MS for that interval (0 = only at the
+// end) and for the whole run at shutdown.
+#define LATENCY_STATS_ENABLED 1
+#define LATENCY_REPORT_INTERVAL_MS 60000
+
+// Metrics endpoint. Counters and latency percentiles are served in the
+// Prometheus text format to any HTTP GET on 127.0.0.1:METRICS_PORT (0 = off)
+// and, if METRICS_UNIX_SOCKET names a path, on that AF_UNIX socket too.
+// A thread of its own serves it on Windows and Linux alike; scraping only
+// reads the counters and never blocks the bridge.
+#define METRICS_PORT 9464
+#define METRICS_UNIX_SOCKET NULL
+
+// Logging runs on a background writer thread. When its queue is full a log call
+// either waits for room (LOG_QUEUE_BLOCK) or discards the line and counts it
+// (LOG_QUEUE_DROP).
+#define LOG_QUEUE_POLICY LOG_QUEUE_BLOCK
+
+// Binary traffic capture: every frame is copied with a small header into a
+// preallocated, memory-mapped file that wraps after FRAME_CAPTURE_RECORDS
+// frames (88 bytes each). Far cheaper than DEBUG hex dumps, so it can stay on
+// in production; render it with the CaptureDecode tool.
+#define FRAME_CAPTURE_ENABLED 1
+#define FRAME_CAPTURE_RECORDS (1024 * 1024)
+#ifdef _WIN32
+#define FRAME_CAPTURE_FILE "C:\\Users\\avons\\Code\\Anatomic\\RAWHID_Service\\logs\\RAWHID_Service.cap"
+
 #define LOG_FILE "C:\\Users\\avons\\Code\\Anatomic\\RAWHID_Service\\logs\\RAWHID_Service.log"
+#else
+#define FRAME_CAPTURE_FILE "/var/log/rawhid_service/RAWHID_Service.cap"
+
+#define LOG_FILE "/var/log/rawhid_service/RAWHID_Service.log"
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "frame_capture.h"
+#include "platform.h"
+#include <string.h>
+
+/**
+ * Internal state of the capture file. Set up once by open_frame_capture before
+ * the worker threads start and torn down by close_frame_capture after they exit.
+ */
+static platform_mapped_file captureFile;
+static capture_file_header* captureHeader = NULL;
+static capture_record* captureRecords = NULL;
+static uint32_t captureCapacity = 0;
+
+/**
+ * Creates (or truncates) the capture file, preallocates room for capacity
+ * records and maps it into memory.
+ *
+ * @param path Path of the capture file.
+ * @param capacity Number of records to keep before the capture wraps.
+ * @return 1 if the capture is running, 0 otherwise.
+ */
+int open_frame_capture(const char* path, uint32_t capacity) {
+    if (!path || capacity == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Frame Capture - Invalid arguments");
+        return 0;
+    }
+
+    uint64_t file_size = sizeof(capture_file_header) + (uint64_t)capacity * sizeof(capture_record);
+
+    captureHeader = (capture_file_header*)platform_map_file(path, file_size, &captureFile);
+    if (!captureHeader) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Frame Capture - Failed to create and map %s. Error: %d", path, platform_last_error());
+        return 0;
+    }
+
+    memset(captureHeader, 0, sizeof(capture_file_header));
+    strncpy(captureHeader->magic, CAPTURE_MAGIC, sizeof(captureHeader->magic));
+    captureHeader->version = CAPTURE_VERSION;
+    captureHeader->header_size = sizeof(capture_file_header);
+    captureHeader->record_size = sizeof(capture_record);
+    captureHeader->frame_size = MESSAGE_MAX_SIZE_BYTES;
+    captureHeader->capacity = capacity;
+    captureHeader->record_count = 0;
+    captureHeader->start_time_us = monotonic_time_us();
+
+    captureCapacity = capacity;
+    captureRecords = (capture_record*)(captureHeader + 1);
+
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Frame Capture - Capturing up to %lu frames to %s", (unsigned long)capacity, path);
+    return 1;
+}
+
+/**
+ * Records one frame. Safe to call from any thread; does nothing if no capture
+ * is running.
+ *
+ * @param direction Which way the frame was travelling.
+ * @param device_index Which HID device the frame belongs to.
+ * @param request_id HID-side request ID the frame belongs to.
+ * @param frame The frame as it appeared on the wire.
+ * @param size Its size in bytes; anything past MESSAGE_MAX_SIZE_BYTES is cut off.
+ */
+void capture_frame(capture_direction direction, uint8_t device_index, uint16_t request_id, const uint8_t* frame, size_t size) {
+    if (!captureRecords) {
+        return;
+    }
+
+    LONG64 number = InterlockedIncrement64((volatile LONG64*)&captureHeader->record_count) - 1;
+    capture_record* record = &captureRecords[(uint64_t)number % captureCapacity];
+
+    record->timestamp_us = monotonic_time_us();
+    record->direction = (uint8_t)direction;
+    record->device_index = device_index;
+    record->request_id = request_id;
+    if (size > MESSAGE_MAX_SIZE_BYTES) {
+        size = MESSAGE_MAX_SIZE_BYTES;
+    }
+    record->frame_length = (uint8_t)size;
+    memcpy(record->frame, frame, size);
+    memset(record->frame + size, 0, MESSAGE_MAX_SIZE_BYTES - size);  // The slot may hold an older, longer frame
+
+    // Publishing the sequence last marks the record complete for the decoder
+    WriteRelease((volatile LONG*)&record->sequence, (LONG)(number + 1));
+}
+
+/**
+ * Flushes the capture to disk and releases the mapping.
+ */
+void close_frame_capture(void) {
+    if (captureHeader) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Frame Capture - %lld frames captured", (long long)captureHeader->record_count);
+        platform_unmap_file(&captureFile);
+        captureHeader = NULL;
+        captureRecords = NULL;
+        captureCapacity = 0;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include "message_protocol.h"
+
+/**
+ * Binary Frame Capture Format
+ *
+ * A capture file is preallocated to hold a fixed number of records and is
+ * written through a memory mapping, so recording a frame is a copy into
+ * mapped memory rather than a formatted log line. Once full the capture wraps
+ * and overwrites its oldest records. All fields are little-endian.
+ *
+ *  - capture_file_header  (64 bytes, at offset 0)
+ *  - capture_record[capacity]  (88 bytes each, immediately after the header)
+ *
+ * record_count counts every record ever claimed; the newest record lives in
+ * slot (record_count - 1) % capacity. A record whose sequence is not its
+ * record number + 1 was still being written when the capture was closed (or
+ * the process died) and should be skipped.
+ *
+ * Version 1 captures hold 48-byte capture_record_v1 records with the first
+ * MESSAGE_SIZE_BYTES of every frame; version 2 keeps frames of up to
+ * MESSAGE_MAX_SIZE_BYTES and their length.
+ */
+
+#define CAPTURE_MAGIC "RHIDCAP"
+#define CAPTURE_VERSION 2
+
+// Which way a captured frame was travelling.
+typedef enum {
+    CAPTURE_HID_TO_TCP = 1,   // Request read from the device
+    CAPTURE_TCP_TO_HID,       // Response received from the server
+    CAPTURE_CONFIRM_TO_HID,   // Confirmation the bridge sent to the device
+    CAPTURE_CONFIRM_FROM_TCP, // Confirmation received from the server
+    CAPTURE_CACHE_TO_HID,     // Response answered from the response cache
+    CAPTURE_CONTROL_FROM_TCP, // Unsolicited message from the server, e.g. an invalidation
+    CAPTURE_PUSH_TO_HID       // Push from the server forwarded to the device (every device if it targets all)
+} capture_direction;
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];             // CAPTURE_MAGIC, NUL terminated
+    uint32_t version;          // CAPTURE_VERSION
+    uint32_t header_size;      // sizeof(capture_file_header)
+    uint32_t record_size;      // sizeof(capture_record)
+    uint32_t frame_size;       // Largest frame a record holds: MESSAGE_MAX_SIZE_BYTES (MESSAGE_SIZE_BYTES in version 1)
+    uint32_t capacity;         // Records the file holds before wrapping
+    uint32_t reserved;
+    volatile int64_t record_count;  // Records claimed so far
+    uint64_t start_time_us;    // monotonic_time_us() when the capture was opened
+    uint8_t padding[16];
+} capture_file_header;
+
+typedef struct {
+    uint64_t timestamp_us;     // monotonic_time_us() when the frame was captured
+    uint32_t sequence;         // Low 32 bits of the record number + 1, written last
+    uint8_t direction;         // capture_direction
+    uint8_t device_index;      // Which HID device the frame belongs to
+    uint16_t request_id;       // HID-side request ID the frame belongs to
+    uint8_t frame_length;      // Bytes of frame in use, the size of the frame on its link
+    uint8_t reserved[7];
+    uint8_t frame[MESSAGE_MAX_SIZE_BYTES];  // Zero past frame_length
+} capture_record;
+
+// Record layout of version 1 captures, read by the decoder.
+typedef struct {
+    uint64_t timestamp_us;
+    uint32_t sequence;
+    uint8_t direction;
+    uint8_t device_index;
+    uint16_t request_id;
+    uint8_t frame[MESSAGE_SIZE_BYTES];
+} capture_record_v1;
+#pragma pack(pop)
+
+int open_frame_capture(const char* path, uint32_t capacity);
+void capture_frame(capture_direction direction, uint8_t device_index, uint16_t request_id, const uint8_t* frame, size_t size);
+void close_frame_capture(void);
+
+#endif // FRAME_CAPTURE_H
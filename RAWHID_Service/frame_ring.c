@@ -0,0 +1,184 @@
+#include "frame_ring.h"
+
+/**
+ * Rounds a requested depth up to the next power of two so indices can be
+ * masked instead of divided.
+ *
+ * @param depth The requested number of slots.
+ * @return The slot count actually used.
+ */
+static ULONG round_up_pow2(uint32_t depth) {
+    ULONG capacity = 1;
+    while (capacity < depth) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/**
+ * Initializes a ring with room for at least depth frames.
+ *
+ * @param ring Pointer to the ring to initialize.
+ * @param depth Requested number of slots (rounded up to a power of two).
+ * @param policy What to do when a push finds the ring full.
+ * @return 1 if initialization is successful, 0 otherwise.
+ */
+int frame_ring_init(frame_ring* ring, uint32_t depth, frame_ring_policy policy) {
+    if (!ring || depth == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Frame Ring - Invalid arguments");
+        return 0;
+    }
+
+    ULONG capacity = round_up_pow2(depth);
+    ring->frames = (bridge_frame*)_aligned_malloc(capacity * sizeof(bridge_frame), CACHE_LINE_SIZE);
+    if (!ring->frames) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Frame Ring - Failed to allocate %lu slots", capacity);
+        return 0;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->consumer_waiting = 0;
+    ring->pushed = 0;
+    ring->popped = 0;
+    ring->dropped = 0;
+    ring->overwritten = 0;
+    ring->high_watermark = 0;
+    ring->mask = capacity - 1;
+    ring->policy = policy;
+    return 1;
+}
+
+/**
+ * Number of frames currently queued. Exact from either owning thread,
+ * a snapshot from anywhere else.
+ *
+ * @param ring Pointer to the ring.
+ * @return The number of queued frames.
+ */
+uint32_t frame_ring_depth(const frame_ring* ring) {
+    return (ULONG)ReadAcquire(&ring->head) - (ULONG)ReadAcquire(&ring->tail);
+}
+
+/**
+ * Queues a frame. Producer side only.
+ *
+ * @param ring Pointer to the ring.
+ * @param frame Pointer to the frame to copy in.
+ * @return 1 if the frame was queued, 0 if it was dropped.
+ */
+int frame_ring_push(frame_ring* ring, const bridge_frame* frame) {
+    ULONG head = (ULONG)ring->head;
+    ULONG capacity = ring->mask + 1;
+
+    while (head - (ULONG)ReadAcquire(&ring->tail) >= capacity) {
+        if (ring->policy == FRAME_RING_DROP_NEWEST) {
+            ring->dropped++;
+            return 0;
+        }
+        if (ring->policy == FRAME_RING_OVERWRITE_OLDEST) {
+            // Claim the oldest slot; if the consumer got there first the ring has room anyway
+            LONG tail = ReadAcquire(&ring->tail);
+            if (head - (ULONG)tail >= capacity &&
+                InterlockedCompareExchange(&ring->tail, tail + 1, tail) == tail) {
+                // The consumer's own compare-exchange on this slot now fails, so the payload is ours to drop
+                message_payload_free(ring->frames[(ULONG)tail & ring->mask].payload);
+                ring->overwritten++;
+            }
+            continue;
+        }
+        SwitchToThread();  // FRAME_RING_BACKPRESSURE
+    }
+
+    ring->frames[head & ring->mask] = *frame;
+    WriteRelease(&ring->head, (LONG)(head + 1));
+    ring->pushed++;
+
+    LONG depth = (LONG)(head + 1 - (ULONG)ReadAcquire(&ring->tail));
+    if (depth > ring->high_watermark) {
+        ring->high_watermark = depth;
+    }
+    return 1;
+}
+
+/**
+ * Dequeues the oldest frame. Consumer side only.
+ *
+ * @param ring Pointer to the ring.
+ * @param frame Frame receiving the copy.
+ * @return TRUE if a frame was copied out, FALSE if the ring was empty.
+ */
+BOOL frame_ring_pop(frame_ring* ring, bridge_frame* frame) {
+    while (true) {
+        LONG tail = ReadAcquire(&ring->tail);
+        if (tail == ReadAcquire(&ring->head)) {
+            return FALSE;
+        }
+
+        *frame = ring->frames[(ULONG)tail & ring->mask];
+
+        if (ring->policy != FRAME_RING_OVERWRITE_OLDEST) {
+            WriteRelease(&ring->tail, tail + 1);
+            break;
+        }
+        // The producer may have overwritten this slot while we copied it; retry if so
+        if (InterlockedCompareExchange(&ring->tail, tail + 1, tail) == tail) {
+            break;
+        }
+    }
+
+    ring->popped++;
+    return TRUE;
+}
+
+/**
+ * Marks the consumer as about to block. Consumer side only.
+ *
+ * @param ring Pointer to the ring.
+ * @return TRUE if the ring is still empty and the consumer may block,
+ *         FALSE if a frame arrived in the meantime.
+ */
+BOOL frame_ring_prepare_wait(frame_ring* ring) {
+    InterlockedExchange(&ring->consumer_waiting, 1);
+    if (frame_ring_depth(ring) != 0) {
+        InterlockedExchange(&ring->consumer_waiting, 0);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Withdraws a frame_ring_prepare_wait when the consumer is not going to block
+ * after all, e.g. because another of its rings has a frame. Consumer side only.
+ *
+ * @param ring Pointer to the ring.
+ */
+void frame_ring_cancel_wait(frame_ring* ring) {
+    InterlockedExchange(&ring->consumer_waiting, 0);
+}
+
+/**
+ * Clears the waiting flag after a push. Producer side only.
+ *
+ * @param ring Pointer to the ring.
+ * @return TRUE if the consumer was blocked and must be signalled.
+ */
+BOOL frame_ring_take_waiter(frame_ring* ring) {
+    // The interlocked exchange is also the full fence between publishing head and reading the flag
+    return InterlockedCompareExchange(&ring->consumer_waiting, 0, 1) == 1;
+}
+
+/**
+ * Releases the slot storage of a ring and the payloads of frames still queued.
+ *
+ * @param ring Pointer to the ring.
+ */
+void frame_ring_destroy(frame_ring* ring) {
+    if (ring && ring->frames) {
+        for (ULONG i = (ULONG)ring->tail; i != (ULONG)ring->head; i++) {
+            message_payload_free(ring->frames[i & ring->mask].payload);
+        }
+        _aligned_free(ring->frames);
+        ring->frames = NULL;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include "message_protocol.h"
+#include "message_fragments.h"
+#include "latency_stats.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "platform.h"
+
+#define CACHE_LINE_SIZE 64
+
+// One protocol frame as it travels between the HID and TCP threads.
+typedef struct {
+    unsigned char data[MESSAGE_MAX_SIZE_BYTES];
+    uint8_t size;         // Bytes of data in use: the frame size of the link it came from
+    uint16_t request_id;  // ID the HID side confirmed this frame with (HID -> TCP only)
+    uint8_t device_index; // HID device the frame came from or is addressed to
+    uint8_t priority;     // priority_class of the request the frame is or answers
+    message_payload* payload;  // Whole payload of a fragmented message (data holds its first fragment), else NULL
+    request_timing timing;  // Timestamps of the request this frame is or answers
+} bridge_frame;
+
+// What the producer does when the ring is full.
+typedef enum {
+    FRAME_RING_DROP_NEWEST,      // Reject the incoming frame and count it as dropped
+    FRAME_RING_OVERWRITE_OLDEST, // Discard the oldest queued frame to make room
+    FRAME_RING_BACKPRESSURE      // Yield until the consumer frees a slot
+} frame_ring_policy;
+
+/**
+ * Bounded single-producer/single-consumer ring of frames.
+ *
+ * head is only written by the producer and tail only by the consumer (except
+ * under FRAME_RING_OVERWRITE_OLDEST, where the producer may advance tail with
+ * a compare-exchange). Each index lives on its own cache line so the two
+ * threads never false-share. Counters are written by one side only and may be
+ * read from anywhere. A frame's payload belongs to the ring while it is
+ * queued, and to the consumer once popped.
+ */
+typedef struct {
+    PLATFORM_CACHE_ALIGNED(CACHE_LINE_SIZE) volatile LONG head;
+    volatile LONG64 pushed;
+    volatile LONG64 dropped;
+    volatile LONG64 overwritten;
+    volatile LONG high_watermark;
+
+    PLATFORM_CACHE_ALIGNED(CACHE_LINE_SIZE) volatile LONG tail;
+    volatile LONG consumer_waiting;  // Set by the consumer before it blocks
+    volatile LONG64 popped;
+
+    PLATFORM_CACHE_ALIGNED(CACHE_LINE_SIZE) bridge_frame* frames;
+    ULONG mask;
+    frame_ring_policy policy;
+} frame_ring;
+
+int frame_ring_init(frame_ring* ring, uint32_t depth, frame_ring_policy policy);
+int frame_ring_push(frame_ring* ring, const bridge_frame* frame);
+BOOL frame_ring_pop(frame_ring* ring, bridge_frame* frame);
+uint32_t frame_ring_depth(const frame_ring* ring);
+BOOL frame_ring_prepare_wait(frame_ring* ring);
+void frame_ring_cancel_wait(frame_ring* ring);
+BOOL frame_ring_take_waiter(frame_ring* ring);
+void frame_ring_destroy(frame_ring* ring);
+
+#endif // FRAME_RING_H
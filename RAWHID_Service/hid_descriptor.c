@@ -0,0 +1,189 @@
+#include "hid_descriptor.h"
+#include "logger.h"
+#include <string.h>
+
+// Item prefixes, with the size bits masked off.
+#define ITEM_INPUT 0x80
+#define ITEM_OUTPUT 0x90
+#define ITEM_FEATURE 0xB0
+#define ITEM_COLLECTION 0xA0
+#define ITEM_END_COLLECTION 0xC0
+#define ITEM_USAGE_PAGE 0x04
+#define ITEM_REPORT_SIZE 0x74
+#define ITEM_REPORT_ID 0x84
+#define ITEM_REPORT_COUNT 0x94
+#define ITEM_PUSH 0xA4
+#define ITEM_POP 0xB4
+#define ITEM_USAGE 0x08
+#define ITEM_LONG 0xFE
+
+/**
+ * Decodes the short item starting at an offset of a report descriptor.
+ *
+ * @param descriptor The report descriptor.
+ * @param length Its length in bytes.
+ * @param offset Offset of the item's prefix byte.
+ * @param value Receives the item's data, zero-extended.
+ * @return The offset of the next item.
+ */
+static size_t next_item(const unsigned char* descriptor, size_t length, size_t offset, uint32_t* value) {
+    unsigned char prefix = descriptor[offset];
+    if (prefix == ITEM_LONG) {  // Long item: data size, tag, data
+        *value = 0;
+        return offset + 3 + (offset + 1 < length ? descriptor[offset + 1] : 0);
+    }
+
+    size_t size = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    *value = 0;
+    for (size_t b = 0; b < size && offset + 1 + b < length; b++) {
+        *value |= (uint32_t)descriptor[offset + 1 + b] << (8 * b);
+    }
+    return offset + 1 + size;
+}
+
+/**
+ * Finds the largest input and output reports a report descriptor declares,
+ * by adding up Report Size x Report Count of the Input and Output items of
+ * each report ID.
+ *
+ * @param descriptor The report descriptor.
+ * @param length Its length in bytes.
+ * @param input_bytes Receives the largest input report in bytes, 0 if none.
+ * @param output_bytes Receives the largest output report in bytes, 0 if none.
+ */
+void hid_descriptor_report_sizes(const unsigned char* descriptor, size_t length, size_t* input_bytes, size_t* output_bytes) {
+    uint32_t input_bits[256] = { 0 };
+    uint32_t output_bits[256] = { 0 };
+    uint32_t globals[4][3] = { { 0 } };  // Report size, count and ID; Push/Pop stack in rows 1-3
+    size_t depth = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        unsigned char prefix = descriptor[i];
+        uint32_t value;
+        i = next_item(descriptor, length, i, &value);
+        if (prefix == ITEM_LONG) {
+            continue;
+        }
+
+        uint32_t* current = globals[depth];
+        switch (prefix & 0xFC) {
+        case ITEM_REPORT_SIZE: current[0] = value; break;
+        case ITEM_REPORT_COUNT: current[1] = value; break;
+        case ITEM_REPORT_ID: current[2] = value & 0xFF; break;
+        case ITEM_PUSH:
+            if (depth < 3) {
+                memcpy(globals[depth + 1], current, sizeof(globals[0]));
+                depth++;
+            }
+            break;
+        case ITEM_POP:
+            if (depth > 0) {
+                depth--;
+            }
+            break;
+        case ITEM_INPUT: input_bits[current[2]] += current[0] * current[1]; break;
+        case ITEM_OUTPUT: output_bits[current[2]] += current[0] * current[1]; break;
+        default: break;
+        }
+    }
+
+    *input_bytes = 0;
+    *output_bytes = 0;
+    for (size_t id = 0; id < 256; id++) {
+        size_t input = (input_bits[id] + 7) / 8;
+        size_t output = (output_bits[id] + 7) / 8;
+        *input_bytes = input > *input_bytes ? input : *input_bytes;
+        *output_bytes = output > *output_bytes ? output : *output_bytes;
+    }
+}
+
+/**
+ * Report size of a device: the smaller of its largest input and output
+ * reports, so a frame of that size can be both read from and written to it.
+ *
+ * @param descriptor The device's report descriptor.
+ * @param length Its length in bytes.
+ * @return The report size in bytes, 0 if the descriptor declares no reports.
+ */
+size_t hid_descriptor_report_size(const unsigned char* descriptor, size_t length) {
+    size_t input_bytes, output_bytes;
+
+    hid_descriptor_report_sizes(descriptor, length, &input_bytes, &output_bytes);
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "HID Descriptor - Input reports of %zu bytes, output reports of %zu bytes", input_bytes, output_bytes);
+    if (input_bytes == 0 || output_bytes == 0) {
+        return input_bytes ? input_bytes : output_bytes;
+    }
+    return input_bytes < output_bytes ? input_bytes : output_bytes;
+}
+
+/**
+ * Whether one of the top-level collections of a report descriptor has the
+ * given usage, which is how hidapi tells the interfaces of a device apart.
+ *
+ * @param descriptor The report descriptor.
+ * @param length Its length in bytes.
+ * @param usage_page The usage page wanted.
+ * @param usage The usage wanted.
+ * @return true if a top-level collection matches.
+ */
+bool hid_descriptor_has_usage(const unsigned char* descriptor, size_t length, uint16_t usage_page, uint16_t usage) {
+    uint32_t pages[4] = { 0 };  // Usage Page, with its Push/Pop stack
+    size_t page_depth = 0;
+    uint32_t local_usage = 0;
+    bool has_usage = false;
+    size_t collection_depth = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        unsigned char prefix = descriptor[i];
+        uint32_t value;
+        i = next_item(descriptor, length, i, &value);
+        if (prefix == ITEM_LONG) {
+            continue;
+        }
+
+        switch (prefix & 0xFC) {
+        case ITEM_USAGE_PAGE: pages[page_depth] = value; break;
+        case ITEM_PUSH:
+            if (page_depth < 3) {
+                pages[page_depth + 1] = pages[page_depth];
+                page_depth++;
+            }
+            break;
+        case ITEM_POP:
+            if (page_depth > 0) {
+                page_depth--;
+            }
+            break;
+        case ITEM_USAGE:
+            if (!has_usage) {  // The first usage names the collection
+                // A 4-byte usage carries its own page in the high half
+                local_usage = (prefix & 0x03) == 3 ? value : ((pages[page_depth] << 16) | (value & 0xFFFF));
+                has_usage = true;
+            }
+            break;
+        case ITEM_COLLECTION:
+            if (collection_depth == 0 && has_usage &&
+                (local_usage >> 16) == usage_page && (local_usage & 0xFFFF) == usage) {
+                return true;
+            }
+            collection_depth++;
+            has_usage = false;
+            break;
+        case ITEM_END_COLLECTION:
+            if (collection_depth > 0) {
+                collection_depth--;
+            }
+            has_usage = false;
+            break;
+        case ITEM_INPUT:
+        case ITEM_OUTPUT:
+        case ITEM_FEATURE:
+            has_usage = false;  // Main items consume the local items
+            break;
+        default: break;
+        }
+    }
+    return false;
+}
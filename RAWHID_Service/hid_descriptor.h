@@ -0,0 +1,20 @@
+#ifndef HID_DESCRIPTOR_H
+#define HID_DESCRIPTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Structure to hold information required for HID device usage.
+typedef struct {
+    uint16_t vendor_id;   // Vendor ID of the device
+    uint16_t product_id;  // Product ID of the device
+    uint16_t usage_page;  // Usage page
+    uint8_t usage;        // Usage ID
+} hid_usage_info;
+
+void hid_descriptor_report_sizes(const unsigned char* descriptor, size_t length, size_t* input_bytes, size_t* output_bytes);
+size_t hid_descriptor_report_size(const unsigned char* descriptor, size_t length);
+bool hid_descriptor_has_usage(const unsigned char* descriptor, size_t length, uint16_t usage_page, uint16_t usage);
+
+#endif // HID_DESCRIPTOR_H
@@ -0,0 +1,256 @@
+#include "hidraw_linux.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#define HIDRAW_DEVICE_DIR "/dev"
+#define HIDRAW_NAME_PREFIX "hidraw"
+
+/**
+ * Opens a hidraw node and checks it against a VID/PID/usage tuple.
+ *
+ * @param path Path of the hidraw node.
+ * @param filter The tuple to match, or NULL to accept any device.
+ * @param report_size Receives the report size its descriptor declares, 0 if unknown.
+ * @return The open descriptor, or -1 if it could not be opened or does not match.
+ */
+static int open_if_matching(const char* path, const hid_usage_info* filter, size_t* report_size) {
+    struct hidraw_devinfo info;
+    struct hidraw_report_descriptor descriptor;
+    int descriptor_size = 0;
+
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+        ioctl(fd, HIDIOCGRDESCSIZE, &descriptor_size) < 0 || descriptor_size <= 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "HIDRAW - Failed to query %s. Error: %d", path, errno);
+        close(fd);
+        return -1;
+    }
+    descriptor.size = (uint32_t)descriptor_size;
+    if (ioctl(fd, HIDIOCGRDESC, &descriptor) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "HIDRAW - Failed to read the report descriptor of %s. Error: %d", path, errno);
+        close(fd);
+        return -1;
+    }
+
+    if (filter && ((uint16_t)info.vendor != filter->vendor_id || (uint16_t)info.product != filter->product_id ||
+        !hid_descriptor_has_usage(descriptor.value, descriptor.size, filter->usage_page, filter->usage))) {
+        close(fd);
+        return -1;
+    }
+
+    *report_size = hid_descriptor_report_size(descriptor.value, descriptor.size);
+    return fd;
+}
+
+/**
+ * Lists the hidraw nodes, in name order so device indices are stable from
+ * run to run.
+ *
+ * @param names Receives the node names; release with free_node_names.
+ * @return The number of nodes, 0 if there are none or they can't be listed.
+ */
+static int list_nodes(struct dirent*** names) {
+    int count = scandir(HIDRAW_DEVICE_DIR, names, NULL, versionsort);
+    if (count < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "HIDRAW - Failed to list %s. Error: %d", HIDRAW_DEVICE_DIR, errno);
+        *names = NULL;
+        return 0;
+    }
+    return count;
+}
+
+/**
+ * Releases a listing from list_nodes.
+ *
+ * @param names The listing.
+ * @param count Number of entries in it.
+ */
+static void free_node_names(struct dirent** names, int count) {
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+/**
+ * Builds the path of a listed node, skipping entries that aren't hidraw nodes.
+ *
+ * @param entry The directory entry.
+ * @param path Buffer receiving the path.
+ * @param size Size of the buffer.
+ * @return true if the entry is a hidraw node.
+ */
+static bool node_path(const struct dirent* entry, char* path, size_t size) {
+    if (strncmp(entry->d_name, HIDRAW_NAME_PREFIX, strlen(HIDRAW_NAME_PREFIX)) != 0) {
+        return false;
+    }
+    return snprintf(path, size, "%s/%s", HIDRAW_DEVICE_DIR, entry->d_name) < (int)size;
+}
+
+/**
+ * Opens every hidraw device matching one of the given VID/PID/usage tuples.
+ *
+ * @param filters Array of hid_usage_info structs describing wanted interfaces.
+ * @param filter_count Number of entries in filters.
+ * @param open_all Open every match if true, stop after the first one otherwise.
+ * @param devices Array receiving the opened devices and their paths.
+ * @param max_devices Capacity of devices.
+ * @return The number of devices opened.
+ */
+size_t hidraw_open_matching(const hid_usage_info* filters, size_t filter_count, bool open_all, hidraw_device* devices, size_t max_devices) {
+    struct dirent** names;
+    size_t opened = 0;
+
+    if (!filters || !devices) {
+        WRITE_LOG(LOGLEVEL_ERROR, "HIDRAW - Invalid arguments");
+        return 0;
+    }
+
+    int node_count = list_nodes(&names);
+    for (size_t i = 0; i < filter_count && opened < max_devices; i++) {
+        const hid_usage_info* filter = &filters[i];
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "HIDRAW - Looking for Vendor ID: 0x%x, Product ID: 0x%x, Usage Page: 0x%x, Usage: 0x%x",
+            filter->vendor_id, filter->product_id, filter->usage_page, filter->usage);
+
+        for (int n = 0; n < node_count && opened < max_devices; n++) {
+            char path[sizeof(HIDRAW_DEVICE_DIR) + 256];
+            size_t report_size;
+            if (!node_path(names[n], path, sizeof(path))) {
+                continue;
+            }
+
+            // A node matched by an earlier filter is already open
+            bool taken = false;
+            for (size_t d = 0; d < opened && !taken; d++) {
+                taken = strcmp(devices[d].path, path) == 0;
+            }
+            int fd = taken ? -1 : open_if_matching(path, filter, &report_size);
+            if (fd < 0) {
+                continue;
+            }
+
+            devices[opened].path = strdup(path);
+            if (!devices[opened].path) {
+                close(fd);
+                continue;
+            }
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "HIDRAW - Opened device %zu at %s", opened, path);
+            devices[opened].fd = fd;
+            devices[opened].filter_index = i;
+            devices[opened].report_size = report_size;
+            opened++;
+            if (!open_all) {
+                break;
+            }
+        }
+
+        if (!open_all && opened > 0) {
+            break;
+        }
+    }
+
+    free_node_names(names, node_count);
+    return opened;
+}
+
+/**
+ * Opens the first hidraw device matching one VID/PID/usage tuple that is not
+ * rejected by skip. Used to find a device again after it came back under a
+ * different node.
+ *
+ * @param filter The tuple to match.
+ * @param skip Optional callback rejecting paths that must not be opened.
+ * @param skip_context Passed through to skip.
+ * @param opened_path Receives a copy of the opened path on success; release with free.
+ * @param report_size Receives the report size its descriptor declares, 0 if unknown.
+ * @return The open descriptor, or -1 if none could be opened.
+ */
+int hidraw_open_first_matching(const hid_usage_info* filter, hidraw_path_filter skip, void* skip_context, char** opened_path, size_t* report_size) {
+    struct dirent** names;
+    int fd = -1;
+
+    if (!filter || !opened_path) {
+        WRITE_LOG(LOGLEVEL_ERROR, "HIDRAW - Invalid arguments");
+        return -1;
+    }
+
+    int node_count = list_nodes(&names);
+    for (int n = 0; n < node_count && fd < 0; n++) {
+        char path[sizeof(HIDRAW_DEVICE_DIR) + 256];
+        if (!node_path(names[n], path, sizeof(path)) || (skip && skip(path, skip_context))) {
+            continue;
+        }
+
+        fd = open_if_matching(path, filter, report_size);
+        if (fd >= 0) {
+            *opened_path = strdup(path);
+            if (!*opened_path) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    free_node_names(names, node_count);
+    return fd;
+}
+
+/**
+ * Reopens a device at a known path, whatever it is now.
+ *
+ * @param path Path of the hidraw node.
+ * @param report_size Receives the report size its descriptor declares, 0 if unknown.
+ * @return The open descriptor, or -1 if it could not be opened.
+ */
+int hidraw_open_path(const char* path, size_t* report_size) {
+    return open_if_matching(path, NULL, report_size);
+}
+
+/**
+ * Reads one report without blocking.
+ *
+ * @param fd The device.
+ * @param buffer Buffer receiving the report.
+ * @param size Size of the buffer in bytes.
+ * @return The number of bytes read, 0 if no report is pending, or -1 if the device failed or is gone.
+ */
+int hidraw_read(int fd, unsigned char* buffer, size_t size) {
+    ssize_t bytes_read = read(fd, buffer, size);
+    if (bytes_read < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return (int)bytes_read;
+}
+
+/**
+ * Writes a message to a device as one report. hidraw sends the report
+ * before returning even on a non-blocking descriptor, so a write only fails
+ * if the device is gone.
+ *
+ * @param fd The device.
+ * @param message Pointer to the message buffer.
+ * @param size The size of the message in bytes.
+ * @return The number of bytes written, or -1 if an error occurs.
+ */
+int hidraw_write(int fd, const unsigned char* message, size_t size) {
+    ssize_t written;
+    do {
+        written = write(fd, message, size);
+    } while (written < 0 && errno == EINTR);
+
+    if (written < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "HIDRAW - Failed to write to device. Error: %d", errno);
+        return -1;
+    }
+    return (int)written;
+}
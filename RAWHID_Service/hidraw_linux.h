@@ -0,0 +1,36 @@
+#ifndef HIDRAW_LINUX_H
+#define HIDRAW_LINUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hid_descriptor.h"
+#include "logger.h"
+
+/**
+ * Raw HID devices through the Linux hidraw driver, without hidapi. Devices
+ * are found by scanning /dev/hidraw*, matched on their VID/PID and on the
+ * usage of a top-level collection of their report descriptor, and opened
+ * non-blocking so an event loop can poll them. Reads and writes are plain
+ * read()/write() calls with the same report framing hidapi uses on Linux:
+ * the first byte written is the report ID (0 for devices without report IDs).
+ */
+
+// A device opened by hidraw_open_matching, with what is needed to reopen it.
+typedef struct {
+    int fd;
+    char* path;           // Path it was opened from; owned by the caller, release with free
+    size_t filter_index;  // Which filter tuple it matched
+    size_t report_size;   // Report size its descriptor declares, 0 if unknown
+} hidraw_device;
+
+// Returns true for a device path that must not be opened (e.g. one already in use).
+typedef bool (*hidraw_path_filter)(const char* path, void* context);
+
+size_t hidraw_open_matching(const hid_usage_info* filters, size_t filter_count, bool open_all, hidraw_device* devices, size_t max_devices);
+int hidraw_open_first_matching(const hid_usage_info* filter, hidraw_path_filter skip, void* skip_context, char** opened_path, size_t* report_size);
+int hidraw_open_path(const char* path, size_t* report_size);
+int hidraw_read(int fd, unsigned char* buffer, size_t size);
+int hidraw_write(int fd, const unsigned char* message, size_t size);
+
+#endif // HIDRAW_LINUX_H
@@ -0,0 +1,343 @@
+#include "inflight_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Takes an entry out of the coalescing index and returns its waiters to the
+ * free list. Does nothing when coalescing is off.
+ *
+ * @param table Pointer to the table.
+ * @param entry The entry being released.
+ */
+static void release_coalescing(inflight_table* table, inflight_entry* entry) {
+    if (!table->uri_buckets) {
+        return;
+    }
+
+    uint32_t index = (uint32_t)(entry - table->entries);
+    uint32_t* link = &table->uri_buckets[uri_hash_bucket(entry->uri, table->uri_bucket_shift)];
+    while (*link != INFLIGHT_NIL && *link != index) {
+        link = &table->entries[*link].uri_next;
+    }
+    if (*link == index) {
+        *link = entry->uri_next;
+    }
+
+    while (entry->first_waiter != INFLIGHT_NIL) {
+        uint32_t waiter = entry->first_waiter;
+        entry->first_waiter = table->waiters[waiter].next;
+        table->waiters[waiter].next = table->free_waiter;
+        table->free_waiter = waiter;
+    }
+    entry->waiter_count = 0;
+}
+
+/**
+ * Frees an entry's slot, its waiters and its payload.
+ *
+ * @param table Pointer to the table.
+ * @param entry The entry being released.
+ */
+static void release_entry(inflight_table* table, inflight_entry* entry) {
+    release_coalescing(table, entry);
+    message_payload_free(entry->request_payload);
+    entry->request_payload = NULL;
+    entry->in_use = false;
+    table->count--;
+}
+
+/**
+ * Initializes an empty in-flight table.
+ *
+ * @param table Pointer to the table to initialize.
+ * @param window Maximum number of requests in flight (1 to 32768).
+ * @param waiter_capacity Duplicate requests that may wait on those in flight, 0 to disable coalescing.
+ * @return 1 if initialization is successful, 0 otherwise.
+ */
+int inflight_init(inflight_table* table, uint32_t window, uint32_t waiter_capacity) {
+    if (!table || window == 0 || window > 32768) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Inflight - Invalid window size");
+        return 0;
+    }
+
+    memset(table, 0, sizeof(inflight_table));
+    table->entries = (inflight_entry*)calloc(window, sizeof(inflight_entry));
+    if (!table->entries) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Inflight - Failed to allocate entries");
+        return 0;
+    }
+
+    if (waiter_capacity > 0) {
+        uint32_t bucket_count = 2;
+        uint32_t bucket_bits = 1;
+        while (bucket_count < window) {
+            bucket_count <<= 1;
+            bucket_bits++;
+        }
+
+        table->uri_buckets = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+        table->waiters = (inflight_waiter*)calloc(waiter_capacity, sizeof(inflight_waiter));
+        if (!table->uri_buckets || !table->waiters) {
+            WRITE_LOG(LOGLEVEL_ERROR, "Inflight - Failed to allocate coalescing index");
+            inflight_destroy(table);
+            return 0;
+        }
+        memset(table->uri_buckets, 0xff, bucket_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < waiter_capacity; i++) {
+            table->waiters[i].next = i + 1 < waiter_capacity ? i + 1 : INFLIGHT_NIL;
+        }
+        table->uri_bucket_shift = 64 - bucket_bits;
+        table->waiter_capacity = waiter_capacity;
+        table->free_waiter = 0;
+    }
+
+    table->window = window;
+    table->count = 0;
+    table->next_id = 1;
+    return 1;
+}
+
+/**
+ * Whether the window is exhausted.
+ *
+ * @param table Pointer to the table.
+ * @return true if no further request may be sent.
+ */
+bool inflight_full(const inflight_table* table) {
+    return table->count >= table->window;
+}
+
+/**
+ * Registers a new outstanding request and assigns its upstream ID.
+ *
+ * @param table Pointer to the table.
+ * @param hid_request_id ID the HID side confirmed the request with.
+ * @param device_index HID device the request came from.
+ * @param uri URI the request asks for.
+ * @param now_us Current monotonic time in microseconds.
+ * @param timeout_ms How long to wait for the response, 0 for no timeout.
+ * @return The new entry, or NULL if the window is full.
+ */
+inflight_entry* inflight_add(inflight_table* table, uint16_t hid_request_id, uint8_t device_index, uint64_t uri, uint64_t now_us, uint32_t timeout_ms) {
+    if (inflight_full(table)) {
+        return NULL;
+    }
+
+    // A slow request may still hold the natural slot of next_id; walk forward to a free one
+    inflight_entry* entry;
+    do {
+        if (table->next_id == 0) {
+            table->next_id = 1;  // 0 is what an unstamped frame carries; never hand it out
+        }
+        entry = &table->entries[table->next_id % table->window];
+        table->next_id++;
+    } while (entry->in_use);
+
+    entry->in_use = true;
+    entry->confirmed = false;
+    entry->upstream_id = (uint16_t)(table->next_id - 1);
+    entry->hid_request_id = hid_request_id;
+    entry->device_index = device_index;
+    entry->sent_us = now_us;
+    entry->deadline_us = timeout_ms ? now_us + (uint64_t)timeout_ms * 1000 : UINT64_MAX;
+    entry->uri = uri;
+    entry->first_waiter = INFLIGHT_NIL;
+    entry->waiter_count = 0;
+    entry->request_payload = NULL;
+    if (table->uri_buckets) {
+        uint32_t bucket = uri_hash_bucket(uri, table->uri_bucket_shift);
+        entry->uri_next = table->uri_buckets[bucket];
+        table->uri_buckets[bucket] = (uint32_t)(entry - table->entries);
+    }
+    table->count++;
+    return entry;
+}
+
+/**
+ * Looks up an outstanding request by the ID the server echoed.
+ *
+ * @param table Pointer to the table.
+ * @param upstream_id Request ID from bytes 1-2 of a server frame.
+ * @return The matching entry, or NULL if there is none.
+ */
+inflight_entry* inflight_find(inflight_table* table, uint16_t upstream_id) {
+    inflight_entry* entry = &table->entries[upstream_id % table->window];
+    if (entry->in_use && entry->upstream_id == upstream_id) {
+        return entry;
+    }
+    return NULL;
+}
+
+/**
+ * Looks up an outstanding request for a URI, so an identical request can
+ * wait on it instead of being sent. Fragmented requests carry more than their
+ * URI, so they are never identical to another.
+ *
+ * @param table Pointer to the table.
+ * @param uri The URI requested.
+ * @return The entry, or NULL if there is none or coalescing is off.
+ */
+inflight_entry* inflight_find_uri(inflight_table* table, uint64_t uri) {
+    if (!table->uri_buckets || table->count == 0) {
+        return NULL;
+    }
+    for (uint32_t index = table->uri_buckets[uri_hash_bucket(uri, table->uri_bucket_shift)]; index != INFLIGHT_NIL; index = table->entries[index].uri_next) {
+        if (table->entries[index].uri == uri && !table->entries[index].request_payload) {
+            return &table->entries[index];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Attaches a duplicate request to an outstanding one. Waiters are kept in
+ * arrival order and answered with the outstanding request's response.
+ *
+ * @param table Pointer to the table.
+ * @param entry The outstanding request.
+ * @param hid_request_id ID the HID side confirmed the duplicate with.
+ * @param device_index HID device the duplicate came from.
+ * @param hid_read_ns When the duplicate was read from the device.
+ * @return true if attached, false if every waiter is in use.
+ */
+bool inflight_attach_waiter(inflight_table* table, inflight_entry* entry, uint16_t hid_request_id, uint8_t device_index, uint64_t hid_read_ns) {
+    if (table->free_waiter == INFLIGHT_NIL) {
+        return false;
+    }
+
+    uint32_t waiter = table->free_waiter;
+    table->free_waiter = table->waiters[waiter].next;
+    table->waiters[waiter].hid_request_id = hid_request_id;
+    table->waiters[waiter].device_index = device_index;
+    table->waiters[waiter].hid_read_ns = hid_read_ns;
+    table->waiters[waiter].next = INFLIGHT_NIL;
+
+    uint32_t* link = &entry->first_waiter;
+    while (*link != INFLIGHT_NIL) {
+        link = &table->waiters[*link].next;
+    }
+    *link = waiter;
+    entry->waiter_count++;
+    table->coalesced++;
+    return true;
+}
+
+/**
+ * Returns the request that has been outstanding the longest. Used in
+ * lockstep mode, where server frames are matched by position rather than ID.
+ *
+ * @param table Pointer to the table.
+ * @return The oldest entry, or NULL if the table is empty.
+ */
+inflight_entry* inflight_oldest(inflight_table* table) {
+    inflight_entry* oldest = NULL;
+    for (uint32_t i = 0; i < table->window && table->count > 0; i++) {
+        inflight_entry* entry = &table->entries[i];
+        if (entry->in_use && (!oldest || entry->sent_us < oldest->sent_us)) {
+            oldest = entry;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * Releases an entry, and its waiters, once its response has been delivered.
+ *
+ * @param table Pointer to the table.
+ * @param entry The entry to release.
+ */
+void inflight_remove(inflight_table* table, inflight_entry* entry) {
+    if (entry && entry->in_use) {
+        release_entry(table, entry);
+        table->completed++;
+    }
+}
+
+/**
+ * Releases an entry for a request that was never sent, without counting it
+ * as completed.
+ *
+ * @param table Pointer to the table.
+ * @param entry The entry to release.
+ */
+void inflight_cancel(inflight_table* table, inflight_entry* entry) {
+    if (entry && entry->in_use) {
+        release_entry(table, entry);
+    }
+}
+
+/**
+ * Drops every request whose deadline has passed so it stops occupying the window.
+ *
+ * @param table Pointer to the table.
+ * @param now_us Current monotonic time in microseconds.
+ * @return The number of requests expired.
+ */
+uint32_t inflight_expire(inflight_table* table, uint64_t now_us) {
+    uint32_t expired = 0;
+    for (uint32_t i = 0; i < table->window && table->count > 0; i++) {
+        inflight_entry* entry = &table->entries[i];
+        if (entry->in_use && now_us >= entry->deadline_us) {
+            WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Inflight - Request %u (device %u, HID request %u, %u coalesced) timed out after %llu us",
+                entry->upstream_id, entry->device_index, entry->hid_request_id, entry->waiter_count, (unsigned long long)(now_us - entry->sent_us));
+            table->timed_out += entry->waiter_count;
+            release_entry(table, entry);
+            table->timed_out++;
+            expired++;
+        }
+    }
+    return expired;
+}
+
+/**
+ * Earliest deadline among outstanding requests.
+ *
+ * @param table Pointer to the table.
+ * @return The deadline in microseconds, or UINT64_MAX if nothing can expire.
+ */
+uint64_t inflight_next_deadline(const inflight_table* table) {
+    uint64_t next = UINT64_MAX;
+    for (uint32_t i = 0; i < table->window && table->count > 0; i++) {
+        const inflight_entry* entry = &table->entries[i];
+        if (entry->in_use && entry->deadline_us < next) {
+            next = entry->deadline_us;
+        }
+    }
+    return next;
+}
+
+/**
+ * Forgets every outstanding request and its waiters without counting them as
+ * completed. Used when the connection drops and the requests are queued for
+ * replay; payloads still left in the entries are released.
+ *
+ * @param table Pointer to the table.
+ */
+void inflight_reset(inflight_table* table) {
+    for (uint32_t i = 0; i < table->window && table->count > 0; i++) {
+        if (table->entries[i].in_use) {
+            release_entry(table, &table->entries[i]);
+        }
+    }
+}
+
+/**
+ * Frees the table storage and the payloads of requests still in flight.
+ *
+ * @param table Pointer to the table.
+ */
+void inflight_destroy(inflight_table* table) {
+    if (table && table->entries) {
+        for (uint32_t i = 0; i < table->window; i++) {
+            message_payload_free(table->entries[i].request_payload);
+        }
+        free(table->entries);
+        table->entries = NULL;
+    }
+    if (table) {
+        free(table->uri_buckets);
+        free(table->waiters);
+        table->uri_buckets = NULL;
+        table->waiters = NULL;
+    }
+}
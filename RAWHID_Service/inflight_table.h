@@ -0,0 +1,80 @@
+#ifndef INFLIGHT_TABLE_H
+#define INFLIGHT_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "message_protocol.h"
+#include "message_fragments.h"
+#include "latency_stats.h"
+#include "uri_index.h"
+#include "logger.h"
+
+#define INFLIGHT_NIL UINT32_MAX
+
+// A request coalesced onto an identical one already in flight; it is answered
+// with that request's response.
+typedef struct {
+    uint16_t hid_request_id;  // ID the HID side confirmed the duplicate with
+    uint8_t device_index;     // HID device the duplicate came from
+    uint64_t hid_read_ns;     // When the duplicate was read from the device
+    uint32_t next;            // Next waiter on the same request, or INFLIGHT_NIL
+} inflight_waiter;
+
+// One request that has been sent upstream and not yet answered.
+typedef struct {
+    bool in_use;
+    bool confirmed;           // Server confirmation seen
+    uint16_t upstream_id;     // ID stamped into bytes 1-2 on the TCP link
+    uint16_t hid_request_id;  // ID the HID side confirmed the request with
+    uint8_t device_index;     // HID device the response must be routed back to
+    uint8_t priority;         // priority_class of the request, given to its response and waiters
+    uint64_t sent_us;         // monotonic_time_us() when the request was sent
+    uint64_t deadline_us;     // Entry is expired once monotonic_time_us() passes this
+    uint32_t cache_epoch;     // Response cache epoch when sent; a newer epoch means the response may be stale
+    uint64_t uri;             // URI requested
+    uint32_t uri_next;        // Next entry in the same coalescing bucket, or INFLIGHT_NIL
+    uint32_t first_waiter;    // Requests coalesced onto this one, or INFLIGHT_NIL
+    uint32_t waiter_count;
+    unsigned char request[MESSAGE_MAX_SIZE_BYTES];  // Request as received from the HID side, kept for replay
+    uint8_t request_size;     // Bytes of request in use
+    message_payload* request_payload;  // Payload of a fragmented request, else NULL; released with the entry
+    request_timing timing;    // Timestamps so far, completed by the TCP thread
+} inflight_entry;
+
+/**
+ * Fixed-size table of outstanding requests, indexed by upstream request ID
+ * modulo the window size. When coalescing is on, entries are also indexed by
+ * URI so duplicates can wait on the request already in flight. Owned by the
+ * TCP thread only, so no locking.
+ */
+typedef struct {
+    inflight_entry* entries;
+    uint32_t window;          // Maximum requests in flight
+    uint32_t count;           // Requests currently in flight
+    uint16_t next_id;         // Next upstream ID to try
+    uint32_t* uri_buckets;    // Head entry of each URI bucket, NULL when coalescing is off
+    uint32_t uri_bucket_shift;  // 64 - log2(bucket count)
+    inflight_waiter* waiters;
+    uint32_t waiter_capacity;
+    uint32_t free_waiter;     // Unused waiters, chained through next
+    uint64_t completed;
+    uint64_t timed_out;
+    uint64_t unmatched;       // Confirmations/responses with no matching entry
+    uint64_t coalesced;       // Requests that waited on an identical one instead of being sent
+} inflight_table;
+
+int inflight_init(inflight_table* table, uint32_t window, uint32_t waiter_capacity);
+bool inflight_full(const inflight_table* table);
+inflight_entry* inflight_add(inflight_table* table, uint16_t hid_request_id, uint8_t device_index, uint64_t uri, uint64_t now_us, uint32_t timeout_ms);
+inflight_entry* inflight_find(inflight_table* table, uint16_t upstream_id);
+inflight_entry* inflight_find_uri(inflight_table* table, uint64_t uri);
+bool inflight_attach_waiter(inflight_table* table, inflight_entry* entry, uint16_t hid_request_id, uint8_t device_index, uint64_t hid_read_ns);
+inflight_entry* inflight_oldest(inflight_table* table);
+void inflight_remove(inflight_table* table, inflight_entry* entry);
+void inflight_cancel(inflight_table* table, inflight_entry* entry);
+uint32_t inflight_expire(inflight_table* table, uint64_t now_us);
+uint64_t inflight_next_deadline(const inflight_table* table);
+void inflight_reset(inflight_table* table);
+void inflight_destroy(inflight_table* table);
+
+#endif // INFLIGHT_TABLE_H
@@ -0,0 +1,310 @@
+#include "latency_stats.h"
+#include "logger.h"
+#include <stddef.h>
+#include <string.h>
+
+// Every stage, then the total of each priority class
+#define LATENCY_SERIES_COUNT (LATENCY_STAGE_COUNT + PRIORITY_CLASS_COUNT)
+
+static latency_histogram histograms[LATENCY_SERIES_COUNT];
+static volatile LONG statsEnabled = 0;
+
+// Counts as of the last interval report; only the reporting thread touches these
+static LONG64 reportedCounts[LATENCY_SERIES_COUNT][LATENCY_BUCKETS];
+
+// Which two timestamps bound each stage.
+static const struct {
+    size_t from;
+    size_t to;
+    const char* name;
+    const char* label;        // Value of the stage label on the metrics page
+} stageBounds[LATENCY_STAGE_COUNT] = {
+    { offsetof(request_timing, hid_read_ns), offsetof(request_timing, enqueued_ns), "HID read -> enqueue", "hid_to_enqueue" },
+    { offsetof(request_timing, enqueued_ns), offsetof(request_timing, sent_ns), "enqueue -> send", "enqueue_to_send" },
+    { offsetof(request_timing, sent_ns), offsetof(request_timing, confirmed_ns), "send -> confirm", "send_to_confirm" },
+    { offsetof(request_timing, confirmed_ns), offsetof(request_timing, responded_ns), "confirm -> response", "confirm_to_response" },
+    { offsetof(request_timing, sent_ns), offsetof(request_timing, responded_ns), "send -> response", "send_to_response" },
+    { offsetof(request_timing, responded_ns), offsetof(request_timing, hid_written_ns), "response -> HID write", "response_to_hid" },
+    { offsetof(request_timing, hid_read_ns), offsetof(request_timing, hid_written_ns), "total", "total" },
+};
+
+/**
+ * Bucket holding a value.
+ *
+ * @param value_ns The value in nanoseconds.
+ * @return The bucket index.
+ */
+static uint32_t bucket_index(uint64_t value_ns) {
+    if (value_ns < LATENCY_SUB_BUCKETS) {
+        return (uint32_t)value_ns;
+    }
+    unsigned long msb;
+    _BitScanReverse64(&msb, value_ns);
+    uint32_t group = msb - LATENCY_SUB_BUCKET_BITS + 1;
+    return group * LATENCY_SUB_BUCKETS + (uint32_t)((value_ns >> (group - 1)) - LATENCY_SUB_BUCKETS);
+}
+
+/**
+ * Largest value a bucket holds.
+ *
+ * @param index The bucket index.
+ * @return The value in nanoseconds.
+ */
+static uint64_t bucket_upper_bound(uint32_t index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+    uint32_t group = index / LATENCY_SUB_BUCKETS;
+    uint64_t lower = (uint64_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << (group - 1);
+    return lower + ((uint64_t)1 << (group - 1)) - 1;
+}
+
+/**
+ * Turns recording on or off. Off by default.
+ *
+ * @param enabled Whether to record.
+ */
+void latency_stats_enable(bool enabled) {
+    WriteRelease(&statsEnabled, enabled ? 1 : 0);
+}
+
+/**
+ * Records one value in a stage's histogram. Safe to call from any thread.
+ *
+ * @param stage The stage the value belongs to.
+ * @param value_ns The latency in nanoseconds.
+ */
+void latency_record(latency_stage stage, uint64_t value_ns) {
+    if (ReadNoFence(&statsEnabled)) {
+        latency_histogram_record(&histograms[stage], value_ns);
+    }
+}
+
+/**
+ * Records one value in any histogram, e.g. one kept by a test harness. Safe
+ * to call from any thread.
+ *
+ * @param histogram The histogram, zero-initialized before first use.
+ * @param value_ns The latency in nanoseconds.
+ */
+void latency_histogram_record(latency_histogram* histogram, uint64_t value_ns) {
+    InterlockedIncrement64(&histogram->counts[bucket_index(value_ns)]);
+    InterlockedIncrement64(&histogram->count);
+    InterlockedExchangeAdd64(&histogram->sum_ns, (LONG64)value_ns);
+
+    LONG64 max = ReadNoFence64(&histogram->max_ns);
+    while ((LONG64)value_ns > max) {
+        LONG64 previous = InterlockedCompareExchange64(&histogram->max_ns, (LONG64)value_ns, max);
+        if (previous == max) {
+            break;
+        }
+        max = previous;
+    }
+}
+
+/**
+ * Records every stage of a delivered request whose two timestamps are set,
+ * and its total in the histogram of its priority class.
+ *
+ * @param timing The request's timestamps.
+ * @param priority The request's priority_class.
+ */
+void latency_record_request(const request_timing* timing, uint8_t priority) {
+    if (!ReadNoFence(&statsEnabled)) {
+        return;
+    }
+    if (timing->hid_read_ns && timing->hid_written_ns >= timing->hid_read_ns && priority < PRIORITY_CLASS_COUNT) {
+        latency_histogram_record(&histograms[LATENCY_STAGE_COUNT + priority], timing->hid_written_ns - timing->hid_read_ns);
+    }
+
+    const unsigned char* base = (const unsigned char*)timing;
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        uint64_t from = *(const uint64_t*)(base + stageBounds[stage].from);
+        uint64_t to = *(const uint64_t*)(base + stageBounds[stage].to);
+        if (from && to >= from) {
+            latency_record((latency_stage)stage, to - from);
+        }
+    }
+}
+
+/**
+ * Value at a percentile of a set of bucket counts.
+ *
+ * @param counts Bucket counts.
+ * @param total Sum of counts.
+ * @param percentile The percentile, 0 to 100.
+ * @return The upper bound of the bucket the percentile falls in, in nanoseconds.
+ */
+static uint64_t value_at_percentile(const LONG64* counts, LONG64 total, double percentile) {
+    LONG64 rank = (LONG64)(percentile / 100.0 * (double)total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    LONG64 seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucket_upper_bound(i);
+        }
+    }
+    return bucket_upper_bound(LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Summarizes everything a histogram has recorded. Call from one thread at a
+ * time; recording may carry on meanwhile.
+ *
+ * @param histogram The histogram.
+ * @param summary Receives the count and percentiles.
+ */
+void latency_histogram_summarize(const latency_histogram* histogram, latency_summary* summary) {
+    static LONG64 counts[LATENCY_BUCKETS];
+    LONG64 total = 0;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = ReadNoFence64(&histogram->counts[i]);
+        total += counts[i];
+    }
+
+    memset(summary, 0, sizeof(*summary));
+    if (total == 0) {
+        return;
+    }
+    summary->count = (uint64_t)total;
+    summary->max_ns = (uint64_t)ReadNoFence64(&histogram->max_ns);
+
+    uint64_t* values[4] = { &summary->p50_ns, &summary->p90_ns, &summary->p99_ns, &summary->p999_ns };
+    static const double percentiles[4] = { 50.0, 90.0, 99.0, 99.9 };
+    for (int i = 0; i < 4; i++) {
+        uint64_t value_ns = value_at_percentile(counts, total, percentiles[i]);
+        *values[i] = value_ns < summary->max_ns ? value_ns : summary->max_ns;
+    }
+}
+
+/**
+ * Summarizes one stage for the whole run.
+ *
+ * @param stage The stage.
+ * @param summary Receives the count and percentiles.
+ */
+void latency_summarize(latency_stage stage, latency_summary* summary) {
+    latency_histogram_summarize(&histograms[stage], summary);
+}
+
+/**
+ * Summarizes the totals of one priority class for the whole run.
+ *
+ * @param priority The class.
+ * @param summary Receives the count and percentiles.
+ */
+void latency_summarize_class(priority_class priority, latency_summary* summary) {
+    latency_histogram_summarize(&histograms[LATENCY_STAGE_COUNT + priority], summary);
+}
+
+/**
+ * Logs p50/p90/p99/p99.9/max of every stage and of each priority class's
+ * totals, either for the whole run or for what was recorded since the
+ * previous interval report. Call from one thread at a time; recording may
+ * carry on meanwhile.
+ *
+ * @param since_last_report true for the interval since the last such report, false for the whole run.
+ */
+void latency_report(bool since_last_report) {
+    static LONG64 counts[LATENCY_BUCKETS];
+
+    for (int series = 0; series < LATENCY_SERIES_COUNT; series++) {
+        latency_histogram* histogram = &histograms[series];
+        LONG64 total = 0;
+        uint32_t highest = 0;
+
+        for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+            LONG64 current = ReadNoFence64(&histogram->counts[i]);
+            counts[i] = since_last_report ? current - reportedCounts[series][i] : current;
+            if (since_last_report) {
+                reportedCounts[series][i] = current;
+            }
+            if (counts[i] > 0) {
+                highest = i;
+            }
+            total += counts[i];
+        }
+        if (total == 0) {
+            continue;
+        }
+
+        // The recorded maximum is exact for the run; an interval only knows its highest bucket
+        uint64_t max_ns = bucket_upper_bound(highest);
+        uint64_t run_max_ns = (uint64_t)ReadNoFence64(&histogram->max_ns);
+        if (!since_last_report || max_ns > run_max_ns) {
+            max_ns = run_max_ns;
+        }
+
+        // A bucket's upper bound can overshoot the largest value actually seen
+        static const double percentiles[4] = { 50.0, 90.0, 99.0, 99.9 };
+        double values_us[4];
+        for (int i = 0; i < 4; i++) {
+            uint64_t value_ns = value_at_percentile(counts, total, percentiles[i]);
+            values_us[i] = (value_ns < max_ns ? value_ns : max_ns) / 1000.0;
+        }
+
+        bool by_class = series >= LATENCY_STAGE_COUNT;
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Latency - %s%s%s: %lld samples, p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us",
+            since_last_report ? "" : "Run total, ", by_class ? "total, " : "",
+            by_class ? priority_class_names[series - LATENCY_STAGE_COUNT] : stageBounds[series].name, total,
+            values_us[0], values_us[1], values_us[2], values_us[3], max_ns / 1000.0);
+    }
+}
+
+/**
+ * Writes every stage's histogram for the whole run to the metrics page as a
+ * Prometheus summary in seconds, plus its maximum. Called from the metrics
+ * thread only.
+ *
+ * @param page The page to append to.
+ */
+void latency_write_metrics(metrics_page* page) {
+    static LONG64 counts[LATENCY_BUCKETS];
+    static const char* quantiles[4] = { "0.5", "0.9", "0.99", "0.999" };
+    static const double percentiles[4] = { 50.0, 90.0, 99.0, 99.9 };
+
+    metrics_printf(page, "# HELP rawhid_latency_seconds Request latency by stage since start\n# TYPE rawhid_latency_seconds summary\n");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        latency_histogram* histogram = &histograms[stage];
+        LONG64 total = 0;
+        for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+            counts[i] = ReadNoFence64(&histogram->counts[i]);
+            total += counts[i];
+        }
+
+        uint64_t max_ns = (uint64_t)ReadNoFence64(&histogram->max_ns);
+        for (int i = 0; i < 4 && total > 0; i++) {
+            uint64_t value_ns = value_at_percentile(counts, total, percentiles[i]);
+            metrics_printf(page, "rawhid_latency_seconds{stage=\"%s\",quantile=\"%s\"} %.9f\n",
+                stageBounds[stage].label, quantiles[i], (value_ns < max_ns ? value_ns : max_ns) / 1e9);
+        }
+        metrics_printf(page, "rawhid_latency_seconds_sum{stage=\"%s\"} %.9f\nrawhid_latency_seconds_count{stage=\"%s\"} %lld\n",
+            stageBounds[stage].label, ReadNoFence64(&histogram->sum_ns) / 1e9, stageBounds[stage].label, total);
+    }
+
+    metrics_printf(page, "# HELP rawhid_class_latency_seconds Device read to device write latency by priority class since start\n# TYPE rawhid_class_latency_seconds summary\n");
+    for (int priority = 0; priority < PRIORITY_CLASS_COUNT; priority++) {
+        latency_summary summary;
+        latency_summarize_class((priority_class)priority, &summary);
+        const char* name = priority_class_names[priority];
+        if (summary.count > 0) {
+            metrics_printf(page, "rawhid_class_latency_seconds{class=\"%s\",quantile=\"0.5\"} %.9f\n", name, summary.p50_ns / 1e9);
+            metrics_printf(page, "rawhid_class_latency_seconds{class=\"%s\",quantile=\"0.9\"} %.9f\n", name, summary.p90_ns / 1e9);
+            metrics_printf(page, "rawhid_class_latency_seconds{class=\"%s\",quantile=\"0.99\"} %.9f\n", name, summary.p99_ns / 1e9);
+            metrics_printf(page, "rawhid_class_latency_seconds{class=\"%s\",quantile=\"0.999\"} %.9f\n", name, summary.p999_ns / 1e9);
+        }
+        metrics_printf(page, "rawhid_class_latency_seconds_sum{class=\"%s\"} %.9f\nrawhid_class_latency_seconds_count{class=\"%s\"} %llu\n",
+            name, ReadNoFence64(&histograms[LATENCY_STAGE_COUNT + priority].sum_ns) / 1e9, name, (unsigned long long)summary.count);
+    }
+
+    metrics_printf(page, "# HELP rawhid_latency_max_seconds Largest latency by stage since start\n# TYPE rawhid_latency_max_seconds gauge\n");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        metrics_printf(page, "rawhid_latency_max_seconds{stage=\"%s\"} %.9f\n",
+            stageBounds[stage].label, ReadNoFence64(&histograms[stage].max_ns) / 1e9);
+    }
+}
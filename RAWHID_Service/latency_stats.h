@@ -0,0 +1,75 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "platform.h"
+#include "metrics.h"
+#include "priority_lanes.h"
+
+/**
+ * Per-request latency histograms.
+ *
+ * Every request carries a request_timing through the bridge. When its
+ * response has been written to the device, each stage whose two timestamps
+ * are set is recorded into that stage's histogram. Histograms are HDR-style
+ * log-linear: values below 64 ns get a bucket each, and every power of two
+ * above that is split into 64 buckets, so a bucket is never wider than about
+ * 1.6% of its values. Recording is a few interlocked increments and never
+ * takes a lock, so it can stay on in production. The total of each request
+ * is also recorded in a histogram of its priority class.
+ */
+
+// Monotonic timestamps (monotonic_time_ns) of one request's trip; 0 where it never got.
+typedef struct {
+    uint64_t hid_read_ns;     // Request read from the device
+    uint64_t enqueued_ns;     // Handed to the TCP thread
+    uint64_t sent_ns;         // Queued on the upstream socket
+    uint64_t confirmed_ns;    // Server confirmation received
+    uint64_t responded_ns;    // Server response received (or answered by the bridge)
+    uint64_t hid_written_ns;  // Response written to the device
+} request_timing;
+
+typedef enum {
+    LATENCY_HID_TO_ENQUEUE,       // Confirming to the device and queueing for the TCP thread
+    LATENCY_ENQUEUE_TO_SEND,      // Hand-off to the TCP thread, routing and waiting for the window
+    LATENCY_SEND_TO_CONFIRM,      // Network and server until the confirmation
+    LATENCY_CONFIRM_TO_RESPONSE,  // Server until the response
+    LATENCY_SEND_TO_RESPONSE,     // Whole upstream round trip
+    LATENCY_RESPONSE_TO_HID,      // Hand-off back to the HID side and the device write
+    LATENCY_TOTAL,                // Device read to device write
+    LATENCY_STAGE_COUNT
+} latency_stage;
+
+#define LATENCY_SUB_BUCKET_BITS 6
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((65 - LATENCY_SUB_BUCKET_BITS) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    volatile LONG64 counts[LATENCY_BUCKETS];
+    volatile LONG64 count;
+    volatile LONG64 sum_ns;
+    volatile LONG64 max_ns;
+} latency_histogram;
+
+// Percentiles of a histogram for the whole time it has been recording.
+typedef struct {
+    uint64_t count;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} latency_summary;
+
+void latency_stats_enable(bool enabled);
+void latency_record(latency_stage stage, uint64_t value_ns);
+void latency_record_request(const request_timing* timing, uint8_t priority);
+void latency_report(bool since_last_report);
+void latency_summarize(latency_stage stage, latency_summary* summary);
+void latency_summarize_class(priority_class priority, latency_summary* summary);
+void latency_histogram_record(latency_histogram* histogram, uint64_t value_ns);
+void latency_histogram_summarize(const latency_histogram* histogram, latency_summary* summary);
+void latency_write_metrics(metrics_page* page);
+
+#endif // LATENCY_STATS_H
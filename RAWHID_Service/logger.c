@@ -1,26 +1,104 @@
 #include "logger.h"
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
 
 /**
- * Constants for maximum log size and general buffer size for temporary string operations.
+ * Constant for maximum log size.
  */
 #define MAX_LOG_SIZE 512
-#define BUFFER_SIZE 4096
+
+/**
+ * Producers only capture a record; the writer thread formats it. A format
+ * record carries the caller's format string plus up to LOG_MAX_ARGS
+ * arguments, with string arguments copied into the record's data area.
+ */
+#define LOG_MAX_ARGS 8
+#define LOG_SPEC_MAX_SIZE 15
+#define LOG_VALUE_MESSAGE_MAX (MAX_LOG_SIZE - 67)  // Leaves room for ": " and 64 binary digits
+#define LOG_RECORD_DATA_SIZE MAX_LOG_SIZE
+
+/**
+ * Asynchronous writer tuning: number of queued records (power of two), size of
+ * the batch buffer handed to one fwrite, and how often the file is flushed.
+ */
+#define LOG_QUEUE_DEPTH 4096
+#define LOG_WRITE_BATCH_SIZE (64 * 1024)
+#define LOG_FLUSH_INTERVAL_MS 1000
+
+// What a queued record holds, and so how the writer formats it.
+typedef enum {
+    LOG_RECORD_TEXT,         // data holds the message
+    LOG_RECORD_FORMAT,       // format and args, string arguments in data
+    LOG_RECORD_BYTES,        // data holds raw bytes, written as hex
+    LOG_RECORD_UINT64_DEC,   // data holds the message, value follows in decimal
+    LOG_RECORD_UINT64_HEX,   // data holds the message, value follows in hex
+    LOG_RECORD_UINT64_BIN    // data holds the message, value follows in binary
+} log_record_kind;
+
+// How a captured argument is passed back to snprintf.
+typedef enum {
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LONG_LONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_INTMAX,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_POINTER,
+    LOG_ARG_STRING,          // offset of the copied string in data
+    LOG_ARG_WIDE_STRING      // offset of the copied wide string in data
+} log_arg_type;
+
+typedef struct {
+    log_arg_type type;
+    union {
+        uint64_t bits;       // Integer arguments, and string offsets
+        double real;
+        const void* pointer;
+    } value;
+} log_arg;
+
+/**
+ * One queued log record. sequence implements the bounded multi-producer queue:
+ * a slot is free for the producer claiming position p when sequence == p and
+ * ready for the writer when sequence == p + 1.
+ */
+typedef struct {
+    volatile LONG sequence;
+    LogLevel level;
+    log_record_kind kind;
+    const char* format;      // LOG_RECORD_FORMAT: must outlive the logger, in practice a literal
+    uint32_t arg_count;
+    log_arg args[LOG_MAX_ARGS];
+    uint64_t value;          // LOG_RECORD_UINT64_*
+    size_t data_len;
+    union {
+        char text[LOG_RECORD_DATA_SIZE];
+        wchar_t wide[LOG_RECORD_DATA_SIZE / sizeof(wchar_t)];  // Keeps copied wide strings aligned
+    } data;
+} log_record;
 
  /**
-  * Internal variables to keep track of the log file and mutex.
+  * Internal variables to keep track of the log file and writer thread.
   * Marked as 'static' to limit their scope to this file.
   */
 static FILE* logFile = NULL;
-static HANDLE logMutex = NULL;
+static platform_thread logWriterThread = NULL;
+static platform_event logWakeEvent = NULL;  // Signalled when the writer is blocked and a record arrives
+static volatile LONG logWriterWaiting = 0;
+static volatile LONG logStopRequested = 0;
+static log_record* logQueue = NULL;
+static volatile LONG logEnqueuePos = 0;     // Claimed by producers with compare-exchange
+static LONG logDequeuePos = 0;              // Owned by the writer thread
+static volatile LONG64 logDroppedCount = 0;
+static LogQueuePolicy logQueuePolicy = LOG_QUEUE_BLOCK;
 
-// Internal variable for log level
-static LogLevel currentLogLevel = LOGLEVEL_DEBUG;
+// Log level; messages below it are discarded before they are formatted
+LogLevel currentLogLevel = LOGLEVEL_DEBUG;
 
-/**
- * Internal utility function to write to the log file.
- *
- * @param message The message string to be logged.
- */
+static log_record* claim_record(log_record* console, LONG* pos);
+static void publish_record(log_record* record, log_record* console, LONG pos);
 static void write_to_log_file(LogLevel level, const char* message);
 
 /**
@@ -33,20 +111,460 @@ void set_log_level(LogLevel level) {
 }
 
 /**
- * Initialize the logger.
+ * Set what happens to a log record when the queue is full.
+ *
+ * @param policy LOG_QUEUE_BLOCK or LOG_QUEUE_DROP.
+ */
+void set_log_queue_policy(LogQueuePolicy policy) {
+    logQueuePolicy = policy;
+}
+
+/**
+ * Number of records discarded because the queue was full.
+ *
+ * @return The dropped record count.
+ */
+uint64_t get_log_dropped_count(void) {
+    return (uint64_t)ReadNoFence64(&logDroppedCount);
+}
+
+/**
+ * Returns the textual tag of a logging level.
+ *
+ * @param level The logging level.
+ * @return The tag, e.g. "[INFO]".
+ */
+static const char* level_tag(LogLevel level) {
+    switch (level) {
+    case LOGLEVEL_DEBUG:
+        return "[DEBUG]";
+    case LOGLEVEL_INFO:
+        return "[INFO]";
+    case LOGLEVEL_WARN:
+        return "[WARN]";
+    case LOGLEVEL_ERROR:
+        return "[ERROR]";
+    }
+    return "";
+}
+
+/**
+ * Parses one conversion specification, the part of a format string after '%'.
+ * Only what the writer thread can replay with a single snprintf is accepted:
+ * no '*' widths, no %n and no long double.
+ *
+ * @param spec The specification, just past the '%'.
+ * @param type Receives how the argument is passed.
+ * @return Length of the specification including the conversion character, or 0 if it can't be deferred.
+ */
+static size_t parse_conversion(const char* spec, log_arg_type* type) {
+    size_t i = strspn(spec, "-+ #0");
+    i += strspn(spec + i, "0123456789");
+    if (spec[i] == '.') {
+        i++;
+        i += strspn(spec + i, "0123456789");
+    }
+
+    log_arg_type integer = LOG_ARG_INT;
+    bool wide = false;
+    if (spec[i] == 'h') {
+        i += spec[i + 1] == 'h' ? 2 : 1;
+    }
+    else if (spec[i] == 'l') {
+        integer = spec[i + 1] == 'l' ? LOG_ARG_LONG_LONG : LOG_ARG_LONG;
+        wide = true;
+        i += spec[i + 1] == 'l' ? 2 : 1;
+    }
+    else if (spec[i] == 'z') {
+        integer = LOG_ARG_SIZE;
+        i++;
+    }
+    else if (spec[i] == 'j') {
+        integer = LOG_ARG_INTMAX;
+        i++;
+    }
+    else if (spec[i] == 't') {
+        integer = LOG_ARG_PTRDIFF;
+        i++;
+    }
+    else if (strncmp(spec + i, "I64", 3) == 0) {
+        integer = LOG_ARG_LONG_LONG;
+        i += 3;
+    }
+
+    switch (spec[i]) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        *type = integer;
+        break;
+    case 'c':
+        *type = LOG_ARG_INT;
+        if (wide) {
+            return 0;
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        *type = LOG_ARG_DOUBLE;
+        break;
+    case 'p':
+        *type = LOG_ARG_POINTER;
+        break;
+    case 's':
+        *type = wide ? LOG_ARG_WIDE_STRING : LOG_ARG_STRING;
+        break;
+    default:
+        return 0;
+    }
+
+    // The writer copies the specification into a small buffer
+    return i + 1 < LOG_SPEC_MAX_SIZE ? i + 1 : 0;
+}
+
+/**
+ * Copies a string argument into the record's data area, truncated to what fits.
+ *
+ * @param record The record being captured.
+ * @param value The string argument, may be NULL.
+ * @return Pointer to the copy, valid as long as the record.
+ */
+static const char* copy_string_arg(log_record* record, const char* value) {
+    if (value == NULL) {
+        return "(null)";
+    }
+    size_t room = sizeof(record->data.text) - record->data_len;
+    if (room == 0) {
+        return "";
+    }
+    char* copy = record->data.text + record->data_len;
+    size_t len = strnlen(value, room - 1);
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    record->data_len += len + 1;
+    return copy;
+}
+
+/**
+ * Copies a wide string argument into the record's data area, truncated to what fits.
+ *
+ * @param record The record being captured.
+ * @param value The wide string argument, may be NULL.
+ * @return Pointer to the copy, valid as long as the record.
+ */
+static const wchar_t* copy_wide_string_arg(log_record* record, const wchar_t* value) {
+    if (value == NULL) {
+        return L"(null)";
+    }
+    size_t capacity = sizeof(record->data.wide) / sizeof(wchar_t);
+    size_t start = (record->data_len + sizeof(wchar_t) - 1) / sizeof(wchar_t);
+    if (start >= capacity) {
+        return L"";
+    }
+    wchar_t* copy = record->data.wide + start;
+    size_t len = wcsnlen(value, capacity - start - 1);
+    memcpy(copy, value, len * sizeof(wchar_t));
+    copy[len] = L'\0';
+    record->data_len = (start + len + 1) * sizeof(wchar_t);
+    return copy;
+}
+
+/**
+ * Captures a formatted log call into a record: the format pointer and the
+ * argument values, with string arguments copied. Formats the writer can't
+ * replay are formatted here instead.
+ *
+ * @param record The record being captured.
+ * @param format The format string; it must outlive the logger.
+ * @param args The format arguments.
+ */
+static void capture_format(log_record* record, const char* format, va_list args) {
+    va_list fallback;
+    va_copy(fallback, args);
+    record->kind = LOG_RECORD_FORMAT;
+    record->format = format;
+    record->arg_count = 0;
+    record->data_len = 0;
+
+    for (const char* c = format; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        if (c[1] == '%') {
+            c++;
+            continue;
+        }
+
+        log_arg_type type;
+        size_t spec_len = parse_conversion(c + 1, &type);
+        if (spec_len == 0 || record->arg_count == LOG_MAX_ARGS) {
+            record->kind = LOG_RECORD_TEXT;
+            vsnprintf(record->data.text, sizeof(record->data.text), format, fallback);
+            va_end(fallback);
+            return;
+        }
+
+        log_arg* arg = &record->args[record->arg_count++];
+        arg->type = type;
+        switch (type) {
+        case LOG_ARG_INT:
+            arg->value.bits = (uint64_t)va_arg(args, int);
+            break;
+        case LOG_ARG_LONG:
+            arg->value.bits = (uint64_t)va_arg(args, long);
+            break;
+        case LOG_ARG_LONG_LONG:
+            arg->value.bits = (uint64_t)va_arg(args, long long);
+            break;
+        case LOG_ARG_SIZE:
+            arg->value.bits = (uint64_t)va_arg(args, size_t);
+            break;
+        case LOG_ARG_INTMAX:
+            arg->value.bits = (uint64_t)va_arg(args, intmax_t);
+            break;
+        case LOG_ARG_PTRDIFF:
+            arg->value.bits = (uint64_t)va_arg(args, ptrdiff_t);
+            break;
+        case LOG_ARG_DOUBLE:
+            arg->value.real = va_arg(args, double);
+            break;
+        case LOG_ARG_POINTER:
+            arg->value.pointer = va_arg(args, void*);
+            break;
+        case LOG_ARG_STRING:
+            arg->value.pointer = copy_string_arg(record, va_arg(args, const char*));
+            break;
+        case LOG_ARG_WIDE_STRING:
+            arg->value.pointer = copy_wide_string_arg(record, va_arg(args, const wchar_t*));
+            break;
+        }
+        c += spec_len;
+    }
+    va_end(fallback);
+}
+
+/**
+ * Formats a captured format record, one conversion at a time.
+ *
+ * @param record The record.
+ * @param out Output buffer.
+ * @param out_size Size of the output buffer.
+ */
+static void replay_format(const log_record* record, char* out, size_t out_size) {
+    size_t len = 0;
+    uint32_t next_arg = 0;
+    const char* c = record->format;
+
+    while (*c != '\0' && len < out_size - 1) {
+        if (*c != '%') {
+            out[len++] = *c++;
+            continue;
+        }
+        if (c[1] == '%') {
+            out[len++] = '%';
+            c += 2;
+            continue;
+        }
+
+        // Capture accepted every specification, so this parse matches it
+        log_arg_type type;
+        size_t spec_len = parse_conversion(c + 1, &type);
+        if (spec_len == 0 || next_arg == record->arg_count) {
+            break;
+        }
+        char spec[LOG_SPEC_MAX_SIZE + 1];
+        memcpy(spec, c, spec_len + 1);
+        spec[spec_len + 1] = '\0';
+        c += spec_len + 1;
+
+        const log_arg* arg = &record->args[next_arg++];
+        char* at = out + len;
+        size_t room = out_size - len;
+        int written = 0;
+        switch (arg->type) {
+        case LOG_ARG_INT:
+            written = snprintf(at, room, spec, (int)arg->value.bits);
+            break;
+        case LOG_ARG_LONG:
+            written = snprintf(at, room, spec, (long)arg->value.bits);
+            break;
+        case LOG_ARG_LONG_LONG:
+            written = snprintf(at, room, spec, (long long)arg->value.bits);
+            break;
+        case LOG_ARG_SIZE:
+            written = snprintf(at, room, spec, (size_t)arg->value.bits);
+            break;
+        case LOG_ARG_INTMAX:
+            written = snprintf(at, room, spec, (intmax_t)arg->value.bits);
+            break;
+        case LOG_ARG_PTRDIFF:
+            written = snprintf(at, room, spec, (ptrdiff_t)arg->value.bits);
+            break;
+        case LOG_ARG_DOUBLE:
+            written = snprintf(at, room, spec, arg->value.real);
+            break;
+        case LOG_ARG_POINTER:
+        case LOG_ARG_STRING:
+        case LOG_ARG_WIDE_STRING:
+            written = snprintf(at, room, spec, arg->value.pointer);
+            break;
+        }
+        if (written > 0) {
+            len += (size_t)written < room ? (size_t)written : room - 1;
+        }
+    }
+    out[len] = '\0';
+}
+
+/**
+ * Formats a queued record into its message text. Runs on the writer thread,
+ * or on the caller's thread when the logger isn't running.
+ *
+ * @param record The record.
+ * @param out Buffer for the message, MAX_LOG_SIZE bytes.
+ * @return The message: out, or the record's own text.
+ */
+static const char* format_record(const log_record* record, char* out) {
+    switch (record->kind) {
+    case LOG_RECORD_TEXT:
+        return record->data.text;
+    case LOG_RECORD_FORMAT:
+        replay_format(record, out, MAX_LOG_SIZE);
+        break;
+    case LOG_RECORD_BYTES:
+        bytes_to_hex_string((const unsigned char*)record->data.text, record->data_len, out, MAX_LOG_SIZE);
+        break;
+    case LOG_RECORD_UINT64_DEC:
+        snprintf(out, MAX_LOG_SIZE, "%.*s: %llu", LOG_VALUE_MESSAGE_MAX, record->data.text, (unsigned long long)record->value);
+        break;
+    case LOG_RECORD_UINT64_HEX:
+        snprintf(out, MAX_LOG_SIZE, "%.*s: 0x%llx", LOG_VALUE_MESSAGE_MAX, record->data.text, (unsigned long long)record->value);
+        break;
+    case LOG_RECORD_UINT64_BIN: {
+        char binaryStr[65];
+        for (int i = 63; i >= 0; i--) {
+            binaryStr[63 - i] = (record->value & (1ULL << i)) ? '1' : '0';
+        }
+        binaryStr[64] = '\0';
+        snprintf(out, MAX_LOG_SIZE, "%.*s: %s", LOG_VALUE_MESSAGE_MAX, record->data.text, binaryStr);
+        break;
+    }
+    }
+    return out;
+}
+
+/**
+ * Writes out a formatted batch to the console and the log file.
+ *
+ * @param batch The formatted lines.
+ * @param batch_len Length of the batch in bytes.
+ */
+static void write_batch(const char* batch, size_t batch_len) {
+    fwrite(batch, 1, batch_len, stdout);
+    if (fwrite(batch, 1, batch_len, logFile) != batch_len) {
+        fprintf(stderr, "Error: Unable to write to log file.\n");
+    }
+}
+
+/**
+ * Background thread that drains the log queue. Records are formatted here,
+ * not by the threads that log them, into large batch buffers written with
+ * one fwrite per batch; the file is flushed every LOG_FLUSH_INTERVAL_MS
+ * rather than after every line.
+ *
+ * @param unused Not used.
+ */
+static void log_writer_thread(void* unused) {
+    static char batch[LOG_WRITE_BATCH_SIZE];
+    char message[MAX_LOG_SIZE];
+    ULONGLONG lastFlush = GetTickCount64();
+    (void)unused;
+
+    while (true) {
+        size_t batchLen = 0;
+
+        // Drain everything queued, one batch buffer at a time
+        while (true) {
+            log_record* record = &logQueue[logDequeuePos & (LOG_QUEUE_DEPTH - 1)];
+            if (ReadAcquire(&record->sequence) != logDequeuePos + 1) {
+                break;
+            }
+
+            const char* tag = level_tag(record->level);
+            const char* text = format_record(record, message);
+            size_t needed = strlen(tag) + strlen(text) + 2;
+            if (batchLen + needed >= sizeof(batch)) {
+                write_batch(batch, batchLen);
+                batchLen = 0;
+            }
+
+            // Records were level-checked before they were queued
+            batchLen += snprintf(batch + batchLen, sizeof(batch) - batchLen, "%s %s\n", tag, text);
+
+            // Hand the slot back to producers for the position one lap ahead
+            WriteRelease(&record->sequence, logDequeuePos + LOG_QUEUE_DEPTH);
+            logDequeuePos++;
+        }
+
+        if (batchLen > 0) {
+            write_batch(batch, batchLen);
+        }
+
+        ULONGLONG now = GetTickCount64();
+        if (now - lastFlush >= LOG_FLUSH_INTERVAL_MS) {
+            fflush(logFile);
+            fflush(stdout);
+            lastFlush = now;
+        }
+
+        if (ReadAcquire(&logStopRequested)) {
+            // Producers are done; one last pass above already drained the queue
+            if (ReadAcquire(&logQueue[logDequeuePos & (LOG_QUEUE_DEPTH - 1)].sequence) != logDequeuePos + 1) {
+                break;
+            }
+            continue;
+        }
+
+        // Sleep until a record arrives or the next flush is due
+        InterlockedExchange(&logWriterWaiting, 1);
+        if (ReadAcquire(&logQueue[logDequeuePos & (LOG_QUEUE_DEPTH - 1)].sequence) == logDequeuePos + 1) {
+            InterlockedExchange(&logWriterWaiting, 0);
+            continue;
+        }
+        platform_event_wait(logWakeEvent, LOG_FLUSH_INTERVAL_MS);
+        InterlockedExchange(&logWriterWaiting, 0);
+    }
+
+    fflush(logFile);
+    fflush(stdout);
+}
+
+/**
+ * Initialize the logger and start its writer thread.
  *
  * @param filePath The path of the file to be used for logging.
  */
 void init_logger(char* filePath) {
-    errno_t err = fopen_s(&logFile, filePath, "a");
-    if (err != 0) {
+    logFile = platform_open_log_file(filePath);
+    if (logFile == NULL) {
         perror("Error opening file");
         exit(-1);
     }
 
-    logMutex = CreateMutex(NULL, FALSE, NULL);
-    if (logMutex == NULL) {
-        fprintf(stderr, "Error: Unable to create mutex.\n");
+    logQueue = (log_record*)malloc(LOG_QUEUE_DEPTH * sizeof(log_record));
+    logWakeEvent = platform_event_create();
+    if (logQueue == NULL || logWakeEvent == NULL) {
+        fprintf(stderr, "Error: Unable to create log queue.\n");
+        fclose(logFile);
+        exit(-1);
+    }
+    for (LONG i = 0; i < LOG_QUEUE_DEPTH; i++) {
+        logQueue[i].sequence = i;
+    }
+    logEnqueuePos = 0;
+    logDequeuePos = 0;
+    logStopRequested = 0;
+
+    logWriterThread = platform_thread_start(log_writer_thread, NULL);
+    if (logWriterThread == NULL) {
+        fprintf(stderr, "Error: Unable to create log writer thread.\n");
         fclose(logFile);
         exit(-1);
     }
@@ -59,24 +577,39 @@ void init_logger(char* filePath) {
  * @param message The message string to be logged.
  */
 void write_log(LogLevel level, const char* message) {
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
+
     write_to_log_file(level, message);
 }
 
 /**
- * Writes a formatted log message with a specific logging level.
+ * Writes a formatted log message with a specific logging level. Only the
+ * arguments are captured here; the writer thread does the formatting.
  *
  * @param level The logging level.
- * @param format A format string for the log message.
+ * @param format A format string for the log message; it must outlive the logger, in practice a literal.
  * @param ... Variable arguments for the format string.
  */
 void write_log_format(LogLevel level, const char* format, ...) {
-    char buffer[BUFFER_SIZE];
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
+
+    log_record console;
+    LONG pos = 0;
+    log_record* record = claim_record(&console, &pos);
+    if (record == NULL) {
+        return;
+    }
+
     va_list args;
     va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
+    capture_format(record, format, args);
     va_end(args);
-
-    write_to_log_file(level, buffer);
+    record->level = level;
+    publish_record(record, &console, pos);
 }
 
 /**
@@ -98,16 +631,55 @@ void bytes_to_hex_string(const unsigned char* data, size_t data_len, char* out_s
 }
 
 /**
- * Logs a byte array as a hexadecimal string.
+ * Logs a byte array as a hexadecimal string. The raw bytes are queued and
+ * the writer thread converts them.
  *
  * @param level The logging level.
  * @param data The byte array to log.
  * @param data_len The length of the byte array.
  */
 void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data_len) {
-    char buffer[BUFFER_SIZE]; // Make sure BUFFER_SIZE is large enough to hold the hex string
-    bytes_to_hex_string(data, data_len, buffer, sizeof(buffer));
-    write_to_log_file(level, buffer);
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
+
+    log_record console;
+    LONG pos = 0;
+    log_record* record = claim_record(&console, &pos);
+    if (record == NULL) {
+        return;
+    }
+
+    // Bytes past what fits on one line as hex would be cut off anyway
+    record->kind = LOG_RECORD_BYTES;
+    record->data_len = data_len < (MAX_LOG_SIZE - 1) / 2 ? data_len : (MAX_LOG_SIZE - 1) / 2;
+    memcpy(record->data.text, data, record->data_len);
+    record->level = level;
+    publish_record(record, &console, pos);
+}
+
+/**
+ * Queues a message with a 64-bit value the writer thread appends to it.
+ *
+ * @param level The logging level.
+ * @param kind Which representation of the value to write.
+ * @param message A message string to prefix the value.
+ * @param value The 64-bit unsigned integer to log.
+ */
+static void write_log_uint64(LogLevel level, log_record_kind kind, const char* message, uint64_t value) {
+    log_record console;
+    LONG pos = 0;
+    log_record* record = claim_record(&console, &pos);
+    if (record == NULL) {
+        return;
+    }
+
+    record->kind = kind;
+    record->value = value;
+    record->data_len = 0;
+    copy_string_arg(record, message);
+    record->level = level;
+    publish_record(record, &console, pos);
 }
 
 /**
@@ -118,10 +690,11 @@ void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data
  * @param value The 64-bit unsigned integer to log.
  */
 void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value) {
-    char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "%s: %llu", message, value);
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
 
-    write_to_log_file(level, buffer);
+    write_log_uint64(level, LOG_RECORD_UINT64_DEC, message, value);
 }
 
 /**
@@ -132,10 +705,11 @@ void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value) {
  * @param value The 64-bit unsigned integer to log.
  */
 void write_log_uint64_hex(LogLevel level, const char* message, uint64_t value) {
-    char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "%s: 0x%llx", message, value);
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
 
-    write_to_log_file(level, buffer);
+    write_log_uint64(level, LOG_RECORD_UINT64_HEX, message, value);
 }
 
 /**
@@ -146,69 +720,121 @@ void write_log_uint64_hex(LogLevel level, const char* message, uint64_t value) {
  * @param value The 64-bit unsigned integer to log.
  */
 void write_log_uint64_bin(LogLevel level, const char* message, uint64_t value) {
-    char buffer[BUFFER_SIZE];
-    char binaryStr[65];
-
-    for (int i = 63; i >= 0; i--) {
-        binaryStr[63 - i] = (value & (1ULL << i)) ? '1' : '0';
+    if (!LOG_ENABLED(level)) {
+        return;
     }
-    binaryStr[64] = '\0';
-
-    snprintf(buffer, sizeof(buffer), "%s: %s", message, binaryStr);
 
-    write_to_log_file(level, buffer);
+    write_log_uint64(level, LOG_RECORD_UINT64_BIN, message, value);
 }
 
 /**
- * Internal utility function to write to log file.
+ * Claims a queue slot for a record. If the logger is not running the record
+ * is built in the caller's console record instead, and written straight to
+ * the console by publish_record.
  *
- * @param level The logging level.
- * @param level The logging level.
- * @param message The message string to be logged.
+ * @param console The caller's record, used when the logger is not running.
+ * @param pos Receives the claimed queue position.
+ * @return The record to fill in, or NULL if the queue is full and the record was dropped.
  */
-static void write_to_log_file(LogLevel level, const char* message) {
-    const char* levelStr = "";
-    switch (level) {
-    case LOGLEVEL_DEBUG:
-        levelStr = "[DEBUG]";
-        break;
-    case LOGLEVEL_INFO:
-        levelStr = "[INFO]";
-        break;
-    case LOGLEVEL_WARN:
-        levelStr = "[WARN]";
-        break;
-    case LOGLEVEL_ERROR:
-        levelStr = "[ERROR]";
-        break;
+static log_record* claim_record(log_record* console, LONG* pos) {
+    if (logWriterThread == NULL || ReadAcquire(&logStopRequested)) {
+        return console;
     }
 
-    // Print to console
-    printf("%s %s\n", levelStr, message);
+    // Claim a slot: a free slot for position pos carries sequence == pos
+    LONG claim = ReadNoFence(&logEnqueuePos);
+    while (true) {
+        log_record* record = &logQueue[claim & (LOG_QUEUE_DEPTH - 1)];
+        LONG diff = ReadAcquire(&record->sequence) - claim;
+        if (diff == 0) {
+            LONG claimed = InterlockedCompareExchange(&logEnqueuePos, claim + 1, claim);
+            if (claimed == claim) {
+                *pos = claim;
+                return record;
+            }
+            claim = claimed;
+        }
+        else if (diff < 0) {
+            // Queue full
+            if (logQueuePolicy == LOG_QUEUE_DROP) {
+                InterlockedIncrement64(&logDroppedCount);
+                return NULL;
+            }
+            SwitchToThread();
+            claim = ReadNoFence(&logEnqueuePos);
+        }
+        else {
+            claim = ReadNoFence(&logEnqueuePos);
+        }
+    }
+}
 
-    if (level >= currentLogLevel) {
+/**
+ * Hands a filled-in record to the writer thread, or writes the console
+ * record straight out.
+ *
+ * @param record The record from claim_record.
+ * @param console The caller's console record.
+ * @param pos The claimed queue position.
+ */
+static void publish_record(log_record* record, log_record* console, LONG pos) {
+    if (record == console) {
+        char message[MAX_LOG_SIZE];
+        printf("%s %s\n", level_tag(record->level), format_record(record, message));
         return;
     }
 
-    WaitForSingleObject(logMutex, INFINITE);
+    WriteRelease(&record->sequence, pos + 1);
+    if (InterlockedCompareExchange(&logWriterWaiting, 0, 1) == 1) {
+        platform_event_signal(logWakeEvent);
+    }
+}
 
-    // Write to the log file
-    if (fprintf(logFile, "%s %s\n", levelStr, message) < 0) {
-        fprintf(stderr, "Error: Unable to write to log file.\n");
+/**
+ * Internal utility function to queue a log line for the writer thread.
+ * Never touches the file; if the logger is not running the line goes
+ * straight to the console.
+ *
+ * @param level The logging level.
+ * @param message The message string to be logged.
+ */
+static void write_to_log_file(LogLevel level, const char* message) {
+    log_record console;
+    LONG pos = 0;
+    log_record* record = claim_record(&console, &pos);
+    if (record == NULL) {
+        return;
     }
 
-    fflush(logFile);
-    ReleaseMutex(logMutex);
+    record->kind = LOG_RECORD_TEXT;
+    record->data_len = 0;
+    copy_string_arg(record, message);
+    record->level = level;
+    publish_record(record, &console, pos);
 }
 
 /**
- * Close and clean up the logger.
+ * Close and clean up the logger. Everything queued before this call is
+ * written and flushed before the file is closed.
  */
 void close_logger() {
+    if (logWriterThread) {
+        InterlockedExchange(&logStopRequested, 1);
+        platform_event_signal(logWakeEvent);
+        platform_thread_join(logWriterThread);
+        logWriterThread = NULL;
+    }
     if (logFile) {
         fclose(logFile);
+        logFile = NULL;
+    }
+    if (logWakeEvent) {
+        platform_event_destroy(logWakeEvent);
+        logWakeEvent = NULL;
     }
-    if (logMutex) {
-        CloseHandle(logMutex);
+    if (logDroppedCount > 0) {
+        printf("[WARN] Logger - %lld records dropped because the queue was full\n", (long long)logDroppedCount);
     }
+    free(logQueue);
+    logQueue = NULL;
 }
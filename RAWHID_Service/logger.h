@@ -3,11 +3,8 @@
 
 #include <stdio.h>
 #include <stdint.h>
-#include <windows.h>
-
-// Global log file pointer and mutex for thread safety.
-extern FILE* logFile;
-extern HANDLE logMutex;
+#include <stdbool.h>
+#include "platform.h"
 
 typedef enum {
     LOGLEVEL_DEBUG = 1,
@@ -16,9 +13,50 @@ typedef enum {
     LOGLEVEL_ERROR
 } LogLevel;
 
+// What a producer does when the asynchronous log queue is full.
+typedef enum {
+    LOG_QUEUE_BLOCK,  // Yield until the writer thread frees a slot
+    LOG_QUEUE_DROP    // Discard the record and count it
+} LogQueuePolicy;
+
+/**
+ * Level checks done before any formatting. LOG_COMPILE_MIN_LEVEL is a constant,
+ * so WRITE_LOG* calls below it are removed by the compiler; calls below the
+ * runtime level set with set_log_level cost one comparison.
+ */
+#ifndef LOG_COMPILE_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_MIN_LEVEL LOGLEVEL_INFO
+#else
+#define LOG_COMPILE_MIN_LEVEL LOGLEVEL_DEBUG
+#endif
+#endif
+
+// Runtime level, read by LOG_ENABLED; change it with set_log_level.
+extern LogLevel currentLogLevel;
+
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILE_MIN_LEVEL && (level) >= currentLogLevel)
+
+#define WRITE_LOG(level, message) \
+    do { if (LOG_ENABLED(level)) write_log(level, message); } while (0)
+// The writer thread formats the record later, so the format must be a string literal.
+#define WRITE_LOG_FORMAT(level, ...) \
+    do { if (LOG_ENABLED(level)) write_log_format(level, __VA_ARGS__); } while (0)
+#define WRITE_LOG_BYTE_ARRAY(level, data, data_len) \
+    do { if (LOG_ENABLED(level)) write_log_byte_array(level, data, data_len); } while (0)
+#define WRITE_LOG_UINT64_DEC(level, message, value) \
+    do { if (LOG_ENABLED(level)) write_log_uint64_dec(level, message, value); } while (0)
+#define WRITE_LOG_UINT64_BIN(level, message, value) \
+    do { if (LOG_ENABLED(level)) write_log_uint64_bin(level, message, value); } while (0)
+#define WRITE_LOG_UINT64_HEX(level, message, value) \
+    do { if (LOG_ENABLED(level)) write_log_uint64_hex(level, message, value); } while (0)
+
 void init_logger(char* filePath);
 void set_log_level(LogLevel level);
+void set_log_queue_policy(LogQueuePolicy policy);
+uint64_t get_log_dropped_count(void);
 void write_log_format(LogLevel level, const char* format, ...);
+void bytes_to_hex_string(const unsigned char* data, size_t data_len, char* out_str, size_t out_str_size);
 void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data_len);
 void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value);
 void write_log_uint64_bin(LogLevel level, const char* message, uint64_t value);
@@ -2,61 +2,108 @@
 #include "tcp_client_thread.h"
 #include "rawhid_thread.h"
 #include "shared_thread_data.h"
+#include "frame_capture.h"
+#include "latency_stats.h"
+#include "metrics_thread.h"
 #include "logger.h"
 #include <windows.h>
 
 #define LOG_LEVEL LOGLEVEL_INFO
 
-int create_threads(HANDLE* rawhid_thread, HANDLE* client_thread, hid_usage_info* device_info, tcp_socket_info* server_info, shared_thread_data* shared_data);
+int create_threads(HANDLE* rawhid_thread, HANDLE* client_thread, hid_usage_info* device_filters, size_t device_filter_count, tcp_socket_info* endpoints, size_t endpoint_count, const upstream_routing* routing, const cache_ttl_rule* cache_ttls, size_t cache_ttl_count, shared_thread_data* shared_data);
 
 int main() {
 
     // Initialization code
     init_logger(LOG_FILE);
     set_log_level(LOG_LEVEL);
+    set_log_queue_policy(LOG_QUEUE_POLICY);
 
     // Logging application start
-    write_log(LOGLEVEL_INFO, "Main - Application started");
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Application started");
 
-    hid_usage_info device_info = {
-        .vendor_id = VENDOR_ID,
-        .product_id = PRODUCT_ID,
-        .usage_page = TARGET_USAGE_PAGE,
-        .usage = TARGET_USAGE
-    };
+    hid_usage_info device_filters[] = HID_DEVICE_FILTERS;
 
-    tcp_socket_info server_info = {
-        .ip = SERVER_IP,
-        .port = SERVER_PORT
+    tcp_socket_info endpoints[] = UPSTREAM_ENDPOINTS;
+    upstream_shard shards[] = UPSTREAM_SHARDS;
+    upstream_routing routing = {
+        .shards = shards,
+        .shard_count = sizeof(shards) / sizeof(shards[0]),
+        .mode = UPSTREAM_SHARD_MODE
+    };
+    cache_ttl_rule cache_ttls[] = RESPONSE_CACHE_TTLS;
+    priority_rule priority_rules[] = PRIORITY_RULES;
+    priority_config priorities = {
+        .rules = priority_rules,
+        .rule_count = sizeof(priority_rules) / sizeof(priority_rules[0]),
+        .policy = PRIORITY_POLICY,
+        .weights = PRIORITY_WEIGHTS
     };
 
+    // Start the binary frame capture; the bridge runs without it if the file can't be created
+    if (FRAME_CAPTURE_ENABLED && !open_frame_capture(FRAME_CAPTURE_FILE, FRAME_CAPTURE_RECORDS)) {
+        WRITE_LOG(LOGLEVEL_WARN, "Main - Frame capture disabled");
+    }
+
+    latency_stats_enable(LATENCY_STATS_ENABLED);
+
     // Initialize shared data
     shared_thread_data shared_data;
-    if (!initialize_shared_data(&shared_data)) {
-        write_log(LOGLEVEL_ERROR, "Main - Failed to initialize shared data");
+    if (!initialize_shared_data(&shared_data, SHARED_RING_DEPTH, SHARED_RING_POLICY, &priorities)) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Failed to initialize shared data");
         return 1;
     }
-    write_log(LOGLEVEL_INFO, "Main - Shared data initialized");
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Shared data initialized");
+    metrics_register(write_shared_data_metrics, &shared_data);
+
+    // Start the metrics endpoint; the bridge runs without it if it can't be started
+    platform_thread metrics_thread_handle = NULL;
+    if (METRICS_PORT || METRICS_UNIX_SOCKET) {
+        metrics_thread_config* metrics_config = (metrics_thread_config*)malloc(sizeof(metrics_thread_config));
+        if (metrics_config) {
+            metrics_config->port = METRICS_PORT;
+            metrics_config->unix_path = METRICS_UNIX_SOCKET;
+            metrics_thread_handle = platform_thread_start(metrics_thread, metrics_config);
+            if (!metrics_thread_handle) {
+                free(metrics_config);
+            }
+        }
+        if (!metrics_thread_handle) {
+            WRITE_LOG(LOGLEVEL_WARN, "Main - Metrics endpoint disabled");
+        }
+    }
 
     // Create threads
     HANDLE rawhid_thread, client_thread;
-    if (!create_threads(&rawhid_thread, &client_thread, &device_info, &server_info, &shared_data)) {
-        write_log(LOGLEVEL_ERROR, "Main - Failed to create threads");
+    if (!create_threads(&rawhid_thread, &client_thread, device_filters, sizeof(device_filters) / sizeof(device_filters[0]), endpoints, sizeof(endpoints) / sizeof(endpoints[0]), &routing, cache_ttls, sizeof(cache_ttls) / sizeof(cache_ttls[0]), &shared_data)) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Failed to create threads");
         return 1;
     }
-    write_log(LOGLEVEL_INFO, "Main - Threads created");
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Threads created");
 
-    // Wait for threads to complete
-    WaitForSingleObject(rawhid_thread, INFINITE);
-    WaitForSingleObject(client_thread, INFINITE);
+    // Wait for threads to complete, reporting latencies meanwhile
+    HANDLE threads[2] = { rawhid_thread, client_thread };
+    DWORD report_interval = (LATENCY_STATS_ENABLED && LATENCY_REPORT_INTERVAL_MS) ? LATENCY_REPORT_INTERVAL_MS : INFINITE;
+    while (WaitForMultipleObjects(2, threads, TRUE, report_interval) == WAIT_TIMEOUT) {
+        latency_report(true);
+    }
+    if (LATENCY_STATS_ENABLED) {
+        latency_report(false);
+    }
 
     // Cleanup
+    if (metrics_thread_handle) {
+        stop_metrics_thread();
+        platform_thread_join(metrics_thread_handle);
+    }
+    metrics_unregister(write_shared_data_metrics, &shared_data);
     cleanup_shared_data(&shared_data);
-    write_log(LOGLEVEL_INFO, "Main - Cleanup completed");
+    close_frame_capture();
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Cleanup completed");
 
     // Close logger
     close_logger();
-    write_log(LOGLEVEL_INFO, "Main - Application exiting successfully");  // Note: This won't be written to the file as the logger is closed, but it's useful for debugging
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Application exiting successfully");  // Note: This goes straight to the console as the logger is closed, but it's useful for debugging
 
     return 0;
 }
@@ -65,34 +112,63 @@ int main() {
  *
  * @param rawhid_thread Pointer to handle for rawhid thread
  * @param client_thread Pointer to handle for client thread
- * @param device_info Pointer to hid_usage_info for rawhid thread
- * @param server_info Pointer to tcp_socket_info for client thread
+ * @param device_filters Array of hid_usage_info tuples for rawhid thread
+ * @param device_filter_count Number of entries in device_filters
+ * @param endpoints Array of tcp_socket_info, one per upstream server, for client thread
+ * @param endpoint_count Number of entries in endpoints
+ * @param routing Shard table mapping URIs to endpoints
+ * @param cache_ttls Response cache TTLs by URI range
+ * @param cache_ttl_count Number of entries in cache_ttls
  * @return 1 if successful, 0 otherwise
  */
-int create_threads(HANDLE* rawhid_thread, HANDLE* client_thread, hid_usage_info* device_info, tcp_socket_info* server_info, shared_thread_data* shared_data) {
+int create_threads(HANDLE* rawhid_thread, HANDLE* client_thread, hid_usage_info* device_filters, size_t device_filter_count, tcp_socket_info* endpoints, size_t endpoint_count, const upstream_routing* routing, const cache_ttl_rule* cache_ttls, size_t cache_ttl_count, shared_thread_data* shared_data) {
     
     hid_thread_config* hid_thread_config_ptr = (hid_thread_config*)malloc(sizeof(hid_thread_config));
     if (hid_thread_config_ptr == NULL) {
-        write_log(LOGLEVEL_ERROR, "Main - Error allocating memory for hid_thread_config\n");
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Error allocating memory for hid_thread_config\n");
         return 0;
     }
-    hid_thread_config_ptr->device_info = device_info;
+    hid_thread_config_ptr->device_filters = device_filters;
+    hid_thread_config_ptr->device_filter_count = device_filter_count;
+    hid_thread_config_ptr->open_all_devices = HID_OPEN_ALL_DEVICES;
+    hid_thread_config_ptr->max_devices = HID_MAX_DEVICES;
+    hid_thread_config_ptr->reacquire_interval_ms = HID_REACQUIRE_INTERVAL_MS;
+    hid_thread_config_ptr->enumerate_interval_ms = HID_ENUMERATE_INTERVAL_MS;
+    hid_thread_config_ptr->held_responses = HID_HELD_RESPONSES;
+    hid_thread_config_ptr->frame_size = HID_FRAME_SIZE_BYTES;
     hid_thread_config_ptr->shared_data = shared_data;
+    hid_thread_config_ptr->spin_budget_us = BRIDGE_SPIN_BUDGET_US;
 
     client_thread_config* client_thread_config_ptr = (client_thread_config*)malloc(sizeof(client_thread_config));
     if (client_thread_config_ptr == NULL) {
-        write_log(LOGLEVEL_ERROR, "Main - Error allocating memory for client_thread_config\n");
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Error allocating memory for client_thread_config\n");
         free(hid_thread_config_ptr);
         return 0;
     }
-    client_thread_config_ptr->server_config = server_info;
+    client_thread_config_ptr->upstream.endpoints = endpoints;
+    client_thread_config_ptr->upstream.endpoint_count = endpoint_count;
+    client_thread_config_ptr->upstream.routing = routing;
     client_thread_config_ptr->shared_data = shared_data;
+    client_thread_config_ptr->spin_budget_us = BRIDGE_SPIN_BUDGET_US;
+    client_thread_config_ptr->upstream.pipelined = TCP_PIPELINE_ENABLED;
+    client_thread_config_ptr->upstream.pipeline_window = TCP_PIPELINE_WINDOW;
+    client_thread_config_ptr->upstream.request_timeout_ms = TCP_REQUEST_TIMEOUT_MS;
+    client_thread_config_ptr->upstream.send_batch_delay_us = TCP_SEND_BATCH_DELAY_US;
+    client_thread_config_ptr->upstream.reconnect_min_ms = TCP_RECONNECT_MIN_MS;
+    client_thread_config_ptr->upstream.reconnect_max_ms = TCP_RECONNECT_MAX_MS;
+    client_thread_config_ptr->upstream.retain_frames = TCP_RETAIN_FRAMES;
+    client_thread_config_ptr->upstream.unhealthy_timeouts = UPSTREAM_UNHEALTHY_TIMEOUTS;
+    client_thread_config_ptr->upstream.coalesce_waiters = TCP_COALESCE_WAITERS;
+    client_thread_config_ptr->upstream.cache_entries = RESPONSE_CACHE_ENTRIES;
+    client_thread_config_ptr->upstream.server_push = TCP_SERVER_PUSH_ENABLED;
+    client_thread_config_ptr->upstream.cache_ttl_rules = cache_ttls;
+    client_thread_config_ptr->upstream.cache_ttl_rule_count = cache_ttl_count;
     
     DWORD rawhid_thread_id, client_thread_id;
 
     *rawhid_thread = CreateThread(NULL, 0, rawhid_device_thread, hid_thread_config_ptr, 0, &rawhid_thread_id);
     if (*rawhid_thread == NULL) {
-        write_log(LOGLEVEL_ERROR, "Main - Error creating hid thread\n");
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Error creating hid thread\n");
         free(hid_thread_config_ptr);
         free(client_thread_config_ptr);
         return 0;
@@ -100,7 +176,7 @@ int create_threads(HANDLE* rawhid_thread, HANDLE* client_thread, hid_usage_info*
 
     *client_thread = CreateThread(NULL, 0, tcp_client_thread, client_thread_config_ptr, 0, &client_thread_id);
     if (*client_thread == NULL) {
-        write_log(LOGLEVEL_ERROR, "Main - Error creating tcp thread\n");
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Error creating tcp thread\n");
         CloseHandle(*rawhid_thread);  // Cleanup before exiting
         free(hid_thread_config_ptr);
         free(client_thread_config_ptr);
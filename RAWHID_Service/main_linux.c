@@ -0,0 +1,136 @@
+#include "config.h"
+#include "bridge_linux.h"
+#include "frame_capture.h"
+#include "latency_stats.h"
+#include "metrics_thread.h"
+#include "logger.h"
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#define LOG_LEVEL LOGLEVEL_INFO
+
+int main() {
+
+    // Turn SIGINT/SIGTERM into a descriptor the event loop watches; blocked
+    // before any thread starts so every thread inherits the mask
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &stop_signals, NULL) != 0) {
+        return 1;
+    }
+    int stop_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+    if (stop_fd < 0) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);  // A dropped upstream shows up as EPIPE instead
+
+    // Initialization code
+    init_logger(LOG_FILE);
+    set_log_level(LOG_LEVEL);
+    set_log_queue_policy(LOG_QUEUE_POLICY);
+
+    // Logging application start
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Application started");
+
+    hid_usage_info device_filters[] = HID_DEVICE_FILTERS;
+
+    tcp_socket_info endpoints[] = UPSTREAM_ENDPOINTS;
+    upstream_shard shards[] = UPSTREAM_SHARDS;
+    upstream_routing routing = {
+        .shards = shards,
+        .shard_count = sizeof(shards) / sizeof(shards[0]),
+        .mode = UPSTREAM_SHARD_MODE
+    };
+    cache_ttl_rule cache_ttls[] = RESPONSE_CACHE_TTLS;
+    priority_rule priority_rules[] = PRIORITY_RULES;
+    priority_config priorities = {
+        .rules = priority_rules,
+        .rule_count = sizeof(priority_rules) / sizeof(priority_rules[0]),
+        .policy = PRIORITY_POLICY,
+        .weights = PRIORITY_WEIGHTS
+    };
+
+    // Start the binary frame capture; the bridge runs without it if the file can't be created
+    if (FRAME_CAPTURE_ENABLED && !open_frame_capture(FRAME_CAPTURE_FILE, FRAME_CAPTURE_RECORDS)) {
+        WRITE_LOG(LOGLEVEL_WARN, "Main - Frame capture disabled");
+    }
+
+    latency_stats_enable(LATENCY_STATS_ENABLED);
+
+    // Start the metrics endpoint; the bridge runs without it if it can't be started
+    platform_thread metrics_thread_handle = NULL;
+    if (METRICS_PORT || METRICS_UNIX_SOCKET) {
+        metrics_thread_config* metrics_config = (metrics_thread_config*)malloc(sizeof(metrics_thread_config));
+        if (metrics_config) {
+            metrics_config->port = METRICS_PORT;
+            metrics_config->unix_path = METRICS_UNIX_SOCKET;
+            metrics_thread_handle = platform_thread_start(metrics_thread, metrics_config);
+            if (!metrics_thread_handle) {
+                free(metrics_config);
+            }
+        }
+        if (!metrics_thread_handle) {
+            WRITE_LOG(LOGLEVEL_WARN, "Main - Metrics endpoint disabled");
+        }
+    }
+
+    linux_bridge_config config = {
+        .device_filters = device_filters,
+        .device_filter_count = sizeof(device_filters) / sizeof(device_filters[0]),
+        .open_all_devices = HID_OPEN_ALL_DEVICES,
+        .max_devices = HID_MAX_DEVICES,
+        .reacquire_interval_ms = HID_REACQUIRE_INTERVAL_MS,
+        .enumerate_interval_ms = HID_ENUMERATE_INTERVAL_MS,
+        .held_responses = HID_HELD_RESPONSES,
+        .frame_size = HID_FRAME_SIZE_BYTES,
+        .upstream = {
+            .endpoints = endpoints,
+            .endpoint_count = sizeof(endpoints) / sizeof(endpoints[0]),
+            .routing = &routing,
+            .pipelined = TCP_PIPELINE_ENABLED,
+            .pipeline_window = TCP_PIPELINE_WINDOW,
+            .request_timeout_ms = TCP_REQUEST_TIMEOUT_MS,
+            .send_batch_delay_us = TCP_SEND_BATCH_DELAY_US,
+            .reconnect_min_ms = TCP_RECONNECT_MIN_MS,
+            .reconnect_max_ms = TCP_RECONNECT_MAX_MS,
+            .retain_frames = TCP_RETAIN_FRAMES,
+            .unhealthy_timeouts = UPSTREAM_UNHEALTHY_TIMEOUTS,
+            .coalesce_waiters = TCP_COALESCE_WAITERS,
+            .cache_entries = RESPONSE_CACHE_ENTRIES,
+            .server_push = TCP_SERVER_PUSH_ENABLED,
+            .cache_ttl_rules = cache_ttls,
+            .cache_ttl_rule_count = sizeof(cache_ttls) / sizeof(cache_ttls[0])
+        },
+        .priorities = &priorities,
+        .latency_report_interval_ms = LATENCY_STATS_ENABLED ? LATENCY_REPORT_INTERVAL_MS : 0,
+        .io_engine = LINUX_IO_ENGINE,
+        .uring_reads_per_device = LINUX_URING_READS_PER_DEVICE,
+        .uring_writes_per_device = LINUX_URING_WRITES_PER_DEVICE
+    };
+
+    // Run the bridge in this thread until a stop signal arrives
+    int ret = run_linux_bridge(&config, stop_fd);
+    if (ret < 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Main - Bridge failed");
+    }
+    if (LATENCY_STATS_ENABLED) {
+        latency_report(false);
+    }
+
+    // Cleanup
+    if (metrics_thread_handle) {
+        stop_metrics_thread();
+        platform_thread_join(metrics_thread_handle);
+    }
+    close_frame_capture();
+    close(stop_fd);
+    WRITE_LOG(LOGLEVEL_INFO, "Main - Cleanup completed");
+
+    // Close logger
+    close_logger();
+
+    return ret < 0 ? 1 : 0;
+}
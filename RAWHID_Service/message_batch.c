@@ -0,0 +1,262 @@
+#include "message_batch.h"
+#include <string.h>
+#include <stdlib.h>
+#ifdef PLATFORM_X86
+#define CODEC_HAS_X86_SIMD 1
+#endif
+
+// The vector paths store message types as 32-bit lanes.
+typedef char message_type_is_32_bits[sizeof(MessageType) == sizeof(int32_t) ? 1 : -1];
+
+// Message type of every flags byte, filled from message_type_of_flags on first use
+// so the batch paths can never disagree with interpret_message.
+static int32_t typeTable[256];
+static volatile LONG typeTableReady = 0;
+static volatile LONG selectedLevel = -1;
+
+static void ensure_type_table(void) {
+    if (ReadAcquire(&typeTableReady)) {
+        return;
+    }
+    // Racing initializers write the same values
+    for (int flags = 0; flags < 256; flags++) {
+        typeTable[flags] = (int32_t)message_type_of_flags((uint8_t)flags);
+    }
+    WriteRelease(&typeTableReady, 1);
+}
+
+static uint32_t load_u32(const uint8_t* bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/**
+ * Highest SIMD level this CPU and OS support for the batch codec.
+ *
+ * @return The detected level.
+ */
+codec_simd_level detect_codec_simd_level(void) {
+#ifdef CODEC_HAS_X86_SIMD
+    int info[4];
+    platform_cpuid(info, 0, 0);
+    int max_leaf = info[0];
+    platform_cpuid(info, 1, 0);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool avx_enabled = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (platform_xgetbv(0) & 0x6) == 0x6;  // OSXSAVE, AVX, YMM state saved
+    if (avx_enabled && max_leaf >= 7) {
+        platform_cpuid(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return CODEC_SIMD_AVX2;
+        }
+    }
+    return sse2 ? CODEC_SIMD_SSE2 : CODEC_SIMD_SCALAR;
+#else
+    return CODEC_SIMD_SCALAR;
+#endif
+}
+
+/**
+ * Caps the SIMD level the batch codec uses, e.g. to compare paths. The
+ * detected level is used by default.
+ *
+ * @param level The highest level to use.
+ * @return The level now in use, which is lower if the CPU lacks the one asked for.
+ */
+codec_simd_level set_codec_simd_level(codec_simd_level level) {
+    codec_simd_level detected = detect_codec_simd_level();
+    if (level > detected) {
+        level = detected;
+    }
+    WriteRelease(&selectedLevel, (LONG)level);
+    return level;
+}
+
+static codec_simd_level current_level(void) {
+    LONG level = ReadAcquire(&selectedLevel);
+    if (level < 0) {
+        level = (LONG)detect_codec_simd_level();
+        WriteRelease(&selectedLevel, level);
+    }
+    return (codec_simd_level)level;
+}
+
+/**
+ * Decodes frames one at a time.
+ */
+static void decode_scalar(const uint8_t* frames, size_t count, size_t stride, const message_batch* out) {
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* frame = frames + i * stride;
+        if (out->types) {
+            out->types[i] = (MessageType)typeTable[frame[0]];
+        }
+        if (out->request_ids || out->status_codes) {
+            uint32_t header = load_u32(frame + 1);  // Bytes 1-4
+            if (out->request_ids) {
+                out->request_ids[i] = (uint16_t)(((header & 0xFF) << 8) | ((header >> 8) & 0xFF));
+            }
+            if (out->status_codes) {
+                out->status_codes[i] = (uint16_t)(((header >> 8) & 0xFF00) | (header >> 24));
+            }
+        }
+        if (out->values) {
+            memcpy(&out->values[i], frame + 8, sizeof(uint64_t));
+        }
+    }
+}
+
+#ifdef CODEC_HAS_X86_SIMD
+
+/**
+ * Request IDs and status codes of lanes holding bytes 1-4 of a frame each,
+ * as 32-bit lanes.
+ */
+PLATFORM_TARGET("sse2")
+static void split_header_sse2(__m128i header, __m128i* request_ids, __m128i* status_codes) {
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    const __m128i high_byte = _mm_set1_epi32(0xFF00);
+    *request_ids = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(header, low_byte), 8), _mm_and_si128(_mm_srli_epi32(header, 8), low_byte));
+    *status_codes = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(header, 8), high_byte), _mm_srli_epi32(header, 24));
+}
+
+// Narrows four 32-bit lanes holding 16-bit values to four uint16_t. Sign
+// extension first keeps the signed saturation of packs from clamping them.
+PLATFORM_TARGET("sse2")
+static void store_u16x4_sse2(uint16_t* out, __m128i lanes) {
+    lanes = _mm_srai_epi32(_mm_slli_epi32(lanes, 16), 16);
+    _mm_storel_epi64((__m128i*)out, _mm_packs_epi32(lanes, lanes));
+}
+
+/**
+ * Decodes four frames per step with SSE2.
+ */
+PLATFORM_TARGET("sse2")
+static size_t decode_sse2(const uint8_t* frames, size_t count, size_t stride, const message_batch* out) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint8_t* frame = frames + i * stride;
+        if (out->types) {
+            __m128i types = _mm_setr_epi32(typeTable[frame[0]], typeTable[frame[stride]],
+                typeTable[frame[2 * stride]], typeTable[frame[3 * stride]]);
+            _mm_storeu_si128((__m128i*)(out->types + i), types);
+        }
+        if (out->request_ids || out->status_codes) {
+            __m128i header = _mm_setr_epi32((int)load_u32(frame + 1), (int)load_u32(frame + stride + 1),
+                (int)load_u32(frame + 2 * stride + 1), (int)load_u32(frame + 3 * stride + 1));
+            __m128i request_ids, status_codes;
+            split_header_sse2(header, &request_ids, &status_codes);
+            if (out->request_ids) {
+                store_u16x4_sse2(out->request_ids + i, request_ids);
+            }
+            if (out->status_codes) {
+                store_u16x4_sse2(out->status_codes + i, status_codes);
+            }
+        }
+        if (out->values) {
+            // Bytes 8-15 of two frames per register
+            __m128i values01 = _mm_unpackhi_epi64(_mm_loadu_si128((const __m128i*)frame), _mm_loadu_si128((const __m128i*)(frame + stride)));
+            __m128i values23 = _mm_unpackhi_epi64(_mm_loadu_si128((const __m128i*)(frame + 2 * stride)), _mm_loadu_si128((const __m128i*)(frame + 3 * stride)));
+            _mm_storeu_si128((__m128i*)(out->values + i), values01);
+            _mm_storeu_si128((__m128i*)(out->values + i + 2), values23);
+        }
+    }
+    return i;
+}
+
+// Narrows eight 32-bit lanes holding 16-bit values to eight uint16_t.
+PLATFORM_TARGET("avx2")
+static void store_u16x8_avx2(uint16_t* out, __m256i lanes) {
+    lanes = _mm256_srai_epi32(_mm256_slli_epi32(lanes, 16), 16);
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lanes, lanes), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(packed));
+}
+
+/**
+ * Decodes eight frames per step with AVX2: the flags, header and value
+ * fields of eight frames are gathered into one register each, and the
+ * message types are gathered from the type table.
+ */
+PLATFORM_TARGET("avx2")
+static size_t decode_avx2(const uint8_t* frames, size_t count, size_t stride, const message_batch* out) {
+    const int step = (int)stride;
+    const __m256i offsets = _mm256_setr_epi32(0, step, 2 * step, 3 * step, 4 * step, 5 * step, 6 * step, 7 * step);
+    const __m128i value_offsets = _mm_setr_epi32(8, step + 8, 2 * step + 8, 3 * step + 8);
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+    const __m256i high_byte = _mm256_set1_epi32(0xFF00);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const uint8_t* frame = frames + i * stride;
+        if (out->types) {
+            __m256i flags = _mm256_and_si256(_mm256_i32gather_epi32((const int*)frame, offsets, 1), low_byte);
+            _mm256_storeu_si256((__m256i*)(out->types + i), _mm256_i32gather_epi32(typeTable, flags, 4));
+        }
+        if (out->request_ids || out->status_codes) {
+            __m256i header = _mm256_i32gather_epi32((const int*)(frame + 1), offsets, 1);  // Bytes 1-4
+            if (out->request_ids) {
+                store_u16x8_avx2(out->request_ids + i, _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(header, low_byte), 8),
+                    _mm256_and_si256(_mm256_srli_epi32(header, 8), low_byte)));
+            }
+            if (out->status_codes) {
+                store_u16x8_avx2(out->status_codes + i, _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(header, 8), high_byte),
+                    _mm256_srli_epi32(header, 24)));
+            }
+        }
+        if (out->values) {
+            _mm256_storeu_si256((__m256i*)(out->values + i), _mm256_i32gather_epi64((const long long*)frame, value_offsets, 1));
+            _mm256_storeu_si256((__m256i*)(out->values + i + 4), _mm256_i32gather_epi64((const long long*)(frame + 4 * stride), value_offsets, 1));
+        }
+    }
+    return i;
+}
+
+#endif // CODEC_HAS_X86_SIMD
+
+/**
+ * Decodes an array of frames into the arrays of a message_batch. Gives the
+ * same fields as calling interpret_message and the extract_* functions on
+ * each frame, without their debug logging.
+ *
+ * @param frames count frames, stride bytes apart.
+ * @param count Number of frames.
+ * @param stride Bytes per frame, MESSAGE_SIZE_BYTES to MESSAGE_MAX_SIZE_BYTES.
+ * @param out Arrays of at least count entries receiving the fields; NULL arrays are skipped.
+ */
+void decode_messages(const uint8_t* frames, size_t count, size_t stride, const message_batch* out) {
+    size_t done = 0;
+
+    ensure_type_table();
+#ifdef CODEC_HAS_X86_SIMD
+    switch (current_level()) {
+    case CODEC_SIMD_AVX2:
+        done = decode_avx2(frames, count, stride, out);
+        break;
+    case CODEC_SIMD_SSE2:
+        done = decode_sse2(frames, count, stride, out);
+        break;
+    default:
+        break;
+    }
+#endif
+
+    message_batch rest = {
+        out->types ? out->types + done : NULL,
+        out->request_ids ? out->request_ids + done : NULL,
+        out->status_codes ? out->status_codes + done : NULL,
+        out->values ? out->values + done : NULL
+    };
+    decode_scalar(frames + done * stride, count - done, stride, &rest);
+}
+
+/**
+ * Classifies an array of frames, as interpret_message would each one.
+ *
+ * @param frames count frames, stride bytes apart.
+ * @param count Number of frames.
+ * @param stride Bytes per frame, MESSAGE_SIZE_BYTES to MESSAGE_MAX_SIZE_BYTES.
+ * @param types Receives count message types.
+ */
+void classify_messages(const uint8_t* frames, size_t count, size_t stride, MessageType* types) {
+    message_batch out = { types, NULL, NULL, NULL };
+    decode_messages(frames, count, stride, &out);
+}
@@ -0,0 +1,37 @@
+#ifndef MESSAGE_BATCH_H
+#define MESSAGE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "message_protocol.h"
+
+/**
+ * Batch frame decoding.
+ *
+ * Classifies and decodes arrays of frames (one frame size apart) into
+ * structure-of-arrays outputs, eight frames at a time with AVX2 or four with
+ * SSE2 where the CPU has them, and one at a time otherwise. Every path gives
+ * exactly what interpret_message and the extract_* functions give for each
+ * frame.
+ */
+
+typedef enum {
+    CODEC_SIMD_SCALAR,
+    CODEC_SIMD_SSE2,
+    CODEC_SIMD_AVX2
+} codec_simd_level;
+
+// Decoded fields of a batch, one array entry per frame. Any array may be NULL to skip that field.
+typedef struct {
+    MessageType* types;
+    uint16_t* request_ids;    // Bytes 1-2
+    uint16_t* status_codes;   // Bytes 3-4
+    uint64_t* values;         // Bytes 8-15: the URI of a request, the data of a response, the first URI of an invalidation
+} message_batch;
+
+codec_simd_level detect_codec_simd_level(void);
+codec_simd_level set_codec_simd_level(codec_simd_level level);
+void classify_messages(const uint8_t* frames, size_t count, size_t stride, MessageType* types);
+void decode_messages(const uint8_t* frames, size_t count, size_t stride, const message_batch* out);
+
+#endif // MESSAGE_BATCH_H
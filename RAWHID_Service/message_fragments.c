@@ -0,0 +1,160 @@
+#include "message_fragments.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocates an empty payload.
+ *
+ * @param capacity Bytes it must hold.
+ * @return The payload, or NULL if out of memory.
+ */
+static message_payload* allocate_payload(size_t capacity) {
+    message_payload* payload = (message_payload*)malloc(sizeof(message_payload) + capacity);
+    if (!payload) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Fragments - Failed to allocate a %zu-byte payload", capacity);
+        return NULL;
+    }
+    payload->size = 0;
+    payload->capacity = capacity;
+    return payload;
+}
+
+/**
+ * Copies a payload, e.g. to answer several requests with one response.
+ *
+ * @param payload The payload to copy.
+ * @return The copy, or NULL if out of memory.
+ */
+message_payload* message_payload_copy(const message_payload* payload) {
+    message_payload* copy = allocate_payload(payload->size);
+    if (copy) {
+        memcpy(copy->bytes, payload->bytes, payload->size);
+        copy->size = payload->size;
+    }
+    return copy;
+}
+
+/**
+ * Releases a payload. Does nothing for NULL.
+ *
+ * @param payload The payload.
+ */
+void message_payload_free(message_payload* payload) {
+    free(payload);
+}
+
+/**
+ * Drops the message in progress, counting it as discarded.
+ *
+ * @param assembler Pointer to the assembler.
+ */
+static void discard_message(fragment_assembler* assembler) {
+    message_payload_free(assembler->payload);
+    assembler->payload = NULL;
+    assembler->discarded++;
+}
+
+/**
+ * Adds a fragment received on the assembler's link. A first fragment starts a
+ * new message, abandoning any unfinished one; any other must be the next
+ * fragment of the message in progress.
+ *
+ * @param assembler Pointer to the assembler.
+ * @param frame The fragment.
+ * @param frame_size Frame size of the link.
+ * @return Whether the message is now complete, or the fragment was rejected.
+ */
+fragment_status fragment_assembler_add(fragment_assembler* assembler, const unsigned char* frame, size_t frame_size) {
+    uint8_t index, count, length;
+    size_t per_fragment = frame_size - MESSAGE_HEADER_BYTES;
+
+    extract_fragment_info(frame, &index, &count, &length);
+    if (index == 0) {
+        if (assembler->payload) {
+            discard_message(assembler);  // Its last fragment never came
+        }
+        if (count == 0) {
+            assembler->discarded++;
+            return FRAGMENT_REJECTED;
+        }
+
+        size_t capacity = (size_t)count * per_fragment;
+        assembler->payload = allocate_payload(capacity < MESSAGE_MAX_PAYLOAD_BYTES ? capacity : MESSAGE_MAX_PAYLOAD_BYTES);
+        if (!assembler->payload) {
+            assembler->discarded++;
+            return FRAGMENT_REJECTED;
+        }
+        memset(assembler->header, 0, sizeof(assembler->header));
+        memcpy(assembler->header, frame, frame_size);
+        assembler->next_index = 0;
+        assembler->count = count;
+    }
+    else if (!assembler->payload || index != assembler->next_index || count != assembler->count ||
+        memcmp(frame, assembler->header, 3) != 0) {  // Flags and request ID must match the first fragment
+        if (assembler->payload) {
+            discard_message(assembler);
+        }
+        else {
+            assembler->discarded++;  // A fragment of a message whose start was lost
+        }
+        return FRAGMENT_REJECTED;
+    }
+
+    message_payload* payload = assembler->payload;
+    if (length > per_fragment || payload->size + length > payload->capacity) {
+        discard_message(assembler);
+        return FRAGMENT_REJECTED;
+    }
+    memcpy(payload->bytes + payload->size, frame + MESSAGE_HEADER_BYTES, length);
+    payload->size += length;
+
+    if (++assembler->next_index < assembler->count) {
+        return FRAGMENT_PENDING;
+    }
+    assembler->reassembled++;
+    return FRAGMENT_COMPLETE;
+}
+
+/**
+ * Takes the message just completed by fragment_assembler_add.
+ *
+ * @param assembler Pointer to the assembler.
+ * @param header Buffer of MESSAGE_MAX_SIZE_BYTES receiving the message's first fragment.
+ * @return The payload, now owned by the caller.
+ */
+message_payload* fragment_assembler_take(fragment_assembler* assembler, unsigned char* header) {
+    message_payload* payload = assembler->payload;
+    memcpy(header, assembler->header, sizeof(assembler->header));
+    assembler->payload = NULL;
+    return payload;
+}
+
+/**
+ * Drops the message in progress, if any, e.g. when the link goes down.
+ *
+ * @param assembler Pointer to the assembler.
+ */
+void fragment_assembler_reset(fragment_assembler* assembler) {
+    if (assembler->payload) {
+        discard_message(assembler);
+    }
+}
+
+/**
+ * Encodes one fragment of a message for a link.
+ *
+ * @param frame Buffer receiving the fragment, frame_size bytes.
+ * @param frame_size Frame size of the link.
+ * @param header The message's first frame, whose flags, request ID and status code every fragment carries.
+ * @param payload The message's payload.
+ * @param index Which fragment, below message_fragment_count(payload->size, frame_size).
+ */
+void fragment_message(unsigned char* frame, size_t frame_size, const unsigned char* header, const message_payload* payload, size_t index) {
+    size_t per_fragment = frame_size - MESSAGE_HEADER_BYTES;
+    size_t offset = index * per_fragment;
+    size_t length = payload->size - offset < per_fragment ? payload->size - offset : per_fragment;
+
+    memset(frame, 0, frame_size);
+    encode_fragment(frame, header, (uint8_t)index, (uint8_t)message_fragment_count(payload->size, frame_size),
+        payload->bytes + offset, (uint8_t)length);
+}
@@ -0,0 +1,44 @@
+#ifndef MESSAGE_FRAGMENTS_H
+#define MESSAGE_FRAGMENTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "message_protocol.h"
+#include "logger.h"
+
+// Payload of a fragmented message, allocated to fit. A frame carrying one
+// owns it: whoever drops or delivers the frame releases it.
+typedef struct {
+    size_t size;
+    size_t capacity;
+    unsigned char bytes[];
+} message_payload;
+
+// Result of adding a fragment to an assembler.
+typedef enum {
+    FRAGMENT_PENDING,         // Accepted; more fragments to come
+    FRAGMENT_COMPLETE,        // Accepted, and the message is whole
+    FRAGMENT_REJECTED         // Out of order or malformed; the message was discarded
+} fragment_status;
+
+/**
+ * Reassembles the fragmented messages arriving on one link, one message at a
+ * time. Owned by the thread reading the link, so no locking.
+ */
+typedef struct {
+    message_payload* payload; // Payload so far, NULL when no message is in progress
+    unsigned char header[MESSAGE_MAX_SIZE_BYTES];  // First fragment of the message in progress
+    uint8_t next_index;
+    uint8_t count;
+    uint64_t reassembled;     // Messages completed
+    uint64_t discarded;       // Messages dropped incomplete or malformed
+} fragment_assembler;
+
+message_payload* message_payload_copy(const message_payload* payload);
+void message_payload_free(message_payload* payload);
+fragment_status fragment_assembler_add(fragment_assembler* assembler, const unsigned char* frame, size_t frame_size);
+message_payload* fragment_assembler_take(fragment_assembler* assembler, unsigned char* header);
+void fragment_assembler_reset(fragment_assembler* assembler);
+void fragment_message(unsigned char* frame, size_t frame_size, const unsigned char* header, const message_payload* payload, size_t index);
+
+#endif // MESSAGE_FRAGMENTS_H
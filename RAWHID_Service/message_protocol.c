@@ -1,38 +1,66 @@
 #include "message_protocol.h"
+#include <stdlib.h>
+#include <string.h>
 
-// This function interprets the message type
-void interpret_message(const uint8_t* buffer, MessageType* result) {
-    uint8_t flags = buffer[0];
-    write_log_byte_array(LOGLEVEL_DEBUG, buffer, MESSAGE_SIZE_BYTES);
+// Every target of this service is little-endian, so the 64-bit fields are
+// moved with single unaligned loads and stores, and the big-endian 16-bit
+// fields with one byte swap. memcpy compiles to a plain mov.
+
+static uint64_t load_le64(const uint8_t* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static void store_le64(uint8_t* bytes, uint64_t value) {
+    memcpy(bytes, &value, sizeof(value));
+}
 
+static uint16_t load_be16(const uint8_t* bytes) {
+    uint16_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return _byteswap_ushort(value);
+}
+
+static void store_be16(uint8_t* bytes, uint16_t value) {
+    value = _byteswap_ushort(value);
+    memcpy(bytes, &value, sizeof(value));
+}
+
+// This function maps the flags byte to the message type it denotes
+MessageType message_type_of_flags(uint8_t flags) {
     if (flags == 0) {
-        write_log(LOGLEVEL_DEBUG, "Message type is REQUEST_MESSAGE");
-        *result = REQUEST_MESSAGE;
-        return;
+        return REQUEST_MESSAGE;
     }
-    if (flags & 0x01) { // Bit 0 is set
-        if (flags & 0x02) { // Bit 1 is also set
-            write_log(LOGLEVEL_DEBUG, "Message type is RESPONSE_MESSAGE");
-            *result = RESPONSE_MESSAGE;
-        }
-        else {
-            write_log(LOGLEVEL_DEBUG, "Message type is CONFIRM_MESSAGE");
-            *result = CONFIRM_MESSAGE;
-        }
+    if (flags == 0x05) { // Bits 0 and 2 are set
+        return INVALIDATE_MESSAGE;
+    }
+    if (flags == MESSAGE_PUSH_FLAGS) { // Bits 0 and 4 are set
+        return PUSH_MESSAGE;
     }
-    else {
-        write_log(LOGLEVEL_DEBUG, "Message type is UNKNOWN_MESSAGE");
-        *result = UNKNOWN_MESSAGE;
+    if (flags == MESSAGE_FRAGMENT_FLAG) { // A fragment of a request; response fragments fall under Bit 0
+        return REQUEST_MESSAGE;
     }
+    if (flags & 0x01) { // Bit 0 is set
+        return (flags & 0x02) ? RESPONSE_MESSAGE : CONFIRM_MESSAGE; // Bit 1 tells a response from a confirmation
+    }
+    return UNKNOWN_MESSAGE;
+}
+
+// This function interprets the message type
+void interpret_message(const uint8_t* buffer, MessageType* result) {
+    static const char* typeNames[] = { "REQUEST_MESSAGE", "CONFIRM_MESSAGE", "RESPONSE_MESSAGE", "INVALIDATE_MESSAGE", "PUSH_MESSAGE", "UNKNOWN_MESSAGE" };
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, buffer, MESSAGE_SIZE_BYTES);
+
+    *result = message_type_of_flags(buffer[0]);
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Message type is %s", typeNames[*result]);
 }
 
 // This function encodes common fields into the first 8 bytes
 static void encode_common_fields(uint8_t* buffer, uint16_t request_id, uint16_t status_code, uint8_t flags) {
     buffer[0] = flags;
-    buffer[1] = (request_id >> 8) & 0xFF;
-    buffer[2] = request_id & 0xFF;
-    buffer[3] = (status_code >> 8) & 0xFF;
-    buffer[4] = status_code & 0xFF;
+    store_be16(buffer + 1, request_id);
+    store_be16(buffer + 3, status_code);
 }
 
 // This function encodes a confirmation message
@@ -43,32 +71,102 @@ void encode_confirmation(uint8_t* buffer, uint16_t request_id, uint16_t status_c
 // This function encodes a request message
 void encode_request(uint8_t* buffer, uint64_t uri) {
     encode_common_fields(buffer, 0, 0, 0);
-    for (int i = 0; i < 8; i++) {
-        buffer[8 + i] = (uri >> (i * 8)) & 0xFF;
-    }
+    store_le64(buffer + 8, uri);
 }
 
 // This function encodes a response message
 void encode_response(uint8_t* buffer, uint16_t request_id, uint64_t data) {
     encode_common_fields(buffer, request_id, 0, 0x03); // 0x03 = 0000 0011 (Bit 0 and Bit 1 are set)
-    for (int i = 0; i < 8; i++) {
-        buffer[8 + i] = (data >> (i * 8)) & 0xFF;
-    }
+    store_le64(buffer + 8, data);
+}
+
+// This function encodes an invalidation message for the URIs first_uri to last_uri
+void encode_invalidation(uint8_t* buffer, uint64_t first_uri, uint64_t last_uri) {
+    encode_common_fields(buffer, 0, 0, 0x05); // 0x05 = 0000 0101 (Bit 0 and Bit 2 are set)
+    store_le64(buffer + 8, first_uri);
+    store_le64(buffer + 16, last_uri);
+}
+
+// This function encodes a push message for one device, or MESSAGE_PUSH_ALL_DEVICES
+void encode_push(uint8_t* buffer, uint16_t target_device, uint64_t data) {
+    encode_common_fields(buffer, target_device, 0, MESSAGE_PUSH_FLAGS); // 0x11 = 0001 0001 (Bit 0 and Bit 4 are set)
+    store_le64(buffer + 8, data);
 }
 
 // This function extracts the URI from a request message
 void extract_request_uri(const uint8_t* buffer, uint64_t* uri) {
-    *uri = 0;
-    for (int i = 0; i < 8; i++) {
-        *uri |= ((uint64_t)buffer[8 + i]) << (i * 8);
+    *uri = load_le64(buffer + 8);
+}
+
+// This function extracts the URI range from an invalidation message
+void extract_invalidation_range(const uint8_t* buffer, uint64_t* first_uri, uint64_t* last_uri) {
+    *first_uri = load_le64(buffer + 8);
+    *last_uri = load_le64(buffer + 16);
+    if (*last_uri < *first_uri) {
+        *last_uri = *first_uri; // Zero (or a reversed range) means just the first URI
     }
 }
 
+// This function extracts the target device of a push message
+uint16_t extract_push_target(const uint8_t* buffer) {
+    return load_be16(buffer + 1);
+}
+
+// This function tells whether a message is a push for every device
+bool message_is_push_to_all(const uint8_t* buffer) {
+    return buffer[0] == MESSAGE_PUSH_FLAGS && extract_push_target(buffer) == MESSAGE_PUSH_ALL_DEVICES;
+}
+
 // This function extracts the request_id and data from a response message
 void extract_request_id_and_data(const uint8_t* buffer, uint16_t* request_id, uint64_t* data) {
-    *request_id = ((uint16_t)buffer[1] << 8) | buffer[2];
-    *data = 0;
-    for (int i = 0; i < 8; i++) {
-        *data |= ((uint64_t)buffer[8 + i]) << (i * 8);
+    *request_id = load_be16(buffer + 1);
+    *data = load_le64(buffer + 8);
+}
+
+// This function overwrites the request_id of an already encoded message
+void set_message_request_id(uint8_t* buffer, uint16_t request_id) {
+    store_be16(buffer + 1, request_id);
+}
+
+// This function picks the frame size for a link with the given report size
+size_t message_frame_size(size_t report_size) {
+    if (report_size < MESSAGE_SIZE_BYTES) {
+        return MESSAGE_SIZE_BYTES; // Too small to carry every field; keep the default
     }
+    return report_size < MESSAGE_MAX_SIZE_BYTES ? report_size : MESSAGE_MAX_SIZE_BYTES;
+}
+
+// This function zero-pads a message of from_size bytes out to to_size bytes
+void resize_message(uint8_t* buffer, size_t from_size, size_t to_size) {
+    if (to_size > from_size) {
+        memset(buffer + from_size, 0, to_size - from_size);
+    }
+}
+
+// This function tells whether a request or response is one fragment of a bigger message
+bool message_is_fragment(const uint8_t* buffer) {
+    return buffer[0] == MESSAGE_FRAGMENT_FLAG || (buffer[0] & 0x0B) == 0x0B; // 0x0B = response with Bit 3 set
+}
+
+// This function encodes one fragment, copying the flags, request ID and status code of the header
+void encode_fragment(uint8_t* buffer, const uint8_t* header, uint8_t index, uint8_t count, const uint8_t* payload, uint8_t length) {
+    memcpy(buffer, header, 5);
+    buffer[0] |= MESSAGE_FRAGMENT_FLAG;
+    buffer[5] = index;
+    buffer[6] = count;
+    buffer[7] = length;
+    memcpy(buffer + MESSAGE_HEADER_BYTES, payload, length);
+}
+
+// This function extracts the fragment fields of a fragment
+void extract_fragment_info(const uint8_t* buffer, uint8_t* index, uint8_t* count, uint8_t* length) {
+    *index = buffer[5];
+    *count = buffer[6];
+    *length = buffer[7];
+}
+
+// This function counts the fragments a payload takes on a link with the given frame size
+size_t message_fragment_count(size_t payload_size, size_t frame_size) {
+    size_t per_fragment = frame_size - MESSAGE_HEADER_BYTES;
+    return payload_size == 0 ? 1 : (payload_size + per_fragment - 1) / per_fragment;
 }
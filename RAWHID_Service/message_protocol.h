@@ -3,14 +3,24 @@
 
 #include "logger.h"
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #define MESSAGE_SIZE_BYTES 32
+#define MESSAGE_MAX_SIZE_BYTES 64
+#define MESSAGE_HEADER_BYTES 8
+#define MESSAGE_FRAGMENT_FLAG 0x08
+#define MESSAGE_PUSH_FLAGS 0x11
+#define MESSAGE_PUSH_ALL_DEVICES 0xFFFF
+#define MESSAGE_MAX_FRAGMENTS 255
+// Largest fragmented payload; fits MESSAGE_MAX_FRAGMENTS fragments on a link of the smallest frame size
+#define MESSAGE_MAX_PAYLOAD_BYTES (MESSAGE_MAX_FRAGMENTS * (MESSAGE_SIZE_BYTES - MESSAGE_HEADER_BYTES))
 
 /**
  * Message Protocol Description
  *
  * This protocol is designed to encode and decode messages for a networked application.
- * Messages can be of the type Request, Confirmation, and Response. The protocol uses
+ * Messages can be of the type Request, Confirmation, Response, Invalidation and Push. The protocol uses
  * byte arrays for the sake of flexibility, simplicity, and better network interoperability.
  *
  * Message Structure (All Sizes in Bytes)
@@ -18,21 +28,54 @@
  *  - Byte 0:              Flags (Message Type and Additional Information)
  *                          - Bit 0: 0 for Request, 1 for Response/Confirmation
  *                          - Bit 1: 0 for Confirmation, 1 for Response (valid only if Bit 0 is 1)
- *                          - Bit 2-7: Reserved for future use
+ *                          - Bit 2: 1 for Invalidation (valid only if Bit 0 is 1 and Bit 1 is 0)
+ *                          - Bit 3: 1 for a Fragment of a Request or Response
+ *                          - Bit 4: 1 for a Push (valid only if Bit 0 is 1 and Bits 1-3 are 0)
+ *                          - Bit 5-7: Reserved for future use
  *
  *  - Bytes 1-2:           Request ID (16 bits)
  *  - Bytes 3-4:           Status Code (16 bits)
- *  - Bytes 5-7:           Reserved (for future use)
+ *  - Bytes 5-7:           Reserved (for future use), or the fragment fields
  *
  *  - Bytes 8-15:          Data Field (64 bits, could be URI or Response Data)
  *  - Bytes 16-63:         Reserved Payload Space (for future use)
  *
+ * Frame Size
+ * ----------
+ * A frame is MESSAGE_SIZE_BYTES long unless the link carrying it uses bigger
+ * frames: a HID device frames with its report size (up to
+ * MESSAGE_MAX_SIZE_BYTES, e.g. the full 64 bytes of a full-speed report) and
+ * each upstream server connection with its configured size. Every field sits
+ * in the first MESSAGE_SIZE_BYTES, so the layout is the same at any size; a
+ * frame moving to a link with bigger frames is zero-padded, and one moving to
+ * a link with smaller frames loses the reserved bytes past that size.
+ *
+ * Fragmented Messages
+ * -------------------
+ * A request or response whose payload is bigger than the 8-byte data field
+ * is sent as up to MESSAGE_MAX_FRAGMENTS frames, back to back, each with
+ * Bit 3 of the flags set (0x08 for a request, 0x0B for a response):
+ *  - Bytes 0-4:           Flags, Request ID and Status Code, the same in every fragment
+ *  - Byte 5:              Fragment index, 0 to count - 1
+ *  - Byte 6:              Fragment count (1-255)
+ *  - Byte 7:              Payload bytes in this fragment
+ *  - Bytes 8-63:          Payload bytes, up to the frame size
+ * The payload is the concatenation of the fragments' payload bytes in index
+ * order, at most MESSAGE_MAX_PAYLOAD_BYTES, and takes the place of the data
+ * field: a fragmented request's first 8 bytes are its URI. A link carries the
+ * fragments of one message at a time; unfragmented frames may come in
+ * between, but a fragment out of order discards the message. The bridge
+ * reassembles fragmented messages from either side and re-fragments them to
+ * the frame size of the link they go out on, and a fragmented request is
+ * confirmed and answered once, as one request.
+ *
  * Specific Structures Based on Message Type
  * ---------------------------
  * Request Message Structure
  * -------------------------
  *  - Byte 0:              Flags (0x00)
- *  - Bytes 1-2:           Zero (unused)
+ *  - Bytes 1-2:           Zero (unused), or the bridge-assigned Request ID in pipelined
+ *                         mode; the server must then echo it in the confirmation and response
  *  - Bytes 3-4:           Zero (unused)
  *  - Bytes 5-7:           Zero (unused)
  *  - Bytes 8-15:          URI (64 bits)
@@ -56,6 +99,31 @@
  *  - Bytes 8-15:          Response Data (64 bits)
  *  - Bytes 16-63:         Reserved for future use
  *
+ * ------------------------------
+ * Invalidation Message Structure
+ * ------------------------------
+ * Sent by the server, unprompted, when data it has answered with changes; the
+ * bridge drops any cached responses for the URIs and does not answer.
+ *  - Byte 0:              Flags (0x05, i.e., 0000 0101 in binary, Bit 0 and Bit 2 are set)
+ *  - Bytes 1-7:           Zero (unused)
+ *  - Bytes 8-15:          First URI to invalidate (64 bits)
+ *  - Bytes 16-23:         Last URI to invalidate, inclusive (64 bits); zero for just the first
+ *  - Bytes 24-63:         Reserved for future use
+ *
+ * ----------------------
+ * Push Message Structure
+ * ----------------------
+ * Sent by the server, unprompted, to hand a device something it did not ask
+ * for (a configuration change, LED or display state). The bridge writes it to
+ * the device as it is, without confirming it; a push is never fragmented.
+ *  - Byte 0:              Flags (0x11, i.e., 0001 0001 in binary, Bit 0 and Bit 4 are set)
+ *  - Bytes 1-2:           Target device, in the order the bridge opened them (its log
+ *                         numbers them), or 0xFFFF for every device
+ *  - Bytes 3-4:           Zero (unused)
+ *  - Bytes 5-7:           Zero (unused)
+ *  - Bytes 8-15:          Push Data (64 bits)
+ *  - Bytes 16-63:         Application defined, up to the frame size
+ *
  * The protocol provides functions to encode these messages into byte arrays and to decode
  * byte arrays back into their respective fields. Endianness should be managed at the
  * application layer if necessary.
@@ -65,14 +133,29 @@ typedef enum {
     REQUEST_MESSAGE,
     CONFIRM_MESSAGE,
     RESPONSE_MESSAGE,
+    INVALIDATE_MESSAGE,
+    PUSH_MESSAGE,
     UNKNOWN_MESSAGE // Represents unrecognized sequences
 } MessageType;
 
+MessageType message_type_of_flags(uint8_t flags);
 void interpret_message(const uint8_t* buffer, MessageType* result);
 void encode_confirmation(uint8_t* buffer, uint16_t request_id, uint16_t status_code);
 void encode_request(uint8_t* buffer, uint64_t uri);
 void encode_response(uint8_t* buffer, uint16_t request_id, uint64_t data);
+void encode_invalidation(uint8_t* buffer, uint64_t first_uri, uint64_t last_uri);
+void encode_push(uint8_t* buffer, uint16_t target_device, uint64_t data);
 void extract_request_uri(const uint8_t* buffer, uint64_t* uri);
+void extract_invalidation_range(const uint8_t* buffer, uint64_t* first_uri, uint64_t* last_uri);
+uint16_t extract_push_target(const uint8_t* buffer);
+bool message_is_push_to_all(const uint8_t* buffer);
 void extract_request_id_and_data(const uint8_t* buffer, uint16_t* request_id, uint64_t* data);
+void set_message_request_id(uint8_t* buffer, uint16_t request_id);
+size_t message_frame_size(size_t report_size);
+void resize_message(uint8_t* buffer, size_t from_size, size_t to_size);
+bool message_is_fragment(const uint8_t* buffer);
+void encode_fragment(uint8_t* buffer, const uint8_t* header, uint8_t index, uint8_t count, const uint8_t* payload, uint8_t length);
+void extract_fragment_info(const uint8_t* buffer, uint8_t* index, uint8_t* count, uint8_t* length);
+size_t message_fragment_count(size_t payload_size, size_t frame_size);
 
 #endif
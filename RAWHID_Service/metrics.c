@@ -0,0 +1,180 @@
+#include "metrics.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define METRICS_PAGE_INITIAL_SIZE (16 * 1024)
+
+static SRWLOCK metricsLock = SRWLOCK_INIT;
+static struct {
+    metrics_source source;
+    void* context;
+} metricsSources[METRICS_MAX_SOURCES];
+static size_t metricsSourceCount = 0;
+
+/**
+ * Adds a source to every page rendered from now on.
+ *
+ * @param source Function that writes the source's metrics.
+ * @param context Passed to source; must stay valid until it is unregistered.
+ * @return 1 if registered, 0 if the registry is full.
+ */
+int metrics_register(metrics_source source, void* context) {
+    int registered = 0;
+    AcquireSRWLockExclusive(&metricsLock);
+    if (metricsSourceCount < METRICS_MAX_SOURCES) {
+        metricsSources[metricsSourceCount].source = source;
+        metricsSources[metricsSourceCount].context = context;
+        metricsSourceCount++;
+        registered = 1;
+    }
+    ReleaseSRWLockExclusive(&metricsLock);
+
+    if (!registered) {
+        WRITE_LOG(LOGLEVEL_WARN, "Metrics - Too many sources, metrics not registered");
+    }
+    return registered;
+}
+
+/**
+ * Removes a source. Waits for a page being rendered to finish, so the
+ * context can be freed as soon as this returns.
+ *
+ * @param source The function passed to metrics_register.
+ * @param context The context passed to metrics_register.
+ */
+void metrics_unregister(metrics_source source, void* context) {
+    AcquireSRWLockExclusive(&metricsLock);
+    for (size_t i = 0; i < metricsSourceCount; i++) {
+        if (metricsSources[i].source == source && metricsSources[i].context == context) {
+            metricsSources[i] = metricsSources[--metricsSourceCount];
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&metricsLock);
+}
+
+/**
+ * Renders the metrics of every registered source into a page, replacing its
+ * contents.
+ *
+ * @param page The page to render into.
+ */
+void metrics_render(metrics_page* page) {
+    page->length = 0;
+    AcquireSRWLockShared(&metricsLock);
+    for (size_t i = 0; i < metricsSourceCount; i++) {
+        metricsSources[i].source(page, metricsSources[i].context);
+    }
+    ReleaseSRWLockShared(&metricsLock);
+}
+
+/**
+ * Appends formatted text to a page, growing it as needed. On allocation
+ * failure the text is left out.
+ *
+ * @param page The page to append to.
+ * @param format printf-style format string.
+ */
+void metrics_printf(metrics_page* page, const char* format, ...) {
+    while (true) {
+        if (page->capacity - page->length < 2) {
+            size_t capacity = page->capacity ? page->capacity * 2 : METRICS_PAGE_INITIAL_SIZE;
+            char* buffer = (char*)realloc(page->buffer, capacity);
+            if (!buffer) {
+                return;
+            }
+            page->buffer = buffer;
+            page->capacity = capacity;
+        }
+
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(page->buffer + page->length, page->capacity - page->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            return;
+        }
+        if ((size_t)written < page->capacity - page->length) {
+            page->length += written;
+            return;
+        }
+
+        // Too long for what is left; make room for it and format again
+        size_t capacity = page->capacity;
+        while (capacity - page->length <= (size_t)written) {
+            capacity *= 2;
+        }
+        char* buffer = (char*)realloc(page->buffer, capacity);
+        if (!buffer) {
+            return;
+        }
+        page->buffer = buffer;
+        page->capacity = capacity;
+    }
+}
+
+/**
+ * Writes a metric with a single unlabelled value.
+ *
+ * @param page The page to append to.
+ * @param name Metric name.
+ * @param type "counter" or "gauge".
+ * @param help One-line description.
+ * @param value The value.
+ */
+void metrics_write_value(metrics_page* page, const char* name, const char* type, const char* help, uint64_t value) {
+    metrics_printf(page, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)value);
+}
+
+/**
+ * Reads an unsigned integer field without synchronization.
+ *
+ * @param object The object holding the field.
+ * @param field Where the field is and how wide it is.
+ * @return The value.
+ */
+static uint64_t read_field(const void* object, const metrics_field* field) {
+    const volatile void* address = (const unsigned char*)object + field->offset;
+    switch (field->size) {
+    case 1:
+        return *(const volatile uint8_t*)address;
+    case 2:
+        return *(const volatile uint16_t*)address;
+    case 4:
+        return *(const volatile uint32_t*)address;
+    default:
+        return *(const volatile uint64_t*)address;
+    }
+}
+
+/**
+ * Writes a set of fields for each of an array of objects, such as every
+ * device or every upstream. Objects are told apart by a label holding their
+ * index.
+ *
+ * @param page The page to append to.
+ * @param fields The fields to write.
+ * @param field_count Number of entries in fields.
+ * @param label Name of the index label, or NULL when there is a single object.
+ * @param objects The first object.
+ * @param stride Distance between objects in bytes.
+ * @param object_count Number of objects.
+ */
+void metrics_write_fields(metrics_page* page, const metrics_field* fields, size_t field_count,
+    const char* label, const void* objects, size_t stride, size_t object_count) {
+    for (size_t i = 0; i < field_count; i++) {
+        const metrics_field* field = &fields[i];
+        metrics_printf(page, "# HELP %s %s\n# TYPE %s %s\n", field->name, field->help, field->name, field->type);
+        for (size_t j = 0; j < object_count; j++) {
+            uint64_t value = read_field((const unsigned char*)objects + j * stride, field);
+            if (label) {
+                metrics_printf(page, "%s{%s=\"%zu\"} %llu\n", field->name, label, j, (unsigned long long)value);
+            }
+            else {
+                metrics_printf(page, "%s %llu\n", field->name, (unsigned long long)value);
+            }
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "platform.h"
+
+/**
+ * Metrics registry.
+ *
+ * Threads that own counters register a source for as long as the counters
+ * exist; the metrics thread calls every source to render the metrics page in
+ * the Prometheus text format. Sources read the counters as they are, without
+ * synchronizing with the threads updating them: counters are aligned and at
+ * most 64 bits wide, so a read may be a moment stale but is never torn. The
+ * registry's lock is only taken when a source comes or goes and while a page
+ * is rendered, never on the data path.
+ */
+
+#define METRICS_MAX_SOURCES 16
+
+// Growable text buffer a page is rendered into.
+typedef struct {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+} metrics_page;
+
+typedef void (*metrics_source)(metrics_page* page, void* context);
+
+// One counter or gauge found at a fixed offset in the objects a source owns.
+typedef struct {
+    const char* name;
+    const char* type;         // "counter" or "gauge"
+    const char* help;
+    size_t offset;
+    size_t size;              // 1, 2, 4 or 8 bytes, read as an unsigned integer
+} metrics_field;
+
+#define METRICS_FIELD(object_type, member, name, type, help) \
+    { name, type, help, offsetof(object_type, member), sizeof(((object_type*)0)->member) }
+
+int metrics_register(metrics_source source, void* context);
+void metrics_unregister(metrics_source source, void* context);
+void metrics_render(metrics_page* page);
+void metrics_printf(metrics_page* page, const char* format, ...);
+void metrics_write_value(metrics_page* page, const char* name, const char* type, const char* help, uint64_t value);
+void metrics_write_fields(metrics_page* page, const metrics_field* fields, size_t field_count,
+    const char* label, const void* objects, size_t stride, size_t object_count);
+
+#endif // METRICS_H
@@ -0,0 +1,217 @@
+#include "metrics_thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// How often the accept loop wakes up to check whether it should stop.
+#define METRICS_STOP_CHECK_MS 500
+// How long to wait for a client's request before answering anyway.
+#define METRICS_REQUEST_WAIT_MS 200
+
+static volatile LONG metricsStopRequested = 0;
+
+/**
+ * Asks the metrics thread to exit; it notices within METRICS_STOP_CHECK_MS.
+ */
+void stop_metrics_thread(void) {
+    InterlockedExchange(&metricsStopRequested, 1);
+}
+
+/**
+ * Creates a listening socket.
+ *
+ * @param family AF_INET or AF_UNIX.
+ * @param address The address to bind.
+ * @param address_length Size of address.
+ * @param description How to refer to the listener in log messages.
+ * @return The listening socket, or INVALID_SOCKET on failure.
+ */
+static SOCKET open_listener(int family, const struct sockaddr* address, int address_length, const char* description) {
+    SOCKET listener = socket(family, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Metrics Thread - Failed to create socket for %s. Error Code: %d", description, platform_socket_error());
+        return INVALID_SOCKET;
+    }
+
+#ifdef SO_EXCLUSIVEADDRUSE
+    if (family == AF_INET) {
+        // Don't let another process bind the same port underneath us; BSD sockets never allow it
+        int exclusive = 1;
+        setsockopt(listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof(exclusive));
+    }
+#endif
+
+    if (bind(listener, address, address_length) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Metrics Thread - Failed to listen on %s. Error Code: %d", description, platform_socket_error());
+        closesocket(listener);
+        return INVALID_SOCKET;
+    }
+
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Metrics Thread - Serving metrics on %s", description);
+    return listener;
+}
+
+/**
+ * Writes the metrics that don't belong to a worker thread: the logger and
+ * the latency histograms.
+ *
+ * @param page The page to append to.
+ */
+static void write_process_metrics(metrics_page* page) {
+    metrics_write_value(page, "rawhid_log_records_dropped_total", "counter",
+        "Log records discarded because the log queue was full", get_log_dropped_count());
+    latency_write_metrics(page);
+}
+
+/**
+ * Sends a whole buffer, however many send calls it takes.
+ *
+ * @param client The client socket.
+ * @param data The data to send.
+ * @param length Number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+static int send_all(SOCKET client, const char* data, size_t length) {
+    while (length > 0) {
+        int sent = (int)send(client, data, length > INT_MAX ? INT_MAX : (int)length, 0);
+        if (sent == SOCKET_ERROR) {
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+/**
+ * Answers one client with the current metrics page as an HTTP/1.0 response,
+ * whatever it asked for, then closes the connection.
+ *
+ * @param client The accepted client socket.
+ * @param page Page buffer reused between clients.
+ */
+static void serve_client(SOCKET client, metrics_page* page) {
+    // Consume the request if one arrives promptly; a bare socket client gets the page regardless
+    if (platform_wait_socket(client, false, METRICS_REQUEST_WAIT_MS) > 0) {
+        char request[1024];
+        recv(client, request, sizeof(request), 0);
+    }
+
+    metrics_render(page);
+    write_process_metrics(page);
+
+    char header[160];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", page->length);
+    if (send_all(client, header, header_length) < 0 || (page->length > 0 && send_all(client, page->buffer, page->length) < 0)) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Metrics Thread - Failed to send metrics. Error Code: %d", platform_socket_error());
+    }
+
+    shutdown(client, SD_SEND);
+    closesocket(client);
+}
+
+/**
+ * Thread function serving the metrics page to local clients. Listens on the
+ * loopback interface and/or a Unix socket and answers every connection with
+ * the current page, so a monitoring agent can scrape it as often as it likes
+ * without touching the data path.
+ *
+ * @param thread_config Pointer to a metrics_thread_config, freed by the thread.
+ */
+void metrics_thread(void* thread_config) {
+    WRITE_LOG(LOGLEVEL_INFO, "Metrics Thread - Metrics thread started.");
+
+    bool sockets_started = false;
+    SOCKET listeners[2] = { INVALID_SOCKET, INVALID_SOCKET };
+    int listener_count = 0;
+    metrics_page page = { 0 };
+    metrics_thread_config* config = (metrics_thread_config*)thread_config;
+
+    if (!config) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Metrics Thread - Configuration is NULL.");
+        goto cleanup;
+    }
+
+    if (platform_socket_startup() != 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Metrics Thread - Failed to initialize sockets. Error Code: %d", platform_socket_error());
+        goto cleanup;
+    }
+    sockets_started = true;
+
+    if (config->port) {
+        struct sockaddr_in address = { 0 };
+        address.sin_family = AF_INET;
+        address.sin_port = htons(config->port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local scrapers only
+
+        char description[32];
+        snprintf(description, sizeof(description), "127.0.0.1:%u", config->port);
+        listeners[listener_count] = open_listener(AF_INET, (struct sockaddr*)&address, sizeof(address), description);
+        if (listeners[listener_count] != INVALID_SOCKET) {
+            listener_count++;
+        }
+    }
+
+    if (config->unix_path && config->unix_path[0]) {
+        SOCKADDR_UN address = { 0 };
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, config->unix_path, sizeof(address.sun_path) - 1);
+
+        DeleteFileA(config->unix_path);  // A socket file left behind by a previous run blocks bind
+        listeners[listener_count] = open_listener(AF_UNIX, (struct sockaddr*)&address, sizeof(address), config->unix_path);
+        if (listeners[listener_count] != INVALID_SOCKET) {
+            listener_count++;
+        }
+    }
+
+    if (listener_count == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Metrics Thread - No metrics listener could be opened.");
+        goto cleanup;
+    }
+
+    while (!ReadAcquire(&metricsStopRequested)) {
+        fd_set readable;
+        SOCKET highest = listeners[0];
+        FD_ZERO(&readable);
+        for (int i = 0; i < listener_count; i++) {
+            FD_SET(listeners[i], &readable);
+            highest = listeners[i] > highest ? listeners[i] : highest;
+        }
+
+        // WinSock ignores the descriptor count; BSD sockets need the highest one plus one
+        struct timeval wait = { METRICS_STOP_CHECK_MS / 1000, (METRICS_STOP_CHECK_MS % 1000) * 1000 };
+        int ready = select((int)highest + 1, &readable, NULL, NULL, &wait);
+        if (ready == SOCKET_ERROR) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Metrics Thread - Wait for clients failed. Error Code: %d", platform_socket_error());
+            break;
+        }
+
+        for (int i = 0; i < listener_count && ready > 0; i++) {
+            if (!FD_ISSET(listeners[i], &readable)) {
+                continue;
+            }
+            SOCKET client = accept(listeners[i], NULL, NULL);
+            if (client != INVALID_SOCKET) {
+                serve_client(client, &page);
+            }
+        }
+    }
+
+cleanup:
+    for (int i = 0; i < listener_count; i++) {
+        closesocket(listeners[i]);
+    }
+    if (config && config->unix_path && config->unix_path[0] && listener_count > 0) {
+        DeleteFileA(config->unix_path);
+    }
+    if (sockets_started) {
+        platform_socket_cleanup();
+    }
+    free(page.buffer);
+    if (config) {
+        free(config);
+    }
+    WRITE_LOG(LOGLEVEL_INFO, "Metrics Thread - Metrics thread terminated.");
+}
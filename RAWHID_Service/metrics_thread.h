@@ -0,0 +1,18 @@
+#ifndef METRICS_THREAD_H
+#define METRICS_THREAD_H
+
+#include <stdint.h>
+#include "platform.h"
+#include "metrics.h"
+#include "latency_stats.h"
+#include "logger.h"
+
+typedef struct {
+    uint16_t port;            // Serve on 127.0.0.1:port, 0 for no TCP listener
+    const char* unix_path;    // Serve on this AF_UNIX socket path, NULL for none
+} metrics_thread_config;
+
+void metrics_thread(void* thread_config);
+void stop_metrics_thread(void);
+
+#endif // METRICS_THREAD_H
@@ -0,0 +1,261 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Platform layer.
+ *
+ * The portable modules (logger, protocol, fragments, in-flight table, cache,
+ * router, metrics registry, latency histograms and the TCP client) are written
+ * against the Win32 interlocked and SRW lock primitives and WinSock. On
+ * Windows this header just pulls in the system headers; elsewhere it supplies
+ * the same names on top of the GCC atomics, pthreads and BSD sockets. What
+ * the two have no common name for (threads, events, sleeping, CPU time, socket
+ * waits and errors, the log file, file mappings, CPU feature queries and the monotonic clock) goes through the platform_* functions
+ * below, implemented in platform_win32.c and platform_posix.c.
+ */
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <afunix.h>
+#include <intrin.h>
+
+#define PLATFORM_CACHE_ALIGNED(bytes) __declspec(align(bytes))
+#define PLATFORM_TARGET(features)
+#define PLATFORM_SOCKET_TIMED_OUT WSAETIMEDOUT
+#define PLATFORM_SOCKET_ABORTED WSAECONNABORTED
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define PLATFORM_X86 1
+
+static inline void platform_cpuid(int info[4], int leaf, int subleaf) {
+    __cpuidex(info, leaf, subleaf);
+}
+
+static inline uint64_t platform_xgetbv(uint32_t index) {
+    return _xgetbv(index);
+}
+#endif
+
+typedef HANDLE platform_thread;
+typedef HANDLE platform_event;
+
+// A file mapped into memory with platform_map_file.
+typedef struct {
+    HANDLE file;
+    HANDLE mapping;
+    void* view;
+} platform_mapped_file;
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+
+typedef int32_t LONG;
+typedef int64_t LONG64;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef uint64_t ULONGLONG;
+
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+
+#define PLATFORM_CACHE_ALIGNED(bytes) __attribute__((aligned(bytes)))
+// Lets one function use instructions the rest of the build is not compiled for.
+#define PLATFORM_TARGET(features) __attribute__((target(features)))
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define PLATFORM_X86 1
+
+static inline void platform_cpuid(int info[4], int leaf, int subleaf) {
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    info[0] = (int)a;
+    info[1] = (int)b;
+    info[2] = (int)c;
+    info[3] = (int)d;
+}
+
+// Only call once CPUID reports OSXSAVE.
+static inline uint64_t platform_xgetbv(uint32_t index) {
+    uint32_t low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+    return ((uint64_t)high << 32) | low;
+}
+#endif
+
+// The interlocked operations are full barriers, as on Windows.
+static inline LONG InterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand) {
+    __atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+static inline LONG64 InterlockedCompareExchange64(volatile LONG64* target, LONG64 exchange, LONG64 comparand) {
+    __atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+static inline LONG InterlockedExchange(volatile LONG* target, LONG value) {
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedIncrement(volatile LONG* target) {
+    return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG64 InterlockedIncrement64(volatile LONG64* target) {
+    return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG64 InterlockedExchangeAdd64(volatile LONG64* target, LONG64 value) {
+    return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG ReadAcquire(const volatile LONG* source) {
+    return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+static inline void WriteRelease(volatile LONG* destination, LONG value) {
+    __atomic_store_n(destination, value, __ATOMIC_RELEASE);
+}
+
+static inline LONG ReadNoFence(const volatile LONG* source) {
+    return __atomic_load_n(source, __ATOMIC_RELAXED);
+}
+
+static inline LONG64 ReadNoFence64(const volatile LONG64* source) {
+    return __atomic_load_n(source, __ATOMIC_RELAXED);
+}
+
+// Slim reader/writer lock.
+typedef pthread_rwlock_t SRWLOCK;
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+#define InitializeSRWLock(lock) pthread_rwlock_init((lock), NULL)
+#define AcquireSRWLockExclusive(lock) pthread_rwlock_wrlock(lock)
+#define ReleaseSRWLockExclusive(lock) pthread_rwlock_unlock(lock)
+#define AcquireSRWLockShared(lock) pthread_rwlock_rdlock(lock)
+#define ReleaseSRWLockShared(lock) pthread_rwlock_unlock(lock)
+
+#define SwitchToThread() sched_yield()
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor() __builtin_ia32_pause()
+#else
+#define YieldProcessor() ((void)0)
+#endif
+
+static inline uint16_t _byteswap_ushort(uint16_t value) {
+    return __builtin_bswap16(value);
+}
+
+static inline unsigned char _BitScanReverse64(unsigned long* index, uint64_t mask) {
+    if (mask == 0) {
+        return 0;
+    }
+    *index = 63 - (unsigned long)__builtin_clzll(mask);
+    return 1;
+}
+
+// Aligned allocation, released with _aligned_free.
+static inline void* _aligned_malloc(size_t size, size_t alignment) {
+    void* memory;
+    return posix_memalign(&memory, alignment, size) == 0 ? memory : NULL;
+}
+#define _aligned_free free
+
+ULONGLONG GetTickCount64(void);
+
+// 64-bit file positions, as off_t is on 64-bit Linux.
+#define _fseeki64 fseeko
+
+// BSD sockets under their WinSock names.
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#define PLATFORM_SOCKET_TIMED_OUT ETIMEDOUT
+#define PLATFORM_SOCKET_ABORTED ECONNABORTED
+#define SD_SEND SHUT_WR
+typedef struct sockaddr_un SOCKADDR_UN;
+
+// Removes a file, such as a Unix socket left behind by an earlier run.
+static inline BOOL DeleteFileA(const char* path) {
+    return unlink(path) == 0;
+}
+
+typedef struct platform_thread_state* platform_thread;
+typedef struct platform_event_state* platform_event;
+
+// A file mapped into memory with platform_map_file.
+typedef struct {
+    int fd;
+    void* view;
+    size_t size;
+} platform_mapped_file;
+
+#endif
+
+// Function run by a thread started with platform_thread_start.
+typedef void (*platform_thread_routine)(void* context);
+
+// One buffer of a vectored send.
+typedef struct {
+    const void* data;
+    size_t length;
+} platform_buffer;
+
+platform_thread platform_thread_start(platform_thread_routine routine, void* context);
+void platform_thread_join(platform_thread thread);
+
+void platform_sleep_ms(uint32_t milliseconds);
+uint64_t platform_process_cpu_us(void);
+uint64_t platform_thread_cpu_us(platform_thread thread);
+
+platform_event platform_event_create(void);
+void platform_event_signal(platform_event event);
+bool platform_event_wait(platform_event event, uint32_t timeout_ms);
+void platform_event_destroy(platform_event event);
+
+FILE* platform_open_log_file(const char* path);
+void* platform_map_file(const char* path, uint64_t size, platform_mapped_file* file);
+void platform_unmap_file(platform_mapped_file* file);
+int platform_last_error(void);
+
+int platform_socket_startup(void);
+void platform_socket_cleanup(void);
+int platform_socket_error(void);
+void platform_set_socket_error(int error);
+bool platform_socket_would_block(int error);
+int platform_socket_pending_error(SOCKET socket);
+int platform_set_socket_blocking(SOCKET socket, bool blocking);
+int platform_wait_socket(SOCKET socket, bool for_write, uint32_t timeout_ms);
+int platform_send_buffers(SOCKET socket, const platform_buffer* buffers, size_t buffer_count, size_t* bytes_sent);
+
+uint64_t monotonic_time_us(void);
+uint64_t monotonic_time_ns(void);
+
+#endif // PLATFORM_H
@@ -0,0 +1,418 @@
+#include "platform.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+struct platform_thread_state {
+    pthread_t thread;
+    platform_thread_routine routine;
+    void* context;
+};
+
+// Auto-reset event: a condition variable guarding one signalled flag.
+struct platform_event_state {
+    pthread_mutex_t mutex;
+    pthread_cond_t signalled_cond;
+    bool signalled;
+};
+
+/**
+ * Entry point of every thread started with platform_thread_start.
+ *
+ * @param parameter The thread's platform_thread_state.
+ * @return NULL when the routine returns.
+ */
+static void* run_thread(void* parameter) {
+    struct platform_thread_state* state = (struct platform_thread_state*)parameter;
+    state->routine(state->context);
+    return NULL;
+}
+
+/**
+ * Starts a thread.
+ *
+ * @param routine Function the thread runs.
+ * @param context Passed to routine.
+ * @return The thread, or NULL on failure.
+ */
+platform_thread platform_thread_start(platform_thread_routine routine, void* context) {
+    struct platform_thread_state* state = (struct platform_thread_state*)malloc(sizeof(struct platform_thread_state));
+    if (!state) {
+        return NULL;
+    }
+    state->routine = routine;
+    state->context = context;
+    if (pthread_create(&state->thread, NULL, run_thread, state) != 0) {
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+/**
+ * Waits for a thread to finish and releases it.
+ *
+ * @param thread The thread.
+ */
+void platform_thread_join(platform_thread thread) {
+    pthread_join(thread->thread, NULL);
+    free(thread);
+}
+
+/**
+ * Suspends the calling thread, resuming the sleep if a signal interrupts it.
+ *
+ * @param milliseconds How long to sleep.
+ */
+void platform_sleep_ms(uint32_t milliseconds) {
+    struct timespec remaining = { (time_t)(milliseconds / 1000), (long)(milliseconds % 1000) * 1000000 };
+    while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR) {
+    }
+}
+
+/**
+ * User plus system time every thread of the process has used so far.
+ *
+ * @return CPU time in microseconds, 0 if unavailable.
+ */
+uint64_t platform_process_cpu_us(void) {
+    struct timespec used;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &used) != 0) {
+        return 0;
+    }
+    return (uint64_t)used.tv_sec * 1000000 + (uint64_t)used.tv_nsec / 1000;
+}
+
+/**
+ * User plus system time a thread has used so far.
+ *
+ * @param thread A thread started with platform_thread_start and not yet joined.
+ * @return CPU time in microseconds, 0 if unavailable.
+ */
+uint64_t platform_thread_cpu_us(platform_thread thread) {
+    clockid_t clock;
+    struct timespec used;
+    if (pthread_getcpuclockid(thread->thread, &clock) != 0 || clock_gettime(clock, &used) != 0) {
+        return 0;
+    }
+    return (uint64_t)used.tv_sec * 1000000 + (uint64_t)used.tv_nsec / 1000;
+}
+
+/**
+ * Creates an auto-reset event: a wait consumes the signal. Waits time out
+ * against CLOCK_MONOTONIC, so changing the wall clock doesn't stretch them.
+ *
+ * @return The event, or NULL on failure.
+ */
+platform_event platform_event_create(void) {
+    struct platform_event_state* event = (struct platform_event_state*)calloc(1, sizeof(struct platform_event_state));
+    pthread_condattr_t attributes;
+    if (!event) {
+        return NULL;
+    }
+    if (pthread_condattr_init(&attributes) != 0) {
+        free(event);
+        return NULL;
+    }
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&event->mutex, NULL) != 0) {
+        pthread_condattr_destroy(&attributes);
+        free(event);
+        return NULL;
+    }
+    if (pthread_cond_init(&event->signalled_cond, &attributes) != 0) {
+        pthread_mutex_destroy(&event->mutex);
+        pthread_condattr_destroy(&attributes);
+        free(event);
+        return NULL;
+    }
+    pthread_condattr_destroy(&attributes);
+    return event;
+}
+
+/**
+ * Signals an event, waking one waiter or the next one to wait.
+ *
+ * @param event The event.
+ */
+void platform_event_signal(platform_event event) {
+    pthread_mutex_lock(&event->mutex);
+    event->signalled = true;
+    pthread_cond_signal(&event->signalled_cond);
+    pthread_mutex_unlock(&event->mutex);
+}
+
+/**
+ * Waits for an event to be signalled.
+ *
+ * @param event The event.
+ * @param timeout_ms How long to wait, INFINITE for no limit.
+ * @return true if signalled, false on timeout.
+ */
+bool platform_event_wait(platform_event event, uint32_t timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&event->mutex);
+    while (!event->signalled) {
+        int result = timeout_ms == INFINITE
+            ? pthread_cond_wait(&event->signalled_cond, &event->mutex)
+            : pthread_cond_timedwait(&event->signalled_cond, &event->mutex, &deadline);
+        if (result == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool signalled = event->signalled;
+    event->signalled = false;
+    pthread_mutex_unlock(&event->mutex);
+    return signalled;
+}
+
+/**
+ * Releases an event.
+ *
+ * @param event The event.
+ */
+void platform_event_destroy(platform_event event) {
+    pthread_cond_destroy(&event->signalled_cond);
+    pthread_mutex_destroy(&event->mutex);
+    free(event);
+}
+
+/**
+ * Opens the log file for appending. The descriptor is not inherited by child
+ * processes.
+ *
+ * @param path Path of the log file.
+ * @return The file, or NULL on failure (errno has the reason).
+ */
+FILE* platform_open_log_file(const char* path) {
+    return fopen(path, "ae");
+}
+
+/**
+ * Creates (or truncates) a file of the given size and maps all of it into
+ * memory for reading and writing.
+ *
+ * @param path Path of the file.
+ * @param size Size of the file in bytes.
+ * @param file Receives the mapping, for platform_unmap_file.
+ * @return The mapped view, or NULL on failure (platform_last_error has the reason).
+ */
+void* platform_map_file(const char* path, uint64_t size, platform_mapped_file* file) {
+    file->view = NULL;
+    file->size = (size_t)size;
+    file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file->fd < 0) {
+        return NULL;
+    }
+
+    // Extend the file to its full length up front
+    if (ftruncate(file->fd, (off_t)size) == 0) {
+        void* view = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+        file->view = view == MAP_FAILED ? NULL : view;
+    }
+    if (!file->view) {
+        int error = errno;
+        platform_unmap_file(file);
+        errno = error;
+    }
+    return file->view;
+}
+
+/**
+ * Flushes a mapped file to disk and releases it.
+ *
+ * @param file The mapping from platform_map_file.
+ */
+void platform_unmap_file(platform_mapped_file* file) {
+    if (file->view) {
+        msync(file->view, file->size, MS_SYNC);
+        munmap(file->view, file->size);
+        file->view = NULL;
+    }
+    if (file->fd >= 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+}
+
+/**
+ * Error code of the last failed file or system call on this thread.
+ *
+ * @return The error code.
+ */
+int platform_last_error(void) {
+    return errno;
+}
+
+/**
+ * Milliseconds on the monotonic clock, as GetTickCount64 counts them.
+ *
+ * @return Milliseconds since an arbitrary fixed point.
+ */
+ULONGLONG GetTickCount64(void) {
+    return monotonic_time_us() / 1000;
+}
+
+/**
+ * Nothing to initialize for BSD sockets.
+ *
+ * @return 0.
+ */
+int platform_socket_startup(void) {
+    return 0;
+}
+
+/**
+ * Nothing to release for BSD sockets.
+ */
+void platform_socket_cleanup(void) {
+}
+
+/**
+ * Error code of the last failed socket call on this thread.
+ *
+ * @return The error code.
+ */
+int platform_socket_error(void) {
+    return errno;
+}
+
+/**
+ * Sets the error code platform_socket_error reports.
+ *
+ * @param error The error code.
+ */
+void platform_set_socket_error(int error) {
+    errno = error;
+}
+
+/**
+ * Whether a socket error only means a non-blocking call could not complete yet.
+ *
+ * @param error The error code.
+ * @return true for EAGAIN, EWOULDBLOCK and a connect still in progress.
+ */
+bool platform_socket_would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINPROGRESS;
+}
+
+/**
+ * Takes the error of a socket, e.g. the outcome of a non-blocking connect.
+ *
+ * @param socket The socket.
+ * @return 0 if none, else the error code.
+ */
+int platform_socket_pending_error(SOCKET socket) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &length) == SOCKET_ERROR) {
+        return errno;
+    }
+    return error;
+}
+
+/**
+ * Switches a socket between blocking and non-blocking mode.
+ *
+ * @param socket The socket.
+ * @param blocking Whether calls on it block.
+ * @return 0 on success, -1 on failure.
+ */
+int platform_set_socket_blocking(SOCKET socket, bool blocking) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return fcntl(socket, F_SETFL, flags) < 0 ? -1 : 0;
+}
+
+/**
+ * Waits until a socket is readable or writable. A failed connect counts as
+ * writable, so the caller can pick up its error.
+ *
+ * @param socket The socket.
+ * @param for_write Wait for writability instead of readability.
+ * @param timeout_ms How long to wait, INFINITE for no limit.
+ * @return 1 once ready, 0 on timeout, -1 on error.
+ */
+int platform_wait_socket(SOCKET socket, bool for_write, uint32_t timeout_ms) {
+    struct pollfd target = { socket, (short)(for_write ? POLLOUT : POLLIN), 0 };
+    int ready;
+    do {
+        ready = poll(&target, 1, timeout_ms == INFINITE ? -1 : (int)timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0) {
+        return -1;
+    }
+    return ready > 0 ? 1 : 0;
+}
+
+/**
+ * Sends several buffers with one vectored call. A peer that has gone away
+ * fails the call with EPIPE instead of raising SIGPIPE.
+ *
+ * @param socket The socket.
+ * @param buffers The buffers, in order.
+ * @param buffer_count Number of buffers, at most 16.
+ * @param bytes_sent Receives the bytes sent, which may be fewer than asked for.
+ * @return 0 on success, -1 on failure (platform_socket_error has the reason).
+ */
+int platform_send_buffers(SOCKET socket, const platform_buffer* buffers, size_t buffer_count, size_t* bytes_sent) {
+    struct iovec vectors[16];
+    struct msghdr message = { 0 };
+
+    if (buffer_count > sizeof(vectors) / sizeof(vectors[0])) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < buffer_count; i++) {
+        vectors[i].iov_base = (void*)buffers[i].data;
+        vectors[i].iov_len = buffers[i].length;
+    }
+    message.msg_iov = vectors;
+    message.msg_iovlen = buffer_count;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return -1;
+    }
+    *bytes_sent = (size_t)sent;
+    return 0;
+}
+
+/**
+ * Returns a monotonic timestamp in microseconds, used to bound spin phases.
+ *
+ * @return Microseconds since an arbitrary fixed point.
+ */
+uint64_t monotonic_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+/**
+ * Reads the high-resolution monotonic clock in nanoseconds, for latency
+ * timestamps.
+ *
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,371 @@
+#include "platform.h"
+#include <stdlib.h>
+
+// What a thread started with platform_thread_start runs.
+typedef struct {
+    platform_thread_routine routine;
+    void* context;
+} thread_start;
+
+/**
+ * Entry point of every thread started with platform_thread_start.
+ *
+ * @param parameter The thread_start, released here.
+ * @return 0 when the routine returns.
+ */
+static DWORD WINAPI run_thread(LPVOID parameter) {
+    thread_start start = *(thread_start*)parameter;
+    free(parameter);
+    start.routine(start.context);
+    return 0;
+}
+
+/**
+ * Starts a thread.
+ *
+ * @param routine Function the thread runs.
+ * @param context Passed to routine.
+ * @return The thread, or NULL on failure.
+ */
+platform_thread platform_thread_start(platform_thread_routine routine, void* context) {
+    thread_start* start = (thread_start*)malloc(sizeof(thread_start));
+    if (!start) {
+        return NULL;
+    }
+    start->routine = routine;
+    start->context = context;
+
+    HANDLE thread = CreateThread(NULL, 0, run_thread, start, 0, NULL);
+    if (!thread) {
+        free(start);
+    }
+    return thread;
+}
+
+/**
+ * Waits for a thread to finish and releases it.
+ *
+ * @param thread The thread.
+ */
+void platform_thread_join(platform_thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/**
+ * Suspends the calling thread.
+ *
+ * @param milliseconds How long to sleep.
+ */
+void platform_sleep_ms(uint32_t milliseconds) {
+    Sleep(milliseconds);
+}
+
+/**
+ * Converts a FILETIME span to microseconds.
+ *
+ * @param time The FILETIME, in 100 ns units.
+ * @return The span in microseconds.
+ */
+static uint64_t filetime_us(const FILETIME* time) {
+    return (((uint64_t)time->dwHighDateTime << 32) | time->dwLowDateTime) / 10;
+}
+
+/**
+ * User plus kernel time every thread of the process has used so far.
+ *
+ * @return CPU time in microseconds, 0 if unavailable.
+ */
+uint64_t platform_process_cpu_us(void) {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    return filetime_us(&kernel) + filetime_us(&user);
+}
+
+/**
+ * User plus kernel time a thread has used so far.
+ *
+ * @param thread A thread started with platform_thread_start and not yet joined.
+ * @return CPU time in microseconds, 0 if unavailable.
+ */
+uint64_t platform_thread_cpu_us(platform_thread thread) {
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(thread, &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    return filetime_us(&kernel) + filetime_us(&user);
+}
+
+/**
+ * Creates an auto-reset event: a wait consumes the signal.
+ *
+ * @return The event, or NULL on failure.
+ */
+platform_event platform_event_create(void) {
+    return CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/**
+ * Signals an event, waking one waiter or the next one to wait.
+ *
+ * @param event The event.
+ */
+void platform_event_signal(platform_event event) {
+    SetEvent(event);
+}
+
+/**
+ * Waits for an event to be signalled.
+ *
+ * @param event The event.
+ * @param timeout_ms How long to wait, INFINITE for no limit.
+ * @return true if signalled, false on timeout.
+ */
+bool platform_event_wait(platform_event event, uint32_t timeout_ms) {
+    return WaitForSingleObject(event, timeout_ms) == WAIT_OBJECT_0;
+}
+
+/**
+ * Releases an event.
+ *
+ * @param event The event.
+ */
+void platform_event_destroy(platform_event event) {
+    CloseHandle(event);
+}
+
+/**
+ * Opens the log file for appending.
+ *
+ * @param path Path of the log file.
+ * @return The file, or NULL on failure (errno has the reason).
+ */
+FILE* platform_open_log_file(const char* path) {
+    FILE* file = NULL;
+    return fopen_s(&file, path, "a") == 0 ? file : NULL;
+}
+
+/**
+ * Creates (or truncates) a file of the given size and maps all of it into
+ * memory for reading and writing.
+ *
+ * @param path Path of the file.
+ * @param size Size of the file in bytes.
+ * @param file Receives the mapping, for platform_unmap_file.
+ * @return The mapped view, or NULL on failure (platform_last_error has the reason).
+ */
+void* platform_map_file(const char* path, uint64_t size, platform_mapped_file* file) {
+    file->mapping = NULL;
+    file->view = NULL;
+    file->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    // Sizing the mapping extends the file to its full length up front
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (file->mapping) {
+        file->view = MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    }
+    if (!file->view) {
+        DWORD error = GetLastError();
+        platform_unmap_file(file);
+        SetLastError(error);
+    }
+    return file->view;
+}
+
+/**
+ * Flushes a mapped file to disk and releases it.
+ *
+ * @param file The mapping from platform_map_file.
+ */
+void platform_unmap_file(platform_mapped_file* file) {
+    if (file->view) {
+        FlushViewOfFile(file->view, 0);
+        UnmapViewOfFile(file->view);
+        file->view = NULL;
+    }
+    if (file->mapping) {
+        CloseHandle(file->mapping);
+        file->mapping = NULL;
+    }
+    if (file->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file->file);
+        file->file = INVALID_HANDLE_VALUE;
+    }
+}
+
+/**
+ * Error code of the last failed file or system call on this thread.
+ *
+ * @return The error code.
+ */
+int platform_last_error(void) {
+    return (int)GetLastError();
+}
+
+/**
+ * Initializes WinSock. Every successful call is paired with platform_socket_cleanup.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int platform_socket_startup(void) {
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0 ? 0 : -1;
+}
+
+/**
+ * Releases one platform_socket_startup.
+ */
+void platform_socket_cleanup(void) {
+    WSACleanup();
+}
+
+/**
+ * Error code of the last failed socket call on this thread.
+ *
+ * @return The error code.
+ */
+int platform_socket_error(void) {
+    return WSAGetLastError();
+}
+
+/**
+ * Sets the error code platform_socket_error reports.
+ *
+ * @param error The error code.
+ */
+void platform_set_socket_error(int error) {
+    WSASetLastError(error);
+}
+
+/**
+ * Whether a socket error only means a non-blocking call could not complete yet.
+ *
+ * @param error The error code.
+ * @return true for WSAEWOULDBLOCK.
+ */
+bool platform_socket_would_block(int error) {
+    return error == WSAEWOULDBLOCK;
+}
+
+/**
+ * Takes the error of a socket, e.g. the outcome of a non-blocking connect.
+ *
+ * @param socket The socket.
+ * @return 0 if none, else the error code.
+ */
+int platform_socket_pending_error(SOCKET socket) {
+    int error = 0;
+    int length = sizeof(error);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == SOCKET_ERROR) {
+        return WSAGetLastError();
+    }
+    return error;
+}
+
+/**
+ * Switches a socket between blocking and non-blocking mode.
+ *
+ * @param socket The socket.
+ * @param blocking Whether calls on it block.
+ * @return 0 on success, -1 on failure.
+ */
+int platform_set_socket_blocking(SOCKET socket, bool blocking) {
+    u_long non_blocking = blocking ? 0 : 1;
+    return ioctlsocket(socket, FIONBIO, &non_blocking) == SOCKET_ERROR ? -1 : 0;
+}
+
+/**
+ * Waits until a socket is readable or writable. A failed connect counts as
+ * writable, so the caller can pick up its error.
+ *
+ * @param socket The socket.
+ * @param for_write Wait for writability instead of readability.
+ * @param timeout_ms How long to wait, INFINITE for no limit.
+ * @return 1 once ready, 0 on timeout, -1 on error.
+ */
+int platform_wait_socket(SOCKET socket, bool for_write, uint32_t timeout_ms) {
+    fd_set socket_set, error_set;
+    FD_ZERO(&socket_set);
+    FD_ZERO(&error_set);
+    FD_SET(socket, &socket_set);
+    FD_SET(socket, &error_set);
+    struct timeval timeout = { (long)(timeout_ms / 1000), (long)(timeout_ms % 1000) * 1000 };
+
+    // WinSock reports a failed connect in the exception set rather than as writable
+    int ready = select(0, for_write ? NULL : &socket_set, for_write ? &socket_set : NULL, for_write ? &error_set : NULL,
+        timeout_ms == INFINITE ? NULL : &timeout);
+    if (ready == SOCKET_ERROR) {
+        return -1;
+    }
+    return ready > 0 ? 1 : 0;
+}
+
+/**
+ * Sends several buffers with one vectored call.
+ *
+ * @param socket The socket.
+ * @param buffers The buffers, in order.
+ * @param buffer_count Number of buffers, at most 16.
+ * @param bytes_sent Receives the bytes sent, which may be fewer than asked for.
+ * @return 0 on success, -1 on failure (platform_socket_error has the reason).
+ */
+int platform_send_buffers(SOCKET socket, const platform_buffer* buffers, size_t buffer_count, size_t* bytes_sent) {
+    WSABUF wsa_buffers[16];
+    DWORD sent = 0;
+
+    if (buffer_count > sizeof(wsa_buffers) / sizeof(wsa_buffers[0])) {
+        WSASetLastError(WSAEINVAL);
+        return -1;
+    }
+    for (size_t i = 0; i < buffer_count; i++) {
+        wsa_buffers[i].buf = (char*)buffers[i].data;
+        wsa_buffers[i].len = (ULONG)buffers[i].length;
+    }
+    if (WSASend(socket, wsa_buffers, (DWORD)buffer_count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+        return -1;
+    }
+    *bytes_sent = sent;
+    return 0;
+}
+
+/**
+ * Returns a monotonic timestamp in microseconds, used to bound spin phases.
+ *
+ * @return Microseconds since an arbitrary fixed point.
+ */
+uint64_t monotonic_time_us(void) {
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000 +
+        ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+}
+
+/**
+ * Reads the high-resolution monotonic clock in nanoseconds, for latency
+ * timestamps.
+ *
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+uint64_t monotonic_time_ns(void) {
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000000 +
+        ((counter.QuadPart % frequency.QuadPart) * 1000000000) / frequency.QuadPart);
+}
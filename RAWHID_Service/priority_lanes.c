@@ -0,0 +1,105 @@
+#include "priority_lanes.h"
+
+const char* const priority_class_names[PRIORITY_CLASS_COUNT] = { "critical", "normal", "bulk" };
+
+/**
+ * Checks that the rules form a URI range table and every class exists. No
+ * rules at all is valid: every request is then PRIORITY_NORMAL.
+ *
+ * @param config The priority configuration.
+ * @return 1 if the configuration is usable, 0 otherwise.
+ */
+int validate_priority_config(const priority_config* config) {
+    if (!config || config->rule_count == 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < config->rule_count; i++) {
+        const priority_rule* rule = &config->rules[i];
+        if ((unsigned)rule->priority >= PRIORITY_CLASS_COUNT) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Priority Lanes - Rule %zu names unknown class %d", i, (int)rule->priority);
+            return 0;
+        }
+    }
+
+    size_t unsorted = URI_RANGE_FIRST_UNSORTED(config->rules, config->rule_count);
+    if (unsorted < config->rule_count) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Priority Lanes - Rule ranges must start at 0 and increase (rule %zu)", unsorted);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Finds the class of a URI.
+ *
+ * @param config A validated priority configuration, or NULL.
+ * @param uri The URI.
+ * @return The class of the last rule starting at or below the URI, PRIORITY_NORMAL without rules.
+ */
+priority_class priority_of_uri(const priority_config* config, uint64_t uri) {
+    if (!config || config->rule_count == 0) {
+        return PRIORITY_NORMAL;
+    }
+    return config->rules[URI_RANGE_LOOKUP(config->rules, config->rule_count, uri)].priority;
+}
+
+/**
+ * Finds the class of a request from its URI (for a fragmented request, the
+ * first fragment, whose payload starts with the URI).
+ *
+ * @param config A validated priority configuration, or NULL.
+ * @param request The request frame.
+ * @return Its class.
+ */
+priority_class priority_of_request(const priority_config* config, const uint8_t* request) {
+    uint64_t uri;
+    extract_request_uri(request, &uri);
+    return priority_of_uri(config, uri);
+}
+
+/**
+ * Sets up the scheduler of one set of per-class queues.
+ *
+ * @param scheduler Pointer to the scheduler.
+ * @param config The priority configuration, or NULL for strict priority.
+ */
+void priority_scheduler_init(priority_scheduler* scheduler, const priority_config* config) {
+    scheduler->policy = config ? config->policy : PRIORITY_STRICT;
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        scheduler->weights[i] = config ? config->weights[i] : 1;
+    }
+    scheduler->current = 0;
+    scheduler->credit = scheduler->weights[0];
+}
+
+/**
+ * Picks the class to take the next frame from and charges it for the frame.
+ * Under PRIORITY_WEIGHTED each class keeps its turn until it has taken its
+ * weight in frames or runs dry; a class with weight 0 is only served when
+ * no other class has frames.
+ *
+ * @param scheduler Pointer to the scheduler.
+ * @param waiting Bit c set if class c has frames queued.
+ * @return The class to serve, or -1 if nothing is waiting.
+ */
+int priority_scheduler_next(priority_scheduler* scheduler, uint32_t waiting) {
+    int highest = -1;
+    for (int i = 0; i < PRIORITY_CLASS_COUNT && highest < 0; i++) {
+        if (waiting & (1u << i)) {
+            highest = i;
+        }
+    }
+    if (highest < 0 || scheduler->policy == PRIORITY_STRICT) {
+        return highest;
+    }
+
+    for (int turns = 0; turns <= PRIORITY_CLASS_COUNT; turns++) {
+        if (scheduler->credit > 0 && (waiting & (1u << scheduler->current))) {
+            scheduler->credit--;
+            return (int)scheduler->current;
+        }
+        scheduler->current = (scheduler->current + 1) % PRIORITY_CLASS_COUNT;
+        scheduler->credit = scheduler->weights[scheduler->current];
+    }
+    return highest;  // Only classes with weight 0 are waiting
+}
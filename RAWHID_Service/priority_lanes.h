@@ -0,0 +1,64 @@
+#ifndef PRIORITY_LANES_H
+#define PRIORITY_LANES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "message_protocol.h"
+#include "uri_index.h"
+#include "logger.h"
+
+/**
+ * Priority classes of the frames crossing the bridge. A request is classed
+ * by its URI, and its response travels in the same class. Wherever frames
+ * queue up (the rings between the Windows threads, a Linux device's write
+ * queue) each class is queued on its own, and the consumer asks a
+ * priority_scheduler which class to take from next, so a burst of bulk
+ * frames never sits in front of a critical one. Critical requests are also
+ * sent upstream at once, without waiting out the send batching delay.
+ */
+
+typedef enum {
+    PRIORITY_CRITICAL,        // Served first and never held for batching, e.g. an emergency stop key
+    PRIORITY_NORMAL,
+    PRIORITY_BULK,            // Served last, e.g. telemetry bursts
+    PRIORITY_CLASS_COUNT
+} priority_class;
+
+// Which class a range of URIs belongs to.
+typedef struct {
+    uint64_t range_start;     // First URI the rule applies to; it runs up to the next rule's start
+    priority_class priority;
+} priority_rule;
+
+// How the consumer of a set of queues picks the next class to serve.
+typedef enum {
+    PRIORITY_STRICT,          // Always the highest class that has frames waiting
+    PRIORITY_WEIGHTED         // Each class in turn for up to its weight in frames, so none starves
+} priority_policy;
+
+// How requests are classed and the classes scheduled.
+typedef struct {
+    const priority_rule* rules;   // A URI range table (uri_index.h)
+    size_t rule_count;
+    priority_policy policy;
+    uint32_t weights[PRIORITY_CLASS_COUNT];  // Frames per turn under PRIORITY_WEIGHTED
+} priority_config;
+
+// Consumer-side scheduling state of one set of per-class queues. Owned by the consumer, so no locking.
+typedef struct {
+    priority_policy policy;
+    uint32_t weights[PRIORITY_CLASS_COUNT];
+    uint32_t current;         // Class whose turn it is (weighted only)
+    uint32_t credit;          // Frames it may still take this turn (weighted only)
+} priority_scheduler;
+
+extern const char* const priority_class_names[PRIORITY_CLASS_COUNT];
+
+int validate_priority_config(const priority_config* config);
+priority_class priority_of_uri(const priority_config* config, uint64_t uri);
+priority_class priority_of_request(const priority_config* config, const uint8_t* request);
+void priority_scheduler_init(priority_scheduler* scheduler, const priority_config* config);
+int priority_scheduler_next(priority_scheduler* scheduler, uint32_t waiting);
+
+#endif // PRIORITY_LANES_H
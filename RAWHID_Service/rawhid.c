@@ -9,22 +9,22 @@
 hid_device* get_handle(hid_usage_info* usage_info) {
     // Check if the usage_info argument is NULL
     if (!usage_info) {
-        write_log(LOGLEVEL_ERROR, "RAWHID - Usage info is NULL");
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Usage info is NULL");
         return NULL; // Return NULL to indicate failure
     }
 
-    write_log_format(LOGLEVEL_INFO, "RAWHID - Attempting to open HID device with Vendor ID: 0x%x, Product ID: 0x%x",
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Attempting to open HID device with Vendor ID: 0x%x, Product ID: 0x%x",
         usage_info->vendor_id, usage_info->product_id);
     // Open the HID device using vendor and product IDs
     hid_device* handle = hid_open(usage_info->vendor_id, usage_info->product_id, NULL);
     if (!handle) {
-        write_log_format(LOGLEVEL_ERROR, "RAWHID - Failed to get handle for Vendor ID: 0x%x, Product ID: 0x%x",
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID - Failed to get handle for Vendor ID: 0x%x, Product ID: 0x%x",
             usage_info->vendor_id, usage_info->product_id);
         return NULL; // Return NULL to indicate failure
     }
 
     // Log success and return the handle
-    write_log_format(LOGLEVEL_INFO, "RAWHID - Successfully got handle for Vendor ID: 0x%x, Product ID: 0x%x",
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Successfully got handle for Vendor ID: 0x%x, Product ID: 0x%x",
         usage_info->vendor_id, usage_info->product_id);
     return handle;
 }
@@ -38,22 +38,22 @@ hid_device* get_handle(hid_usage_info* usage_info) {
 void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
     // Check for invalid arguments
     if (!handle || !usage_info) {
-        write_log(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
         return;
     }
 
     // Check if handle is NULL
     if (*handle == NULL) {
-        write_log(LOGLEVEL_ERROR, "RAWHID - No handle to open");
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - No handle to open");
         return;
     }
 
-    write_log_format(LOGLEVEL_INFO, "RAWHID - Enumerating HID devices for Vendor ID: 0x%x, Product ID: 0x%x",
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Enumerating HID devices for Vendor ID: 0x%x, Product ID: 0x%x",
         usage_info->vendor_id, usage_info->product_id);
     // Enumerate HID devices using vendor and product IDs
     struct hid_device_info* enum_device_info = hid_enumerate(usage_info->vendor_id, usage_info->product_id);
     if (!enum_device_info) {
-        write_log_format(LOGLEVEL_ERROR, "RAWHID - Failed to enumerate devices for Vendor ID: 0x%x, Product ID: 0x%x",
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID - Failed to enumerate devices for Vendor ID: 0x%x, Product ID: 0x%x",
             usage_info->vendor_id, usage_info->product_id);
         return;
     }
@@ -66,12 +66,12 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
             // Open the device by its path
             *handle = hid_open_path(enum_device_info->path);
             if (*handle) {
-                write_log_format(LOGLEVEL_INFO, "RAWHID - Successfully opened device with Usage Page: 0x%x, Usage: 0x%x",
+                WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Successfully opened device with Usage Page: 0x%x, Usage: 0x%x",
                     usage_info->usage_page, usage_info->usage);
                 break;
             }
             else {
-                write_log_format(LOGLEVEL_ERROR, "RAWHID - Failed to open device with Usage Page: 0x%x, Usage: 0x%x",
+                WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID - Failed to open device with Usage Page: 0x%x, Usage: 0x%x",
                     usage_info->usage_page, usage_info->usage);
             }
         }
@@ -81,6 +81,125 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
     hid_free_enumeration(enum_device_info);
 }
 
+/**
+ * Opens every interface matching one of the given VID/PID/usage tuples.
+ *
+ * @param filters Array of hid_usage_info structs describing wanted interfaces.
+ * @param filter_count Number of entries in filters.
+ * @param open_all Open every match if true, stop after the first one otherwise.
+ * @param devices Array receiving the opened devices and their paths.
+ * @param max_devices Capacity of devices.
+ * @return The number of devices opened.
+ */
+size_t open_matching_devices(const hid_usage_info* filters, size_t filter_count, bool open_all, hid_opened_device* devices, size_t max_devices) {
+    size_t opened = 0;
+
+    if (!filters || !devices) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
+        return 0;
+    }
+
+    for (size_t i = 0; i < filter_count && opened < max_devices; i++) {
+        const hid_usage_info* filter = &filters[i];
+
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Enumerating HID devices for Vendor ID: 0x%x, Product ID: 0x%x, Usage Page: 0x%x, Usage: 0x%x",
+            filter->vendor_id, filter->product_id, filter->usage_page, filter->usage);
+        struct hid_device_info* enum_head = hid_enumerate(filter->vendor_id, filter->product_id);
+
+        for (struct hid_device_info* info = enum_head; info != NULL && opened < max_devices; info = info->next) {
+            if (info->usage_page != filter->usage_page || info->usage != filter->usage) {
+                continue;
+            }
+
+            char* path = _strdup(info->path);
+            hid_device* handle = path ? hid_open_path(path) : NULL;
+            if (!handle) {
+                WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID - Failed to open device at %s", info->path);
+                free(path);
+                continue;
+            }
+
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID - Opened device %zu at %s", opened, path);
+            devices[opened].handle = handle;
+            devices[opened].path = path;
+            devices[opened].filter_index = i;
+            opened++;
+            if (!open_all) {
+                break;
+            }
+        }
+
+        hid_free_enumeration(enum_head);
+        if (!open_all && opened > 0) {
+            break;
+        }
+    }
+
+    return opened;
+}
+
+/**
+ * Enumerates the interfaces matching one VID/PID/usage tuple and opens the
+ * first one not rejected by skip. Used to find a device again after it came
+ * back under a different path.
+ *
+ * @param filter The tuple to match.
+ * @param skip Optional callback rejecting paths that must not be opened.
+ * @param skip_context Passed through to skip.
+ * @param opened_path Receives a copy of the opened path on success; release with free.
+ * @return A handle to the opened device, or NULL if none could be opened.
+ */
+hid_device* open_first_matching(const hid_usage_info* filter, hid_path_filter skip, void* skip_context, char** opened_path) {
+    hid_device* handle = NULL;
+
+    if (!filter || !opened_path) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
+        return NULL;
+    }
+
+    struct hid_device_info* enum_head = hid_enumerate(filter->vendor_id, filter->product_id);
+    for (struct hid_device_info* info = enum_head; info != NULL && !handle; info = info->next) {
+        if (info->usage_page != filter->usage_page || info->usage != filter->usage) {
+            continue;
+        }
+        if (skip && skip(info->path, skip_context)) {
+            continue;
+        }
+
+        char* path = _strdup(info->path);
+        handle = path ? hid_open_path(path) : NULL;
+        if (handle) {
+            *opened_path = path;
+        }
+        else {
+            free(path);
+        }
+    }
+    hid_free_enumeration(enum_head);
+
+    return handle;
+}
+
+/**
+ * Reads the report size of an opened device from its report descriptor: the
+ * smaller of its largest input and output reports, so a frame of that size
+ * can be both read from and written to it.
+ *
+ * @param handle The handle to the HID device.
+ * @return The report size in bytes, or 0 if the descriptor is unavailable.
+ */
+size_t hid_report_size(hid_device* handle) {
+    unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+
+    int length = hid_get_report_descriptor(handle, descriptor, sizeof(descriptor));
+    if (length <= 0) {
+        WRITE_LOG(LOGLEVEL_WARN, "RAWHID - Failed to read report descriptor");
+        return 0;
+    }
+
+    return hid_descriptor_report_size(descriptor, (size_t)length);
+}
+
 /**
  * Writes a message to the given HID handle.
  *
@@ -89,23 +208,23 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
  * @param size The size of the message in bytes.
  * @return The number of bytes written, or -1 if an error occurs.
  */
-int write_to_handle(hid_device** handle, unsigned char* message, size_t size) {
+int write_to_handle(hid_device* handle, unsigned char* message, size_t size) {
     // Check for invalid arguments
-    if (*handle == NULL || !message) {
-        write_log(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
+    if (handle == NULL || !message) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
         return -1; // Return -1 to indicate failure
     }
 
     // Log the writing action
-    write_log_format(LOGLEVEL_DEBUG, "RAWHID - Attempting to write %d bytes to handle", size);
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "RAWHID - Attempting to write %d bytes to handle", size);
 
     // Write the message to the HID device
     int result = hid_write(handle, message, size);
     if (result < 0) {
-        write_log(LOGLEVEL_ERROR, "RAWHID - Failed to write to handle");
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID - Failed to write to handle");
         return result;
     }
 
-    write_log(LOGLEVEL_DEBUG, "RAWHID - Wrote to handle", message);
+    WRITE_LOG(LOGLEVEL_DEBUG, "RAWHID - Wrote to handle");
     return result; // Return the number of bytes written or -1 if an error occurs
 }
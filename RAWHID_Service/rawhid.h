@@ -4,23 +4,31 @@
 #include <hidapi.h>
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <synchapi.h>
 #include <time.h>
+#include "hid_descriptor.h"
 #include "logger.h"
 
-// Structure to hold information required for HID device usage.
+// A device opened by open_matching_devices, with what is needed to reopen it.
 typedef struct {
-    uint16_t vendor_id;   // Vendor ID of the device
-    uint16_t product_id;  // Product ID of the device
-    uint16_t usage_page;  // Usage page
-    uint8_t usage;        // Usage ID
-} hid_usage_info;
+    hid_device* handle;
+    char* path;           // Path it was opened from; owned by the caller, release with free
+    size_t filter_index;  // Which filter tuple it matched
+} hid_opened_device;
+
+// Returns true for an enumerated path that must not be opened (e.g. one already in use).
+typedef bool (*hid_path_filter)(const char* path, void* context);
 
 // Function prototypes
-hid_device* get_handle(struct hid_usage_info* device_info);
-void open_usage_path(struct hid_usage_info* device_info, hid_device** handle);
-int write_to_handle(hid_device** handle, unsigned char* message, size_t size);
+hid_device* get_handle(hid_usage_info* device_info);
+void open_usage_path(hid_usage_info* device_info, hid_device** handle);
+size_t open_matching_devices(const hid_usage_info* filters, size_t filter_count, bool open_all, hid_opened_device* devices, size_t max_devices);
+hid_device* open_first_matching(const hid_usage_info* filter, hid_path_filter skip, void* skip_context, char** opened_path);
+size_t hid_report_size(hid_device* handle);
+int write_to_handle(hid_device* handle, unsigned char* message, size_t size);
 
 #endif // _RAWHID_H_
@@ -1,100 +1,660 @@
 #include "rawhid_thread.h"
 
+// How often a blocked reader wakes up to check whether it should stop.
+#define READER_STOP_CHECK_MS 500
+
+typedef struct hid_bridge hid_bridge;
+
+// One bridged HID device and the state its reader needs.
+typedef struct {
+    uint8_t index;        // Device index carried in the frames of this device
+    hid_device* handle;   // NULL while the device is lost; only its reader changes it, under write_mutex
+    char* path;           // Last path the device was opened from; only its reader changes it, under path_lock
+    const hid_usage_info* filter;  // Tuple the device matched, used to find it again
+    HANDLE write_mutex;   // Serializes hid_write between confirmations and responses
+    uint8_t frame_size;   // Bytes per report; only its reader changes it, under write_mutex
+    hid_bridge* bridge;
+    uint32_t spin_budget_us;
+    bridge_frame* held;   // Responses waiting for the device to come back (writer only)
+    uint32_t held_start;
+    uint32_t held_count;
+    uint64_t held_dropped;
+    uint32_t reacquisitions;
+    uint64_t frames_read;     // Reports read from the device (its reader only)
+    uint64_t frames_written;  // Responses written to the device (writer only)
+    fragment_assembler fragments;  // Fragmented request being read (its reader only)
+    uint64_t message_read_ns; // When its first fragment was read
+} hid_device_context;
+
+// Devices and threads of the HID side, shared by the readers and the writer.
+struct hid_bridge {
+    hid_device_context* devices;
+    size_t device_count;
+    shared_thread_data* shared_data;
+    SRWLOCK path_lock;          // Guards the path of every device
+    HANDLE stop_event;          // Manual-reset; stops the writer
+    HANDLE reacquired_event;    // Auto-reset; tells the writer a device is back
+    volatile LONG stop_requested;  // Stops the readers
+    uint32_t spin_budget_us;
+    uint32_t reacquire_interval_ms;
+    uint32_t enumerate_interval_ms;
+    uint32_t held_capacity;
+    uint8_t configured_frame_size;  // Frame size for every device, 0 to use each one's report size
+};
+
+/**
+ * Writes a message to a device while holding its write mutex, so that
+ * confirmations from the reader and responses from the writer never interleave.
+ * The message is written as one frame of the device's frame size,
+ * zero-padded if it came from a link with smaller frames.
+ *
+ * @param device Pointer to the device context.
+ * @param message Pointer to the message buffer, MESSAGE_MAX_SIZE_BYTES long.
+ * @param size The size of the message in bytes.
+ * @return The number of bytes written, or -1 if an error occurs or the device is lost.
+ */
+static int locked_write_to_handle(hid_device_context* device, unsigned char* message, size_t size) {
+    if (WaitForSingleObject(device->write_mutex, INFINITE) != WAIT_OBJECT_0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID Thread - Failed to acquire write mutex of device %u", device->index);
+        return -1;
+    }
+    resize_message(message, size, device->frame_size);
+    int result = device->handle ? write_to_handle(device->handle, message, device->frame_size) : -1;
+    ReleaseMutex(device->write_mutex);
+    return result;
+}
+
+/**
+ * Writes a response to a device. A fragmented response is written as
+ * fragments of the device's frame size, all under one hold of the write
+ * mutex so no confirmation lands in between.
+ *
+ * @param device Pointer to the device context.
+ * @param frame The response.
+ * @return The number of bytes written, or -1 if an error occurs or the device is lost.
+ */
+static int write_response(hid_device_context* device, bridge_frame* frame) {
+    if (!frame->payload) {
+        return locked_write_to_handle(device, frame->data, frame->size);
+    }
+
+    if (WaitForSingleObject(device->write_mutex, INFINITE) != WAIT_OBJECT_0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID Thread - Failed to acquire write mutex of device %u", device->index);
+        return -1;
+    }
+    int written = 0;
+    size_t count = message_fragment_count(frame->payload->size, device->frame_size);
+    for (size_t i = 0; i < count && written >= 0; i++) {
+        unsigned char fragment[MESSAGE_MAX_SIZE_BYTES];
+        fragment_message(fragment, device->frame_size, frame->data, frame->payload, i);
+        int result = device->handle ? write_to_handle(device->handle, fragment, device->frame_size) : -1;
+        written = result < 0 ? -1 : written + result;
+    }
+    ReleaseMutex(device->write_mutex);
+    return written;
+}
+
+/**
+ * Reads one report from the device. Polls without blocking for up to the spin
+ * budget and then blocks in hid_read_timeout until a report arrives or the
+ * stop check interval passes, so an idle device costs no CPU.
+ *
+ * @param handle The handle to the HID device.
+ * @param buffer Buffer receiving the report.
+ * @param size Size of the buffer in bytes.
+ * @param spin_budget_us How long to poll before blocking, in microseconds.
+ * @return The number of bytes read, 0 on timeout, or -1 on error.
+ */
+static int read_report(hid_device* handle, unsigned char* buffer, size_t size, uint32_t spin_budget_us) {
+    if (spin_budget_us > 0) {
+        uint64_t deadline = monotonic_time_us() + spin_budget_us;
+        do {
+            int bytes_read = hid_read_timeout(handle, buffer, size, 0);
+            if (bytes_read != 0) {
+                return bytes_read;
+            }
+            YieldProcessor();
+        } while (monotonic_time_us() < deadline);
+    }
+
+    return hid_read_timeout(handle, buffer, size, READER_STOP_CHECK_MS);
+}
+
+/**
+ * Keeps a response for a lost device until it comes back, discarding the
+ * oldest held response if the device's buffer is full. Writer thread only.
+ *
+ * @param device Pointer to the device context.
+ * @param frame The response to hold.
+ */
+static void hold_response(hid_device_context* device, const bridge_frame* frame) {
+    uint32_t capacity = device->bridge->held_capacity;
+    if (capacity == 0) {
+        message_payload_free(frame->payload);
+        device->held_dropped++;
+        return;
+    }
+    if (device->held_count == capacity) {
+        message_payload_free(device->held[device->held_start].payload);
+        device->held_start = (device->held_start + 1) % capacity;
+        device->held_count--;
+        device->held_dropped++;
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Device %u still lost, dropped its oldest held response", device->index);
+    }
+    device->held[(device->held_start + device->held_count) % capacity] = *frame;
+    device->held_count++;
+}
+
+/**
+ * Stamps a response as written to its device, records its latencies and
+ * releases its payload.
+ *
+ * @param device The device the response was written to.
+ * @param frame The response just written.
+ */
+static void record_delivery(hid_device_context* device, bridge_frame* frame) {
+    device->frames_written++;
+    frame->timing.hid_written_ns = monotonic_time_ns();
+    latency_record_request(&frame->timing, frame->priority);
+    message_payload_free(frame->payload);
+    frame->payload = NULL;
+}
+
+/**
+ * Delivers the responses held for a device once it is back. Writer thread only.
+ *
+ * @param device Pointer to the device context.
+ */
+static void flush_held_responses(hid_device_context* device) {
+    uint32_t delivered = 0;
+    while (device->held_count > 0) {
+        bridge_frame* frame = &device->held[device->held_start];
+        if (write_response(device, frame) < 0) {
+            break;  // Lost again; keep the rest for the next reacquisition
+        }
+        record_delivery(device, frame);
+        device->held_start = (device->held_start + 1) % device->bridge->held_capacity;
+        device->held_count--;
+        delivered++;
+    }
+    if (delivered > 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Delivered %u held response(s) to device %u", delivered, device->index);
+    }
+}
+
 /**
- * The thread function that handles communication with the HID device.
+ * Writes a frame to a device after whatever is held for it, or holds it
+ * while the device is lost. Writer thread only.
+ *
+ * @param device Pointer to the device context.
+ * @param frame The frame; its payload is taken over.
+ */
+static void deliver_frame(hid_device_context* device, bridge_frame* frame) {
+    if (device->held_count > 0) {
+        flush_held_responses(device);  // Older responses go first
+    }
+    if (device->held_count > 0 || write_response(device, frame) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Device %u unavailable, holding response", device->index);
+        hold_response(device, frame);
+    }
+    else {
+        record_delivery(device, frame);
+    }
+}
+
+/**
+ * Thread function that forwards messages from the TCP client to the devices,
+ * routing each by the device index it carries; a push for every device goes
+ * to each of them. Responses for a lost device are held and delivered when it
+ * comes back. Blocks on its events (after an optional spin phase) instead of
+ * polling, and exits when the stop event is signalled.
+ *
+ * @param writer_context Pointer to the hid_bridge.
+ * @return 0 on successful execution.
+ */
+static DWORD WINAPI rawhid_writer_thread(LPVOID writer_context) {
+    hid_bridge* bridge = (hid_bridge*)writer_context;
+    HANDLE wait_handles[3] = { bridge->shared_data->response_received_event, bridge->reacquired_event, bridge->stop_event };
+    bridge_frame message_from_tcp;
+
+    WRITE_LOG(LOGLEVEL_INFO, "RAWHID Thread - Writer started.");
+    while (true) {
+        if (!spin_message_from_tcp(bridge->shared_data, &message_from_tcp, bridge->spin_budget_us)) {
+            if (!prepare_wait_message_from_tcp(bridge->shared_data)) {
+                continue;  // A frame was queued while we were arming the wait
+            }
+            DWORD wait_result = WaitForMultipleObjects(3, wait_handles, FALSE, INFINITE);
+            if (wait_result == WAIT_OBJECT_0 + 1) {
+                for (size_t i = 0; i < bridge->device_count; i++) {
+                    flush_held_responses(&bridge->devices[i]);
+                }
+            }
+            else if (wait_result != WAIT_OBJECT_0) {
+                break;  // Stop requested or wait failed
+            }
+            continue;
+        }
+
+        if (message_is_push_to_all(message_from_tcp.data)) {
+            for (size_t i = 0; i < bridge->device_count; i++) {
+                bridge_frame copy = message_from_tcp;  // Pushes carry no payload
+                copy.device_index = (uint8_t)i;
+                deliver_frame(&bridge->devices[i], &copy);
+            }
+            continue;
+        }
+        if (message_from_tcp.device_index >= bridge->device_count) {
+            WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Dropping message for unknown device %u", message_from_tcp.device_index);
+            message_payload_free(message_from_tcp.payload);
+            continue;
+        }
+
+        // Now you can send this message to HID device; keep it if the device is gone
+        deliver_frame(&bridge->devices[message_from_tcp.device_index], &message_from_tcp);
+    }
+
+    WRITE_LOG(LOGLEVEL_INFO, "RAWHID Thread - Writer exiting.");
+    return 0;
+}
+
+/**
+ * Whether another device already owns an enumerated path, so reacquisition
+ * never grabs a sibling keypad.
+ *
+ * @param path The enumerated path.
+ * @param context The hid_device_context looking for its device.
+ * @return true if the path belongs to another device.
+ */
+static bool path_in_use(const char* path, void* context) {
+    hid_device_context* self = (hid_device_context*)context;
+    hid_bridge* bridge = self->bridge;
+    bool in_use = false;
+
+    AcquireSRWLockShared(&bridge->path_lock);
+    for (size_t i = 0; i < bridge->device_count && !in_use; i++) {
+        hid_device_context* device = &bridge->devices[i];
+        in_use = device != self && device->path && strcmp(device->path, path) == 0;
+    }
+    ReleaseSRWLockShared(&bridge->path_lock);
+    return in_use;
+}
+
+/**
+ * Picks the frame size of a device: the configured one, or else the report
+ * size its descriptor declares, within what a frame can be.
+ *
+ * @param device Pointer to the device context.
+ * @param handle The device's open handle.
+ * @return The frame size in bytes.
+ */
+static uint8_t device_frame_size(const hid_device_context* device, hid_device* handle) {
+    size_t report_size = device->bridge->configured_frame_size ? device->bridge->configured_frame_size : hid_report_size(handle);
+    uint8_t frame_size = (uint8_t)message_frame_size(report_size);
+    if (report_size != frame_size) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Device %u has %zu-byte reports, using %u-byte frames", device->index, report_size, frame_size);
+    }
+    return frame_size;
+}
+
+/**
+ * Closes the handle of a device that stopped answering. Reader thread only.
+ *
+ * @param device Pointer to the device context.
+ */
+static void lose_device(hid_device_context* device) {
+    WaitForSingleObject(device->write_mutex, INFINITE);
+    hid_close(device->handle);
+    device->handle = NULL;
+    ReleaseMutex(device->write_mutex);
+}
+
+/**
+ * Waits for a lost device to come back. Retries the cached path every
+ * reacquire interval and falls back to a full enumeration every enumerate
+ * interval, in case the device returned under a different path.
+ * Reader thread only.
+ *
+ * @param device Pointer to the device context.
+ * @return true once the device is open again, false if asked to stop.
+ */
+static bool reacquire_device(hid_device_context* device) {
+    hid_bridge* bridge = device->bridge;
+    uint64_t lost_us = monotonic_time_us();
+    uint64_t next_enumerate_us = lost_us + (uint64_t)bridge->enumerate_interval_ms * 1000;
+
+    WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Device %u lost, waiting for it at %s", device->index, device->path);
+
+    while (!ReadAcquire(&bridge->stop_requested)) {
+        char* new_path = NULL;
+        hid_device* handle = hid_open_path(device->path);
+
+        if (!handle && monotonic_time_us() >= next_enumerate_us) {
+            handle = open_first_matching(device->filter, path_in_use, device, &new_path);
+            next_enumerate_us = monotonic_time_us() + (uint64_t)bridge->enumerate_interval_ms * 1000;
+        }
+
+        if (handle) {
+            if (new_path) {
+                WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Device %u moved to %s", device->index, new_path);
+                AcquireSRWLockExclusive(&bridge->path_lock);
+                free(device->path);
+                device->path = new_path;
+                ReleaseSRWLockExclusive(&bridge->path_lock);
+            }
+
+            uint8_t frame_size = device_frame_size(device, handle);
+            WaitForSingleObject(device->write_mutex, INFINITE);
+            device->handle = handle;
+            device->frame_size = frame_size;
+            ReleaseMutex(device->write_mutex);
+
+            device->reacquisitions++;
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Device %u reacquired after %llu ms",
+                device->index, (unsigned long long)((monotonic_time_us() - lost_us) / 1000));
+            SetEvent(bridge->reacquired_event);
+            return true;
+        }
+
+        Sleep(bridge->reacquire_interval_ms);
+    }
+    return false;
+}
+
+/**
+ * Adds a fragment read from a device to the request it is reassembling.
+ * Reader thread only.
+ *
+ * @param device Pointer to the device context.
+ * @param frame The fragment just read; receives the whole request once its last fragment is in.
+ * @param read_ns When the fragment was read.
+ * @return true if the request is complete.
+ */
+static bool collect_fragment(hid_device_context* device, bridge_frame* frame, uint64_t read_ns) {
+    uint8_t index, count, length;
+    extract_fragment_info(frame->data, &index, &count, &length);
+    if (index == 0) {
+        device->message_read_ns = read_ns;
+    }
+
+    fragment_status status = fragment_assembler_add(&device->fragments, frame->data, frame->size);
+    if (status == FRAGMENT_REJECTED) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Fragment %u of %u from device %u out of order, request discarded", index, count, device->index);
+    }
+    if (status != FRAGMENT_COMPLETE) {
+        return false;
+    }
+
+    frame->payload = fragment_assembler_take(&device->fragments, frame->data);
+    frame->timing.hid_read_ns = device->message_read_ns;
+    return true;
+}
+
+/**
+ * Thread function that reads reports from one device, confirms them to the
+ * device and queues them for the TCP thread tagged with the device index.
+ * The fragments of a fragmented request are reassembled first and the whole
+ * request is confirmed and queued once.
+ * Blocks in the read while the device is idle, and supervises the device:
+ * when a read fails it closes the handle and reopens the device once it is
+ * back, without disturbing frames already queued for the server.
+ *
+ * @param device_context Pointer to the device's hid_device_context.
+ * @return 0 on successful execution.
+ */
+static DWORD WINAPI rawhid_reader_thread(LPVOID device_context) {
+    hid_device_context* device = (hid_device_context*)device_context;
+    hid_bridge* bridge = device->bridge;
+    bridge_frame message_from_hid;
+    uint16_t messageid = 0;
+
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Reader for device %u started.", device->index);
+    message_from_hid.device_index = device->index;
+    message_from_hid.payload = NULL;
+
+    // Main loop for reading from the device
+    while (!ReadAcquire(&bridge->stop_requested)) {
+        int bytes_read = read_report(device->handle, message_from_hid.data, device->frame_size, device->spin_budget_us);
+        if (bytes_read < 0) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID Thread - Failed to read from device %u: %ls", device->index, hid_error(device->handle));
+            fragment_assembler_reset(&device->fragments);
+            lose_device(device);
+            if (!reacquire_device(device)) {
+                break;
+            }
+            continue;
+        }
+
+        // If read is successful
+        if (bytes_read > 0) {
+            device->frames_read++;
+            memset(&message_from_hid.timing, 0, sizeof(message_from_hid.timing));
+            message_from_hid.timing.hid_read_ns = monotonic_time_ns();
+            message_from_hid.size = device->frame_size;
+            resize_message(message_from_hid.data, (size_t)bytes_read, message_from_hid.size);  // A short report reads as zero-padded
+            if (message_is_fragment(message_from_hid.data) &&
+                !collect_fragment(device, &message_from_hid, message_from_hid.timing.hid_read_ns)) {
+                continue;
+            }
+
+            unsigned char confirm_message[MESSAGE_MAX_SIZE_BYTES] = { 0 };
+            encode_confirmation(confirm_message, ++messageid, 0x01);
+            capture_frame(CAPTURE_HID_TO_TCP, device->index, messageid, message_from_hid.data, message_from_hid.size);
+            locked_write_to_handle(device, confirm_message, MESSAGE_SIZE_BYTES);
+            capture_frame(CAPTURE_CONFIRM_TO_HID, device->index, messageid, confirm_message, device->frame_size);
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Number of bytes read from device %u: %d", device->index, bytes_read);
+            // Log the byte array using your new function
+            WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, message_from_hid.data, message_from_hid.size);
+
+            // Queue the message to be sent over TCP in its class, remembering which ID the device was given
+            message_from_hid.request_id = messageid;
+            message_from_hid.priority = (uint8_t)priority_of_request(bridge->shared_data->priorities, message_from_hid.data);
+            message_from_hid.timing.enqueued_ns = monotonic_time_ns();
+            if (!set_message_to_tcp(bridge->shared_data, &message_from_hid)) {
+                WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - Message to TCP from device %u dropped, ring is full", device->index);
+            }
+            message_from_hid.payload = NULL;  // Handed over with the frame
+        }
+    }
+
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Reader for device %u exiting.", device->index);
+    return 0;
+}
+
+/**
+ * Metrics source for the HID side: per-device counters, labelled by device index.
+ *
+ * @param page The page to append to.
+ * @param context Pointer to the hid_bridge.
+ */
+static void write_device_metrics(metrics_page* page, void* context) {
+    static const metrics_field fields[] = {
+        METRICS_FIELD(hid_device_context, frames_read, "rawhid_hid_frames_read_total", "counter", "Reports read from the device"),
+        METRICS_FIELD(hid_device_context, frames_written, "rawhid_hid_frames_written_total", "counter", "Responses written to the device"),
+        METRICS_FIELD(hid_device_context, held_count, "rawhid_hid_held_responses", "gauge", "Responses held while the device is lost"),
+        METRICS_FIELD(hid_device_context, held_dropped, "rawhid_hid_held_dropped_total", "counter", "Held responses dropped because the hold queue was full"),
+        METRICS_FIELD(hid_device_context, reacquisitions, "rawhid_hid_reacquisitions_total", "counter", "Times the device was found again after being lost"),
+        METRICS_FIELD(hid_device_context, frame_size, "rawhid_hid_frame_size_bytes", "gauge", "Bytes per frame exchanged with the device"),
+        METRICS_FIELD(hid_device_context, fragments.reassembled, "rawhid_hid_reassembled_requests_total", "counter", "Fragmented requests reassembled from the device"),
+        METRICS_FIELD(hid_device_context, fragments.discarded, "rawhid_hid_fragments_discarded_total", "counter", "Fragmented requests from the device dropped incomplete or out of order"),
+    };
+    hid_bridge* bridge = (hid_bridge*)context;
+    metrics_write_fields(page, fields, sizeof(fields) / sizeof(fields[0]), "device",
+        bridge->devices, sizeof(hid_device_context), bridge->device_count);
+}
+
+/**
+ * The thread function that handles communication with the HID devices.
+ * Opens every matching device (waiting for one to appear if none is plugged
+ * in), gives each a reader thread that blocks in its read and supervises the
+ * device, and starts one writer thread that routes responses back by device
+ * index.
  *
  * @param thread_config Pointer to a hid_thread_config struct containing
- *                      the device information and shared data.
+ *                      the device filters and shared data.
  * @return 0 on successful execution, -1 on failure.
  */
 DWORD WINAPI rawhid_device_thread(LPVOID thread_config) {
-    write_log(LOGLEVEL_INFO, "RAWHID Thread - Entered rawhid_device_thread.");
+    WRITE_LOG(LOGLEVEL_INFO, "RAWHID Thread - Entered rawhid_device_thread.");
     int ret = 0; // Variable to store the return status
-    hid_device* handle = NULL; // Handle for the HID device
+    hid_opened_device* opened = NULL;
+    hid_device_context* devices = NULL;
+    HANDLE* reader_threads = NULL;
+    size_t device_count = 0;
+    size_t reader_count = 0;
+    HANDLE writer_thread = NULL;
+    hid_bridge bridge = { 0 };
 
     // Cast thread_config to its proper type
     hid_thread_config* config = (hid_thread_config*)thread_config;
 
     // Validate that configuration and device information isn't NULL
-    if (!config || !config->device_info || !config->shared_data) {
-        write_log(LOGLEVEL_ERROR, "RAWHID Thread - Configuration or Device information is NULL.\n");
+    if (!config || !config->device_filters || !config->shared_data) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Configuration or Device information is NULL.\n");
+        ret = -1;
+        goto cleanup;
+    }
+    if (config->max_devices == 0 || config->max_devices > MAXIMUM_WAIT_OBJECTS) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID Thread - Maximum device count must be 1 to %d.", MAXIMUM_WAIT_OBJECTS);
         ret = -1;
         goto cleanup;
     }
-
-    // Log Vendor ID and Product ID
-    write_log_format(LOGLEVEL_INFO, "RAWHID Thread - Initializing HIDAPI for Vendor ID: 0x%x, Product ID: 0x%x", config->device_info->vendor_id, config->device_info->product_id);
 
     // Initialize the HID API
     if (hid_init()) {
-        write_log(LOGLEVEL_ERROR, "RAWHID Thread - Unable to initialize HIDAPI.\n");
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Unable to initialize HIDAPI.\n");
         ret = -1;
         goto cleanup;
     }
 
-    // Get and open the device handle
-    handle = get_handle(config->device_info);
-    open_usage_path(config->device_info, &handle);
-    if (!handle) {
-        write_log(LOGLEVEL_ERROR, "RAWHID Thread - Failed to open the device.\n");
+    opened = (hid_opened_device*)calloc(config->max_devices, sizeof(hid_opened_device));
+    devices = (hid_device_context*)calloc(config->max_devices, sizeof(hid_device_context));
+    reader_threads = (HANDLE*)calloc(config->max_devices, sizeof(HANDLE));
+    if (!opened || !devices || !reader_threads) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Failed to allocate device table.");
         ret = -1;
         goto cleanup;
     }
 
-    write_log(LOGLEVEL_INFO, "RAWHID Thread - Device opened successfully.");
-    
-    // Set the device to non-blocking mode
-    hid_set_nonblocking(handle, true);
+    // Open the devices, waiting for the first one to be plugged in if necessary
+    while ((device_count = open_matching_devices(config->device_filters, config->device_filter_count,
+        config->open_all_devices, opened, config->max_devices)) == 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "RAWHID Thread - No device found, retrying in %lu ms.", config->enumerate_interval_ms);
+        Sleep(config->enumerate_interval_ms);
+    }
 
-    // Get the shared data
-    shared_thread_data* shared_data = config->shared_data;
-    unsigned char message_from_hid[MESSAGE_SIZE_BYTES];
-    unsigned char message_from_tcp[MESSAGE_SIZE_BYTES];
-    int messageid = 0;
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - %zu device(s) opened successfully.", device_count);
 
-    // Main loop for reading from the device
-    while (true) {
-        int bytes_read = hid_read(handle, message_from_hid, sizeof(message_from_hid));
-        if (bytes_read < 0) {
-            write_log_format(LOGLEVEL_ERROR, "RAWHID Thread - Failed to read from device: %s", hid_error(handle));
-            ret = -1;
-            goto cleanup;
-        }
+    // A spinning reader per device would burn a core each; only spin when there is one
+    uint32_t reader_spin_budget_us = device_count == 1 ? config->spin_budget_us : 0;
+    if (config->spin_budget_us && device_count > 1) {
+        WRITE_LOG(LOGLEVEL_INFO, "RAWHID Thread - Read spinning disabled with more than one device.");
+    }
 
-        // If read is successful
-        if (bytes_read > 0) {
-            char confirm_message[MESSAGE_SIZE_BYTES];
-            encode_confirmation(confirm_message, ++messageid, 0x01);
-            write_to_handle(handle, confirm_message, MESSAGE_SIZE_BYTES);
-            write_log_format(LOGLEVEL_INFO, "RAWHID Thread - Number of bytes read: %d", bytes_read);
-            // Log the byte array using your new function
-            write_log_byte_array(LOGLEVEL_DEBUG, message_from_hid, MESSAGE_SIZE_BYTES);
+    bridge.devices = devices;
+    bridge.device_count = device_count;
+    bridge.shared_data = config->shared_data;
+    bridge.spin_budget_us = config->spin_budget_us;
+    bridge.reacquire_interval_ms = config->reacquire_interval_ms;
+    bridge.enumerate_interval_ms = config->enumerate_interval_ms;
+    bridge.held_capacity = config->held_responses;
+    bridge.configured_frame_size = config->frame_size;
+    InitializeSRWLock(&bridge.path_lock);
 
-            // Set the message to be sent over TCP
-            set_message_to_tcp(shared_data, message_from_hid, MESSAGE_SIZE_BYTES);
-        }
+    bool setup_failed = false;
+    for (size_t i = 0; i < device_count; i++) {
+        devices[i].index = (uint8_t)i;
+        devices[i].handle = opened[i].handle;
+        devices[i].path = opened[i].path;
+        devices[i].filter = &config->device_filters[opened[i].filter_index];
+        devices[i].bridge = &bridge;
+        devices[i].spin_budget_us = reader_spin_budget_us;
+        devices[i].frame_size = device_frame_size(&devices[i], devices[i].handle);
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Device %zu uses %u-byte frames.", i, devices[i].frame_size);
+        devices[i].write_mutex = CreateMutex(NULL, FALSE, NULL);
+        devices[i].held = bridge.held_capacity ? (bridge_frame*)calloc(bridge.held_capacity, sizeof(bridge_frame)) : NULL;
+        setup_failed |= !devices[i].write_mutex || (bridge.held_capacity && !devices[i].held);
+    }
+    if (setup_failed) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Failed to set up device state.");
+        ret = -1;
+        goto cleanup;
+    }
 
-        // Wait for the response_received_event to be set, signaling a new message from TCP client
-        if (check_message_from_tcp( shared_data, message_from_tcp, MESSAGE_SIZE_BYTES)) {
+    metrics_register(write_device_metrics, &bridge);
 
-            // Now you can send this message to HID device
-            if (write_to_handle(handle, message_from_tcp, MESSAGE_SIZE_BYTES) < 0) {
-                write_log(LOGLEVEL_ERROR, "RAWHID Thread - Failed to send message to device");
-            }
-        }
+    // Start the writer that forwards TCP responses to the devices
+    bridge.stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    bridge.reacquired_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!bridge.stop_event || !bridge.reacquired_event) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Failed to create writer synchronization objects.");
+        ret = -1;
+        goto cleanup;
+    }
+    writer_thread = CreateThread(NULL, 0, rawhid_writer_thread, &bridge, 0, NULL);
+    if (!writer_thread) {
+        WRITE_LOG(LOGLEVEL_ERROR, "RAWHID Thread - Failed to create writer thread.");
+        ret = -1;
+        goto cleanup;
+    }
 
+    // Start one blocking reader per device
+    for (size_t i = 0; i < device_count; i++) {
+        reader_threads[i] = CreateThread(NULL, 0, rawhid_reader_thread, &devices[i], 0, NULL);
+        if (!reader_threads[i]) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "RAWHID Thread - Failed to create reader thread for device %zu.", i);
+            ret = -1;
+            goto cleanup;
+        }
+        reader_count++;
     }
 
+    // Readers recover lost devices themselves and only exit when asked to stop
+    WaitForMultipleObjects((DWORD)reader_count, reader_threads, TRUE, INFINITE);
+
 cleanup: // Cleanup label for resource freeing and exit
-    if (handle) {
-        hid_close(handle);
+    metrics_unregister(write_device_metrics, &bridge);
+    if (reader_count > 0) {
+        InterlockedExchange(&bridge.stop_requested, 1);
+        WaitForMultipleObjects((DWORD)reader_count, reader_threads, TRUE, INFINITE);
+    }
+    for (size_t i = 0; i < reader_count; i++) {
+        CloseHandle(reader_threads[i]);
+    }
+    if (writer_thread) {
+        SetEvent(bridge.stop_event);
+        WaitForSingleObject(writer_thread, INFINITE);
+        CloseHandle(writer_thread);
+    }
+    if (bridge.stop_event) {
+        CloseHandle(bridge.stop_event);
+    }
+    if (bridge.reacquired_event) {
+        CloseHandle(bridge.reacquired_event);
+    }
+    for (size_t i = 0; i < device_count; i++) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "RAWHID Thread - Device %zu: %lu reacquisition(s), %llu held response(s) dropped",
+            i, devices[i].reacquisitions, (unsigned long long)devices[i].held_dropped);
+        if (devices[i].handle) {
+            hid_close(devices[i].handle);
+        }
+        if (devices[i].write_mutex) {
+            CloseHandle(devices[i].write_mutex);
+        }
+        for (uint32_t h = 0; h < devices[i].held_count; h++) {
+            message_payload_free(devices[i].held[(devices[i].held_start + h) % bridge.held_capacity].payload);
+        }
+        fragment_assembler_reset(&devices[i].fragments);
+        free(devices[i].path);
+        free(devices[i].held);
     }
     hid_exit();
+    free(reader_threads);
+    free(devices);
+    free(opened);
     if (config) {
         free(config);
     }
 
-    write_log(LOGLEVEL_INFO, "RAWHID Thread - Exiting rawhid_device_thread.");
+    WRITE_LOG(LOGLEVEL_INFO, "RAWHID Thread - Exiting rawhid_device_thread.");
     return ret;
 }
-
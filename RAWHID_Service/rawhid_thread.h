@@ -7,12 +7,22 @@
 #include "rawhid.h"
 #include "message_protocol.h"
 #include "shared_thread_data.h"
+#include "frame_capture.h"
+#include "metrics.h"
 #include "logger.h"
 
 // Structure to hold information required for HID device usage.
 typedef struct {
-    hid_usage_info* device_info;
+    hid_usage_info* device_filters;  // VID/PID/usage tuples to bridge
+    size_t device_filter_count;
+    bool open_all_devices;    // Bridge every matching interface, not just the first
+    uint32_t max_devices;     // At most MAXIMUM_WAIT_OBJECTS
+    uint32_t reacquire_interval_ms;  // How often a lost device's cached path is retried
+    uint32_t enumerate_interval_ms;  // How often a lost device is searched for by enumeration
+    uint32_t held_responses;  // Responses kept per device while it is disconnected
+    uint8_t frame_size;       // Bytes per frame for every device, 0 to use each device's report size
     shared_thread_data* shared_data;
+    uint32_t spin_budget_us;  // Poll this long before blocking, 0 to block immediately
 } hid_thread_config;
 
 DWORD WINAPI rawhid_device_thread(LPVOID thread_config);
@@ -0,0 +1,257 @@
+#include "response_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_NIL UINT32_MAX
+
+/**
+ * How long responses for a URI may be cached.
+ *
+ * @param cache Pointer to the cache.
+ * @param uri The URI.
+ * @return The TTL in milliseconds, 0 if the URI is not cached.
+ */
+static uint32_t ttl_for_uri(const response_cache* cache, uint64_t uri) {
+    return cache->ttl_rules[URI_RANGE_LOOKUP(cache->ttl_rules, cache->ttl_rule_count, uri)].ttl_ms;
+}
+
+static void lru_unlink(response_cache* cache, uint32_t index) {
+    cache_entry* entry = &cache->entries[index];
+    if (entry->lru_prev != CACHE_NIL) {
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    }
+    else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != CACHE_NIL) {
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    }
+    else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(response_cache* cache, uint32_t index) {
+    cache_entry* entry = &cache->entries[index];
+    entry->lru_prev = CACHE_NIL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != CACHE_NIL) {
+        cache->entries[cache->lru_head].lru_prev = index;
+    }
+    else {
+        cache->lru_tail = index;
+    }
+    cache->lru_head = index;
+}
+
+/**
+ * Finds the entry for a URI.
+ *
+ * @param cache Pointer to the cache.
+ * @param uri The URI.
+ * @param link Receives the link pointing at the entry, for unlinking it.
+ * @return The entry index, or CACHE_NIL.
+ */
+static uint32_t find_entry(response_cache* cache, uint64_t uri, uint32_t** link) {
+    uint32_t* current = &cache->buckets[uri_hash_bucket(uri, cache->bucket_shift)];
+    while (*current != CACHE_NIL) {
+        if (cache->entries[*current].uri == uri) {
+            if (link) {
+                *link = current;
+            }
+            return *current;
+        }
+        current = &cache->entries[*current].bucket_next;
+    }
+    return CACHE_NIL;
+}
+
+/**
+ * Removes an entry from its bucket and the LRU list and frees it.
+ *
+ * @param cache Pointer to the cache.
+ * @param index The entry index.
+ * @param link The link pointing at the entry, or NULL to search for it.
+ */
+static void remove_entry(response_cache* cache, uint32_t index, uint32_t* link) {
+    cache_entry* entry = &cache->entries[index];
+    if (!link) {
+        find_entry(cache, entry->uri, &link);
+    }
+    *link = entry->bucket_next;
+    lru_unlink(cache, index);
+
+    entry->in_use = false;
+    entry->bucket_next = cache->free_head;
+    cache->free_head = index;
+    cache->count--;
+}
+
+/**
+ * Initializes an empty cache.
+ *
+ * @param cache Pointer to the cache to initialize.
+ * @param capacity Maximum number of cached responses.
+ * @param ttl_rules TTLs as a URI range table.
+ * @param ttl_rule_count Number of entries in ttl_rules.
+ * @return 1 if initialization is successful, 0 otherwise.
+ */
+int response_cache_init(response_cache* cache, uint32_t capacity, const cache_ttl_rule* ttl_rules, size_t ttl_rule_count) {
+    memset(cache, 0, sizeof(response_cache));
+    if (capacity == 0 || capacity > (1u << 30) || !ttl_rules || ttl_rule_count == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Response Cache - Invalid capacity or TTL rules");
+        return 0;
+    }
+    size_t unsorted = URI_RANGE_FIRST_UNSORTED(ttl_rules, ttl_rule_count);
+    if (unsorted < ttl_rule_count) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Response Cache - TTL rules must start at 0 and increase (rule %zu)", unsorted);
+        return 0;
+    }
+
+    // Keep the load factor at or below one
+    uint32_t bucket_count = 2;
+    uint32_t bucket_bits = 1;
+    while (bucket_count < capacity) {
+        bucket_count <<= 1;
+        bucket_bits++;
+    }
+
+    cache->entries = (cache_entry*)calloc(capacity, sizeof(cache_entry));
+    cache->buckets = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    if (!cache->entries || !cache->buckets) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Response Cache - Failed to allocate entries");
+        response_cache_destroy(cache);
+        return 0;
+    }
+    memset(cache->buckets, 0xff, bucket_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < capacity; i++) {
+        cache->entries[i].bucket_next = i + 1 < capacity ? i + 1 : CACHE_NIL;
+    }
+
+    cache->capacity = capacity;
+    cache->bucket_shift = 64 - bucket_bits;
+    cache->lru_head = CACHE_NIL;
+    cache->lru_tail = CACHE_NIL;
+    cache->free_head = 0;
+    cache->ttl_rules = ttl_rules;
+    cache->ttl_rule_count = ttl_rule_count;
+    return 1;
+}
+
+/**
+ * Looks up a fresh response for a URI. Expired entries are dropped on sight.
+ *
+ * @param cache Pointer to the cache.
+ * @param uri The requested URI.
+ * @param now_us Current monotonic time in microseconds.
+ * @param data Receives the cached response data on a hit.
+ * @return true on a hit.
+ */
+bool response_cache_lookup(response_cache* cache, uint64_t uri, uint64_t now_us, uint64_t* data) {
+    uint32_t* link = NULL;
+    uint32_t index = find_entry(cache, uri, &link);
+    if (index == CACHE_NIL) {
+        cache->misses++;
+        return false;
+    }
+
+    cache_entry* entry = &cache->entries[index];
+    if (now_us >= entry->expires_us) {
+        remove_entry(cache, index, link);
+        cache->expirations++;
+        cache->misses++;
+        return false;
+    }
+
+    lru_unlink(cache, index);
+    lru_push_front(cache, index);
+    *data = entry->data;
+    cache->hits++;
+    return true;
+}
+
+/**
+ * Caches a server response if its URI has a TTL, replacing any older
+ * response for the URI and evicting the least recently used entry if full.
+ *
+ * @param cache Pointer to the cache.
+ * @param uri The URI the request asked for.
+ * @param data The response data.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void response_cache_store(response_cache* cache, uint64_t uri, uint64_t data, uint64_t now_us) {
+    uint32_t ttl_ms = ttl_for_uri(cache, uri);
+    if (ttl_ms == 0) {
+        return;
+    }
+
+    uint32_t index = find_entry(cache, uri, NULL);
+    if (index != CACHE_NIL) {
+        lru_unlink(cache, index);
+    }
+    else {
+        if (cache->free_head == CACHE_NIL) {
+            remove_entry(cache, cache->lru_tail, NULL);
+            cache->evictions++;
+        }
+        index = cache->free_head;
+        cache->free_head = cache->entries[index].bucket_next;
+
+        uint32_t bucket = uri_hash_bucket(uri, cache->bucket_shift);
+        cache->entries[index].uri = uri;
+        cache->entries[index].in_use = true;
+        cache->entries[index].bucket_next = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+        cache->count++;
+    }
+
+    cache->entries[index].data = data;
+    cache->entries[index].expires_us = now_us + (uint64_t)ttl_ms * 1000;
+    lru_push_front(cache, index);
+}
+
+/**
+ * Drops the cached responses for a range of URIs, as told by the server.
+ *
+ * @param cache Pointer to the cache.
+ * @param first_uri First URI to drop.
+ * @param last_uri Last URI to drop (inclusive).
+ * @return The number of entries dropped.
+ */
+uint32_t response_cache_invalidate(response_cache* cache, uint64_t first_uri, uint64_t last_uri) {
+    uint32_t dropped = 0;
+    cache->epoch++;
+
+    if (first_uri == last_uri) {
+        uint32_t* link = NULL;
+        uint32_t index = find_entry(cache, first_uri, &link);
+        if (index != CACHE_NIL) {
+            remove_entry(cache, index, link);
+            dropped++;
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < cache->capacity && cache->count > 0; i++) {
+            if (cache->entries[i].in_use && cache->entries[i].uri >= first_uri && cache->entries[i].uri <= last_uri) {
+                remove_entry(cache, i, NULL);
+                dropped++;
+            }
+        }
+    }
+
+    cache->invalidations += dropped;
+    return dropped;
+}
+
+/**
+ * Frees the cache's storage.
+ *
+ * @param cache Pointer to the cache.
+ */
+void response_cache_destroy(response_cache* cache) {
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->count = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "uri_index.h"
+#include "logger.h"
+
+// How long responses for a range of URIs stay cached.
+typedef struct {
+    uint64_t range_start;     // First URI the rule applies to; it runs up to the next rule's start
+    uint32_t ttl_ms;          // 0 to never cache these URIs
+} cache_ttl_rule;
+
+// One cached response, linked into its hash bucket and into the LRU list.
+typedef struct {
+    uint64_t uri;
+    uint64_t data;            // Response data (bytes 8-15 of the response)
+    uint64_t expires_us;
+    uint32_t bucket_next;     // Next entry in the same bucket, or CACHE_NIL
+    uint32_t lru_prev;        // Towards the most recently used entry
+    uint32_t lru_next;        // Towards the least recently used entry
+    bool in_use;
+} cache_entry;
+
+/**
+ * Fixed-capacity cache of server responses keyed by request URI. When full,
+ * the least recently used entry is evicted. Owned by the TCP thread only, so
+ * no locking.
+ */
+typedef struct {
+    cache_entry* entries;
+    uint32_t* buckets;        // Head entry of each bucket, or CACHE_NIL
+    uint32_t capacity;
+    uint32_t bucket_shift;    // 64 - log2(bucket count)
+    uint32_t count;
+    uint32_t lru_head;        // Most recently used
+    uint32_t lru_tail;        // Least recently used, evicted first
+    uint32_t free_head;       // Unused entries, chained through bucket_next
+    const cache_ttl_rule* ttl_rules;  // A URI range table (uri_index.h)
+    size_t ttl_rule_count;
+    uint32_t epoch;           // Bumped by every invalidation, so responses to older requests aren't stored
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expirations;
+    uint64_t evictions;
+    uint64_t invalidations;   // Entries removed by the server
+} response_cache;
+
+int response_cache_init(response_cache* cache, uint32_t capacity, const cache_ttl_rule* ttl_rules, size_t ttl_rule_count);
+bool response_cache_lookup(response_cache* cache, uint64_t uri, uint64_t now_us, uint64_t* data);
+void response_cache_store(response_cache* cache, uint64_t uri, uint64_t data, uint64_t now_us);
+uint32_t response_cache_invalidate(response_cache* cache, uint64_t first_uri, uint64_t last_uri);
+void response_cache_destroy(response_cache* cache);
+
+#endif // RESPONSE_CACHE_H
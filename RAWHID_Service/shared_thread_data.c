@@ -1,149 +1,316 @@
 #include "shared_thread_data.h"
 
 /**
- * Initialize the mutex and event for shared data.
+ * Initialize the frame rings and wake-up events for shared data.
  *
  * @param sharedData Pointer to the shared data structure.
+ * @param ring_depth Number of frames each priority class can queue in each direction.
+ * @param policy What a producer does when its ring is full.
+ * @param priorities How requests are classed and the classes scheduled; must outlive the shared data.
  * @return 1 if initialization is successful, 0 otherwise.
  */
-int initialize_shared_data(shared_thread_data* sharedData) {
-    // Create a mutex and store its handle in sharedData
-    sharedData->mutex = CreateMutex(NULL, FALSE, NULL);
-    if (sharedData->mutex == NULL) {
-        write_log(LOGLEVEL_ERROR, "Shared Data - Failed to create mutex.\n");
-        return 0; // Initialization failed
+int initialize_shared_data(shared_thread_data* sharedData, uint32_t ring_depth, frame_ring_policy policy, const priority_config* priorities) {
+    memset(sharedData, 0, sizeof(*sharedData));
+    InitializeSRWLock(&sharedData->to_tcp_producer_lock);
+
+    if (!validate_priority_config(priorities)) {
+        return 0;
+    }
+    sharedData->priorities = priorities;
+    priority_scheduler_init(&sharedData->to_tcp_scheduler, priorities);
+    priority_scheduler_init(&sharedData->from_tcp_scheduler, priorities);
+
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        if (!frame_ring_init(&sharedData->to_tcp[i], ring_depth, policy) ||
+            !frame_ring_init(&sharedData->from_tcp[i], ring_depth, policy)) {
+            WRITE_LOG(LOGLEVEL_ERROR, "Shared Data - Failed to create frame rings.\n");
+            cleanup_shared_data(sharedData);
+            return 0; // Initialization failed
+        }
     }
 
     // Initialize data_ready_to_send_event
-    sharedData->data_ready_to_send_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    sharedData->data_ready_to_send_event = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (sharedData->data_ready_to_send_event == NULL) {
-        write_log(LOGLEVEL_ERROR, "Shared Data - Failed to create event.\n");
-        CloseHandle(sharedData->mutex);  // Clean up the mutex before exiting
+        WRITE_LOG(LOGLEVEL_ERROR, "Shared Data - Failed to create event.\n");
+        cleanup_shared_data(sharedData);
         return 0; // Initialization failed
     }
 
     // Initialize response_received_event
-    sharedData->response_received_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    sharedData->response_received_event = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (sharedData->response_received_event == NULL) {
-        write_log(LOGLEVEL_ERROR, "Shared Data - Failed to create event.\n");
-        CloseHandle(sharedData->mutex);  // Clean up the mutex before exiting
+        WRITE_LOG(LOGLEVEL_ERROR, "Shared Data - Failed to create event.\n");
+        cleanup_shared_data(sharedData);
         return 0; // Initialization failed
     }
 
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Shared Data - Frame rings created with %lu slots per direction and priority class, %s scheduling",
+        sharedData->to_tcp[0].mask + 1, sharedData->to_tcp_scheduler.policy == PRIORITY_WEIGHTED ? "weighted" : "strict");
     return 1; // Initialization successful
 }
 
 // Helper function to log if a Windows API operation failed
 void log_if_failed(BOOL success, const char* operation) {
     if (!success) {
-        write_log_format(LOGLEVEL_ERROR, "Shared Data - Failed to %s. Error: %lu", operation, GetLastError());
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Shared Data - Failed to %s. Error: %lu", operation, GetLastError());
     }
 }
 
 /**
- * Copies a message to the shared data, designated for TCP transmission.
+ * Dequeues the next frame of a direction from the class its scheduler picks.
+ * Consumer side only.
  *
- * @param sharedData Pointer to the shared data structure.
- * @param message Pointer to the message data.
- * @param size Size of the message in bytes.
+ * @param rings The direction's rings, one per priority class.
+ * @param scheduler The direction's scheduler.
+ * @param frame Frame receiving the message.
+ * @return TRUE if a message was copied into frame, FALSE if every ring was empty.
  */
-void set_message_to_tcp(shared_thread_data* sharedData, const unsigned char* message, size_t size) {
-    // Log the attempt to acquire a mutex
-    write_log_format(LOGLEVEL_DEBUG, "Shared Data - Pre-mutex acquire for message to TCP. Message size: %lu", size);
-
-    // Acquire the mutex before accessing shared data
-    if (WaitForSingleObject(sharedData->mutex, INFINITE) != WAIT_OBJECT_0) {
-        write_log(LOGLEVEL_ERROR, "Shared Data - Failed to acquire mutex for message to TCP");
-        return; // Mutex acquire failed, exit function
+static BOOL take_next_frame(frame_ring* rings, priority_scheduler* scheduler, bridge_frame* frame) {
+    uint32_t waiting = 0;
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        if (frame_ring_depth(&rings[i]) != 0) {
+            waiting |= 1u << i;
+        }
     }
+    int priority = priority_scheduler_next(scheduler, waiting);
+    return priority >= 0 && frame_ring_pop(&rings[priority], frame);
+}
 
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Mutex acquired for message to TCP");
+/**
+ * Marks the consumer of a direction as about to block on every one of its
+ * rings, so a push to any of them wakes it. Consumer side only.
+ *
+ * @param rings The direction's rings, one per priority class.
+ * @return TRUE if they are all still empty, FALSE if a frame arrived in the meantime.
+ */
+static BOOL prepare_wait_rings(frame_ring* rings) {
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        if (!frame_ring_prepare_wait(&rings[i])) {
+            while (i-- > 0) {
+                frame_ring_cancel_wait(&rings[i]);
+            }
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
 
-    // Copy the message to shared data
-    memcpy(sharedData->message_to_tcp, message, size);
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Wrote message for TCP:");
-    write_log_byte_array(LOGLEVEL_DEBUG, message, size);
-    // Set the event
-    SetEvent(sharedData->data_ready_to_send_event);
+/**
+ * Queues a message for TCP transmission on the ring of its priority class and
+ * wakes the TCP thread if it is blocked. May be called from several device
+ * readers at once. The frame's payload goes with it, or is released if it is
+ * dropped.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @param frame Pointer to the frame to queue.
+ * @return 1 if the message was queued, 0 if the ring was full and it was dropped.
+ */
+int set_message_to_tcp(shared_thread_data* sharedData, const bridge_frame* frame) {
+    frame_ring* ring = &sharedData->to_tcp[frame->priority];
+    AcquireSRWLockExclusive(&sharedData->to_tcp_producer_lock);
+    int queued = frame_ring_push(ring, frame);
+    ReleaseSRWLockExclusive(&sharedData->to_tcp_producer_lock);
+    if (!queued) {
+        message_payload_free(frame->payload);
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Shared Data - Ring to TCP full, dropped %s message (%lld dropped so far)", priority_class_names[frame->priority], ring->dropped);
+        return 0;
+    }
 
-    // Release the mutex
-    log_if_failed(ReleaseMutex(sharedData->mutex), "Shared Data - Failed release mutex for message to TCP");
+    WRITE_LOG(LOGLEVEL_DEBUG, "Shared Data - Wrote message for TCP:");
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, frame->data, frame->size);
 
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Mutex released for message to TCP");
+    if (frame_ring_take_waiter(ring)) {
+        log_if_failed(SetEvent(sharedData->data_ready_to_send_event), "signal message to TCP");
+    }
+    return 1;
 }
 
 /**
- * Copies a message to the shared data, originating from a TCP connection.
+ * Queues a message originating from a TCP connection on the ring of its priority class and
+ * wakes the HID writer if it is blocked. The frame's payload goes with it, or is released if it is dropped.
  *
  * @param sharedData Pointer to the shared data structure.
- * @param message Pointer to the message data.
- * @param size Size of the message in bytes.
+ * @param frame Pointer to the frame to queue.
+ * @return 1 if the message was queued, 0 if the ring was full and it was dropped.
  */
-void set_message_from_tcp(shared_thread_data* sharedData, const unsigned char* message, size_t size) {
-    // Log the attempt to acquire a mutex
-    write_log_format(LOGLEVEL_DEBUG, "Shared Data - Pre-mutex acquire for message from TCP. Message size: %lu", size);
+int set_message_from_tcp(shared_thread_data* sharedData, const bridge_frame* frame) {
+    frame_ring* ring = &sharedData->from_tcp[frame->priority];
+    if (!frame_ring_push(ring, frame)) {
+        message_payload_free(frame->payload);
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Shared Data - Ring from TCP full, dropped %s message (%lld dropped so far)", priority_class_names[frame->priority], ring->dropped);
+        return 0;
+    }
 
-    // Acquire the mutex before accessing shared data
-    if (WaitForSingleObject(sharedData->mutex, INFINITE) != WAIT_OBJECT_0) {
-        write_log(LOGLEVEL_ERROR, "Shared Data - Failed to acquire mutex for message from TCP");
-        return; // Mutex acquire failed, exit function
+    WRITE_LOG(LOGLEVEL_DEBUG, "Shared Data - Wrote message from TCP:");
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, frame->data, frame->size);
+
+    if (frame_ring_take_waiter(ring)) {
+        log_if_failed(SetEvent(sharedData->response_received_event), "signal message from TCP");
     }
+    return 1;
+}
 
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Mutex acquired for message from TCP");
+/**
+ * Dequeues the next message destined for TCP without blocking: the oldest of
+ * the priority class the scheduler picks.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @param frame Frame receiving the message.
+ * @return TRUE if a message was copied into frame, FALSE otherwise.
+ */
+BOOL check_message_to_tcp(shared_thread_data* sharedData, bridge_frame* frame) {
+    return take_next_frame(sharedData->to_tcp, &sharedData->to_tcp_scheduler, frame);
+}
 
-    // Copy the message to shared data
-    memcpy(sharedData->message_from_tcp, message, size);
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Wrote message from TCP:");
-    write_log_byte_array(LOGLEVEL_DEBUG, message, size);
+/**
+ * Dequeues the next message coming from TCP without blocking: the oldest of
+ * the priority class the scheduler picks.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @param frame Frame receiving the message.
+ * @return TRUE if a message was copied into frame, FALSE otherwise.
+ */
+BOOL check_message_from_tcp(shared_thread_data* sharedData, bridge_frame* frame) {
+    return take_next_frame(sharedData->from_tcp, &sharedData->from_tcp_scheduler, frame);
+}
 
-    // Set the event
-    SetEvent(sharedData->response_received_event);
+/**
+ * Announces that the TCP thread is about to block on data_ready_to_send_event.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @return TRUE if it may block, FALSE if a message arrived and it should check again.
+ */
+BOOL prepare_wait_message_to_tcp(shared_thread_data* sharedData) {
+    return prepare_wait_rings(sharedData->to_tcp);
+}
 
-    // Release the mutex
-    log_if_failed(ReleaseMutex(sharedData->mutex), "Shared Data - Failed release mutex for message from TCP");
+/**
+ * Announces that the HID writer is about to block on response_received_event.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @return TRUE if it may block, FALSE if a message arrived and it should check again.
+ */
+BOOL prepare_wait_message_from_tcp(shared_thread_data* sharedData) {
+    return prepare_wait_rings(sharedData->from_tcp);
+}
 
-    write_log(LOGLEVEL_DEBUG, "Shared Data - Mutex released for message from TCP");
+/**
+ * Polls for a message destined for TCP for up to spin_budget_us microseconds.
+ * With a budget of 0 this is a single non-blocking check; callers block on
+ * data_ready_to_send_event once it returns FALSE.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @param frame Frame receiving the message.
+ * @param spin_budget_us How long to keep polling, in microseconds.
+ * @return TRUE if a message was copied into frame, FALSE otherwise.
+ */
+BOOL spin_message_to_tcp(shared_thread_data* sharedData, bridge_frame* frame, uint32_t spin_budget_us) {
+    uint64_t deadline = spin_budget_us ? monotonic_time_us() + spin_budget_us : 0;
+    do {
+        if (check_message_to_tcp(sharedData, frame)) {
+            return TRUE;
+        }
+        YieldProcessor();
+    } while (spin_budget_us && monotonic_time_us() < deadline);
+    return FALSE;
 }
 
-BOOL check_message_to_tcp(shared_thread_data* sharedData, unsigned char* buffer, size_t size) {
-    if (WaitForSingleObject(sharedData->data_ready_to_send_event, 0) == WAIT_OBJECT_0) {
-        memcpy(buffer, sharedData->message_to_tcp, size);
-        ResetEvent(sharedData->data_ready_to_send_event);
-        return TRUE;
-    }
+/**
+ * Polls for a message coming from TCP for up to spin_budget_us microseconds.
+ * With a budget of 0 this is a single non-blocking check; callers block on
+ * response_received_event once it returns FALSE.
+ *
+ * @param sharedData Pointer to the shared data structure.
+ * @param frame Frame receiving the message.
+ * @param spin_budget_us How long to keep polling, in microseconds.
+ * @return TRUE if a message was copied into frame, FALSE otherwise.
+ */
+BOOL spin_message_from_tcp(shared_thread_data* sharedData, bridge_frame* frame, uint32_t spin_budget_us) {
+    uint64_t deadline = spin_budget_us ? monotonic_time_us() + spin_budget_us : 0;
+    do {
+        if (check_message_from_tcp(sharedData, frame)) {
+            return TRUE;
+        }
+        YieldProcessor();
+    } while (spin_budget_us && monotonic_time_us() < deadline);
     return FALSE;
 }
 
-BOOL check_message_from_tcp(shared_thread_data* sharedData, unsigned char* buffer, size_t size) {
-    if (WaitForSingleObject(sharedData->response_received_event, 0) == WAIT_OBJECT_0) {
-        memcpy(buffer, sharedData->message_from_tcp, size);
-        ResetEvent(sharedData->response_received_event);
-        return TRUE;
+/**
+ * Metrics source for the rings between the threads, labelled by direction and priority class.
+ *
+ * @param page The page to append to.
+ * @param context Pointer to the shared data structure.
+ */
+void write_shared_data_metrics(metrics_page* page, void* context) {
+    static const char* names[2] = { "to_tcp", "from_tcp" };
+    static const struct {
+        const char* name;
+        const char* type;
+        const char* help;
+    } series[] = {
+        { "rawhid_ring_pushed_total", "counter", "Frames queued on the ring" },
+        { "rawhid_ring_popped_total", "counter", "Frames taken off the ring" },
+        { "rawhid_ring_dropped_total", "counter", "Frames rejected because the ring was full" },
+        { "rawhid_ring_overwritten_total", "counter", "Queued frames overwritten because the ring was full" },
+        { "rawhid_ring_high_watermark", "gauge", "Most frames the ring has held at once" },
+        { "rawhid_ring_depth", "gauge", "Frames currently on the ring" },
+    };
+    shared_thread_data* sharedData = (shared_thread_data*)context;
+    const frame_ring* rings[2] = { sharedData->to_tcp, sharedData->from_tcp };
+
+    for (size_t i = 0; i < sizeof(series) / sizeof(series[0]); i++) {
+        metrics_printf(page, "# HELP %s %s\n# TYPE %s %s\n", series[i].name, series[i].help, series[i].name, series[i].type);
+        for (int r = 0; r < 2; r++) {
+            for (int c = 0; c < PRIORITY_CLASS_COUNT; c++) {
+                const frame_ring* ring = &rings[r][c];
+                uint64_t values[] = {
+                    (uint64_t)ReadNoFence64(&ring->pushed),
+                    (uint64_t)ReadNoFence64(&ring->popped),
+                    (uint64_t)ReadNoFence64(&ring->dropped),
+                    (uint64_t)ReadNoFence64(&ring->overwritten),
+                    (uint64_t)ReadNoFence(&ring->high_watermark),
+                    frame_ring_depth(ring),
+                };
+                metrics_printf(page, "%s{ring=\"%s\",class=\"%s\"} %llu\n", series[i].name, names[r], priority_class_names[c], (unsigned long long)values[i]);
+            }
+        }
     }
-    return FALSE;
 }
 
 /**
- * Cleans up the shared data by closing handles to the mutex and event.
+ * Cleans up the shared data by releasing the rings and closing the event handles.
  *
  * @param sharedData Pointer to the shared data structure.
  */
 void cleanup_shared_data(shared_thread_data* sharedData) {
-    // Close the mutex handle if it's valid
-    if (sharedData->mutex) {
-        CloseHandle(sharedData->mutex);
-        write_log(LOGLEVEL_DEBUG, "Shared Data - Mutex closed.");
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        const frame_ring* to_tcp = &sharedData->to_tcp[i];
+        const frame_ring* from_tcp = &sharedData->from_tcp[i];
+        if (to_tcp->pushed == 0 && from_tcp->pushed == 0) {
+            continue;  // Class unused
+        }
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Shared Data - To TCP (%s): %lld queued, %lld dropped, %lld overwritten, high watermark %ld",
+            priority_class_names[i], to_tcp->pushed, to_tcp->dropped, to_tcp->overwritten, to_tcp->high_watermark);
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Shared Data - From TCP (%s): %lld queued, %lld dropped, %lld overwritten, high watermark %ld",
+            priority_class_names[i], from_tcp->pushed, from_tcp->dropped, from_tcp->overwritten, from_tcp->high_watermark);
+    }
+
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        frame_ring_destroy(&sharedData->to_tcp[i]);
+        frame_ring_destroy(&sharedData->from_tcp[i]);
     }
 
     // Close the event handle if it's valid
     if (sharedData->data_ready_to_send_event) {
         CloseHandle(sharedData->data_ready_to_send_event);
-        write_log(LOGLEVEL_DEBUG, "Shared Data - Event handle closed.");
+        WRITE_LOG(LOGLEVEL_DEBUG, "Shared Data - Event handle closed.");
     }
 
     // Close the event handle if it's valid
     if (sharedData->response_received_event) {
         CloseHandle(sharedData->response_received_event);
-        write_log(LOGLEVEL_DEBUG, "Shared Data - Event handle closed.");
+        WRITE_LOG(LOGLEVEL_DEBUG, "Shared Data - Event handle closed.");
     }
 }
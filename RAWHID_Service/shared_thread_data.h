@@ -2,23 +2,36 @@
 #define INTERTHREAD_COMM_H
 
 #include "message_protocol.h"
+#include "frame_ring.h"
+#include "priority_lanes.h"
 #include "logger.h"
+#include "metrics.h"
 #include <stdint.h>
-#include "windows.h"
+#include "platform.h"
 
+// One ring per priority class in each direction; the consumer of a direction
+// takes from them in the order its scheduler picks.
 typedef struct {
-    unsigned char message_to_tcp[MESSAGE_SIZE_BYTES];
-    unsigned char message_from_tcp[MESSAGE_SIZE_BYTES];
-    HANDLE mutex;
-    HANDLE data_ready_to_send_event;
-    HANDLE response_received_event;
+    frame_ring to_tcp[PRIORITY_CLASS_COUNT];    // HID device readers -> TCP thread
+    SRWLOCK to_tcp_producer_lock;  // Serializes the device readers, as a ring takes one producer at a time
+    frame_ring from_tcp[PRIORITY_CLASS_COUNT];  // TCP thread -> HID thread
+    priority_scheduler to_tcp_scheduler;    // TCP thread only
+    priority_scheduler from_tcp_scheduler;  // HID writer only
+    const priority_config* priorities;      // How the device readers class requests
+    HANDLE data_ready_to_send_event;  // Auto-reset, signalled only when the TCP thread is blocked
+    HANDLE response_received_event;   // Auto-reset, signalled only when the HID writer is blocked
 } shared_thread_data;
 
-int initialize_shared_data(shared_thread_data* sharedData);
-void set_message_to_tcp(shared_thread_data* sharedData, const unsigned char* message, size_t size);
-void set_message_from_tcp(shared_thread_data* sharedData, const unsigned char* message, size_t size);
-BOOL check_message_to_tcp(shared_thread_data* sharedData, unsigned char* buffer, size_t size);
-BOOL check_message_from_tcp(shared_thread_data* sharedData, unsigned char* buffer, size_t size);
+int initialize_shared_data(shared_thread_data* sharedData, uint32_t ring_depth, frame_ring_policy policy, const priority_config* priorities);
+int set_message_to_tcp(shared_thread_data* sharedData, const bridge_frame* frame);
+int set_message_from_tcp(shared_thread_data* sharedData, const bridge_frame* frame);
+BOOL check_message_to_tcp(shared_thread_data* sharedData, bridge_frame* frame);
+BOOL check_message_from_tcp(shared_thread_data* sharedData, bridge_frame* frame);
+BOOL spin_message_to_tcp(shared_thread_data* sharedData, bridge_frame* frame, uint32_t spin_budget_us);
+BOOL spin_message_from_tcp(shared_thread_data* sharedData, bridge_frame* frame, uint32_t spin_budget_us);
+BOOL prepare_wait_message_to_tcp(shared_thread_data* sharedData);
+BOOL prepare_wait_message_from_tcp(shared_thread_data* sharedData);
+void write_shared_data_metrics(metrics_page* page, void* context);
 void cleanup_shared_data(shared_thread_data* sharedData);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,77 +1,221 @@
 #include "tcp_client.h"
 
 /**
- * Initializes the TCP client and connects to the server.
+ * Blocks until the socket is readable or writable. Used when a call on a
+ * socket in non-blocking mode reports that it would block.
  *
- * @param server_info Pointer to a tcp_socket_info struct containing server details.
- * @return A valid socket to the server, or INVALID_SOCKET on failure.
+ * @param serverSocket The socket to wait on.
+ * @param for_write true to wait for writability, false for readability.
+ * @return 0 once the socket is ready, -1 on error.
  */
-SOCKET init_client(tcp_socket_info* server_info) {
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Entering init_client");
+static int wait_for_socket(SOCKET serverSocket, bool for_write) {
+    if (platform_wait_socket(serverSocket, for_write, INFINITE) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Wait on socket failed. Error Code: %d", platform_socket_error());
+        return -1;
+    }
+    return 0;
+}
 
-    WSADATA wsaData;  // WinSock Data
+/**
+ * Connects a socket, giving up after timeout_ms instead of the system's much
+ * longer connect timeout, so an unreachable server doesn't stall reconnects.
+ *
+ * @param clientSocket The socket to connect.
+ * @param serverAddr The server address.
+ * @param timeout_ms How long to wait for the connection, 0 for the system default.
+ * @return 0 once connected, -1 on failure (platform_socket_error has the reason).
+ */
+static int connect_with_timeout(SOCKET clientSocket, const struct sockaddr_in* serverAddr, uint32_t timeout_ms) {
+    if (timeout_ms == 0) {
+        return connect(clientSocket, (const struct sockaddr*)serverAddr, sizeof(*serverAddr)) == SOCKET_ERROR ? -1 : 0;
+    }
 
-    // Initialize WinSock
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        write_log_format(LOGLEVEL_ERROR, "TCP Client - Failed to initialize WinSock. Error Code: %d", WSAGetLastError());
+    platform_set_socket_blocking(clientSocket, false);
+
+    if (connect(clientSocket, (const struct sockaddr*)serverAddr, sizeof(*serverAddr)) == SOCKET_ERROR) {
+        if (!platform_socket_would_block(platform_socket_error())) {
+            return -1;
+        }
+
+        int ready = platform_wait_socket(clientSocket, true, timeout_ms);
+        if (ready == 0) {
+            platform_set_socket_error(PLATFORM_SOCKET_TIMED_OUT);
+            return -1;
+        }
+        if (ready < 0) {
+            return -1;
+        }
+
+        int connect_error = platform_socket_pending_error(clientSocket);
+        if (connect_error != 0) {
+            platform_set_socket_error(connect_error);
+            return -1;
+        }
+    }
+
+    platform_set_socket_blocking(clientSocket, true);
+    return 0;
+}
+
+/**
+ * Creates a client socket and resolves the server's address.
+ *
+ * @param server_info Pointer to a tcp_socket_info struct containing server details.
+ * @param serverAddr Receives the server address.
+ * @return The socket, or INVALID_SOCKET on failure.
+ */
+static SOCKET create_client_socket(tcp_socket_info* server_info, struct sockaddr_in* serverAddr) {
+    // Initialize the socket library
+    if (platform_socket_startup() != 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Failed to initialize sockets. Error Code: %d", platform_socket_error());
         return INVALID_SOCKET;
     }
 
     // Check for null server info
     if (!server_info) {
-        write_log(LOGLEVEL_ERROR, "TCP Client - Server information is NULL");
-        WSACleanup();
+        WRITE_LOG(LOGLEVEL_ERROR, "TCP Client - Server information is NULL");
+        platform_socket_cleanup();
         return INVALID_SOCKET;
     }
 
     // Create the client socket
     SOCKET clientSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (clientSocket == INVALID_SOCKET) {
-        write_log_format(LOGLEVEL_ERROR, "TCP Client - Failed to create socket. Error Code: %d; Server IP: %s, Port: %d",
-            WSAGetLastError(), server_info->ip, server_info->port);
-        WSACleanup();
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Failed to create socket. Error Code: %d; Server IP: %s, Port: %d",
+            platform_socket_error(), server_info->ip, server_info->port);
+        platform_socket_cleanup();
         return INVALID_SOCKET;
     }
 
-    struct sockaddr_in serverAddr;  // Server address
-    serverAddr.sin_family = AF_INET;
+    memset(serverAddr, 0, sizeof(*serverAddr));
+    serverAddr->sin_family = AF_INET;
 
     // Convert IP address from string to binary
-    if (inet_pton(AF_INET, server_info->ip, &(serverAddr.sin_addr)) <= 0) {
-        write_log_format(LOGLEVEL_ERROR, "TCP Client - Invalid IP address or error in inet_pton. Error Code: %d; Server IP: %s, Port: %d",
-            WSAGetLastError(), server_info->ip, server_info->port);
+    if (inet_pton(AF_INET, server_info->ip, &(serverAddr->sin_addr)) <= 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Invalid IP address or error in inet_pton. Error Code: %d; Server IP: %s, Port: %d",
+            platform_socket_error(), server_info->ip, server_info->port);
         cleanup_client(clientSocket);
         return INVALID_SOCKET;
     }
 
     // Set server port
-    serverAddr.sin_port = htons(server_info->port);
+    serverAddr->sin_port = htons(server_info->port);
+    return clientSocket;
+}
+
+/**
+ * Readies a freshly connected socket for the request traffic.
+ *
+ * @param clientSocket The connected socket.
+ */
+static void configure_connected_socket(SOCKET clientSocket) {
+    // Requests are single small frames; don't let Nagle hold them back
+    BOOL no_delay = TRUE;
+    if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay)) == SOCKET_ERROR) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "TCP Client - Failed to disable Nagle. Error Code: %d", platform_socket_error());
+    }
+}
+
+/**
+ * Initializes the TCP client and connects to the server.
+ *
+ * @param server_info Pointer to a tcp_socket_info struct containing server details.
+ * @return A valid socket to the server, or INVALID_SOCKET on failure.
+ */
+SOCKET init_client(tcp_socket_info* server_info) {
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Entering init_client");
+
+    struct sockaddr_in serverAddr;  // Server address
+    SOCKET clientSocket = create_client_socket(server_info, &serverAddr);
+    if (clientSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
 
     // Connect to the server
-    if (connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        write_log_format(LOGLEVEL_ERROR, "TCP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
-            WSAGetLastError(), server_info->ip, server_info->port);
+    if (connect_with_timeout(clientSocket, &serverAddr, server_info->connect_timeout_ms) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
+            platform_socket_error(), server_info->ip, server_info->port);
         cleanup_client(clientSocket);
         return INVALID_SOCKET;
     }
 
-    write_log(LOGLEVEL_INFO, "TCP Client - Successfully connected to the server");
+    configure_connected_socket(clientSocket);
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client - Successfully connected to the server");
 
     return clientSocket;  // Return the connected socket
 }
 
 /**
- * Reads a 64-bit (8 bytes) message from the server.
+ * Starts connecting to the server without waiting for the connection, for
+ * an event loop that watches the socket instead. The socket stays in
+ * non-blocking mode; once it is writable, finish_client_connect tells how
+ * the attempt went.
+ *
+ * @param server_info Pointer to a tcp_socket_info struct containing server details.
+ * @param connected Receives true if the connection was made at once.
+ * @return The socket, or INVALID_SOCKET on failure.
+ */
+SOCKET begin_client_connect(tcp_socket_info* server_info, bool* connected) {
+    struct sockaddr_in serverAddr;
+    SOCKET clientSocket = create_client_socket(server_info, &serverAddr);
+    if (clientSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    *connected = false;
+    if (platform_set_socket_blocking(clientSocket, false) < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Failed to make socket non-blocking. Error Code: %d", platform_socket_error());
+        cleanup_client(clientSocket);
+        return INVALID_SOCKET;
+    }
+    if (connect(clientSocket, (const struct sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        if (!platform_socket_would_block(platform_socket_error())) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
+                platform_socket_error(), server_info->ip, server_info->port);
+            cleanup_client(clientSocket);
+            return INVALID_SOCKET;
+        }
+        return clientSocket;
+    }
+
+    *connected = finish_client_connect(clientSocket, server_info) == 0;
+    return clientSocket;
+}
+
+/**
+ * Completes a connection started by begin_client_connect once its socket is
+ * writable.
+ *
+ * @param clientSocket The socket.
+ * @param server_info The server it is connecting to, for logging.
+ * @return 0 if connected, -1 if the attempt failed; the caller closes the socket.
+ */
+int finish_client_connect(SOCKET clientSocket, tcp_socket_info* server_info) {
+    int connect_error = platform_socket_pending_error(clientSocket);
+    if (connect_error != 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
+            connect_error, server_info->ip, server_info->port);
+        return -1;
+    }
+
+    configure_connected_socket(clientSocket);
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client - Successfully connected to the server");
+    return 0;
+}
+
+/**
+ * Reads one frame from the server.
  *
  * @param serverSocket The server socket to read the message from.
- * @param buffer The buffer to store the message.
+ * @param buffer The buffer to store the message, at least frame_size bytes.
+ * @param frame_size Bytes per frame on the connection.
  * @return The number of bytes read, or -1 on error.
  */
-int read_message_from_server(SOCKET serverSocket, char* buffer) {
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Entering read_message_from_server");
+int read_message_from_server(SOCKET serverSocket, char* buffer, size_t frame_size) {
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Entering read_message_from_server");
     // Check for null buffer
     if (!buffer) {
-        write_log(LOGLEVEL_ERROR, "TCP Client - Buffer is NULL");
+        WRITE_LOG(LOGLEVEL_ERROR, "TCP Client - Buffer is NULL");
         return -1;
     }
 
@@ -79,71 +223,359 @@ int read_message_from_server(SOCKET serverSocket, char* buffer) {
     int bytesRead = 0;       // Bytes read in a single recv call
 
     // Loop until the entire message has been read
-    while (totalBytesRead < MESSAGE_SIZE_BYTES) {
-        bytesRead = recv(serverSocket, buffer + totalBytesRead, MESSAGE_SIZE_BYTES - totalBytesRead, 0);
+    while (totalBytesRead < (int)frame_size) {
+        bytesRead = recv(serverSocket, buffer + totalBytesRead, (int)frame_size - totalBytesRead, 0);
+
+        // Socket is in non-blocking mode; wait for the rest of the message
+        if (bytesRead == SOCKET_ERROR && platform_socket_would_block(platform_socket_error())) {
+            if (wait_for_socket(serverSocket, false) < 0) {
+                return -1;
+            }
+            continue;
+        }
 
         // Check for socket errors
-        if (bytesRead == SOCKET_ERROR && WSAGetLastError() != 10053) {
-            write_log_format(LOGLEVEL_ERROR, "TCP Client - Error occurred while reading from socket. Error Code: %d", WSAGetLastError());
+        if (bytesRead == SOCKET_ERROR && platform_socket_error() != PLATFORM_SOCKET_ABORTED) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Error occurred while reading from socket. Error Code: %d", platform_socket_error());
             return -1;
         }
 
         // Check for server disconnection
         if (bytesRead == 0) {
-            write_log(LOGLEVEL_ERROR, "TCP Client - Server disconnected before sending full message.");
+            WRITE_LOG(LOGLEVEL_ERROR, "TCP Client - Server disconnected before sending full message.");
             return totalBytesRead;
         }
 
         totalBytesRead += bytesRead;  // Update the total bytes read
     }
 
-    write_log_format(LOGLEVEL_DEBUG, "TCP Client - Read %d bytes from server", totalBytesRead);
-    write_log_byte_array(LOGLEVEL_DEBUG, buffer, totalBytesRead);
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Exiting read_message_from_server");
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "TCP Client - Read %d bytes from server", totalBytesRead);
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, (const unsigned char*)buffer, totalBytesRead);
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Exiting read_message_from_server");
     return totalBytesRead;
 }
 
 /**
- * Sends data to the server.
+ * Allocates the receive buffer of a stream reader.
+ *
+ * @param reader Pointer to the reader to initialize.
+ * @param capacity Size of the buffer in bytes (at least one message).
+ * @param frame_size Bytes per frame on the connection.
+ * @return 1 if initialization is successful, 0 otherwise.
+ */
+int init_stream_reader(tcp_stream_reader* reader, size_t capacity, size_t frame_size) {
+    memset(reader, 0, sizeof(*reader));
+    if (capacity < frame_size) {
+        capacity = frame_size;
+    }
+    reader->frame_size = frame_size;
+
+    reader->buffer = (unsigned char*)malloc(capacity);
+    if (!reader->buffer) {
+        WRITE_LOG(LOGLEVEL_ERROR, "TCP Client - Failed to allocate receive buffer");
+        return 0;
+    }
+    reader->capacity = capacity;
+    return 1;
+}
+
+/**
+ * Receives as much as the socket has pending (up to the free buffer space)
+ * with a single recv. A partial frame left over from the previous call is
+ * moved to the front of the buffer first.
+ *
+ * @param serverSocket The server socket, in non-blocking mode.
+ * @param reader Pointer to the stream reader.
+ * @return The number of bytes received, 0 if nothing was pending, or -1 on
+ *         error or if the server disconnected.
+ */
+int recv_into_stream_reader(SOCKET serverSocket, tcp_stream_reader* reader) {
+    // Keep the partial tail, drop everything already handed out
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    int space = (int)(reader->capacity - reader->end);
+    int bytesRead = recv(serverSocket, (char*)reader->buffer + reader->end, space, 0);
+    reader->recv_calls++;
+
+    if (bytesRead == SOCKET_ERROR) {
+        if (platform_socket_would_block(platform_socket_error())) {
+            return 0;
+        }
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Error occurred while reading from socket. Error Code: %d", platform_socket_error());
+        return -1;
+    }
+    if (bytesRead == 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Server disconnected with %u bytes of a partial message buffered.",
+            (unsigned)(reader->end - reader->start));
+        return -1;
+    }
+
+    reader->end += bytesRead;
+    reader->bytes_received += bytesRead;
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "TCP Client - Received %d bytes from server", bytesRead);
+    return bytesRead;
+}
+
+/**
+ * Returns the complete frames currently buffered as one contiguous batch.
+ * The frames stay valid until the next recv_into_stream_reader call.
+ *
+ * @param reader Pointer to the stream reader.
+ * @param frames Receives a pointer to the first complete frame.
+ * @return The number of complete frames available.
+ */
+size_t stream_reader_frames(tcp_stream_reader* reader, const unsigned char** frames) {
+    *frames = reader->buffer + reader->start;
+    return (reader->end - reader->start) / reader->frame_size;
+}
+
+/**
+ * Marks frames returned by stream_reader_frames as handled.
+ *
+ * @param reader Pointer to the stream reader.
+ * @param frame_count The number of frames consumed.
+ */
+void stream_reader_consume(tcp_stream_reader* reader, size_t frame_count) {
+    reader->start += frame_count * reader->frame_size;
+    reader->frames_decoded += frame_count;
+    if (reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    }
+}
+
+/**
+ * Discards everything buffered, including a partial frame. Used when the
+ * connection is replaced, as the new stream starts on a frame boundary.
+ *
+ * @param reader Pointer to the stream reader.
+ */
+void stream_reader_reset(tcp_stream_reader* reader) {
+    reader->start = 0;
+    reader->end = 0;
+}
+
+/**
+ * Releases the receive buffer and logs how well reads were batched.
+ *
+ * @param reader Pointer to the stream reader.
+ */
+void cleanup_stream_reader(tcp_stream_reader* reader) {
+    if (reader->recv_calls > 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "TCP Client - %llu recv calls, %llu bytes, %llu frames decoded",
+            reader->recv_calls, reader->bytes_received, reader->frames_decoded);
+    }
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+/**
+ * Sends data to the server, continuing after short writes.
  *
  * @param serverSocket The server socket to send the data to.
  * @param data Pointer to the data to be sent.
  * @param dataLength The length of the data in bytes.
  */
 int send_to_server(SOCKET serverSocket, const char* data, int dataLength) {
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Entering send_to_server");
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Entering send_to_server");
     // Check for null data or zero length
     if (!data || dataLength <= 0) {
-        write_log(LOGLEVEL_ERROR, "TCP Client - Invalid data to send");
+        WRITE_LOG(LOGLEVEL_ERROR, "TCP Client - Invalid data to send");
         return -1;
     }
 
-    // Send the data
-    if (send(serverSocket, data, dataLength, 0) == SOCKET_ERROR) {
-        write_log_format(LOGLEVEL_ERROR, "TCP Client - Failed to send data. Error Code: %d", WSAGetLastError());
-        return -1;
+    // Send the data, waiting for buffer space if the socket is in non-blocking mode
+    int totalBytesSent = 0;
+    while (totalBytesSent < dataLength) {
+        int bytesSent = send(serverSocket, data + totalBytesSent, dataLength - totalBytesSent, 0);
+        if (bytesSent == SOCKET_ERROR) {
+            if (!platform_socket_would_block(platform_socket_error()) || wait_for_socket(serverSocket, true) < 0) {
+                WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Failed to send data. Error Code: %d", platform_socket_error());
+                return -1;
+            }
+            continue;
+        }
+        totalBytesSent += bytesSent;
+    }
+
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "TCP Client - Sent %d bytes to server:", dataLength);
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_DEBUG, (const unsigned char*)data, dataLength);
+
+    return 0;
+}
+
+/**
+ * Empties an outbound frame queue.
+ *
+ * @param queue Pointer to the queue to initialize.
+ * @param frame_size Bytes per frame on the connection, at most MESSAGE_MAX_SIZE_BYTES.
+ */
+void init_send_queue(tcp_send_queue* queue, size_t frame_size) {
+    queue->frame_size = frame_size;
+    queue->head = 0;
+    queue->count = 0;
+    queue->head_offset = 0;
+    queue->oldest_queued_us = 0;
+    queue->send_calls = 0;
+    queue->frames_sent = 0;
+    queue->bytes_sent = 0;
+    queue->frames_truncated = 0;
+}
+
+/**
+ * Discards every queued frame but keeps the counters. Used when the
+ * connection drops; the frames are resent from the in-flight table.
+ *
+ * @param queue Pointer to the queue.
+ */
+void send_queue_clear(tcp_send_queue* queue) {
+    queue->head = 0;
+    queue->count = 0;
+    queue->head_offset = 0;
+}
+
+/**
+ * Whether the outbound queue has no room for another frame.
+ *
+ * @param queue Pointer to the queue.
+ * @return true if send_queue_push would fail.
+ */
+bool send_queue_full(const tcp_send_queue* queue) {
+    return queue->count >= TCP_SEND_QUEUE_FRAMES;
+}
+
+/**
+ * Number of frames the outbound queue still has room for.
+ *
+ * @param queue Pointer to the queue.
+ * @return The free frame slots.
+ */
+size_t send_queue_room(const tcp_send_queue* queue) {
+    return TCP_SEND_QUEUE_FRAMES - queue->count;
+}
+
+/**
+ * Appends a frame to the outbound queue without sending it, zero-padded or
+ * cut to the connection's frame size.
+ *
+ * @param queue Pointer to the queue.
+ * @param frame Pointer to one message.
+ * @param size The size of the message in bytes.
+ * @param now_us Current monotonic time, used for the batching deadline.
+ * @return 1 if queued, 0 if the queue is full.
+ */
+int send_queue_push(tcp_send_queue* queue, const unsigned char* frame, size_t size, uint64_t now_us) {
+    if (send_queue_full(queue)) {
+        return 0;
     }
+    if (queue->count == 0) {
+        queue->oldest_queued_us = now_us;
+    }
+    unsigned char* slot = queue->frames + ((queue->head + queue->count) % TCP_SEND_QUEUE_FRAMES) * queue->frame_size;
+    if (size > queue->frame_size) {
+        size = queue->frame_size;
+        queue->frames_truncated++;
+    }
+    memcpy(slot, frame, size);
+    resize_message(slot, size, queue->frame_size);
+    queue->count++;
+    return 1;
+}
+
+/**
+ * Appends a fragmented message to the outbound queue as fragments of the
+ * connection's frame size, all or none of them.
+ *
+ * @param queue Pointer to the queue.
+ * @param header The message's first frame, carrying its flags and request ID.
+ * @param payload The message's payload.
+ * @param now_us Current monotonic time, used for the batching deadline.
+ * @return 1 if queued, 0 if the queue has no room for every fragment.
+ */
+int send_queue_push_fragments(tcp_send_queue* queue, const unsigned char* header, const message_payload* payload, uint64_t now_us) {
+    size_t count = message_fragment_count(payload->size, queue->frame_size);
+    if (send_queue_room(queue) < count) {
+        return 0;
+    }
+    if (queue->count == 0) {
+        queue->oldest_queued_us = now_us;
+    }
+    for (size_t i = 0; i < count; i++) {
+        unsigned char* slot = queue->frames + ((queue->head + queue->count) % TCP_SEND_QUEUE_FRAMES) * queue->frame_size;
+        fragment_message(slot, queue->frame_size, header, payload, i);
+        queue->count++;
+    }
+    return 1;
+}
 
-    write_log_format(LOGLEVEL_DEBUG, "TCP Client - Sent %d bytes to server:", dataLength);
-    write_log_byte_array(LOGLEVEL_DEBUG, data, dataLength);
+/**
+ * Writes every queued frame with vectored send calls (at most two buffers,
+ * since the queue is circular). Short writes are resumed from the exact byte
+ * they stopped at; if the socket buffer is full the rest stays queued and
+ * the caller flushes again once the socket is writable.
+ *
+ * @param serverSocket The server socket, in non-blocking mode.
+ * @param queue Pointer to the queue.
+ * @return 0 if the queue is empty, 1 if frames are still pending, -1 on error.
+ */
+int flush_send_queue(SOCKET serverSocket, tcp_send_queue* queue) {
+    while (queue->count > 0) {
+        platform_buffer buffers[2];
+        size_t buffer_count = 1;
+        size_t contiguous = TCP_SEND_QUEUE_FRAMES - queue->head;
+        if (contiguous > queue->count) {
+            contiguous = queue->count;
+        }
+
+        buffers[0].data = queue->frames + queue->head * queue->frame_size + queue->head_offset;
+        buffers[0].length = contiguous * queue->frame_size - queue->head_offset;
+        if (contiguous < queue->count) {
+            buffers[1].data = queue->frames;
+            buffers[1].length = (queue->count - contiguous) * queue->frame_size;
+            buffer_count = 2;
+        }
 
+        size_t bytesSent = 0;
+        if (platform_send_buffers(serverSocket, buffers, buffer_count, &bytesSent) < 0) {
+            if (platform_socket_would_block(platform_socket_error())) {
+                return 1;
+            }
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client - Failed to send data. Error Code: %d", platform_socket_error());
+            return -1;
+        }
+        queue->send_calls++;
+
+        // Retire every fully sent frame and remember how far into the next one we got
+        size_t progress = queue->head_offset + bytesSent;
+        size_t frames_done = progress / queue->frame_size;
+        queue->head = (queue->head + frames_done) % TCP_SEND_QUEUE_FRAMES;
+        queue->count -= frames_done;
+        queue->head_offset = progress % queue->frame_size;
+        queue->frames_sent += frames_done;
+        queue->bytes_sent += bytesSent;
+
+        WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "TCP Client - Sent %zu bytes (%u frames) to server in one call", bytesSent, (unsigned)frames_done);
+    }
     return 0;
 }
 
 /**
- * Cleans up the client by closing the socket and cleaning up WinSock resources.
+ * Cleans up the client by closing the socket and releasing the socket library.
  *
  * @param serverSocket The server socket to close.
  */
 void cleanup_client(SOCKET serverSocket) {
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Entering cleanup_client");
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Entering cleanup_client");
     // Close the socket if it's valid
     if (serverSocket != INVALID_SOCKET) {
         closesocket(serverSocket);
     }
 
-    // Cleanup WinSock
-    WSACleanup();
-    write_log(LOGLEVEL_INFO, "TCP Client - Client resources cleaned up");
-    write_log(LOGLEVEL_DEBUG, "TCP Client - Exiting cleanup_client");
+    // Release the socket library
+    platform_socket_cleanup();
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client - Client resources cleaned up");
+    WRITE_LOG(LOGLEVEL_DEBUG, "TCP Client - Exiting cleanup_client");
 }
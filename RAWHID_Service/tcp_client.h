@@ -3,20 +3,72 @@
 
 #include <stdio.h>
 #include <stdint.h>
-#include <winsock2.h>
+#include <stdbool.h>
+#include "platform.h"
 #include "message_protocol.h"
+#include "message_fragments.h"
 #include "logger.h"
 
 // Structure to hold information required for TCP socket connection
 typedef struct {
 	const char* ip;  // IP address of the server
 	uint16_t port;   // Port number to connect to
+	uint32_t connect_timeout_ms;  // Give up on a connection attempt after this long, 0 for the system default
+	uint8_t frame_size;  // Bytes per frame on this connection, 0 for MESSAGE_SIZE_BYTES
 } tcp_socket_info;
 
+#define TCP_RECEIVE_BUFFER_SIZE (64 * 1024)
+
+// Connection-level receive buffer: one recv pulls everything available and
+// complete frames are carved out of it, with a partial tail kept for next time.
+typedef struct {
+    unsigned char* buffer;
+    size_t capacity;
+    size_t start;             // First byte not yet handed out as a frame
+    size_t end;               // One past the last byte received
+    size_t frame_size;        // Bytes per frame on the connection
+    uint64_t recv_calls;
+    uint64_t bytes_received;
+    uint64_t frames_decoded;
+} tcp_stream_reader;
+
+#define TCP_SEND_QUEUE_FRAMES 256
+
+// Outbound frame queue. Frames are stored back to back at the connection's
+// frame size, so everything queued is written with one vectored send; a
+// short write leaves the unsent bytes queued for the next flush.
+typedef struct {
+    unsigned char frames[TCP_SEND_QUEUE_FRAMES * MESSAGE_MAX_SIZE_BYTES];
+    size_t frame_size;        // Bytes per frame on the connection
+    size_t head;              // Index of the oldest queued frame
+    size_t count;             // Frames queued (including a partially sent head)
+    size_t head_offset;       // Bytes of the head frame already sent
+    uint64_t oldest_queued_us;  // When the oldest queued frame was queued
+    uint64_t send_calls;
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t frames_truncated;  // Frames longer than frame_size, cut to fit
+} tcp_send_queue;
+
 // Function prototypes
-int read_message_from_server(SOCKET socket, char* buffer);
+int read_message_from_server(SOCKET socket, char* buffer, size_t frame_size);
 SOCKET init_client(tcp_socket_info* server_info);
+SOCKET begin_client_connect(tcp_socket_info* server_info, bool* connected);
+int finish_client_connect(SOCKET clientSocket, tcp_socket_info* server_info);
 int send_to_server(SOCKET serverSocket, const char* data, int dataLength);
 void cleanup_client(SOCKET serverSocket);
+int init_stream_reader(tcp_stream_reader* reader, size_t capacity, size_t frame_size);
+int recv_into_stream_reader(SOCKET serverSocket, tcp_stream_reader* reader);
+size_t stream_reader_frames(tcp_stream_reader* reader, const unsigned char** frames);
+void stream_reader_consume(tcp_stream_reader* reader, size_t frame_count);
+void stream_reader_reset(tcp_stream_reader* reader);
+void cleanup_stream_reader(tcp_stream_reader* reader);
+void init_send_queue(tcp_send_queue* queue, size_t frame_size);
+int send_queue_push(tcp_send_queue* queue, const unsigned char* frame, size_t size, uint64_t now_us);
+int send_queue_push_fragments(tcp_send_queue* queue, const unsigned char* header, const message_payload* payload, uint64_t now_us);
+bool send_queue_full(const tcp_send_queue* queue);
+size_t send_queue_room(const tcp_send_queue* queue);
+void send_queue_clear(tcp_send_queue* queue);
+int flush_send_queue(SOCKET serverSocket, tcp_send_queue* queue);
 
 #endif
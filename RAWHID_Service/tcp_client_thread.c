@@ -1,116 +1,322 @@
 #include "tcp_client_thread.h"
 
-// Define constants for maximum number of timeout attempts, confirmation message type, and buffer size
-#define MAX_TIMEOUT_COUNTER 10
+/**
+ * Hands a response to the HID side through the shared ring.
+ *
+ * @param response The response.
+ * @param context Pointer to the shared_thread_data.
+ */
+static void deliver_to_hid(const bridge_frame* response, void* context) {
+    set_message_from_tcp((shared_thread_data*)context, response);
+}
+
+/**
+ * Handles the socket event: drains everything the server has sent and
+ * reports a disconnect.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param socket_event The event the pipeline's socket is registered with.
+ * @return 0 to keep running, -1 if the connection is gone.
+ */
+static int service_socket(tcp_pipeline* pipeline, WSAEVENT socket_event) {
+    WSANETWORKEVENTS network_events;
+    if (WSAEnumNetworkEvents(pipeline->socket, socket_event, &network_events) == SOCKET_ERROR) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Failed to query socket events. Error Code: %d", WSAGetLastError());
+        return -1;
+    }
+
+    if (upstream_receive(pipeline) < 0) {
+        return -1;
+    }
+
+    if (network_events.lNetworkEvents & FD_CLOSE) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Upstream %u closed the connection.", pipeline->index);
+        return -1;
+    }
+
+    // Room in the socket buffer again; resume the pending flush
+    if (network_events.lNetworkEvents & FD_WRITE) {
+        pipeline->write_blocked = false;
+    }
+    return 0;
+}
+
+// Connection attempt in progress to one upstream.
+typedef struct {
+    SOCKET socket;            // INVALID_SOCKET when not connecting
+    uint64_t deadline_us;     // Give up once monotonic_time_us() passes this, UINT64_MAX for never
+} upstream_attempt;
+
+/**
+ * Starts a connection attempt without waiting for it, so a dead server never
+ * stalls the other upstreams or the HID side. The socket is registered with
+ * the pipeline's socket event, which FD_CONNECT or FD_WRITE signals once the
+ * attempt is decided; on failure the next attempt is scheduled.
+ *
+ * @param router Pointer to the router, told that routes have changed.
+ * @param pipeline Pointer to the pipeline state.
+ * @param attempt Receives the attempt in progress.
+ * @param socket_event The event to register the socket with.
+ * @param now_us Current monotonic time in microseconds.
+ */
+static void start_connect(tcp_router* router, tcp_pipeline* pipeline, upstream_attempt* attempt, WSAEVENT socket_event, uint64_t now_us) {
+    bool connected = false;
+    SOCKET socket = begin_client_connect(pipeline->server, &connected);
+    if (socket != INVALID_SOCKET) {
+        WSAResetEvent(socket_event);
+        if (WSAEventSelect(socket, socket_event, FD_CONNECT | FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Failed to register socket events. Error Code: %d", WSAGetLastError());
+            cleanup_client(socket);
+            socket = INVALID_SOCKET;
+        }
+    }
+
+    if (socket == INVALID_SOCKET) {
+        upstream_connect_failed(pipeline);
+    }
+    else if (connected) {
+        upstream_connected(router, pipeline, socket);
+    }
+    else {
+        attempt->socket = socket;
+        attempt->deadline_us = pipeline->server->connect_timeout_ms
+            ? now_us + (uint64_t)pipeline->server->connect_timeout_ms * 1000 : UINT64_MAX;
+    }
+}
+
+/**
+ * Completes a connection attempt once its socket event is signalled. Data
+ * the server sent straight away is drained, since its FD_READ has been
+ * consumed with the connection's events.
+ *
+ * @param router Pointer to the router, told that routes have changed.
+ * @param pipeline Pointer to the pipeline state.
+ * @param attempt The attempt in progress.
+ * @param socket_event The event the socket is registered with.
+ */
+static void finish_connect(tcp_router* router, tcp_pipeline* pipeline, upstream_attempt* attempt, WSAEVENT socket_event) {
+    WSANETWORKEVENTS network_events;
+    if (WSAEnumNetworkEvents(attempt->socket, socket_event, &network_events) == SOCKET_ERROR) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Failed to query socket events. Error Code: %d", WSAGetLastError());
+    }
+    else if (!(network_events.lNetworkEvents & (FD_CONNECT | FD_WRITE | FD_CLOSE))) {
+        return;  // Not decided yet
+    }
+    else if (!(network_events.lNetworkEvents & FD_CONNECT && network_events.iErrorCode[FD_CONNECT_BIT] != 0) &&
+        finish_client_connect(attempt->socket, pipeline->server) == 0) {
+        upstream_connected(router, pipeline, attempt->socket);
+        attempt->socket = INVALID_SOCKET;
+        if (upstream_receive(pipeline) < 0 || (network_events.lNetworkEvents & FD_CLOSE)) {
+            upstream_drop_connection(router, pipeline);
+        }
+        return;
+    }
+
+    cleanup_client(attempt->socket);
+    attempt->socket = INVALID_SOCKET;
+    upstream_connect_failed(pipeline);
+}
+
+/**
+ * Starts connecting to every upstream whose next attempt is due, and gives up
+ * on attempts that ran past their connect timeout.
+ *
+ * @param router Pointer to the router.
+ * @param attempts The attempt in progress for each upstream.
+ * @param socket_events The socket event of each upstream.
+ * @param now_us Current monotonic time in microseconds.
+ */
+static void connect_upstreams(tcp_router* router, upstream_attempt* attempts, WSAEVENT* socket_events, uint64_t now_us) {
+    for (size_t i = 0; i < router->upstream_count; i++) {
+        tcp_pipeline* upstream = &router->upstreams[i];
+        if (attempts[i].socket != INVALID_SOCKET && now_us >= attempts[i].deadline_us) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Connecting to upstream %zu (%s:%u) timed out.", i, upstream->server->ip, upstream->server->port);
+            cleanup_client(attempts[i].socket);
+            attempts[i].socket = INVALID_SOCKET;
+            upstream_connect_failed(upstream);
+        }
+        if (!upstream->connected && attempts[i].socket == INVALID_SOCKET && now_us >= upstream->next_attempt_us) {
+            start_connect(router, upstream, &attempts[i], socket_events[i], now_us);
+        }
+    }
+}
+
+/**
+ * Routes the HID side's requests until its ring is empty or a request's
+ * upstream is full. That request is held back (and the ring left alone) so
+ * a busy upstream pushes back on the devices just as a single server did.
+ *
+ * @param router Pointer to the router.
+ * @param shared_data The rings shared with the HID thread.
+ */
+static void drain_hid_requests(tcp_router* router, shared_thread_data* shared_data) {
+    while (true) {
+        if (!router->has_pending) {
+            if (!check_message_to_tcp(shared_data, &router->pending)) {
+                return;
+            }
+            if (upstream_answer_from_cache(router, &router->pending)) {
+                continue;
+            }
+            router->has_pending = true;
+        }
+
+        if (!upstream_place_request(router, &router->pending)) {
+            return;
+        }
+        router->has_pending = false;
+    }
+}
 
 /**
  * Thread function for handling TCP client operations.
- * Establishes connection, sends/receives messages, and updates shared data.
+ * Keeps a connection to every upstream server and routes each request from
+ * the HID side to the shard its URI belongs to, with up to pipeline_window
+ * requests in flight per upstream. Confirmations and responses are routed
+ * back to the HID side as they arrive. A failed connection is retried with
+ * jittered exponential backoff; meanwhile its requests go to a connected
+ * replica of their shard or, if there is none, are kept and replayed in order.
  *
  * @param thread_config: Pointer to the configuration structure for this thread
  * @return 0 on success, error code otherwise
  */
 DWORD WINAPI tcp_client_thread(LPVOID thread_config) {
-    write_log(LOGLEVEL_INFO, "TCP Client Thread - TCP client thread started.");
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client Thread - TCP client thread started.");
 
     int ret = 0;  // Return code
-    SOCKET clientSocket = INVALID_SOCKET;  // Initialize socket to INVALID_SOCKET
+    tcp_router router = { 0 };
+    WSAEVENT socket_events[MAXIMUM_WAIT_OBJECTS];  // One per upstream, so one wait covers all of them
+    upstream_attempt attempts[MAXIMUM_WAIT_OBJECTS];
+    size_t socket_event_count = 0;
     client_thread_config* config = (client_thread_config*)thread_config;  // Cast the void pointer to the expected struct type
 
     // Check if the required configuration is present
-    if (!config || !config->server_config || !config->shared_data) {
-        write_log(LOGLEVEL_ERROR, "TCP Client Thread - Configuration or Server information is NULL.\n");
+    if (!config || !config->upstream.endpoints || !config->upstream.routing || !config->shared_data) {
+        WRITE_LOG(LOGLEVEL_ERROR, "TCP Client Thread - Configuration or Server information is NULL.\n");
         ret = -1;  // Update return code to indicate error
         goto cleanup;
     }
 
-    // Initialize the client socket
-    write_log(LOGLEVEL_INFO, "TCP Client Thread - Initializing client socket.");
-    clientSocket = init_client(config->server_config);
-    if (clientSocket == INVALID_SOCKET) {
-        write_log(LOGLEVEL_ERROR, "TCP Client Thread - Failed to initialize client socket.");
-        ret = -1;  // Update return code to indicate error
+    // One wait handle per upstream plus the HID side's
+    if (config->upstream.endpoint_count == 0 || config->upstream.endpoint_count > MAXIMUM_WAIT_OBJECTS - 1) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Between 1 and %d upstreams are supported, %zu configured.",
+            MAXIMUM_WAIT_OBJECTS - 1, config->upstream.endpoint_count);
+        ret = -1;
         goto cleanup;
     }
 
-    char buffer[MESSAGE_SIZE_BYTES];  // Buffer for incoming/outgoing data
     shared_thread_data* shared_data = config->shared_data;  // Pointer to the shared data
+    if (!upstream_router_init(&router, &config->upstream, deliver_to_hid, shared_data)) {
+        ret = -1;
+        goto cleanup;
+    }
+    for (; socket_event_count < router.upstream_count; socket_event_count++) {
+        attempts[socket_event_count].socket = INVALID_SOCKET;
+        socket_events[socket_event_count] = WSACreateEvent();
+        if (socket_events[socket_event_count] == WSA_INVALID_EVENT) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Failed to create socket event. Error Code: %d", WSAGetLastError());
+            ret = -1;
+            goto cleanup;
+        }
+    }
+    srand((unsigned)GetTickCount() ^ GetCurrentThreadId());
 
-    // Main client operation loop
-    write_log(LOGLEVEL_INFO, "TCP Client Thread - Entering main client operation loop.");
+    // Main client operation loop; it connects the client sockets, and retries servers that aren't up yet
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client Thread - Entering main client operation loop.");
     while (true) {
-        // Read the message to send to TCP server from the shared data
-        unsigned char request_from_hid[MESSAGE_SIZE_BYTES];
-        if (check_message_to_tcp(shared_data, request_from_hid, MESSAGE_SIZE_BYTES)) {
-
-            // Log the message that will be sent to the server
-            write_log(LOGLEVEL_DEBUG, "TCP Client Thread - Preparing to send data to TCP server.");
+        connect_upstreams(&router, attempts, socket_events, monotonic_time_us());
 
-            if (send_to_server(clientSocket, (const char*)request_from_hid, MESSAGE_SIZE_BYTES) == SOCKET_ERROR) {
-                write_log(LOGLEVEL_ERROR, "TCP Client Thread - Failed to send data to the server.");
-                ret = -1;
-                goto cleanup;
-            }
-
-            write_log(LOGLEVEL_DEBUG, "TCP Client Thread - Message sent to server, awaiting response.");
-
-            unsigned char confirmation_message[MESSAGE_SIZE_BYTES];
-            MessageType message_type;
-            int timeoutCounter = 0;  // Counter for timeout attempts
+        // Fill the windows with replayed and failed-over requests first, then route the HID side's
+        upstream_send_retained(&router);
+        drain_hid_requests(&router, shared_data);
 
-            // Read the confirmation message from the server
-            int bytesRead = read_message_from_server(clientSocket, (char*)confirmation_message);
-            write_log_format(LOGLEVEL_INFO, "TCP Client Thread - Received %d/%d bytes of confirmation from server.", bytesRead, MESSAGE_SIZE_BYTES);
-            write_log_byte_array(LOGLEVEL_DEBUG, confirmation_message, bytesRead);
+        // Coalesce everything queued at this wake-up into one send per upstream, subject to the batching delay
+        upstream_flush(&router, monotonic_time_us());
 
-            if (bytesRead == SOCKET_ERROR) {
-                write_log(LOGLEVEL_ERROR, "TCP Client Thread - An error occurred while reading confirmation from the server.");
-                ret = -1;  // Update return code to indicate error
-                goto cleanup;
+        // Wait for the connected and connecting servers, and for the HID side only while no request is held back
+        HANDLE wait_handles[MAXIMUM_WAIT_OBJECTS];
+        size_t waiting[MAXIMUM_WAIT_OBJECTS];
+        DWORD socket_count = 0;
+        DWORD timeout = INFINITE;
+        uint64_t now = monotonic_time_us();
+        for (size_t i = 0; i < router.upstream_count; i++) {
+            tcp_pipeline* upstream = &router.upstreams[i];
+            DWORD upstream_timeout = upstream_next_timeout_ms(upstream);
+            if (attempts[i].socket != INVALID_SOCKET) {
+                // Waiting for the connection, not for a retry
+                upstream_timeout = attempts[i].deadline_us == UINT64_MAX ? INFINITE
+                    : attempts[i].deadline_us <= now ? 0 : (DWORD)((attempts[i].deadline_us - now + 999) / 1000);
             }
+            if (upstream_timeout < timeout) {
+                timeout = upstream_timeout;
+            }
+            if (upstream->connected || attempts[i].socket != INVALID_SOCKET) {
+                wait_handles[socket_count] = socket_events[i];
+                waiting[socket_count++] = i;
+            }
+        }
 
-            // Interpret the received message
-            interpret_message(&confirmation_message, &message_type);
-            write_log_format(LOGLEVEL_INFO, "TCP Client Thread - Interpreted message type: %d, expected confirm type: %d", message_type, CONFIRM_MESSAGE);
-
-            // Continue with further processing if the message type is CONFIRMATION_TYPE
-            if (message_type == CONFIRM_MESSAGE) {
-                unsigned char response[MESSAGE_SIZE_BYTES];
-
-                int bytesRead = read_message_from_server(clientSocket, (char*)&response);
-                if (bytesRead != SOCKET_ERROR) {
+        DWORD handle_count = socket_count;
+        if (!router.has_pending) {
+            if (spin_message_to_tcp(shared_data, &router.pending, config->spin_budget_us)) {
+                router.has_pending = !upstream_answer_from_cache(&router, &router.pending);
+                timeout = 0;  // Still look at the sockets before routing it
+            }
+            else if (!prepare_wait_message_to_tcp(shared_data)) {
+                timeout = 0;  // A frame was queued while we were arming the wait
+            }
+            else {
+                wait_handles[handle_count++] = shared_data->data_ready_to_send_event;
+            }
+        }
 
-                    // Log the message received from the server
-                    write_log(LOGLEVEL_DEBUG, "TCP Client Thread - Received response from TCP server");
-                    write_log_byte_array(LOGLEVEL_DEBUG, response, bytesRead);
+        // Nothing to wait on only happens when every upstream is down, and then a reconnect is due
+        if (handle_count == 0) {
+            Sleep(timeout);
+            continue;
+        }
 
-                    // Update the shared data with the response from the server
-                    set_message_from_tcp(shared_data, response, MESSAGE_SIZE_BYTES);
+        DWORD wait_result = WaitForMultipleObjects(handle_count, wait_handles, FALSE, timeout);
+        if (wait_result == WAIT_FAILED) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "TCP Client Thread - Wait failed. Error Code: %lu", GetLastError());
+            ret = -1;
+            goto cleanup;
+        }
+        if (wait_result < WAIT_OBJECT_0 + socket_count) {
+            // The wait reports only the first signalled socket; service any later ones that are signalled too
+            for (DWORD i = wait_result - WAIT_OBJECT_0; i < socket_count; i++) {
+                if (i != wait_result - WAIT_OBJECT_0 && WaitForSingleObject(wait_handles[i], 0) != WAIT_OBJECT_0) {
+                    continue;
+                }
+                tcp_pipeline* upstream = &router.upstreams[waiting[i]];
+                if (attempts[waiting[i]].socket != INVALID_SOCKET) {
+                    finish_connect(&router, upstream, &attempts[waiting[i]], wait_handles[i]);
+                }
+                else if (service_socket(upstream, wait_handles[i]) < 0) {
+                    upstream_drop_connection(&router, upstream);
                 }
-				else {
-					write_log(LOGLEVEL_ERROR, "TCP Client Thread - An error occurred while reading response from the server.");
-					ret = -1;  // Update return code to indicate error
-					goto cleanup;
-				}
-            }
-            else {
-                write_log(LOGLEVEL_DEBUG, "TCP Client Thread - unexpected response.");
             }
         }
     }
 
     // Cleanup
 cleanup:
-    // Close the client socket if it's valid
-    write_log(LOGLEVEL_INFO, "TCP Client Thread - Starting cleanup process.");
-    if (clientSocket != INVALID_SOCKET) {
-        cleanup_client(clientSocket);
+    // Close the client sockets and report each upstream
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client Thread - Starting cleanup process.");
+    for (size_t i = 0; i < socket_event_count; i++) {
+        if (attempts[i].socket != INVALID_SOCKET) {
+            cleanup_client(attempts[i].socket);
+        }
+    }
+    upstream_router_cleanup(&router);
+    for (size_t i = 0; i < socket_event_count; i++) {
+        WSACloseEvent(socket_events[i]);
     }
 
     // Free the configuration structure
     if (config) {
         free(config);
     }
-    write_log(LOGLEVEL_INFO, "TCP Client Thread - TCP client thread terminated.");
+    WRITE_LOG(LOGLEVEL_INFO, "TCP Client Thread - TCP client thread terminated.");
     return ret;  // Return the final result code
 }
@@ -2,15 +2,19 @@
 #define TCP_CLIENT_THREAD_H
 
 #include "tcp_client.h"
+#include "upstream_pipeline.h"
 #include "message_protocol.h"
 #include "shared_thread_data.h"
+#include "frame_capture.h"
+#include "metrics.h"
 #include "logger.h"
 #include <windows.h>
 #include <stdbool.h>
 
 typedef struct {
-    tcp_socket_info* server_config;
+    upstream_config upstream; // Endpoints, routing and pipeline settings
     shared_thread_data* shared_data;
+    uint32_t spin_budget_us;  // Poll this long before blocking, 0 to block immediately
 } client_thread_config;
 
 DWORD WINAPI tcp_client_thread(LPVOID server_info);
@@ -0,0 +1,1021 @@
+#include "upstream_pipeline.h"
+
+#define RECEIVE_DECODE_BATCH 64  // Frames decoded per batch codec call
+
+/**
+ * Appends a frame to the retained queue, discarding the oldest retained frame
+ * if it is full.
+ *
+ * @param queue Pointer to the retained queue.
+ * @param frame The frame to keep.
+ */
+static void retain_frame(retained_queue* queue, const bridge_frame* frame) {
+    if (queue->count == queue->capacity) {
+        message_payload_free(queue->frames[queue->head].payload);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->dropped++;
+    }
+    queue->frames[(queue->head + queue->count) % queue->capacity] = *frame;
+    queue->count++;
+}
+
+/**
+ * Puts a frame in front of everything retained. Frames requeued this way are
+ * older than the rest, so if the queue is full the frame itself is dropped.
+ *
+ * @param queue Pointer to the retained queue.
+ * @param frame The frame to keep.
+ */
+static void retain_frame_front(retained_queue* queue, const bridge_frame* frame) {
+    if (queue->count == queue->capacity) {
+        message_payload_free(frame->payload);
+        queue->dropped++;
+        return;
+    }
+    queue->head = (queue->head + queue->capacity - 1) % queue->capacity;
+    queue->frames[queue->head] = *frame;
+    queue->count++;
+}
+
+/**
+ * The oldest retained frame, left in the queue.
+ *
+ * @param queue Pointer to the retained queue.
+ * @return The frame, or NULL if the queue is empty.
+ */
+static const bridge_frame* peek_retained(const retained_queue* queue) {
+    return queue->count > 0 ? &queue->frames[queue->head] : NULL;
+}
+
+/**
+ * Takes the oldest retained frame.
+ *
+ * @param queue Pointer to the retained queue.
+ * @param frame Frame receiving the request.
+ * @return true if a frame was taken.
+ */
+static bool take_retained(retained_queue* queue, bridge_frame* frame) {
+    if (queue->count == 0) {
+        return false;
+    }
+    *frame = queue->frames[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return true;
+}
+
+/**
+ * Queues one request from the HID side for sending and records it as in
+ * flight. In pipelined mode the request is stamped with a fresh upstream
+ * request ID. A fragmented request is queued as fragments of the upstream's
+ * frame size, and its payload moves to the in-flight entry. The caller checks
+ * the window and the send queue for room first; if either is full all the
+ * same, the request stays with the caller to try again.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param request The frame received from the HID thread.
+ * @return true if the request was queued, false if there was no room for it.
+ */
+static bool send_request(tcp_pipeline* pipeline, bridge_frame* request) {
+    uint64_t now = monotonic_time_us();
+    uint64_t uri;
+    extract_request_uri(request->data, &uri);
+    inflight_entry* entry = inflight_add(&pipeline->inflight, request->request_id, request->device_index, uri, now, pipeline->request_timeout_ms);
+    if (!entry) {
+        WRITE_LOG(LOGLEVEL_WARN, "Upstream - No free in-flight slot for request, holding it back.");
+        return false;
+    }
+
+    memcpy(entry->request, request->data, request->size);
+    entry->request_size = request->size;
+    entry->priority = request->priority;
+    entry->timing = request->timing;
+    entry->timing.sent_ns = monotonic_time_ns();
+    entry->cache_epoch = pipeline->cache ? pipeline->cache->epoch : 0;
+    if (pipeline->pipelined) {
+        set_message_request_id(request->data, entry->upstream_id);
+    }
+
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Upstream - Queueing request %u (device %u, HID request %u) to upstream %u, %u in flight.",
+        entry->upstream_id, entry->device_index, entry->hid_request_id, pipeline->index, pipeline->inflight.count);
+
+    int queued = request->payload
+        ? send_queue_push_fragments(&pipeline->send_queue, request->data, request->payload, now)
+        : send_queue_push(&pipeline->send_queue, request->data, request->size, now);
+    if (!queued) {
+        WRITE_LOG(LOGLEVEL_WARN, "Upstream - Send queue full, holding the request back.");
+        inflight_cancel(&pipeline->inflight, entry);
+        return false;
+    }
+    entry->request_payload = request->payload;  // Kept for replay
+    request->payload = NULL;
+    if (request->priority == PRIORITY_CRITICAL) {
+        pipeline->flush_now = true;  // Goes out with the next flush, whatever the batching delay
+    }
+    if (entry->request_payload) {
+        pipeline->messages_fragmented++;
+    }
+    return true;
+}
+
+/**
+ * Attaches a request to an identical one (same URI) already in flight on this
+ * upstream, so it is answered with that request's response instead of being
+ * sent again.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param request The frame received from the HID thread.
+ * @return true if the request was coalesced.
+ */
+static bool coalesce_request(tcp_pipeline* pipeline, const bridge_frame* request) {
+    uint64_t uri;
+    if (request->payload) {
+        return false;  // Carries more than its URI, so it is never a duplicate
+    }
+    extract_request_uri(request->data, &uri);
+
+    inflight_entry* entry = inflight_find_uri(&pipeline->inflight, uri);
+    if (!entry || !inflight_attach_waiter(&pipeline->inflight, entry, request->request_id, request->device_index, request->timing.hid_read_ns)) {
+        return false;
+    }
+
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Upstream - HID request %u (device %u) waits on request %u for the same URI, %u waiting.",
+        request->request_id, request->device_index, entry->upstream_id, entry->waiter_count);
+    return true;
+}
+
+/**
+ * Flushes the send queue once its batching delay has elapsed (immediately if
+ * the delay is 0, the queue is full or it holds a critical request), unless
+ * the socket is still blocked.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param now_us Current monotonic time in microseconds.
+ * @return 0 on success, -1 if the send failed.
+ */
+static int flush_if_due(tcp_pipeline* pipeline, uint64_t now_us) {
+    tcp_send_queue* queue = &pipeline->send_queue;
+    if (queue->count == 0 || pipeline->write_blocked) {
+        return 0;
+    }
+    if (!pipeline->flush_now && !send_queue_full(queue) && now_us - queue->oldest_queued_us < pipeline->send_batch_delay_us) {
+        return 0;
+    }
+
+    pipeline->flush_now = false;
+    int result = flush_send_queue(pipeline->socket, queue);
+    if (result < 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream - Failed to send data to upstream %u.", pipeline->index);
+        return -1;
+    }
+    pipeline->write_blocked = (result == 1);
+    return 0;
+}
+
+/**
+ * Whether a request can be sent right now.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param request The request, whose fragments all need room in the send queue.
+ * @return true if both the window and the send queue have room.
+ */
+static bool can_accept_request(const tcp_pipeline* pipeline, const bridge_frame* request) {
+    size_t frames = request->payload ? message_fragment_count(request->payload->size, pipeline->send_queue.frame_size) : 1;
+    return !inflight_full(&pipeline->inflight) && send_queue_room(&pipeline->send_queue) >= frames;
+}
+
+/**
+ * Drops the cached responses the server says are out of date.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param message The invalidation message.
+ */
+static void handle_invalidation(tcp_pipeline* pipeline, const unsigned char* message) {
+    uint64_t first_uri, last_uri;
+
+    capture_frame(CAPTURE_CONTROL_FROM_TCP, 0, 0, message, pipeline->reader.frame_size);
+    if (!pipeline->cache) {
+        return;
+    }
+
+    extract_invalidation_range(message, &first_uri, &last_uri);
+    uint32_t dropped = response_cache_invalidate(pipeline->cache, first_uri, last_uri);
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Upstream - Upstream %u invalidated URIs 0x%016llx-0x%016llx, %u cached response(s) dropped.",
+        pipeline->index, (unsigned long long)first_uri, (unsigned long long)last_uri, dropped);
+}
+
+/**
+ * Forwards a message the server pushed unprompted to the device it names,
+ * or to every device, through the same path as responses. It answers no
+ * request, so it carries no request ID or timing of one.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param message The push message.
+ */
+static void handle_push(tcp_pipeline* pipeline, const unsigned char* message) {
+    uint16_t target = extract_push_target(message);
+
+    // Any message shows the server is alive
+    pipeline->consecutive_timeouts = 0;
+    if (!pipeline->server_push || (target != MESSAGE_PUSH_ALL_DEVICES && target > UINT8_MAX)) {
+        pipeline->pushes_discarded++;
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Push for device %u from upstream %u discarded.", target, pipeline->index);
+        return;
+    }
+
+    // The HID side sends a push for every device to each of them
+    bridge_frame push;
+    memset(&push, 0, sizeof(push));
+    memcpy(push.data, message, pipeline->reader.frame_size);
+    push.size = (uint8_t)pipeline->reader.frame_size;
+    push.device_index = target == MESSAGE_PUSH_ALL_DEVICES ? 0 : (uint8_t)target;
+    push.priority = PRIORITY_NORMAL;
+    capture_frame(CAPTURE_PUSH_TO_HID, push.device_index, 0, message, push.size);
+    pipeline->pushes_forwarded++;
+    pipeline->deliver(&push, pipeline->deliver_context);
+}
+
+/**
+ * Hands a response to the HID side. The payload of a fragmented response is
+ * copied for each device that gets it, the last one taking the original.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param response The response.
+ * @param payload Payload of a fragmented response, or NULL.
+ * @param last Whether no other response needs the payload after this one.
+ */
+static void deliver_response(tcp_pipeline* pipeline, bridge_frame* response, message_payload* payload, bool last) {
+    response->payload = payload && !last ? message_payload_copy(payload) : payload;
+    if (payload && !response->payload) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream - Out of memory, response for device %u dropped.", response->device_index);
+        return;
+    }
+    pipeline->deliver(response, pipeline->deliver_context);
+}
+
+/**
+ * Matches a confirmation or response from the server to its in-flight request
+ * and forwards responses to the HID side as soon as they arrive, in whatever
+ * order the server answers. Fragments are collected until their response is
+ * whole, and it is then forwarded as one message.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param message One complete frame received from the server.
+ * @param message_type The frame's type.
+ * @param request_id The frame's request ID.
+ * @param data The frame's data field.
+ */
+static void dispatch_server_message(tcp_pipeline* pipeline, const unsigned char* message, MessageType message_type, uint16_t request_id, uint64_t data) {
+    unsigned char header[MESSAGE_MAX_SIZE_BYTES];
+    message_payload* payload = NULL;
+
+    if (message_type == INVALIDATE_MESSAGE) {
+        handle_invalidation(pipeline, message);
+        return;
+    }
+    if (message_type == PUSH_MESSAGE) {
+        handle_push(pipeline, message);
+        return;
+    }
+    if (message_is_fragment(message)) {
+        fragment_status status = fragment_assembler_add(&pipeline->fragments, message, pipeline->reader.frame_size);
+        if (status == FRAGMENT_REJECTED) {
+            WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Fragment out of order from upstream %u, message discarded.", pipeline->index);
+        }
+        if (status != FRAGMENT_COMPLETE) {
+            return;
+        }
+        payload = fragment_assembler_take(&pipeline->fragments, header);
+        message = header;  // The first fragment stands for the whole message
+        extract_request_id_and_data(message, &request_id, &data);
+    }
+
+    // In lockstep mode the server's IDs are its own, so frames match the only outstanding request
+    inflight_entry* entry = pipeline->pipelined
+        ? inflight_find(&pipeline->inflight, request_id)
+        : inflight_oldest(&pipeline->inflight);
+    if (!entry) {
+        pipeline->inflight.unmatched++;
+        message_payload_free(payload);
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - No in-flight request for server message type %d, request ID %u.", message_type, request_id);
+        return;
+    }
+
+    // Any answer shows the server is alive
+    pipeline->consecutive_timeouts = 0;
+
+    if (message_type == CONFIRM_MESSAGE) {
+        capture_frame(CAPTURE_CONFIRM_FROM_TCP, entry->device_index, entry->hid_request_id, message, pipeline->reader.frame_size);
+        WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Upstream - Request %u confirmed.", entry->upstream_id);
+        entry->confirmed = true;
+        entry->timing.confirmed_ns = monotonic_time_ns();
+        return;
+    }
+
+    if (message_type != RESPONSE_MESSAGE) {
+        message_payload_free(payload);
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Unexpected message type %d from server.", message_type);
+        return;
+    }
+
+    capture_frame(CAPTURE_TCP_TO_HID, entry->device_index, entry->hid_request_id, message, pipeline->reader.frame_size);
+
+    bridge_frame response;
+    memcpy(response.data, message, pipeline->reader.frame_size);
+    response.size = (uint8_t)pipeline->reader.frame_size;
+    response.request_id = entry->hid_request_id;
+    response.device_index = entry->device_index;
+    response.priority = entry->priority;
+    response.timing = entry->timing;
+    response.timing.responded_ns = monotonic_time_ns();
+    // Hand the device back the ID it was confirmed with, as for every waiter below
+    set_message_request_id(response.data, entry->hid_request_id);
+
+    WRITE_LOG_FORMAT(LOGLEVEL_DEBUG, "Upstream - Response for request %u after %llu us.",
+        entry->upstream_id, (unsigned long long)(monotonic_time_us() - entry->sent_us));
+    if (!entry->confirmed) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Response for request %u arrived before its confirmation.", entry->upstream_id);
+    }
+
+    // Unless an invalidation arrived while it was in flight, the response is fresh enough to cache; only the data field is
+    if (pipeline->cache && !payload && entry->cache_epoch == pipeline->cache->epoch) {
+        uint64_t uri;
+        extract_request_uri(entry->request, &uri);
+        response_cache_store(pipeline->cache, uri, data, monotonic_time_us());
+    }
+
+    // Update the shared data with the response from the server
+    deliver_response(pipeline, &response, payload, entry->first_waiter == INFLIGHT_NIL);
+
+    // Give every request coalesced onto this one the same answer under its own ID
+    uint64_t responded_ns = response.timing.responded_ns;
+    for (uint32_t i = entry->first_waiter; i != INFLIGHT_NIL; i = pipeline->inflight.waiters[i].next) {
+        const inflight_waiter* waiter = &pipeline->inflight.waiters[i];
+        response.request_id = waiter->hid_request_id;
+        response.device_index = waiter->device_index;
+        memset(&response.timing, 0, sizeof(response.timing));
+        response.timing.hid_read_ns = waiter->hid_read_ns;
+        response.timing.responded_ns = responded_ns;
+        set_message_request_id(response.data, waiter->hid_request_id);
+        capture_frame(CAPTURE_TCP_TO_HID, waiter->device_index, waiter->hid_request_id, response.data, response.size);
+        deliver_response(pipeline, &response, payload, waiter->next == INFLIGHT_NIL);
+    }
+    inflight_remove(&pipeline->inflight, entry);
+}
+
+/**
+ * Decodes the frames of one receive in runs of RECEIVE_DECODE_BATCH with the
+ * batch codec and dispatches them in order.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param frames The complete frames received.
+ * @param frame_count Number of frames.
+ */
+static void dispatch_server_messages(tcp_pipeline* pipeline, const unsigned char* frames, size_t frame_count) {
+    MessageType types[RECEIVE_DECODE_BATCH];
+    uint16_t request_ids[RECEIVE_DECODE_BATCH];
+    uint64_t values[RECEIVE_DECODE_BATCH];
+    message_batch batch = { types, request_ids, NULL, values };
+    size_t frame_size = pipeline->reader.frame_size;
+
+    for (size_t first = 0; first < frame_count; first += RECEIVE_DECODE_BATCH) {
+        size_t count = frame_count - first < RECEIVE_DECODE_BATCH ? frame_count - first : RECEIVE_DECODE_BATCH;
+        const unsigned char* run = frames + first * frame_size;
+        decode_messages(run, count, frame_size, &batch);
+        for (size_t i = 0; i < count; i++) {
+            dispatch_server_message(pipeline, run + i * frame_size, types[i], request_ids[i], values[i]);
+        }
+    }
+}
+
+/**
+ * Drains everything the server has sent with as few recv calls as possible
+ * and dispatches the complete frames in batches. Called when the socket is
+ * readable.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @return 0 to keep running, -1 if the connection is gone.
+ */
+int upstream_receive(tcp_pipeline* pipeline) {
+    tcp_stream_reader* reader = &pipeline->reader;
+    while (true) {
+        size_t space = reader->capacity - (reader->end - reader->start);
+        int bytesRead = recv_into_stream_reader(pipeline->socket, reader);
+        if (bytesRead < 0) {
+            return -1;
+        }
+
+        const unsigned char* frames;
+        size_t frame_count = stream_reader_frames(reader, &frames);
+        dispatch_server_messages(pipeline, frames, frame_count);
+        stream_reader_consume(reader, frame_count);
+
+        // A short read means the socket is drained; only a full buffer warrants another recv
+        if ((size_t)bytesRead < space) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Milliseconds until the earliest in-flight request times out, the send
+ * queue is due to be flushed or, while disconnected, the next connection
+ * attempt is due.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @return The wait timeout to use, INFINITE if nothing is scheduled.
+ */
+uint32_t upstream_next_timeout_ms(const tcp_pipeline* pipeline) {
+    uint64_t now = monotonic_time_us();
+    uint64_t deadline = pipeline->connected ? inflight_next_deadline(&pipeline->inflight) : pipeline->next_attempt_us;
+    if (pipeline->send_queue.count > 0 && !pipeline->write_blocked) {
+        uint64_t flush_deadline = pipeline->flush_now ? now : pipeline->send_queue.oldest_queued_us + pipeline->send_batch_delay_us;
+        // Waits have millisecond granularity; poll through sub-millisecond batching delays
+        if (flush_deadline < now + 1000) {
+            return 0;
+        }
+        if (flush_deadline < deadline) {
+            deadline = flush_deadline;
+        }
+    }
+    if (deadline == UINT64_MAX) {
+        return INFINITE;
+    }
+    return deadline <= now ? 0 : (uint32_t)((deadline - now + 999) / 1000);
+}
+
+/**
+ * Orders in-flight entries by when they were sent.
+ */
+static int compare_sent_order(const void* a, const void* b) {
+    const inflight_entry* left = *(const inflight_entry* const*)a;
+    const inflight_entry* right = *(const inflight_entry* const*)b;
+    if (left->sent_us != right->sent_us) {
+        return left->sent_us < right->sent_us ? -1 : 1;
+    }
+    return (int)left->upstream_id - (int)right->upstream_id;
+}
+
+/**
+ * Moves every unanswered request back to the front of the retained queue, in
+ * the order it was originally sent, and empties the in-flight table. From
+ * there it is replayed on reconnect or failed over to a replica. Requests
+ * coalesced onto it follow it, and coalesce again when it is resent.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @return The number of requests requeued.
+ */
+static uint32_t requeue_in_flight(tcp_pipeline* pipeline) {
+    inflight_table* table = &pipeline->inflight;
+    uint32_t count = 0;
+    uint32_t requeued = 0;
+
+    inflight_entry** pending = (inflight_entry**)malloc(table->window * sizeof(inflight_entry*));
+    uint32_t* waiters = table->waiter_capacity ? (uint32_t*)malloc(table->waiter_capacity * sizeof(uint32_t)) : NULL;
+    if (!pending || (table->waiter_capacity && !waiters)) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream - Out of memory, %u in-flight request(s) lost.", table->count);
+        pipeline->retained.dropped += table->count;
+        inflight_reset(table);
+        free(pending);
+        free(waiters);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < table->window; i++) {
+        if (table->entries[i].in_use) {
+            pending[count++] = &table->entries[i];
+        }
+    }
+    qsort(pending, count, sizeof(inflight_entry*), compare_sent_order);
+
+    // Newest first, so the oldest ends up at the very front
+    for (uint32_t i = count; i > 0; i--) {
+        inflight_entry* entry = pending[i - 1];
+        bridge_frame frame;
+        memcpy(frame.data, entry->request, entry->request_size);
+        frame.size = entry->request_size;
+        frame.priority = entry->priority;
+        memset(&frame.timing, 0, sizeof(frame.timing));
+
+        // Its waiters go in behind it, last first as well
+        frame.payload = NULL;
+        uint32_t waiter_count = 0;
+        for (uint32_t w = entry->first_waiter; w != INFLIGHT_NIL; w = table->waiters[w].next) {
+            waiters[waiter_count++] = w;
+        }
+        for (uint32_t w = waiter_count; w > 0; w--) {
+            frame.request_id = table->waiters[waiters[w - 1]].hid_request_id;
+            frame.device_index = table->waiters[waiters[w - 1]].device_index;
+            frame.timing.hid_read_ns = table->waiters[waiters[w - 1]].hid_read_ns;
+            retain_frame_front(&pipeline->retained, &frame);
+        }
+
+        frame.request_id = entry->hid_request_id;
+        frame.device_index = entry->device_index;
+        frame.timing = entry->timing;
+        frame.timing.sent_ns = 0;  // Stamped again when it is resent
+        frame.timing.confirmed_ns = 0;
+        frame.payload = entry->request_payload;
+        entry->request_payload = NULL;
+        retain_frame_front(&pipeline->retained, &frame);
+        requeued += 1 + waiter_count;
+    }
+    pipeline->frames_replayed += requeued;
+
+    free(pending);
+    free(waiters);
+    inflight_reset(table);
+    return requeued;
+}
+
+/**
+ * Schedules the next connection attempt after the current backoff with
+ * jitter (between half and all of it), then doubles the backoff up to the
+ * maximum, so a fleet of bridges doesn't reconnect in lockstep.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ * @param now_us Current monotonic time in microseconds.
+ */
+static void schedule_reconnect(tcp_pipeline* pipeline, uint64_t now_us) {
+    uint32_t half = pipeline->backoff_ms / 2;
+    uint32_t delay_ms = half + (uint32_t)rand() % (pipeline->backoff_ms - half + 1);
+    pipeline->next_attempt_us = now_us + (uint64_t)delay_ms * 1000;
+
+    pipeline->backoff_ms *= 2;
+    if (pipeline->backoff_ms > pipeline->reconnect_max_ms) {
+        pipeline->backoff_ms = pipeline->reconnect_max_ms;
+    }
+}
+
+/**
+ * Tears down a failed connection. Unanswered requests are requeued for
+ * replay (or failover) and the first reconnect attempt is made right away.
+ *
+ * @param router Pointer to the router, told that routes have changed.
+ * @param pipeline Pointer to the pipeline state.
+ */
+void upstream_drop_connection(tcp_router* router, tcp_pipeline* pipeline) {
+    uint64_t now = monotonic_time_us();
+
+    if (pipeline->socket != INVALID_SOCKET) {
+        cleanup_client(pipeline->socket);
+        pipeline->socket = INVALID_SOCKET;
+    }
+    stream_reader_reset(&pipeline->reader);
+    fragment_assembler_reset(&pipeline->fragments);
+    send_queue_clear(&pipeline->send_queue);  // Everything in it is also in flight
+    pipeline->write_blocked = false;
+    pipeline->flush_now = false;
+
+    uint32_t requeued = requeue_in_flight(pipeline);
+    WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Connection to upstream %u (%s:%u) lost, %u request(s) kept for replay.",
+        pipeline->index, pipeline->server->ip, pipeline->server->port, requeued);
+
+    pipeline->connected = false;
+    pipeline->outage_start_us = now;
+    pipeline->attempts = 0;
+    pipeline->outages++;
+    pipeline->backoff_ms = pipeline->reconnect_min_ms;
+    pipeline->next_attempt_us = now;
+    pipeline->consecutive_timeouts = 0;
+    router->routes_changed = true;
+}
+
+/**
+ * Drops the connection to an upstream that keeps timing out even though its
+ * socket is up, and holds off reconnecting for the longest backoff so its
+ * shards are served by their replicas meanwhile.
+ *
+ * @param router Pointer to the router.
+ * @param pipeline Pointer to the pipeline state.
+ */
+static void mark_unhealthy(tcp_router* router, tcp_pipeline* pipeline) {
+    WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Upstream %u missed %u consecutive responses, marking it down.",
+        pipeline->index, pipeline->consecutive_timeouts);
+    upstream_drop_connection(router, pipeline);
+    pipeline->marked_down++;
+    pipeline->backoff_ms = pipeline->reconnect_max_ms;
+    schedule_reconnect(pipeline, monotonic_time_us());
+}
+
+/**
+ * Takes over a newly connected socket. The retained requests are replayed by
+ * the next upstream_send_retained.
+ *
+ * @param router Pointer to the router, told that routes have changed.
+ * @param pipeline Pointer to the pipeline state.
+ * @param socket The connected socket, in non-blocking mode.
+ */
+void upstream_connected(tcp_router* router, tcp_pipeline* pipeline, SOCKET socket) {
+    uint64_t outage_us = monotonic_time_us() - pipeline->outage_start_us;
+    pipeline->socket = socket;
+    pipeline->connected = true;
+    pipeline->outage_total_us += outage_us;
+    router->routes_changed = true;
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Connected to upstream %u (%s:%u) after %llu ms and %u failed attempt(s); replaying %u request(s), %llu dropped so far.",
+        pipeline->index, pipeline->server->ip, pipeline->server->port, (unsigned long long)(outage_us / 1000),
+        pipeline->attempts, pipeline->retained.count, pipeline->retained.dropped);
+}
+
+/**
+ * Counts a failed connection attempt and schedules the next one.
+ *
+ * @param pipeline Pointer to the pipeline state.
+ */
+void upstream_connect_failed(tcp_pipeline* pipeline) {
+    pipeline->attempts++;
+    schedule_reconnect(pipeline, monotonic_time_us());
+}
+
+/**
+ * Picks the upstream for a request: the first connected endpoint of the shard
+ * its URI belongs to, or the shard's primary if none is up, so the request
+ * waits there until one comes back.
+ *
+ * @param router Pointer to the router.
+ * @param frame The request.
+ * @return The upstream to send the request to.
+ */
+static tcp_pipeline* select_upstream(tcp_router* router, const bridge_frame* frame) {
+    uint64_t uri;
+    extract_request_uri(frame->data, &uri);
+
+    const upstream_shard* shard = upstream_shard_for_uri(router->routing, uri);
+    for (uint8_t i = 0; i < shard->endpoint_count; i++) {
+        tcp_pipeline* candidate = &router->upstreams[shard->endpoints[i]];
+        if (candidate->connected) {
+            return candidate;
+        }
+    }
+    return &router->upstreams[shard->endpoints[0]];
+}
+
+/**
+ * Sends a request to its upstream, or retains it there if no endpoint of its
+ * shard is up. A request for a URI already in flight there waits on that
+ * request instead. A connected upstream with a full window or older requests
+ * still waiting takes nothing else, which leaves the request with the caller.
+ *
+ * @param router Pointer to the router.
+ * @param frame The request.
+ * @return true if the request was placed, false if its upstream has no room yet.
+ */
+bool upstream_place_request(tcp_router* router, bridge_frame* frame) {
+    tcp_pipeline* upstream = select_upstream(router, frame);
+    if (!upstream->connected) {
+        retain_frame(&upstream->retained, frame);
+        return true;
+    }
+    if (coalesce_request(upstream, frame)) {
+        return true;
+    }
+    if (upstream->retained.count > 0 || !can_accept_request(upstream, frame)) {
+        return false;
+    }
+    return send_request(upstream, frame);
+}
+
+/**
+ * Answers a request from the response cache, without involving any upstream.
+ *
+ * @param router Pointer to the router.
+ * @param request The request taken from the HID side.
+ * @return true if the request was answered.
+ */
+bool upstream_answer_from_cache(tcp_router* router, const bridge_frame* request) {
+    uint64_t uri, data;
+    if (!router->cache || request->payload) {
+        return false;  // A fragmented request's answer depends on more than its URI
+    }
+
+    extract_request_uri(request->data, &uri);
+    if (!response_cache_lookup(router->cache, uri, monotonic_time_us(), &data)) {
+        return false;
+    }
+
+    bridge_frame response;
+    memset(response.data, 0, sizeof(response.data));
+    encode_response(response.data, request->request_id, data);
+    response.size = request->size;
+    response.payload = NULL;
+    response.request_id = request->request_id;
+    response.device_index = request->device_index;
+    response.priority = request->priority;
+    response.timing = request->timing;
+    response.timing.responded_ns = monotonic_time_ns();
+    capture_frame(CAPTURE_CACHE_TO_HID, response.device_index, response.request_id, response.data, response.size);
+
+    router->deliver(&response, router->deliver_context);
+    return true;
+}
+
+/**
+ * Moves the requests retained by upstreams that are down to a connected
+ * replica of their shard, keeping their order. Requests whose shard has no
+ * endpoint up stay where they are.
+ *
+ * @param router Pointer to the router.
+ */
+static void fail_over_retained(tcp_router* router) {
+    for (size_t i = 0; i < router->upstream_count; i++) {
+        tcp_pipeline* upstream = &router->upstreams[i];
+        if (upstream->connected || upstream->retained.count == 0) {
+            continue;
+        }
+
+        uint32_t moved = 0;
+        uint32_t count = upstream->retained.count;
+        for (uint32_t j = 0; j < count; j++) {
+            bridge_frame frame;
+            take_retained(&upstream->retained, &frame);
+
+            tcp_pipeline* target = select_upstream(router, &frame);
+            if (target->connected) {
+                retain_frame(&target->retained, &frame);
+                target->frames_failed_over++;
+                moved++;
+            }
+            else {
+                retain_frame(&upstream->retained, &frame);
+            }
+        }
+
+        if (moved > 0) {
+            WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Failed over %u request(s) from upstream %u, %u still waiting for it.",
+                moved, upstream->index, upstream->retained.count);
+        }
+    }
+}
+
+/**
+ * Sets up the pipeline for one upstream. The connection itself is made by
+ * the main loop.
+ *
+ * @param pipeline Pointer to the zeroed pipeline state.
+ * @param index Position of the endpoint in the endpoint list.
+ * @param config The thread configuration.
+ * @param cache The shared response cache, or NULL.
+ * @param deliver Hands responses to the HID side.
+ * @param deliver_context Passed to deliver.
+ * @return 1 on success, 0 on failure.
+ */
+static int init_upstream(tcp_pipeline* pipeline, uint8_t index, const upstream_config* config, response_cache* cache, upstream_deliver deliver, void* deliver_context) {
+    pipeline->index = index;
+    pipeline->server = &config->endpoints[index];
+    pipeline->socket = INVALID_SOCKET;
+    pipeline->deliver = deliver;
+    pipeline->deliver_context = deliver_context;
+    pipeline->cache = cache;
+    pipeline->pipelined = config->pipelined;
+    // Lockstep frames are matched by position, so a late answer to an expired
+    // request would be taken for the next one's; lockstep requests never expire
+    pipeline->request_timeout_ms = config->pipelined ? config->request_timeout_ms : 0;
+    pipeline->send_batch_delay_us = config->send_batch_delay_us;
+    pipeline->server_push = config->server_push;
+    size_t frame_size = message_frame_size(pipeline->server->frame_size);
+    if (pipeline->server->frame_size && pipeline->server->frame_size != frame_size) {
+        WRITE_LOG_FORMAT(LOGLEVEL_WARN, "Upstream - Upstream %u frame size %u not supported, using %zu bytes.", index, pipeline->server->frame_size, frame_size);
+    }
+    init_send_queue(&pipeline->send_queue, frame_size);
+    if (!inflight_init(&pipeline->inflight, config->pipelined ? config->pipeline_window : 1, config->coalesce_waiters)) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Upstream - Failed to create in-flight table.");
+        return 0;
+    }
+    if (!init_stream_reader(&pipeline->reader, TCP_RECEIVE_BUFFER_SIZE, frame_size)) {
+        return 0;
+    }
+
+    // Requests are kept here while the server is unreachable
+    pipeline->retained.capacity = config->retain_frames ? config->retain_frames : 1;
+    pipeline->retained.frames = (bridge_frame*)calloc(pipeline->retained.capacity, sizeof(bridge_frame));
+    if (!pipeline->retained.frames) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Upstream - Failed to allocate retained queue.");
+        return 0;
+    }
+    pipeline->reconnect_min_ms = config->reconnect_min_ms ? config->reconnect_min_ms : 1;
+    pipeline->reconnect_max_ms = config->reconnect_max_ms > pipeline->reconnect_min_ms ? config->reconnect_max_ms : pipeline->reconnect_min_ms;
+    pipeline->backoff_ms = pipeline->reconnect_min_ms;
+    pipeline->outage_start_us = monotonic_time_us();
+    return 1;
+}
+
+/**
+ * Logs an upstream's statistics and releases its resources.
+ *
+ * @param pipeline Pointer to the pipeline state, possibly only partly set up.
+ */
+static void cleanup_upstream(tcp_pipeline* pipeline) {
+    if (pipeline->inflight.entries) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Upstream %u: requests completed: %llu, coalesced: %llu, timed out: %llu, unmatched server messages: %llu, abandoned in flight: %u, pushes forwarded: %llu, discarded: %llu",
+            pipeline->index, pipeline->inflight.completed, pipeline->inflight.coalesced, pipeline->inflight.timed_out, pipeline->inflight.unmatched, pipeline->inflight.count,
+            pipeline->pushes_forwarded, pipeline->pushes_discarded);
+        inflight_destroy(&pipeline->inflight);
+    }
+    if (pipeline->reader.buffer) {
+        cleanup_stream_reader(&pipeline->reader);
+    }
+    if (pipeline->send_queue.send_calls > 0) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Upstream %u: %llu frames sent in %llu send calls, %u left unsent",
+            pipeline->index, pipeline->send_queue.frames_sent, pipeline->send_queue.send_calls, (unsigned)pipeline->send_queue.count);
+    }
+    if (pipeline->retained.frames) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Upstream %u: %llu outage(s) totalling %llu ms, marked down %llu time(s), %llu request(s) replayed, %llu taken over from replicas, %llu dropped while disconnected",
+            pipeline->index, pipeline->outages, (unsigned long long)(pipeline->outage_total_us / 1000), pipeline->marked_down,
+            pipeline->frames_replayed, pipeline->frames_failed_over, pipeline->retained.dropped);
+        bridge_frame frame;
+        while (take_retained(&pipeline->retained, &frame)) {
+            message_payload_free(frame.payload);
+        }
+        free(pipeline->retained.frames);
+    }
+    fragment_assembler_reset(&pipeline->fragments);
+    if (pipeline->socket != INVALID_SOCKET) {
+        cleanup_client(pipeline->socket);
+    }
+}
+
+/**
+ * Metrics source for the TCP side: per-upstream counters, labelled by
+ * endpoint index, and the response cache's when caching is on.
+ *
+ * @param page The page to append to.
+ * @param context Pointer to the tcp_router.
+ */
+static void write_upstream_metrics(metrics_page* page, void* context) {
+    static const metrics_field upstream_fields[] = {
+        METRICS_FIELD(tcp_pipeline, connected, "rawhid_upstream_connected", "gauge", "Whether the upstream is connected"),
+        METRICS_FIELD(tcp_pipeline, inflight.count, "rawhid_upstream_inflight", "gauge", "Requests in flight to the upstream"),
+        METRICS_FIELD(tcp_pipeline, inflight.completed, "rawhid_upstream_completed_total", "counter", "Requests answered by the upstream"),
+        METRICS_FIELD(tcp_pipeline, inflight.timed_out, "rawhid_upstream_timed_out_total", "counter", "Requests the upstream did not answer in time"),
+        METRICS_FIELD(tcp_pipeline, inflight.unmatched, "rawhid_upstream_unmatched_total", "counter", "Confirmations and responses matching no request"),
+        METRICS_FIELD(tcp_pipeline, inflight.coalesced, "rawhid_upstream_coalesced_total", "counter", "Requests that waited on an identical request in flight"),
+        METRICS_FIELD(tcp_pipeline, send_queue.frames_sent, "rawhid_upstream_frames_sent_total", "counter", "Frames sent to the upstream"),
+        METRICS_FIELD(tcp_pipeline, send_queue.bytes_sent, "rawhid_upstream_bytes_sent_total", "counter", "Bytes sent to the upstream"),
+        METRICS_FIELD(tcp_pipeline, send_queue.send_calls, "rawhid_upstream_send_calls_total", "counter", "Send calls made to the upstream"),
+        METRICS_FIELD(tcp_pipeline, send_queue.frames_truncated, "rawhid_upstream_frames_truncated_total", "counter", "Requests cut to the upstream's smaller frame size"),
+        METRICS_FIELD(tcp_pipeline, send_queue.frame_size, "rawhid_upstream_frame_size_bytes", "gauge", "Bytes per frame exchanged with the upstream"),
+        METRICS_FIELD(tcp_pipeline, pushes_forwarded, "rawhid_upstream_pushes_forwarded_total", "counter", "Push messages from the upstream forwarded to the devices"),
+        METRICS_FIELD(tcp_pipeline, pushes_discarded, "rawhid_upstream_pushes_discarded_total", "counter", "Push messages from the upstream discarded"),
+        METRICS_FIELD(tcp_pipeline, messages_fragmented, "rawhid_upstream_fragmented_requests_total", "counter", "Requests sent to the upstream as several fragments"),
+        METRICS_FIELD(tcp_pipeline, fragments.reassembled, "rawhid_upstream_reassembled_responses_total", "counter", "Fragmented responses reassembled from the upstream"),
+        METRICS_FIELD(tcp_pipeline, fragments.discarded, "rawhid_upstream_fragments_discarded_total", "counter", "Fragmented messages from the upstream dropped incomplete or out of order"),
+        METRICS_FIELD(tcp_pipeline, reader.frames_decoded, "rawhid_upstream_frames_received_total", "counter", "Frames received from the upstream"),
+        METRICS_FIELD(tcp_pipeline, reader.bytes_received, "rawhid_upstream_bytes_received_total", "counter", "Bytes received from the upstream"),
+        METRICS_FIELD(tcp_pipeline, reader.recv_calls, "rawhid_upstream_recv_calls_total", "counter", "Receive calls made on the upstream"),
+        METRICS_FIELD(tcp_pipeline, retained.count, "rawhid_upstream_retained", "gauge", "Requests kept for replay while the upstream is down"),
+        METRICS_FIELD(tcp_pipeline, retained.dropped, "rawhid_upstream_retained_dropped_total", "counter", "Kept requests dropped because the replay queue was full"),
+        METRICS_FIELD(tcp_pipeline, outages, "rawhid_upstream_outages_total", "counter", "Times the connection to the upstream was lost"),
+        METRICS_FIELD(tcp_pipeline, attempts, "rawhid_upstream_reconnect_attempts", "gauge", "Failed reconnection attempts in the current outage"),
+        METRICS_FIELD(tcp_pipeline, frames_replayed, "rawhid_upstream_frames_replayed_total", "counter", "Requests replayed after reconnecting"),
+        METRICS_FIELD(tcp_pipeline, frames_failed_over, "rawhid_upstream_frames_failed_over_total", "counter", "Requests sent to a replica while the upstream was down"),
+        METRICS_FIELD(tcp_pipeline, marked_down, "rawhid_upstream_marked_down_total", "counter", "Connections dropped because the upstream stopped answering"),
+        METRICS_FIELD(tcp_pipeline, consecutive_timeouts, "rawhid_upstream_consecutive_timeouts", "gauge", "Requests expired since the upstream last answered"),
+    };
+    static const metrics_field cache_fields[] = {
+        METRICS_FIELD(response_cache, count, "rawhid_cache_entries", "gauge", "Responses in the cache"),
+        METRICS_FIELD(response_cache, hits, "rawhid_cache_hits_total", "counter", "Requests answered from the cache"),
+        METRICS_FIELD(response_cache, misses, "rawhid_cache_misses_total", "counter", "Requests not found in the cache"),
+        METRICS_FIELD(response_cache, expirations, "rawhid_cache_expirations_total", "counter", "Cached responses found expired"),
+        METRICS_FIELD(response_cache, evictions, "rawhid_cache_evictions_total", "counter", "Cached responses evicted to make room"),
+        METRICS_FIELD(response_cache, invalidations, "rawhid_cache_invalidations_total", "counter", "Cached responses invalidated by the server"),
+    };
+    tcp_router* router = (tcp_router*)context;
+    metrics_write_fields(page, upstream_fields, sizeof(upstream_fields) / sizeof(upstream_fields[0]), "upstream",
+        router->upstreams, sizeof(tcp_pipeline), router->upstream_count);
+    if (router->cache) {
+        metrics_write_fields(page, cache_fields, sizeof(cache_fields) / sizeof(cache_fields[0]), NULL,
+            router->cache, sizeof(response_cache), 1);
+    }
+}
+
+/**
+ * Routes the requests waiting in the retained queues: after an upstream came
+ * up or went down, requests held for a dead one move to a live replica, and
+ * then every connected upstream's window is filled from its queue, oldest
+ * first, before anything new from the HID side.
+ *
+ * @param router Pointer to the router.
+ */
+void upstream_send_retained(tcp_router* router) {
+    if (router->routes_changed) {
+        router->routes_changed = false;
+        fail_over_retained(router);
+    }
+
+    for (size_t i = 0; i < router->upstream_count; i++) {
+        tcp_pipeline* upstream = &router->upstreams[i];
+        const bridge_frame* next;
+        bridge_frame frame;
+        while (upstream->connected && (next = peek_retained(&upstream->retained)) && can_accept_request(upstream, next)) {
+            take_retained(&upstream->retained, &frame);
+            if (!coalesce_request(upstream, &frame) && !send_request(upstream, &frame)) {
+                retain_frame_front(&upstream->retained, &frame);  // Tried again once the upstream has room
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Coalesces everything queued since the last call into one send per
+ * upstream, subject to the batching delay, and frees the slots of requests
+ * the servers never answered. A connection whose send fails is dropped, and
+ * a server that keeps missing responses is marked down.
+ *
+ * @param router Pointer to the router.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void upstream_flush(tcp_router* router, uint64_t now_us) {
+    for (size_t i = 0; i < router->upstream_count; i++) {
+        tcp_pipeline* upstream = &router->upstreams[i];
+        if (!upstream->connected) {
+            continue;
+        }
+        if (flush_if_due(upstream, now_us) < 0) {
+            upstream_drop_connection(router, upstream);
+            continue;
+        }
+
+        upstream->consecutive_timeouts += inflight_expire(&upstream->inflight, now_us);
+        if (router->unhealthy_timeouts > 0 && upstream->consecutive_timeouts >= router->unhealthy_timeouts) {
+            mark_unhealthy(router, upstream);
+        }
+    }
+}
+
+/**
+ * Sets up the router and a pipeline per endpoint, and registers their
+ * metrics. Nothing is connected yet: the caller's event loop connects each
+ * upstream once its next attempt is due.
+ *
+ * @param router Pointer to the zeroed router.
+ * @param config Endpoints, routing and pipeline settings; must outlive the router.
+ * @param deliver Hands responses to the HID side.
+ * @param deliver_context Passed to deliver.
+ * @return 1 on success, 0 on failure; upstream_router_cleanup releases what was set up either way.
+ */
+int upstream_router_init(tcp_router* router, const upstream_config* config, upstream_deliver deliver, void* deliver_context) {
+    if (!config->endpoints || !config->routing || config->endpoint_count == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Upstream - No upstream configured.");
+        return 0;
+    }
+    if (!validate_upstream_routing(config->routing, config->endpoint_count)) {
+        return 0;
+    }
+
+    router->routing = config->routing;
+    router->deliver = deliver;
+    router->deliver_context = deliver_context;
+    router->unhealthy_timeouts = config->unhealthy_timeouts;
+    if (config->cache_entries > 0) {
+        if (!response_cache_init(&router->cache_storage, config->cache_entries, config->cache_ttl_rules, config->cache_ttl_rule_count)) {
+            return 0;
+        }
+        router->cache = &router->cache_storage;
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Caching up to %u response(s).", config->cache_entries);
+    }
+    router->upstreams = (tcp_pipeline*)calloc(config->endpoint_count, sizeof(tcp_pipeline));
+    if (!router->upstreams) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Upstream - Failed to allocate upstreams.");
+        return 0;
+    }
+    for (size_t i = 0; i < config->endpoint_count; i++) {
+        router->upstream_count++;
+        if (!init_upstream(&router->upstreams[i], (uint8_t)i, config, router->cache, deliver, deliver_context)) {
+            return 0;
+        }
+    }
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - %s mode, window of %u request(s) per upstream, %zu upstream(s) in %zu shard(s).",
+        config->pipelined ? "Pipelined" : "Lockstep", router->upstreams[0].inflight.window, router->upstream_count, router->routing->shard_count);
+    metrics_register(write_upstream_metrics, router);
+    return 1;
+}
+
+/**
+ * Closes every upstream connection, logs their statistics and releases the
+ * router.
+ *
+ * @param router Pointer to the router, possibly only partly set up.
+ */
+void upstream_router_cleanup(tcp_router* router) {
+    metrics_unregister(write_upstream_metrics, router);
+    if (router->has_pending) {
+        message_payload_free(router->pending.payload);
+        router->has_pending = false;
+    }
+    if (router->upstreams) {
+        for (size_t i = 0; i < router->upstream_count; i++) {
+            cleanup_upstream(&router->upstreams[i]);
+        }
+        free(router->upstreams);
+        router->upstreams = NULL;
+    }
+    if (router->cache) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "Upstream - Response cache hits: %llu, misses: %llu, expired: %llu, evicted: %llu, invalidated: %llu, %u cached",
+            router->cache->hits, router->cache->misses, router->cache->expirations, router->cache->evictions, router->cache->invalidations, router->cache->count);
+        response_cache_destroy(router->cache);
+        router->cache = NULL;
+    }
+}
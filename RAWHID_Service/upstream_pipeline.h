@@ -0,0 +1,130 @@
+#ifndef UPSTREAM_PIPELINE_H
+#define UPSTREAM_PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "platform.h"
+#include "tcp_client.h"
+#include "message_protocol.h"
+#include "message_batch.h"
+#include "message_fragments.h"
+#include "frame_ring.h"
+#include "frame_capture.h"
+#include "inflight_table.h"
+#include "upstream_router.h"
+#include "response_cache.h"
+#include "priority_lanes.h"
+#include "metrics.h"
+#include "logger.h"
+
+/**
+ * Upstream side of the bridge: the request pipelines to the upstream servers
+ * and the routing of requests across them, independent of how the sockets
+ * are waited on. The event loop that owns the router connects the sockets,
+ * calls upstream_receive when one is readable and hands requests in with
+ * upstream_place_request; responses come back through the deliver callback.
+ * Owned by that one thread, so no locking.
+ */
+
+// Endpoints, routing and pipeline settings of the upstream side.
+typedef struct {
+    tcp_socket_info* endpoints;   // Upstream servers, indexed by the shard table
+    size_t endpoint_count;
+    const upstream_routing* routing;  // Which endpoints serve which URIs
+    bool pipelined;           // Match server frames by request ID instead of by position
+    uint32_t pipeline_window; // Maximum requests in flight (forced to 1 when not pipelined)
+    uint32_t request_timeout_ms;  // Give up on a request after this long, 0 to wait forever; pipelined only
+    uint32_t send_batch_delay_us; // Hold queued frames up to this long to batch them, 0 to flush at once
+    uint32_t reconnect_min_ms;    // First reconnect backoff after the connection drops
+    uint32_t reconnect_max_ms;    // Backoff cap while the server stays unreachable
+    uint32_t retain_frames;       // Requests kept for replay per upstream while disconnected
+    uint32_t unhealthy_timeouts;  // Consecutive timeouts before a connected upstream is treated as down, 0 to never
+    uint32_t coalesce_waiters;    // Duplicate requests that may wait on an identical one in flight, per upstream, 0 to send every request
+    uint32_t cache_entries;       // Responses cached by URI, 0 to disable the cache
+    bool server_push;             // Forward push messages from the server to the devices instead of discarding them
+    const cache_ttl_rule* cache_ttl_rules;  // How long each URI range is cached
+    size_t cache_ttl_rule_count;
+} upstream_config;
+
+// Hands a response to the HID side, which takes over its payload.
+typedef void (*upstream_deliver)(const bridge_frame* response, void* context);
+
+// Requests waiting for a connection, oldest first: those that were in flight
+// when it dropped, then whatever the HID side queued during the outage.
+typedef struct {
+    bridge_frame* frames;
+    uint32_t capacity;
+    uint32_t head;            // Index of the oldest retained frame
+    uint32_t count;
+    uint64_t dropped;         // Oldest frames discarded because the queue was full
+} retained_queue;
+
+// State of the request pipeline to one upstream server.
+typedef struct {
+    uint8_t index;            // Position in the endpoint list, as named by the shard table
+    tcp_socket_info* server;
+    SOCKET socket;
+    upstream_deliver deliver;
+    void* deliver_context;
+    inflight_table inflight;
+    tcp_stream_reader reader;
+    tcp_send_queue send_queue;
+    retained_queue retained;
+    fragment_assembler fragments;  // Fragmented response being received
+    uint64_t messages_fragmented;  // Requests sent as several fragments
+    bool server_push;         // Forward push messages to the devices
+    uint64_t pushes_forwarded;     // Push messages handed to the HID side
+    uint64_t pushes_discarded;     // Push messages dropped: pushes disabled or no such device
+    response_cache* cache;    // Shared by all upstreams, NULL when caching is off
+    bool write_blocked;       // Socket buffer was full; wait for it to drain before flushing again
+    bool flush_now;           // A critical request is queued; flush without waiting out the batching delay
+    bool pipelined;
+    uint32_t request_timeout_ms;
+    uint32_t send_batch_delay_us;
+
+    // Connection manager
+    bool connected;
+    uint32_t reconnect_min_ms;
+    uint32_t reconnect_max_ms;
+    uint32_t backoff_ms;      // Base delay before the next attempt, doubled after each failure
+    uint64_t next_attempt_us; // When to try connecting again
+    uint64_t outage_start_us;
+    uint32_t attempts;        // Failed attempts in the current outage
+    uint64_t outages;
+    uint64_t outage_total_us;
+    uint64_t frames_replayed;
+
+    // Health tracking
+    uint32_t consecutive_timeouts;  // Requests expired since the server last answered
+    uint64_t marked_down;     // Connections dropped because the server stopped answering
+    uint64_t frames_failed_over;  // Requests taken over from a replica that was down
+} tcp_pipeline;
+
+// Every upstream plus the state needed to route the HID side's requests to them.
+typedef struct {
+    tcp_pipeline* upstreams;
+    size_t upstream_count;
+    const upstream_routing* routing;
+    upstream_deliver deliver;
+    void* deliver_context;
+    uint32_t unhealthy_timeouts;
+    response_cache cache_storage;
+    response_cache* cache;    // &cache_storage, or NULL when caching is off
+    bridge_frame pending;     // Request taken from the HID side whose upstream had no room yet
+    bool has_pending;
+    bool routes_changed;      // An upstream came up or went down since retained frames were last routed
+} tcp_router;
+
+int upstream_router_init(tcp_router* router, const upstream_config* config, upstream_deliver deliver, void* deliver_context);
+void upstream_router_cleanup(tcp_router* router);
+void upstream_connected(tcp_router* router, tcp_pipeline* pipeline, SOCKET socket);
+void upstream_connect_failed(tcp_pipeline* pipeline);
+void upstream_drop_connection(tcp_router* router, tcp_pipeline* pipeline);
+int upstream_receive(tcp_pipeline* pipeline);
+bool upstream_answer_from_cache(tcp_router* router, const bridge_frame* request);
+bool upstream_place_request(tcp_router* router, bridge_frame* frame);
+void upstream_send_retained(tcp_router* router);
+void upstream_flush(tcp_router* router, uint64_t now_us);
+uint32_t upstream_next_timeout_ms(const tcp_pipeline* pipeline);
+
+#endif // UPSTREAM_PIPELINE_H
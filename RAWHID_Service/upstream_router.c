@@ -0,0 +1,51 @@
+#include "upstream_router.h"
+
+/**
+ * Checks that every shard names at least one valid endpoint and, in range
+ * mode, that the shards form a URI range table.
+ *
+ * @param routing The routing table.
+ * @param endpoint_count Number of configured endpoints.
+ * @return 1 if the table is usable, 0 otherwise.
+ */
+int validate_upstream_routing(const upstream_routing* routing, size_t endpoint_count) {
+    if (!routing || !routing->shards || routing->shard_count == 0) {
+        WRITE_LOG(LOGLEVEL_ERROR, "Upstream Router - No shards configured");
+        return 0;
+    }
+
+    for (size_t i = 0; i < routing->shard_count; i++) {
+        const upstream_shard* shard = &routing->shards[i];
+        if (shard->endpoint_count == 0 || shard->endpoint_count > UPSTREAM_MAX_REPLICAS) {
+            WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream Router - Shard %zu must list 1 to %d endpoints", i, UPSTREAM_MAX_REPLICAS);
+            return 0;
+        }
+        for (uint8_t j = 0; j < shard->endpoint_count; j++) {
+            if (shard->endpoints[j] >= endpoint_count) {
+                WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream Router - Shard %zu names unknown endpoint %u", i, shard->endpoints[j]);
+                return 0;
+            }
+        }
+    }
+
+    size_t unsorted = URI_RANGE_FIRST_UNSORTED(routing->shards, routing->shard_count);
+    if (routing->mode == UPSTREAM_SHARD_BY_RANGE && unsorted < routing->shard_count) {
+        WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Upstream Router - Shard ranges must start at 0 and increase (shard %zu)", unsorted);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Finds the shard responsible for a URI.
+ *
+ * @param routing A validated routing table.
+ * @param uri The URI decoded from the request.
+ * @return The shard serving the URI.
+ */
+const upstream_shard* upstream_shard_for_uri(const upstream_routing* routing, uint64_t uri) {
+    if (routing->mode == UPSTREAM_SHARD_BY_HASH) {
+        return &routing->shards[uri_hash(uri) % routing->shard_count];
+    }
+    return &routing->shards[URI_RANGE_LOOKUP(routing->shards, routing->shard_count, uri)];
+}
@@ -0,0 +1,33 @@
+#ifndef UPSTREAM_ROUTER_H
+#define UPSTREAM_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "uri_index.h"
+#include "logger.h"
+
+#define UPSTREAM_MAX_REPLICAS 4
+
+// How a request's URI selects its shard.
+typedef enum {
+    UPSTREAM_SHARD_BY_HASH,   // Hash of the URI modulo the shard count
+    UPSTREAM_SHARD_BY_RANGE   // Last shard whose range_start is <= the URI
+} upstream_shard_mode;
+
+// One slice of the URI space and the endpoints that serve it.
+typedef struct {
+    uint64_t range_start;     // First URI of the shard (UPSTREAM_SHARD_BY_RANGE only)
+    uint8_t endpoints[UPSTREAM_MAX_REPLICAS];  // Endpoint indices, preferred first
+    uint8_t endpoint_count;
+} upstream_shard;
+
+typedef struct {
+    const upstream_shard* shards;  // A URI range table (uri_index.h) in range mode
+    size_t shard_count;
+    upstream_shard_mode mode;
+} upstream_routing;
+
+int validate_upstream_routing(const upstream_routing* routing, size_t endpoint_count);
+const upstream_shard* upstream_shard_for_uri(const upstream_routing* routing, uint64_t uri);
+
+#endif // UPSTREAM_ROUTER_H
@@ -0,0 +1,84 @@
+#include "uri_index.h"
+
+/**
+ * Range start of one rule of a URI range table.
+ *
+ * @param ranges The first rule.
+ * @param stride Size of a rule in bytes.
+ * @param offset Offset of range_start within a rule.
+ * @param index The rule.
+ * @return Its range_start.
+ */
+static uint64_t range_start_of(const void* ranges, size_t stride, size_t offset, size_t index) {
+    return *(const uint64_t*)((const unsigned char*)ranges + index * stride + offset);
+}
+
+/**
+ * Mixes the bits of a URI so that neighbouring URIs spread out (the
+ * splitmix64 finalizer).
+ *
+ * @param uri The 64-bit URI.
+ * @return The hashed value.
+ */
+uint64_t uri_hash(uint64_t uri) {
+    uri ^= uri >> 30;
+    uri *= 0xbf58476d1ce4e5b9ULL;
+    uri ^= uri >> 27;
+    uri *= 0x94d049bb133111ebULL;
+    uri ^= uri >> 31;
+    return uri;
+}
+
+/**
+ * Bucket of a URI in a power-of-two hash table: the top bits of its hash.
+ *
+ * @param uri The URI.
+ * @param bucket_shift 64 - log2(bucket count).
+ * @return The bucket index.
+ */
+uint32_t uri_hash_bucket(uint64_t uri, uint32_t bucket_shift) {
+    return (uint32_t)(uri_hash(uri) >> bucket_shift);
+}
+
+/**
+ * Finds the rule of a URI range table covering a URI.
+ *
+ * @param ranges The first rule of a non-empty, validated table.
+ * @param count Number of rules.
+ * @param stride Size of a rule in bytes.
+ * @param offset Offset of range_start within a rule.
+ * @param uri The URI.
+ * @return Index of the last rule starting at or below the URI.
+ */
+size_t uri_range_lookup(const void* ranges, size_t count, size_t stride, size_t offset, uint64_t uri) {
+    size_t low = 0, high = count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (range_start_of(ranges, stride, offset, middle) <= uri) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Checks that a URI range table starts at 0 and its starts increase.
+ *
+ * @param ranges The first rule.
+ * @param count Number of rules.
+ * @param stride Size of a rule in bytes.
+ * @param offset Offset of range_start within a rule.
+ * @return Index of the first rule out of place, or count if the table is valid.
+ */
+size_t uri_range_first_unsorted(const void* ranges, size_t count, size_t stride, size_t offset) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = range_start_of(ranges, stride, offset, i);
+        if (i == 0 ? start != 0 : start <= range_start_of(ranges, stride, offset, i - 1)) {
+            return i;
+        }
+    }
+    return count;
+}
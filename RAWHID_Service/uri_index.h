@@ -0,0 +1,25 @@
+#ifndef URI_INDEX_H
+#define URI_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Lookups keyed by a request's 64-bit URI, shared by the router, the
+ * response cache, the in-flight table and the priority lanes.
+ *
+ * A URI range table is an array of rules sorted by a uint64_t range_start,
+ * the first starting at 0; each rule covers the URIs up to the next rule's
+ * start. The URI_RANGE_* macros take such an array of any rule type.
+ */
+
+#define URI_RANGE_OFFSET(ranges) ((size_t)((const char*)&(ranges)->range_start - (const char*)(ranges)))
+#define URI_RANGE_LOOKUP(ranges, count, uri) uri_range_lookup((ranges), (count), sizeof(*(ranges)), URI_RANGE_OFFSET(ranges), (uri))
+#define URI_RANGE_FIRST_UNSORTED(ranges, count) uri_range_first_unsorted((ranges), (count), sizeof(*(ranges)), URI_RANGE_OFFSET(ranges))
+
+uint64_t uri_hash(uint64_t uri);
+uint32_t uri_hash_bucket(uint64_t uri, uint32_t bucket_shift);
+size_t uri_range_lookup(const void* ranges, size_t count, size_t stride, size_t offset, uint64_t uri);
+size_t uri_range_first_unsorted(const void* ranges, size_t count, size_t stride, size_t offset);
+
+#endif // URI_INDEX_H
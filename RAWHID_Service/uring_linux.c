@@ -0,0 +1,384 @@
+#include "uring_linux.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned arg_count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, arg_count);
+}
+
+/**
+ * Sets up a ring and maps its queues.
+ *
+ * @param ring Pointer to the ring to set up.
+ * @param entries Submission queue entries.
+ * @param completion_entries Completion queue entries, at least entries.
+ * @return 0 on success, -1 on failure (errno has the reason).
+ */
+int uring_init(uring* ring, unsigned entries, unsigned completion_entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = completion_entries;
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return -1;
+    }
+    ring->features = params.features;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_cleanup(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_cleanup(ring);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_cleanup(ring);
+        return -1;
+    }
+
+    unsigned char* sq = (unsigned char*)ring->sq_ring;
+    unsigned char* cq = (unsigned char*)ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Entries are always submitted in order, so the index array is the identity
+    unsigned* array = (unsigned*)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    return 0;
+}
+
+/**
+ * Unmaps the queues and closes the ring, which also cancels whatever it
+ * still has in flight.
+ *
+ * @param ring Pointer to the ring.
+ */
+void uring_cleanup(uring* ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    ring->sqes = NULL;
+    ring->sq_ring = NULL;
+    ring->cq_ring = NULL;
+    ring->fd = -1;
+}
+
+/**
+ * Registers a frame pool as fixed buffer 0, so reads and writes into it skip
+ * the per-operation page pinning.
+ *
+ * @param ring Pointer to the ring.
+ * @param pool The pool.
+ * @return 0 on success, -1 on failure (errno has the reason).
+ */
+int uring_register_pool(uring* ring, const uring_frame_pool* pool) {
+    struct iovec region = { pool->buffers, (size_t)pool->count * MESSAGE_MAX_SIZE_BYTES };
+    ring->enter_calls++;
+    return sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, &region, 1) < 0 ? -1 : 0;
+}
+
+/**
+ * Publishes the prepared entries and optionally waits for completions.
+ *
+ * @param ring Pointer to the ring.
+ * @param wait_count Completions to wait for, 0 to only submit.
+ * @param timeout_ms Longest wait, -1 for no limit.
+ * @return 0 on success or timeout, -1 on failure (errno has the reason).
+ */
+int uring_submit_and_wait(uring* ring, unsigned wait_count, int timeout_ms) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_count == 0) {
+        return 0;
+    }
+
+    unsigned flags = wait_count ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg wait_arg;
+    void* arg = NULL;
+    size_t arg_size = 0;
+    if (wait_count && timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&wait_arg, 0, sizeof(wait_arg));
+        wait_arg.sigmask_sz = _NSIG / 8;
+        wait_arg.ts = (uint64_t)(uintptr_t)&timeout;
+        flags |= IORING_ENTER_EXT_ARG;
+        arg = &wait_arg;
+        arg_size = sizeof(wait_arg);
+    }
+
+    ring->enter_calls++;
+    if (sys_io_uring_enter(ring->fd, to_submit, wait_count, flags, arg, arg_size) < 0 &&
+        errno != ETIME && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Takes a free submission entry, submitting what is queued first if the
+ * queue is full. The entry is cleared; the caller fills it in.
+ *
+ * @param ring Pointer to the ring.
+ * @return The entry, or NULL if the queue stays full.
+ */
+struct io_uring_sqe* uring_get_sqe(uring* ring) {
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_submit_and_wait(ring, 0, 0) < 0 ||
+            ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * Free submission entries, so a linked chain can be kept in one submission.
+ *
+ * @param ring Pointer to the ring.
+ * @return The number of entries uring_get_sqe can hand out without submitting.
+ */
+unsigned uring_sq_space(uring* ring) {
+    return ring->sq_entries - (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Returns the oldest unconsumed completion without waiting.
+ *
+ * @param ring Pointer to the ring.
+ * @return The completion, or NULL if there is none.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring* ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * Marks the completion returned by uring_peek_cqe as consumed.
+ *
+ * @param ring Pointer to the ring.
+ */
+void uring_cqe_seen(uring* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Allocates a pool of frame buffers, all free.
+ *
+ * @param pool Pointer to the pool.
+ * @param count Number of buffers.
+ * @return 1 on success, 0 on failure.
+ */
+int uring_pool_init(uring_frame_pool* pool, uint32_t count) {
+    memset(pool, 0, sizeof(*pool));
+    // Page aligned, as the whole region is pinned when it is registered
+    if (posix_memalign((void**)&pool->buffers, 4096, (size_t)count * MESSAGE_MAX_SIZE_BYTES) != 0) {
+        pool->buffers = NULL;
+        return 0;
+    }
+    pool->free_slots = (uint32_t*)malloc(count * sizeof(uint32_t));
+    if (!pool->free_slots) {
+        uring_pool_cleanup(pool);
+        return 0;
+    }
+    pool->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        pool->free_slots[i] = count - 1 - i;
+    }
+    pool->free_count = count;
+    return 1;
+}
+
+/**
+ * Releases a pool's memory.
+ *
+ * @param pool Pointer to the pool.
+ */
+void uring_pool_cleanup(uring_frame_pool* pool) {
+    free(pool->buffers);
+    free(pool->free_slots);
+    memset(pool, 0, sizeof(*pool));
+}
+
+/**
+ * Takes a free buffer.
+ *
+ * @param pool Pointer to the pool.
+ * @param slot Receives its slot number.
+ * @return true if one was free.
+ */
+bool uring_pool_get(uring_frame_pool* pool, uint32_t* slot) {
+    if (pool->free_count == 0) {
+        return false;
+    }
+    *slot = pool->free_slots[--pool->free_count];
+    return true;
+}
+
+/**
+ * Returns a buffer to the pool.
+ *
+ * @param pool Pointer to the pool.
+ * @param slot Its slot number.
+ */
+void uring_pool_put(uring_frame_pool* pool, uint32_t slot) {
+    pool->free_slots[pool->free_count++] = slot;
+}
+
+/**
+ * Address of a buffer.
+ *
+ * @param pool Pointer to the pool.
+ * @param slot Its slot number.
+ * @return The buffer, MESSAGE_MAX_SIZE_BYTES long.
+ */
+unsigned char* uring_pool_buffer(const uring_frame_pool* pool, uint32_t slot) {
+    return pool->buffers + (size_t)slot * MESSAGE_MAX_SIZE_BYTES;
+}
+
+/**
+ * Allocates an empty write queue.
+ *
+ * @param queue Pointer to the queue.
+ * @param capacity Most reports it holds.
+ * @return 1 on success, 0 on failure.
+ */
+int uring_write_queue_init(uring_write_queue* queue, uint32_t capacity) {
+    memset(queue, 0, sizeof(*queue));
+    queue->entries = (uring_write_entry*)calloc(capacity, sizeof(uring_write_entry));
+    if (!queue->entries) {
+        return 0;
+    }
+    queue->capacity = capacity;
+    return 1;
+}
+
+/**
+ * Releases a write queue's memory. The pool slots still queued are the
+ * caller's to return.
+ *
+ * @param queue Pointer to the queue.
+ */
+void uring_write_queue_cleanup(uring_write_queue* queue) {
+    free(queue->entries);
+    memset(queue, 0, sizeof(*queue));
+}
+
+/**
+ * Queues a report, which must fit. A report that starts a message goes ahead
+ * of every queued message of a lower class and behind the rest. A later
+ * fragment goes straight after the report pushed before it, the previous
+ * fragment.
+ *
+ * @param queue Pointer to the queue.
+ * @param slot Pool slot holding the report.
+ * @param priority Its message's class, the same for every fragment.
+ * @param continues Whether it is a later fragment of the message pushed last.
+ */
+void uring_write_queue_push(uring_write_queue* queue, uint32_t slot, priority_class priority, bool continues) {
+    uint32_t position;
+    if (continues) {
+        // Once the previous fragment has been taken for writing, the rest of its message goes first
+        uint32_t last_position = (queue->last + queue->capacity - queue->start) % queue->capacity;
+        position = last_position < queue->count ? last_position + 1 : 0;
+    }
+    else {
+        // Move ahead of lower classes, but never between the fragments of a message
+        position = queue->count;
+        while (position > 0 && queue->entries[(queue->start + position - 1) % queue->capacity].priority > priority) {
+            position--;
+        }
+        while (position < queue->count && queue->entries[(queue->start + position) % queue->capacity].continues) {
+            position++;
+        }
+    }
+
+    for (uint32_t i = queue->count; i > position; i--) {
+        queue->entries[(queue->start + i) % queue->capacity] = queue->entries[(queue->start + i - 1) % queue->capacity];
+    }
+    queue->last = (queue->start + position) % queue->capacity;
+    queue->entries[queue->last].slot = slot;
+    queue->entries[queue->last].priority = (uint8_t)priority;
+    queue->entries[queue->last].continues = continues;
+    queue->count++;
+    queue->queued[priority]++;
+}
+
+/**
+ * Takes the next report to write.
+ *
+ * @param queue Pointer to a queue that is not empty.
+ * @return The pool slot holding the report.
+ */
+uint32_t uring_write_queue_pop(uring_write_queue* queue) {
+    uring_write_entry* entry = &queue->entries[queue->start];
+    queue->start = (queue->start + 1) % queue->capacity;
+    queue->count--;
+    queue->queued[entry->priority]--;
+    return entry->slot;
+}
@@ -0,0 +1,90 @@
+#ifndef URING_LINUX_H
+#define URING_LINUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+#include "message_protocol.h"
+#include "priority_lanes.h"
+#include "logger.h"
+
+/**
+ * Minimal io_uring wrapper over the raw system calls, enough for the Linux
+ * bridge's io_uring engine without depending on liburing: one ring, one
+ * registered buffer region, submission with an optional wait timeout.
+ * Owned by one thread, so no locking beyond the ring's own barriers.
+ */
+
+typedef struct {
+    int fd;
+    unsigned features;        // IORING_FEAT_* the kernel reported
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;   // Entries prepared, published to the kernel at the next submit
+    struct io_uring_sqe* sqes;
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    // Mappings
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    uint64_t enter_calls;     // io_uring_enter and io_uring_register calls made
+} uring;
+
+// Fixed-size frame buffers registered with the ring, handed out by slot number.
+typedef struct {
+    unsigned char* buffers;   // count * MESSAGE_MAX_SIZE_BYTES, registered as fixed buffer 0
+    uint32_t count;
+    uint32_t* free_slots;     // Stack of free slot numbers
+    uint32_t free_count;
+} uring_frame_pool;
+
+// One report waiting in a uring_write_queue.
+typedef struct {
+    uint32_t slot;            // Pool slot holding the report
+    uint8_t priority;         // Its class, that of the first report of its message
+    bool continues;           // A later fragment of the same message as the entry before it
+} uring_write_entry;
+
+// Reports waiting to be written to one device, highest class first and oldest
+// first within a class. The fragments of one message stay together and in
+// order: nothing is inserted between them.
+typedef struct {
+    uring_write_entry* entries;  // Circular
+    uint32_t capacity;
+    uint32_t start;
+    uint32_t count;
+    uint32_t last;            // Index of the entry pushed most recently
+    uint32_t queued[PRIORITY_CLASS_COUNT];  // Entries of each class
+} uring_write_queue;
+
+int uring_init(uring* ring, unsigned entries, unsigned completion_entries);
+void uring_cleanup(uring* ring);
+int uring_register_pool(uring* ring, const uring_frame_pool* pool);
+struct io_uring_sqe* uring_get_sqe(uring* ring);
+unsigned uring_sq_space(uring* ring);
+int uring_submit_and_wait(uring* ring, unsigned wait_count, int timeout_ms);
+struct io_uring_cqe* uring_peek_cqe(uring* ring);
+void uring_cqe_seen(uring* ring);
+
+int uring_pool_init(uring_frame_pool* pool, uint32_t count);
+void uring_pool_cleanup(uring_frame_pool* pool);
+bool uring_pool_get(uring_frame_pool* pool, uint32_t* slot);
+void uring_pool_put(uring_frame_pool* pool, uint32_t slot);
+unsigned char* uring_pool_buffer(const uring_frame_pool* pool, uint32_t slot);
+
+int uring_write_queue_init(uring_write_queue* queue, uint32_t capacity);
+void uring_write_queue_cleanup(uring_write_queue* queue);
+void uring_write_queue_push(uring_write_queue* queue, uint32_t slot, priority_class priority, bool continues);
+uint32_t uring_write_queue_pop(uring_write_queue* queue);
+
+#endif // URING_LINUX_H
@@ -0,0 +1,81 @@
+#include "test_support.h"
+#include "frame_capture.h"
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * The capture file format the decoder reads: the on-disk layout of the
+ * header and both record versions, and what capture_frame writes, including
+ * zero padding of short frames and wrapping once the file is full.
+ */
+
+#define TEST_CAPTURE_PATH "test_frame_capture.rhc"
+#define TEST_CAPACITY 4
+
+static void test_layout(void) {
+    CHECK(sizeof(capture_file_header) == 64);
+    CHECK(offsetof(capture_file_header, version) == 8);
+    CHECK(offsetof(capture_file_header, record_size) == 16);
+    CHECK(offsetof(capture_file_header, capacity) == 24);
+    CHECK(offsetof(capture_file_header, record_count) == 32);
+    CHECK(offsetof(capture_file_header, start_time_us) == 40);
+
+    CHECK(sizeof(capture_record) == 88);
+    CHECK(offsetof(capture_record, sequence) == 8);
+    CHECK(offsetof(capture_record, direction) == 12);
+    CHECK(offsetof(capture_record, device_index) == 13);
+    CHECK(offsetof(capture_record, request_id) == 14);
+    CHECK(offsetof(capture_record, frame_length) == 16);
+    CHECK(offsetof(capture_record, frame) == 24);
+
+    CHECK(sizeof(capture_record_v1) == 48);
+    CHECK(offsetof(capture_record_v1, frame) == 16);
+}
+
+static void test_records(void) {
+    CHECK(open_frame_capture(TEST_CAPTURE_PATH, TEST_CAPACITY));
+
+    // Six frames into four slots: the first two are overwritten, frame 1 by a shorter one
+    uint8_t frame[MESSAGE_MAX_SIZE_BYTES + 8];
+    for (uint32_t i = 0; i < 6; i++) {
+        memset(frame, 0xA0 + i, sizeof(frame));
+        size_t size = i == 1 || i == 3 ? sizeof(frame) : MESSAGE_SIZE_BYTES + i;
+        capture_frame(CAPTURE_TCP_TO_HID, (uint8_t)i, (uint16_t)(100 + i), frame, size);
+    }
+    close_frame_capture();
+
+    FILE* file = fopen(TEST_CAPTURE_PATH, "rb");
+    CHECK(file != NULL);
+    if (file == NULL) {
+        return;
+    }
+    capture_file_header header;
+    capture_record records[TEST_CAPACITY];
+    CHECK(fread(&header, sizeof(header), 1, file) == 1);
+    CHECK(fread(records, sizeof(capture_record), TEST_CAPACITY, file) == TEST_CAPACITY);
+    fclose(file);
+    remove(TEST_CAPTURE_PATH);
+
+    CHECK(strcmp(header.magic, CAPTURE_MAGIC) == 0 && header.version == CAPTURE_VERSION);
+    CHECK(header.header_size == sizeof(capture_file_header) && header.record_size == sizeof(capture_record));
+    CHECK(header.frame_size == MESSAGE_MAX_SIZE_BYTES && header.capacity == TEST_CAPACITY && header.record_count == 6);
+
+    for (uint32_t i = 2; i < 6; i++) {
+        const capture_record* record = &records[i % TEST_CAPACITY];
+        size_t length = i == 3 ? MESSAGE_MAX_SIZE_BYTES : MESSAGE_SIZE_BYTES + i;
+        CHECK(record->sequence == i + 1);
+        CHECK(record->direction == CAPTURE_TCP_TO_HID && record->device_index == i && record->request_id == 100 + i);
+        CHECK(record->frame_length == length);
+        for (size_t b = 0; b < MESSAGE_MAX_SIZE_BYTES; b++) {
+            CHECK(record->frame[b] == (b < length ? 0xA0 + i : 0));
+        }
+    }
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+
+    test_layout();
+    test_records();
+    return TEST_RESULT();
+}
@@ -0,0 +1,165 @@
+#include "test_support.h"
+#include "frame_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The SPSC frame ring: each full-ring policy, payload ownership when a frame
+ * is overwritten, the consumer wait handshake, and ordering with a producer
+ * and a consumer on separate threads.
+ */
+
+#define THREADED_FRAMES 200000
+
+// A frame numbered in its request ID and first data bytes.
+static bridge_frame numbered_frame(uint32_t number, message_payload* payload) {
+    bridge_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.request_id = (uint16_t)number;
+    memcpy(frame.data, &number, sizeof(number));
+    frame.size = MESSAGE_SIZE_BYTES;
+    frame.payload = payload;
+    return frame;
+}
+
+static uint32_t frame_number(const bridge_frame* frame) {
+    uint32_t number;
+    memcpy(&number, frame->data, sizeof(number));
+    return number;
+}
+
+static message_payload* new_payload(void) {
+    message_payload* payload = (message_payload*)malloc(sizeof(message_payload) + 8);
+    payload->size = 8;
+    payload->capacity = 8;
+    return payload;
+}
+
+static void test_drop_newest(void) {
+    frame_ring ring;
+    CHECK(frame_ring_init(&ring, 3, FRAME_RING_DROP_NEWEST));  // Rounded up to 4
+
+    for (uint32_t i = 0; i < 4; i++) {
+        bridge_frame frame = numbered_frame(i, NULL);
+        CHECK(frame_ring_push(&ring, &frame) == 1);
+    }
+    bridge_frame extra = numbered_frame(4, NULL);
+    CHECK(frame_ring_push(&ring, &extra) == 0);
+    CHECK(ring.dropped == 1 && ring.pushed == 4 && ring.high_watermark == 4 && frame_ring_depth(&ring) == 4);
+
+    bridge_frame frame;
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(frame_ring_pop(&ring, &frame) && frame_number(&frame) == i);
+    }
+    CHECK(!frame_ring_pop(&ring, &frame) && ring.popped == 4);
+    frame_ring_destroy(&ring);
+}
+
+static void test_overwrite_oldest(void) {
+    frame_ring ring;
+    CHECK(frame_ring_init(&ring, 4, FRAME_RING_OVERWRITE_OLDEST));
+
+    // The two oldest frames give way, and the ring frees their payloads
+    message_payload* payloads[6];
+    for (uint32_t i = 0; i < 6; i++) {
+        payloads[i] = new_payload();
+        bridge_frame frame = numbered_frame(i, payloads[i]);
+        CHECK(frame_ring_push(&ring, &frame) == 1);
+    }
+    CHECK(ring.overwritten == 2 && ring.dropped == 0 && frame_ring_depth(&ring) == 4);
+
+    bridge_frame frame;
+    for (uint32_t i = 2; i < 5; i++) {
+        CHECK(frame_ring_pop(&ring, &frame) && frame_number(&frame) == i && frame.payload == payloads[i]);
+        message_payload_free(frame.payload);
+    }
+
+    // Destroying the ring frees what is still queued
+    frame_ring_destroy(&ring);
+}
+
+static void test_wait_handshake(void) {
+    frame_ring ring;
+    CHECK(frame_ring_init(&ring, 4, FRAME_RING_BACKPRESSURE));
+
+    // An empty ring lets the consumer block, and the next push wakes it exactly once
+    CHECK(frame_ring_prepare_wait(&ring));
+    bridge_frame frame = numbered_frame(1, NULL);
+    frame_ring_push(&ring, &frame);
+    CHECK(frame_ring_take_waiter(&ring));
+    CHECK(!frame_ring_take_waiter(&ring));
+
+    // A frame already queued keeps the consumer awake
+    CHECK(!frame_ring_prepare_wait(&ring));
+    CHECK(!frame_ring_take_waiter(&ring));
+
+    // A withdrawn wait needs no wake-up
+    CHECK(frame_ring_pop(&ring, &frame));
+    CHECK(frame_ring_prepare_wait(&ring));
+    frame_ring_cancel_wait(&ring);
+    frame_ring_push(&ring, &frame);
+    CHECK(!frame_ring_take_waiter(&ring));
+    frame_ring_destroy(&ring);
+}
+
+static volatile LONG producer_done;
+
+// Pushes THREADED_FRAMES numbered frames.
+static void producer(void* context) {
+    frame_ring* ring = (frame_ring*)context;
+    for (uint32_t i = 0; i < THREADED_FRAMES; i++) {
+        bridge_frame frame = numbered_frame(i, NULL);
+        frame_ring_push(ring, &frame);
+    }
+    WriteRelease(&producer_done, 1);
+}
+
+// Runs a producer thread against this thread as the consumer.
+static void threaded(frame_ring_policy policy) {
+    frame_ring ring;
+    CHECK(frame_ring_init(&ring, 64, policy));
+    producer_done = 0;
+    platform_thread thread = platform_thread_start(producer, &ring);
+    CHECK(thread != NULL);
+
+    // Frames come out in order; only the policy may skip any
+    uint64_t received = 0;
+    int64_t last = -1;
+    bool ordered = true;
+    bridge_frame frame;
+    while (last < THREADED_FRAMES - 1) {
+        if (!frame_ring_pop(&ring, &frame)) {
+            if (ReadAcquire(&producer_done) && frame_ring_depth(&ring) == 0) {
+                break;  // The last frames were dropped
+            }
+            SwitchToThread();
+            continue;
+        }
+        int64_t number = frame_number(&frame);
+        ordered &= number > last;
+        last = number;
+        received++;
+    }
+    platform_thread_join(thread);
+    CHECK(ordered);
+
+    // Every frame is accounted for
+    CHECK(ring.pushed + ring.dropped == THREADED_FRAMES);
+    CHECK(received == (uint64_t)(ring.pushed - ring.overwritten) && ring.popped == (LONG64)received);
+    if (policy == FRAME_RING_BACKPRESSURE) {
+        CHECK(received == THREADED_FRAMES);
+    }
+    frame_ring_destroy(&ring);
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+
+    test_drop_newest();
+    test_overwrite_oldest();
+    test_wait_handshake();
+    threaded(FRAME_RING_BACKPRESSURE);
+    threaded(FRAME_RING_DROP_NEWEST);
+    threaded(FRAME_RING_OVERWRITE_OLDEST);
+    return TEST_RESULT();
+}
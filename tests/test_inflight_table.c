@@ -0,0 +1,192 @@
+#include "test_support.h"
+#include "inflight_table.h"
+#include <stdlib.h>
+
+/**
+ * The in-flight table's mapping of upstream IDs to slots: IDs wrap past
+ * 65535 without handing out 0, a slot still held by a slow request is
+ * skipped, lookups only match the exact ID, expiry frees slots, and a reset
+ * forgets everything in flight. With coalescing on, the URI index and the
+ * waiters released with their request.
+ */
+
+static void test_id_mapping(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 4, 0));
+
+    inflight_entry* entries[4];
+    for (int i = 0; i < 4; i++) {
+        entries[i] = inflight_add(&table, (uint16_t)(100 + i), (uint8_t)i, 1000 + i, (uint64_t)i * 10, 0);
+        CHECK(entries[i] && entries[i]->upstream_id == (uint16_t)(i + 1));
+        CHECK(entries[i] == &table.entries[entries[i]->upstream_id % table.window]);
+    }
+    CHECK(inflight_full(&table) && !inflight_add(&table, 200, 0, 0, 0, 0));
+
+    for (int i = 0; i < 4; i++) {
+        inflight_entry* found = inflight_find(&table, entries[i]->upstream_id);
+        CHECK(found == entries[i] && found->hid_request_id == 100 + i && found->device_index == i);
+        CHECK(!inflight_find(&table, (uint16_t)(entries[i]->upstream_id + table.window)));
+    }
+    CHECK(inflight_oldest(&table) == entries[0]);
+
+    // ID 5 would take slot 1, still held by ID 1; the table moves on to ID 6
+    inflight_remove(&table, entries[1]);
+    inflight_entry* next = inflight_add(&table, 300, 0, 0, 0, 0);
+    CHECK(next && next->upstream_id == 6 && next == &table.entries[2 % table.window]);
+    inflight_destroy(&table);
+}
+
+static void test_id_wrap(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 8, 0));
+    table.next_id = 65535;
+
+    inflight_entry* last = inflight_add(&table, 1, 0, 0, 0, 0);
+    inflight_entry* wrapped = inflight_add(&table, 2, 0, 0, 0, 0);
+    CHECK(last && last->upstream_id == 65535);
+    CHECK(wrapped && wrapped->upstream_id == 1);  // 0 is never handed out
+    CHECK(inflight_find(&table, 65535) == last && inflight_find(&table, 1) == wrapped);
+    CHECK(!inflight_find(&table, 0));
+    inflight_destroy(&table);
+}
+
+static void test_expiry(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 4, 0));
+
+    inflight_entry* quick = inflight_add(&table, 1, 0, 0, 0, 10);
+    inflight_entry* slow = inflight_add(&table, 2, 0, 0, 0, 50);
+    inflight_entry* forever = inflight_add(&table, 3, 0, 0, 0, 0);
+    uint16_t quick_id = quick->upstream_id;
+    CHECK(inflight_next_deadline(&table) == 10 * 1000);
+
+    CHECK(inflight_expire(&table, 9 * 1000) == 0);
+    CHECK(inflight_expire(&table, 10 * 1000) == 1);
+    CHECK(!inflight_find(&table, quick_id) && table.count == 2);
+    CHECK(inflight_next_deadline(&table) == 50 * 1000);
+    CHECK(inflight_expire(&table, UINT64_MAX - 1) == 1);
+    CHECK(table.count == 1 && inflight_find(&table, forever->upstream_id) == forever);
+    (void)slow;
+    inflight_destroy(&table);
+}
+
+static void test_coalescing(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 4, 2));
+
+    inflight_entry* entry = inflight_add(&table, 1, 0, 0xABCD, 0, 0);
+    CHECK(inflight_find_uri(&table, 0xABCD) == entry);
+    CHECK(!inflight_find_uri(&table, 0xABCE));
+    CHECK(inflight_attach_waiter(&table, entry, 2, 1, 0));
+    CHECK(inflight_attach_waiter(&table, entry, 3, 2, 0));
+    CHECK(!inflight_attach_waiter(&table, entry, 4, 3, 0));  // Every waiter is in use
+
+    // Waiters are kept in arrival order
+    uint32_t first = entry->first_waiter;
+    CHECK(first != INFLIGHT_NIL && table.waiters[first].hid_request_id == 2);
+    CHECK(table.waiters[table.waiters[first].next].hid_request_id == 3);
+
+    inflight_remove(&table, entry);
+    CHECK(!inflight_find_uri(&table, 0xABCD));
+    entry = inflight_add(&table, 5, 0, 0xABCD, 0, 0);
+    CHECK(inflight_attach_waiter(&table, entry, 6, 0, 0));  // Removing returned the waiters
+    inflight_destroy(&table);
+}
+
+static void test_coalescing_index(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 32, 8));
+
+    // Every outstanding URI is found, including those sharing a bucket
+    inflight_entry* entries[32];
+    for (uint32_t i = 0; i < 32; i++) {
+        entries[i] = inflight_add(&table, (uint16_t)i, 0, 0x1000 + i * 0x10000ULL, 0, 0);
+        CHECK(entries[i] != NULL);
+    }
+    for (uint32_t i = 0; i < 32; i += 2) {
+        inflight_remove(&table, entries[i]);
+    }
+    for (uint32_t i = 0; i < 32; i++) {
+        CHECK(inflight_find_uri(&table, 0x1000 + i * 0x10000ULL) == (i % 2 ? entries[i] : NULL));
+    }
+
+    // A fragmented request carries more than its URI and is never waited on
+    message_payload* payload = (message_payload*)malloc(sizeof(message_payload));
+    inflight_entry* fragmented = inflight_add(&table, 40, 0, 0x9999, 0, 0);
+    fragmented->request_payload = payload;
+    CHECK(!inflight_find_uri(&table, 0x9999));
+    inflight_destroy(&table);
+}
+
+static void test_coalesced_expiry(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 4, 2));
+
+    // Waiters time out with the request they wait on, and their slots come back
+    inflight_entry* entry = inflight_add(&table, 1, 0, 0x42, 0, 10);
+    CHECK(inflight_attach_waiter(&table, entry, 2, 0, 0));
+    CHECK(inflight_attach_waiter(&table, entry, 3, 0, 0));
+    CHECK(inflight_expire(&table, 10 * 1000) == 1);
+    CHECK(table.timed_out == 3 && table.coalesced == 2 && !inflight_find_uri(&table, 0x42));
+
+    // So do those of requests forgotten on a reconnect
+    entry = inflight_add(&table, 4, 0, 0x43, 0, 0);
+    CHECK(inflight_attach_waiter(&table, entry, 5, 0, 0) && inflight_attach_waiter(&table, entry, 6, 0, 0));
+    inflight_reset(&table);
+    entry = inflight_add(&table, 7, 0, 0x43, 0, 0);
+    CHECK(inflight_attach_waiter(&table, entry, 8, 0, 0) && inflight_attach_waiter(&table, entry, 9, 0, 0));
+    CHECK(entry->waiter_count == 2);
+    inflight_destroy(&table);
+}
+
+static void test_cancel(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 2, 0));
+
+    // A request that was never sent frees its slot without counting as completed
+    inflight_entry* entry = inflight_add(&table, 1, 0, 0x10, 0, 0);
+    inflight_cancel(&table, entry);
+    CHECK(table.count == 0 && table.completed == 0 && !inflight_find(&table, entry->upstream_id));
+    entry = inflight_add(&table, 2, 0, 0x20, 0, 0);
+    inflight_remove(&table, entry);
+    CHECK(table.count == 0 && table.completed == 1);
+    inflight_destroy(&table);
+}
+
+static void test_oldest_and_reset(void) {
+    inflight_table table;
+    CHECK(inflight_init(&table, 4, 0));
+
+    // Lockstep matching answers the request sent first, whatever its slot
+    inflight_entry* first = inflight_add(&table, 1, 0, 0, 300, 0);
+    inflight_entry* second = inflight_add(&table, 2, 0, 0, 100, 0);
+    inflight_entry* third = inflight_add(&table, 3, 0, 0, 200, 0);
+    CHECK(inflight_oldest(&table) == second);
+    inflight_remove(&table, second);
+    CHECK(inflight_oldest(&table) == third);
+
+    // A reconnect forgets what was in flight, payloads included, without counting it
+    first->request_payload = (message_payload*)malloc(sizeof(message_payload));
+    uint16_t first_id = first->upstream_id;
+    inflight_reset(&table);
+    CHECK(table.count == 0 && table.completed == 1 && table.timed_out == 0);
+    CHECK(!inflight_find(&table, first_id) && !inflight_oldest(&table) && !first->request_payload);
+
+    // IDs carry on from where they were, so a late answer to a forgotten request matches nothing
+    inflight_entry* after = inflight_add(&table, 4, 0, 0, 400, 0);
+    CHECK(after && after->upstream_id == 4);
+    inflight_destroy(&table);
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+    test_id_mapping();
+    test_id_wrap();
+    test_expiry();
+    test_coalescing();
+    test_coalescing_index();
+    test_coalesced_expiry();
+    test_cancel();
+    test_oldest_and_reset();
+    return TEST_RESULT();
+}
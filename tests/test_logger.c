@@ -0,0 +1,176 @@
+#include "test_support.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/**
+ * The asynchronous logger: records formatted by the writer thread match what
+ * the caller would have formatted, and a full queue blocks or drops records
+ * according to the policy without losing or reordering the rest.
+ */
+
+#define TEST_LOG_PATH "test_logger.log"
+#define TEST_LINE_SIZE 1024
+#define FLOOD_RECORDS 20000
+#define FLOOD_PRODUCERS 2
+
+static char log_lines[FLOOD_RECORDS * FLOOD_PRODUCERS + 64][TEST_LINE_SIZE];
+
+// Starts the logger on an empty file.
+static void start_logger(void) {
+    remove(TEST_LOG_PATH);
+    init_logger(TEST_LOG_PATH);
+}
+
+// Stops the logger and reads back every line it wrote, without the newline.
+static size_t stop_logger(void) {
+    close_logger();
+    FILE* file = fopen(TEST_LOG_PATH, "r");
+    CHECK(file != NULL);
+    if (file == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    while (count < sizeof(log_lines) / sizeof(log_lines[0]) && fgets(log_lines[count], TEST_LINE_SIZE, file) != NULL) {
+        log_lines[count][strcspn(log_lines[count], "\n")] = '\0';
+        count++;
+    }
+    fclose(file);
+    remove(TEST_LOG_PATH);
+    return count;
+}
+
+static void test_deferred_formatting(void) {
+    char expected[16][TEST_LINE_SIZE];
+    size_t expected_count = 0;
+    char scratch[32];
+
+    start_logger();
+
+    // A string argument is copied, so reusing the caller's buffer doesn't change the line
+    strcpy(scratch, "127.0.0.1");
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "TCP Client Thread - Connecting to %s:%u (upstream %zu)", scratch, 8080u, (size_t)2);
+    strcpy(scratch, "overwritten");
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] TCP Client Thread - Connecting to 127.0.0.1:8080 (upstream 2)");
+
+    WRITE_LOG_FORMAT(LOGLEVEL_WARN, "%d %ld %lld %llu %x %016llx %.1f %.2f %c %% %5s|%-4d|",
+        -7, -70000L, -9000000000LL, 18000000000ULL, 0xBEEFu, 0x1234ULL, 2.25, 0.125, 'z', "ab", 3);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[WARN] %d %ld %lld %llu %x %016llx %.1f %.2f %c %% %5s|%-4d|",
+        -7, -70000L, -9000000000LL, 18000000000ULL, 0xBEEFu, 0x1234ULL, 2.25, 0.125, 'z', "ab", 3);
+
+    WRITE_LOG_FORMAT(LOGLEVEL_ERROR, "Device error: %ls, %s", L"wide text", (const char*)NULL);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[ERROR] Device error: wide text, (null)");
+
+    // Width from an argument can't be deferred and is formatted by the caller
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "[%*d]", 6, 42);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] [    42]");
+
+    WRITE_LOG(LOGLEVEL_INFO, "Plain message");
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] Plain message");
+
+    static const unsigned char bytes[] = { 0x00, 0x1F, 0xA5, 0xFF };
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_INFO, bytes, sizeof(bytes));
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] 001FA5FF");
+
+    WRITE_LOG_UINT64_DEC(LOGLEVEL_INFO, "URI", 1234567890123ULL);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] URI: 1234567890123");
+    WRITE_LOG_UINT64_HEX(LOGLEVEL_INFO, "Data", 0xABCDEFULL);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] Data: 0xabcdef");
+    WRITE_LOG_UINT64_BIN(LOGLEVEL_INFO, "Bits", 5);
+    snprintf(expected[expected_count++], TEST_LINE_SIZE, "[INFO] Bits: %064d", 101);
+
+    // Records below the level are never queued
+    WRITE_LOG(LOGLEVEL_DEBUG, "Filtered");
+
+    size_t count = stop_logger();
+    CHECK(count == expected_count);
+    for (size_t i = 0; i < count && i < expected_count; i++) {
+        if (strcmp(log_lines[i], expected[i]) != 0) {
+            fprintf(stderr, "line %zu: got \"%s\", expected \"%s\"\n", i, log_lines[i], expected[i]);
+        }
+        CHECK(strcmp(log_lines[i], expected[i]) == 0);
+    }
+}
+
+static void test_truncation(void) {
+    char long_text[2 * TEST_LINE_SIZE];
+    memset(long_text, 'x', sizeof(long_text) - 1);
+    long_text[sizeof(long_text) - 1] = '\0';
+    unsigned char long_bytes[400];
+    memset(long_bytes, 0xAB, sizeof(long_bytes));
+
+    start_logger();
+    WRITE_LOG_FORMAT(LOGLEVEL_INFO, "%s%s", long_text, long_text);
+    WRITE_LOG(LOGLEVEL_INFO, long_text);
+    WRITE_LOG_BYTE_ARRAY(LOGLEVEL_INFO, long_bytes, sizeof(long_bytes));
+    size_t count = stop_logger();
+
+    // Every record is cut to one line of the logger's maximum size
+    CHECK(count == 3);
+    for (size_t i = 0; i < count; i++) {
+        CHECK(strlen(log_lines[i]) > 400 && strlen(log_lines[i]) < 520);
+    }
+}
+
+// Logs FLOOD_RECORDS numbered records tagged with the producer's index.
+static void flood_producer(void* context) {
+    unsigned producer = (unsigned)(size_t)context;
+    for (unsigned i = 0; i < FLOOD_RECORDS; i++) {
+        WRITE_LOG_FORMAT(LOGLEVEL_INFO, "producer %u record %u", producer, i);
+    }
+}
+
+// Floods the queue from several threads and checks what came out.
+static void flood(LogQueuePolicy policy) {
+    uint64_t dropped_before = get_log_dropped_count();
+    set_log_queue_policy(policy);
+    start_logger();
+
+    platform_thread producers[FLOOD_PRODUCERS];
+    for (size_t p = 0; p < FLOOD_PRODUCERS; p++) {
+        producers[p] = platform_thread_start(flood_producer, (void*)p);
+        CHECK(producers[p] != NULL);
+    }
+    for (size_t p = 0; p < FLOOD_PRODUCERS; p++) {
+        platform_thread_join(producers[p]);
+    }
+
+    size_t count = stop_logger();
+    uint64_t dropped = get_log_dropped_count() - dropped_before;
+
+    // Every record is either written or counted as dropped, and each producer's records stay in order
+    CHECK(count + dropped == (uint64_t)FLOOD_RECORDS * FLOOD_PRODUCERS);
+    if (policy == LOG_QUEUE_BLOCK) {
+        CHECK(dropped == 0);
+    }
+    long last[FLOOD_PRODUCERS];
+    for (size_t p = 0; p < FLOOD_PRODUCERS; p++) {
+        last[p] = -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        unsigned producer;
+        unsigned record;
+        CHECK(sscanf(log_lines[i], "[INFO] producer %u record %u", &producer, &record) == 2);
+        CHECK(producer < FLOOD_PRODUCERS);
+        if (producer < FLOOD_PRODUCERS) {
+            CHECK((long)record > last[producer]);
+            last[producer] = (long)record;
+        }
+    }
+    set_log_queue_policy(LOG_QUEUE_BLOCK);
+}
+
+int main(void) {
+    // The writer thread echoes every line to the console
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    set_log_level(LOGLEVEL_INFO);
+
+    test_deferred_formatting();
+    test_truncation();
+    flood(LOG_QUEUE_BLOCK);
+    flood(LOG_QUEUE_DROP);
+    return TEST_RESULT();
+}
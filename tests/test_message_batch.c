@@ -0,0 +1,67 @@
+#include "test_support.h"
+#include "message_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The batch codec against interpret_message and extract_request_id_and_data
+ * over random frames, at every SIMD level the CPU has and every frame size.
+ */
+
+#define TEST_FRAMES 203  // Not a multiple of 4 or 8, so every path leaves a scalar tail
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint8_t random_byte(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (uint8_t)(random_state >> 32);
+}
+
+static void test_decode(size_t stride) {
+    static uint8_t frames[TEST_FRAMES * MESSAGE_MAX_SIZE_BYTES];
+    MessageType types[TEST_FRAMES];
+    MessageType classified[TEST_FRAMES];
+    uint16_t request_ids[TEST_FRAMES];
+    uint16_t status_codes[TEST_FRAMES];
+    uint64_t values[TEST_FRAMES];
+    message_batch out = { types, request_ids, status_codes, values };
+
+    for (size_t i = 0; i < TEST_FRAMES * stride; i++) {
+        frames[i] = random_byte();
+    }
+    decode_messages(frames, TEST_FRAMES, stride, &out);
+    classify_messages(frames, TEST_FRAMES, stride, classified);
+
+    for (size_t i = 0; i < TEST_FRAMES; i++) {
+        const uint8_t* frame = frames + i * stride;
+        MessageType type;
+        uint16_t request_id;
+        uint64_t data;
+        interpret_message(frame, &type);
+        extract_request_id_and_data(frame, &request_id, &data);
+        CHECK(types[i] == type);
+        CHECK(classified[i] == type);
+        CHECK(request_ids[i] == request_id);
+        CHECK(status_codes[i] == (uint16_t)((frame[3] << 8) | frame[4]));
+        CHECK(values[i] == data);
+    }
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+
+    static const codec_simd_level levels[] = { CODEC_SIMD_SCALAR, CODEC_SIMD_SSE2, CODEC_SIMD_AVX2 };
+    static const size_t strides[] = { MESSAGE_SIZE_BYTES, 48, 61, MESSAGE_MAX_SIZE_BYTES };
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (set_codec_simd_level(levels[l]) != levels[l]) {
+            printf("SIMD level %d not supported by this CPU, skipped\n", (int)levels[l]);
+            continue;
+        }
+        for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+            test_decode(strides[s]);
+        }
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,103 @@
+#include "test_support.h"
+#include "message_fragments.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Round trips of fragment_message through fragment_assembler_add at every
+ * frame size, and the assembler's handling of fragments out of order.
+ */
+
+static message_payload* make_payload(size_t size, unsigned seed) {
+    message_payload* payload = (message_payload*)malloc(sizeof(message_payload) + size);
+    payload->size = size;
+    payload->capacity = size;
+    for (size_t i = 0; i < size; i++) {
+        payload->bytes[i] = (unsigned char)(seed + i * 7);
+    }
+    return payload;
+}
+
+static void make_header(unsigned char* header, uint16_t request_id) {
+    memset(header, 0, MESSAGE_MAX_SIZE_BYTES);
+    encode_response(header, request_id, 0);
+}
+
+static void test_round_trip(size_t frame_size, size_t payload_size) {
+    unsigned char header[MESSAGE_MAX_SIZE_BYTES];
+    make_header(header, 0x1234);
+    message_payload* payload = make_payload(payload_size, (unsigned)(frame_size + payload_size));
+    fragment_assembler assembler = { 0 };
+
+    size_t count = message_fragment_count(payload_size, frame_size);
+    fragment_status status = FRAGMENT_REJECTED;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char frame[MESSAGE_MAX_SIZE_BYTES];
+        fragment_message(frame, frame_size, header, payload, i);
+        CHECK(message_is_fragment(frame));
+        status = fragment_assembler_add(&assembler, frame, frame_size);
+        CHECK(status == (i + 1 < count ? FRAGMENT_PENDING : FRAGMENT_COMPLETE));
+    }
+
+    unsigned char first[MESSAGE_MAX_SIZE_BYTES];
+    message_payload* reassembled = fragment_assembler_take(&assembler, first);
+    CHECK(reassembled && reassembled->size == payload_size && memcmp(reassembled->bytes, payload->bytes, payload_size) == 0);
+    CHECK(first[1] == header[1] && first[2] == header[2]);
+    CHECK(assembler.reassembled == 1 && assembler.discarded == 0);
+    message_payload_free(reassembled);
+    message_payload_free(payload);
+}
+
+static void test_out_of_order(void) {
+    const size_t frame_size = MESSAGE_SIZE_BYTES;
+    unsigned char header[MESSAGE_MAX_SIZE_BYTES];
+    unsigned char frame[MESSAGE_MAX_SIZE_BYTES];
+    make_header(header, 7);
+    message_payload* payload = make_payload(100, 3);
+    fragment_assembler assembler = { 0 };
+
+    // Skipping a fragment discards the message
+    fragment_message(frame, frame_size, header, payload, 0);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_PENDING);
+    fragment_message(frame, frame_size, header, payload, 2);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_REJECTED);
+    CHECK(assembler.payload == NULL && assembler.discarded == 1);
+
+    // A later fragment without its start is rejected too
+    fragment_message(frame, frame_size, header, payload, 1);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_REJECTED);
+    CHECK(assembler.discarded == 2);
+
+    // A fragment of another request is not taken for the next one
+    unsigned char other[MESSAGE_MAX_SIZE_BYTES];
+    make_header(other, 8);
+    fragment_message(frame, frame_size, header, payload, 0);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_PENDING);
+    fragment_message(frame, frame_size, other, payload, 1);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_REJECTED);
+
+    // A new first fragment abandons the unfinished message and starts over
+    fragment_message(frame, frame_size, header, payload, 0);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_PENDING);
+    fragment_message(frame, frame_size, header, payload, 0);
+    CHECK(fragment_assembler_add(&assembler, frame, frame_size) == FRAGMENT_PENDING);
+    CHECK(assembler.discarded == 4);
+
+    fragment_assembler_reset(&assembler);
+    CHECK(assembler.payload == NULL && assembler.discarded == 5);
+    message_payload_free(payload);
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+
+    static const size_t frame_sizes[] = { MESSAGE_SIZE_BYTES, 48, MESSAGE_MAX_SIZE_BYTES };
+    static const size_t payload_sizes[] = { 1, 8, 24, 25, 56, 57, 200, MESSAGE_MAX_PAYLOAD_BYTES };
+    for (size_t f = 0; f < sizeof(frame_sizes) / sizeof(frame_sizes[0]); f++) {
+        for (size_t p = 0; p < sizeof(payload_sizes) / sizeof(payload_sizes[0]); p++) {
+            test_round_trip(frame_sizes[f], payload_sizes[p]);
+        }
+    }
+    test_out_of_order();
+    return TEST_RESULT();
+}
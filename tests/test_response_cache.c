@@ -0,0 +1,103 @@
+#include "test_support.h"
+#include "response_cache.h"
+
+/**
+ * Response cache TTLs by URI range, expiry, LRU eviction and invalidation.
+ */
+
+static const cache_ttl_rule ttl_rules[] = {
+    { 0, 100 },       // URIs 0-999: 100 ms
+    { 1000, 0 },      // URIs 1000-1999: never cached
+    { 2000, 5000 },   // URIs 2000 and up: 5 s
+};
+
+static void test_ttl_expiry(void) {
+    response_cache cache;
+    uint64_t data = 0;
+    CHECK(response_cache_init(&cache, 8, ttl_rules, 3));
+
+    response_cache_store(&cache, 5, 0x55, 0);
+    CHECK(response_cache_lookup(&cache, 5, 99 * 1000, &data) && data == 0x55);
+    CHECK(!response_cache_lookup(&cache, 5, 100 * 1000, &data));  // Expires at exactly the TTL
+    CHECK(cache.expirations == 1 && cache.count == 0);
+
+    response_cache_store(&cache, 1500, 0x15, 0);
+    CHECK(!response_cache_lookup(&cache, 1500, 0, &data));  // TTL 0 leaves the range uncached
+    CHECK(cache.count == 0);
+
+    response_cache_store(&cache, 2000, 0x20, 0);
+    CHECK(response_cache_lookup(&cache, 2000, 4999 * 1000, &data) && data == 0x20);
+    CHECK(!response_cache_lookup(&cache, 2000, 5000 * 1000, &data));
+
+    // Storing again refreshes the data and the expiry
+    response_cache_store(&cache, 7, 1, 0);
+    response_cache_store(&cache, 7, 2, 90 * 1000);
+    CHECK(response_cache_lookup(&cache, 7, 150 * 1000, &data) && data == 2);
+    CHECK(cache.count == 1);
+    response_cache_destroy(&cache);
+}
+
+static void test_eviction_and_invalidation(void) {
+    response_cache cache;
+    uint64_t data = 0;
+    CHECK(response_cache_init(&cache, 2, ttl_rules, 3));
+
+    response_cache_store(&cache, 2001, 1, 0);
+    response_cache_store(&cache, 2002, 2, 0);
+    CHECK(response_cache_lookup(&cache, 2001, 0, &data));  // 2002 is now least recently used
+    response_cache_store(&cache, 2003, 3, 0);
+    CHECK(cache.evictions == 1);
+    CHECK(!response_cache_lookup(&cache, 2002, 0, &data));
+    CHECK(response_cache_lookup(&cache, 2001, 0, &data) && data == 1);
+    CHECK(response_cache_lookup(&cache, 2003, 0, &data) && data == 3);
+
+    uint32_t epoch = cache.epoch;
+    CHECK(response_cache_invalidate(&cache, 2003, 2003) == 1);
+    CHECK(response_cache_invalidate(&cache, 0, UINT64_MAX) == 1);
+    CHECK(cache.count == 0 && cache.epoch == epoch + 2);
+    response_cache_destroy(&cache);
+}
+
+static void test_range_invalidation(void) {
+    response_cache cache;
+    uint64_t data = 0;
+    CHECK(response_cache_init(&cache, 64, ttl_rules, 3));
+
+    // Enough entries that buckets are shared, then a range out of the middle
+    for (uint64_t uri = 2000; uri < 2064; uri++) {
+        response_cache_store(&cache, uri, uri * 3, 0);
+    }
+    CHECK(cache.count == 64 && cache.evictions == 0);
+    CHECK(response_cache_invalidate(&cache, 2010, 2029) == 20);
+    CHECK(cache.count == 44);
+    for (uint64_t uri = 2000; uri < 2064; uri++) {
+        bool cached = uri < 2010 || uri > 2029;
+        CHECK(response_cache_lookup(&cache, uri, 0, &data) == cached && (!cached || data == uri * 3));
+    }
+
+    // The freed entries are reused before anything is evicted
+    for (uint64_t uri = 3000; uri < 3020; uri++) {
+        response_cache_store(&cache, uri, uri, 0);
+    }
+    CHECK(cache.count == 64 && cache.evictions == 0);
+    CHECK(response_cache_lookup(&cache, 3019, 0, &data) && data == 3019);
+    response_cache_destroy(&cache);
+}
+
+static void test_invalid_rules(void) {
+    static const cache_ttl_rule unsorted[] = { { 0, 1 }, { 10, 1 }, { 10, 1 } };
+    static const cache_ttl_rule late_start[] = { { 5, 1 } };
+    response_cache cache;
+    CHECK(!response_cache_init(&cache, 4, unsorted, 3));
+    CHECK(!response_cache_init(&cache, 4, late_start, 1));
+    CHECK(!response_cache_init(&cache, 0, ttl_rules, 3));
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+    test_ttl_expiry();
+    test_eviction_and_invalidation();
+    test_range_invalidation();
+    test_invalid_rules();
+    return TEST_RESULT();
+}
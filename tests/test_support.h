@@ -0,0 +1,24 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <stdio.h>
+
+/**
+ * Minimal checks for the unit tests: a failed CHECK reports where and keeps
+ * going, and TEST_RESULT turns the failure count into the exit status ctest
+ * looks at.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : (fprintf(stderr, "%d check(s) failed\n", test_failures), 1))
+
+#endif // TEST_SUPPORT_H
@@ -0,0 +1,101 @@
+#include "test_support.h"
+#include "uring_linux.h"
+
+/**
+ * Ordering of the io_uring engine's per-device write queue: classes, and the
+ * fragments of one message kept together and in order.
+ */
+
+#define QUEUE_CAPACITY 8
+
+// Pops every queued slot and checks they come out as expected.
+static void check_order(uring_write_queue* queue, const uint32_t* expected, uint32_t count) {
+    CHECK(queue->count == count);
+    for (uint32_t i = 0; i < count && queue->count > 0; i++) {
+        uint32_t slot = uring_write_queue_pop(queue);
+        CHECK(slot == expected[i]);
+    }
+    CHECK(queue->count == 0);
+    for (int c = 0; c < PRIORITY_CLASS_COUNT; c++) {
+        CHECK(queue->queued[c] == 0);
+    }
+}
+
+static void test_fragmented_response(void) {
+    uring_write_queue queue;
+    CHECK(uring_write_queue_init(&queue, QUEUE_CAPACITY));
+
+    // Fragments 0-3 of a normal response come out in index order, behind the normal report already queued
+    uring_write_queue_push(&queue, 100, PRIORITY_BULK, false);
+    uring_write_queue_push(&queue, 101, PRIORITY_NORMAL, false);
+    for (uint32_t i = 0; i < 4; i++) {
+        uring_write_queue_push(&queue, i, PRIORITY_NORMAL, i > 0);
+    }
+    CHECK(queue.queued[PRIORITY_NORMAL] == 5 && queue.queued[PRIORITY_BULK] == 1);
+
+    // A critical report goes ahead of the response, not between its fragments
+    uring_write_queue_push(&queue, 102, PRIORITY_CRITICAL, false);
+    static const uint32_t expected[] = { 102, 101, 0, 1, 2, 3, 100 };
+    check_order(&queue, expected, sizeof(expected) / sizeof(expected[0]));
+    uring_write_queue_cleanup(&queue);
+}
+
+static void test_partly_written_response(void) {
+    uring_write_queue queue;
+    CHECK(uring_write_queue_init(&queue, QUEUE_CAPACITY));
+
+    // Once the first fragments have been taken, nothing overtakes the rest
+    uring_write_queue_push(&queue, 100, PRIORITY_BULK, false);
+    for (uint32_t i = 0; i < 4; i++) {
+        uring_write_queue_push(&queue, i, PRIORITY_BULK, i > 0);
+    }
+    CHECK(uring_write_queue_pop(&queue) == 100);
+    CHECK(uring_write_queue_pop(&queue) == 0);
+    CHECK(uring_write_queue_pop(&queue) == 1);
+    uring_write_queue_push(&queue, 102, PRIORITY_CRITICAL, false);
+    uring_write_queue_push(&queue, 103, PRIORITY_NORMAL, false);
+    static const uint32_t expected[] = { 2, 3, 102, 103 };
+    check_order(&queue, expected, sizeof(expected) / sizeof(expected[0]));
+
+    // A fragment whose predecessor has already been taken goes first
+    uring_write_queue_push(&queue, 100, PRIORITY_BULK, false);
+    uring_write_queue_push(&queue, 0, PRIORITY_NORMAL, false);
+    CHECK(uring_write_queue_pop(&queue) == 0);
+    uring_write_queue_push(&queue, 1, PRIORITY_NORMAL, true);
+    uring_write_queue_push(&queue, 102, PRIORITY_CRITICAL, false);
+    static const uint32_t resumed[] = { 1, 102, 100 };
+    check_order(&queue, resumed, sizeof(resumed) / sizeof(resumed[0]));
+    uring_write_queue_cleanup(&queue);
+}
+
+static void test_wrap_around(void) {
+    uring_write_queue queue;
+    CHECK(uring_write_queue_init(&queue, QUEUE_CAPACITY));
+
+    // Many rounds move the start of the circular queue past its end
+    for (uint32_t round = 0; round < 3 * QUEUE_CAPACITY; round++) {
+        uring_write_queue_push(&queue, 200, PRIORITY_BULK, false);
+        for (uint32_t i = 0; i < QUEUE_CAPACITY - 2; i++) {
+            uring_write_queue_push(&queue, i, PRIORITY_NORMAL, i > 0);
+        }
+        uring_write_queue_push(&queue, 201, PRIORITY_CRITICAL, false);
+        uint32_t expected[QUEUE_CAPACITY] = { 201 };
+        for (uint32_t i = 0; i < QUEUE_CAPACITY - 2; i++) {
+            expected[i + 1] = i;
+        }
+        expected[QUEUE_CAPACITY - 1] = 200;
+        check_order(&queue, expected, QUEUE_CAPACITY);
+        uring_write_queue_push(&queue, 202, PRIORITY_NORMAL, false);
+        CHECK(uring_write_queue_pop(&queue) == 202);
+    }
+    uring_write_queue_cleanup(&queue);
+}
+
+int main(void) {
+    set_log_level(LOGLEVEL_ERROR);
+
+    test_fragmented_response();
+    test_partly_written_response();
+    test_wrap_around();
+    return TEST_RESULT();
+}